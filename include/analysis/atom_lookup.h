@@ -0,0 +1,47 @@
+#ifndef MP4_MANIPULATOR_ATOM_LOOKUP_H_
+#define MP4_MANIPULATOR_ATOM_LOOKUP_H_
+
+#include "Ap4.h"
+#include "parsing/atom.h"
+
+namespace mp4_manipulator::analysis {
+// Helpers for finding atoms of the parsed tree by their ap4 atoms, so analyses
+// can report the tree's atoms while reading the ap4 atoms' tables.
+
+// Returns the ap4 atom of `atom` as a T, or nullptr if it isn't one.
+template <typename T>
+T* GetAp4AtomAs(AtomOrDescriptorBase const& atom) {
+  return AP4_DYNAMIC_CAST(T, atom.GetAp4Atom());
+}
+
+// Returns true if `atom` has an ap4 atom of `type`.
+inline bool HasType(AtomOrDescriptorBase const& atom, AP4_Atom::Type type) {
+  return atom.GetAp4Atom() != nullptr && atom.GetAp4Atom()->GetType() == type;
+}
+
+// Returns the first descendant of `atom`, in pre-order, whose ap4 atom is a
+// T, or nullptr.
+template <typename T>
+AtomOrDescriptorBase const* FindDescendant(AtomOrDescriptorBase const& atom) {
+  for (auto const& child : atom.GetChildAtoms()) {
+    if (GetAp4AtomAs<T>(*child) != nullptr) {
+      return child.get();
+    }
+    if (AtomOrDescriptorBase const* found = FindDescendant<T>(*child)) {
+      return found;
+    }
+  }
+  return nullptr;
+}
+
+// Returns the ap4 atom of the first descendant of `atom` that's a T, or
+// nullptr.
+template <typename T>
+T* FindDescendantAp4Atom(AtomOrDescriptorBase const& atom) {
+  AtomOrDescriptorBase const* found = FindDescendant<T>(atom);
+  return found != nullptr ? GetAp4AtomAs<T>(*found) : nullptr;
+}
+
+}  // namespace mp4_manipulator::analysis
+
+#endif  // MP4_MANIPULATOR_ATOM_LOOKUP_H_
@@ -0,0 +1,64 @@
+#ifndef MP4_MANIPULATOR_CONFORMANCE_CHECKER_H_
+#define MP4_MANIPULATOR_CONFORMANCE_CHECKER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "parsing/atom.h"
+#include "parsing/atom_holder.h"
+
+namespace mp4_manipulator::analysis {
+enum class ConformanceSeverity {
+  // The file breaks a requirement of ISO 14496-12 or of one of its brands.
+  kError = 0,
+  // The file is allowed, but unusual enough that it may trip up players or
+  // packagers, e.g. a box out of its recommended order.
+  kWarning = 1,
+};
+
+struct ConformanceIssue {
+  ConformanceSeverity severity;
+  // The name of the rule that found the issue, e.g. "duration-agreement".
+  char const* rule;
+  // The atom the issue is about.
+  AtomOrDescriptorBase const* atom;
+  std::string description;
+};
+
+struct ConformanceReport {
+  // In tree order of the atoms they're about. Only the first issues found by
+  // each rule are listed, as one problem (e.g. a packager setting the wrong
+  // flags) can repeat in every fragment.
+  std::vector<ConformanceIssue> issues;
+  // The number of issues found, including those not listed.
+  uint64_t error_count{0};
+  uint64_t warning_count{0};
+  // The number of atoms that at least one rule applied to.
+  uint64_t checked_atom_count{0};
+};
+
+// Checks the atoms against a table of rules for ISO 14496-12 and CMAF:
+//
+// - required-boxes: boxes that must be present, per brand of the ftyp (e.g.
+//   every file needs a moov, CMAF and DASH files a moov/mvex) and per
+//   container (e.g. a trak needs a tkhd and an mdia).
+// - box-order: ftyp first, moofs after the moov and followed by an mdat, and
+//   boxes such as tkhd and mfhd first in their containers.
+// - version-flags: full boxes have a version they define and no undefined
+//   flags, and CMAF track fragments are addressed from their moof.
+// - duration-agreement: each tkhd's duration matches its mdhd's (converted
+//   to the movie timescale) unless an edit list sets it, and the mvhd's
+//   duration is that of the longest track.
+// - sidx-references: each reference of a top level sidx starts at a top
+//   level box, spans whole boxes, and points at a moof (or a sidx, for
+//   hierarchical indexes). Skipped if the atoms' positions aren't known.
+//
+// Rules are dispatched by four cc, so each atom is only visited by the rules
+// for its type. Each top level atom's subtree is checked on its own task, on
+// `thread_count` threads (0 uses one per hardware thread).
+ConformanceReport CheckConformance(AtomHolder& atoms, size_t thread_count = 0);
+
+}  // namespace mp4_manipulator::analysis
+
+#endif  // MP4_MANIPULATOR_CONFORMANCE_CHECKER_H_
@@ -0,0 +1,22 @@
+#ifndef MP4_MANIPULATOR_CONTENT_HASH_H_
+#define MP4_MANIPULATOR_CONTENT_HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mp4_manipulator::analysis {
+// Fast, non-cryptographic 64 bit hashes for comparing file contents (XXH64).
+// Hashing runs at several GB/s per core, so comparing large files is bound
+// by how fast they can be read.
+
+// Returns the hash of `size` bytes at `data`.
+uint64_t HashBytes(void const* data, size_t size, uint64_t seed = 0);
+
+// Returns a hash of `hash` followed by `value`. Used to build the hash of a
+// sequence (e.g. the chunks of a large payload, or the children of a box)
+// from the hashes of its parts. The order of the parts matters.
+uint64_t CombineHashes(uint64_t hash, uint64_t value);
+
+}  // namespace mp4_manipulator::analysis
+
+#endif  // MP4_MANIPULATOR_CONTENT_HASH_H_
@@ -0,0 +1,96 @@
+#ifndef MP4_MANIPULATOR_LAYOUT_MAP_H_
+#define MP4_MANIPULATOR_LAYOUT_MAP_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "parsing/atom.h"
+#include "parsing/atom_holder.h"
+#include "result.h"
+
+namespace mp4_manipulator::analysis {
+// A top level box of the file.
+struct LayoutBox {
+  std::string type;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// A chunk of a track's samples, as found from stco or co64, stsc and stsz.
+struct LayoutChunk {
+  uint64_t offset;
+  uint64_t size;
+  // Index into LayoutMap::tracks.
+  uint32_t track;
+  // Seconds of decode time at which the chunk's first sample starts, and the
+  // duration of its samples.
+  double start_time;
+  double duration;
+};
+
+struct LayoutTrack {
+  uint32_t track_id{0};
+  std::string handler_type;
+  uint64_t chunk_count{0};
+  uint64_t bytes{0};
+  double duration{0};
+};
+
+// Aggregates of the chunks over bins of equal size covering the file, so a
+// view of any part of the file at any zoom can be drawn from a few bins per
+// pixel rather than from every chunk.
+struct LayoutLevel {
+  uint64_t bin_size{0};
+  size_t bin_count{0};
+  // The bytes of each track in each bin, at [bin * track count + track].
+  std::vector<uint64_t> track_bytes;
+  // The greatest interleave depth (see LayoutMap) of the chunks starting in
+  // each bin.
+  std::vector<float> interleave_depth;
+};
+
+struct LayoutMap {
+  uint64_t file_size{0};
+  std::vector<LayoutBox> boxes;
+  std::vector<LayoutTrack> tracks;
+  // All tracks' chunks, in order of offset.
+  std::vector<LayoutChunk> chunks;
+
+  // Begin streaming startup. When a file is read front to back, the interleave
+  // depth at a chunk is how far, in seconds of decode time, the track that's
+  // furthest ahead is ahead of the track that's furthest behind, once the
+  // chunk has been read. A player has to buffer that much of the tracks that
+  // are ahead before it can play them, so well interleaved files keep this
+  // to a second or so.
+  double max_interleave_depth{0};
+  uint64_t max_interleave_depth_offset{0};
+  // Bytes that have to be read before the first kStartupSeconds of every
+  // track, and moov, have been read.
+  uint64_t startup_bytes{0};
+  // End streaming startup.
+
+  // The finest level first, each following level having bins twice the size,
+  // down to a level with a single bin.
+  std::vector<LayoutLevel> levels;
+};
+
+// How much of each track counts towards LayoutMap::startup_bytes.
+constexpr double kStartupSeconds = 1.0;
+
+// Computes the layout of the chunks of a file's tracks, from their sample
+// tables, along with the aggregates for drawing it. The chunks of each track
+// are found in parallel on `thread_count` threads (0 uses one per hardware
+// thread).
+//
+// Only the sample tables of moov are used, so for fragmented files the map
+// only shows the boxes and any samples in moov.
+//
+// Returns an error if the atoms' positions aren't known (e.g. they were read
+// from a pipe).
+Result<LayoutMap, std::string> ComputeLayoutMap(AtomHolder& atoms,
+                                                size_t thread_count = 0);
+
+}  // namespace mp4_manipulator::analysis
+
+#endif  // MP4_MANIPULATOR_LAYOUT_MAP_H_
@@ -0,0 +1,79 @@
+#ifndef MP4_MANIPULATOR_SAMPLE_LOCATIONS_H_
+#define MP4_MANIPULATOR_SAMPLE_LOCATIONS_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parsing/atom.h"
+
+namespace mp4_manipulator::analysis {
+enum class SampleIssueKind {
+  // A sample extends past the end of the file.
+  kOutOfFileBounds,
+  // A sample isn't within the payload of an mdat.
+  kOutsideMediaData,
+  // A sample overlaps another sample, of the same or another track.
+  kOverlap,
+  // A track's sample tables disagree, e.g. stsc maps more samples than stsz
+  // has sizes for, or a fragment's sample sizes can't be found.
+  kInconsistentTables,
+  // Bytes of an mdat that no sample references. These aren't necessarily a
+  // problem, e.g. CENC auxiliary information or padding may be stored there.
+  kUnreferencedMediaData,
+};
+
+// Returns true for the kinds of issue that mean samples can't be read
+// correctly, i.e. all but kUnreferencedMediaData.
+bool IsError(SampleIssueKind kind);
+
+struct SampleIssue {
+  SampleIssueKind kind;
+  // Where to look for the issue: the chunk offset table (stco or co64) or
+  // trun that references the sample, the table that's inconsistent, or the
+  // mdat with unreferenced bytes.
+  AtomOrDescriptorBase const* atom;
+  std::string description;
+};
+
+// What references a run of samples: a track's chunk offset table, or a trun.
+struct SampleSource {
+  AtomOrDescriptorBase const* atom;
+  uint32_t track_id;
+  bool is_fragment;
+};
+
+// A sample's bytes, [offset, offset + size).
+struct SampleRange {
+  uint64_t offset;
+  uint32_t size;
+  // Index into the sources of the samples.
+  uint32_t source;
+  // 1-based number of the sample within its track, or within its trun for
+  // fragments.
+  uint32_t number;
+};
+
+// The samples of a trak or moof, in the order of their tables (i.e. decode
+// order within each track), and any problems found with the tables.
+struct SampleLocations {
+  std::vector<SampleSource> sources;
+  std::vector<SampleRange> samples;
+  std::vector<SampleIssue> issues;
+};
+
+// Locates the samples of a trak. Chunk offsets come from stco or co64, the
+// samples in each chunk from stsc, and their sizes from stsz or stz2.
+SampleLocations LocateTrackSamples(AtomOrDescriptorBase const& trak);
+
+// Locates the samples of the truns of a moof, which starts at
+// `moof_position`, following the base offset rules of tfhd.
+// `default_sample_sizes` maps track ids to the sizes set by trex.
+SampleLocations LocateFragmentSamples(
+    AtomOrDescriptorBase const& moof, uint64_t moof_position,
+    std::unordered_map<uint32_t, uint32_t> const& default_sample_sizes);
+
+}  // namespace mp4_manipulator::analysis
+
+#endif  // MP4_MANIPULATOR_SAMPLE_LOCATIONS_H_
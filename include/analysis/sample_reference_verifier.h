@@ -0,0 +1,42 @@
+#ifndef MP4_MANIPULATOR_SAMPLE_REFERENCE_VERIFIER_H_
+#define MP4_MANIPULATOR_SAMPLE_REFERENCE_VERIFIER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "analysis/sample_locations.h"
+#include "parsing/atom_holder.h"
+#include "result.h"
+
+namespace mp4_manipulator::analysis {
+struct SampleVerification {
+  // Inconsistent tables first, then the rest in order of offset. Only the
+  // first issues of each kind are listed, as a systematic problem (e.g. a
+  // wrong base offset) can affect every sample.
+  std::vector<SampleIssue> issues;
+  // The number of issues found, including those not listed.
+  uint64_t error_count{0};
+  uint64_t unreferenced_range_count{0};
+  size_t track_count{0};
+  uint64_t sample_count{0};
+};
+
+// Checks that every sample referenced by the atoms, via a track's chunk
+// offsets (stco or co64), stsc and sample sizes (stsz or stz2), or via the
+// data offsets of tfhd and trun in movie fragments, lies within an mdat and
+// within the file, and that samples don't overlap. Bytes of mdats that no
+// sample references are also reported.
+//
+// The sample tables of each track and each moof are expanded into offset and
+// size ranges in parallel on `thread_count` threads (0 uses one per hardware
+// thread), then all the ranges are sorted and checked in a single sweep.
+//
+// Returns an error if the atoms' positions aren't known (e.g. they were read
+// from a pipe).
+Result<SampleVerification, std::string> VerifySampleReferences(
+    AtomHolder& atoms, size_t thread_count = 0);
+
+}  // namespace mp4_manipulator::analysis
+
+#endif  // MP4_MANIPULATOR_SAMPLE_REFERENCE_VERIFIER_H_
@@ -0,0 +1,68 @@
+#ifndef MP4_MANIPULATOR_STRUCTURAL_DIFF_H_
+#define MP4_MANIPULATOR_STRUCTURAL_DIFF_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "parsing/atom.h"
+#include "parsing/atom_holder.h"
+#include "result.h"
+
+namespace mp4_manipulator::analysis {
+enum class DifferenceKind {
+  // The atom is in both files, but its bytes or children differ.
+  kChanged,
+  // The atom is only in the left file.
+  kRemoved,
+  // The atom is only in the right file.
+  kAdded,
+};
+
+struct Difference {
+  DifferenceKind kind;
+  // The atom in the left file, nullptr for kAdded.
+  AtomOrDescriptorBase const* left{nullptr};
+  // The atom in the right file, nullptr for kRemoved.
+  AtomOrDescriptorBase const* right{nullptr};
+  // For kChanged, true if the atom's own bytes (its header and fields, but not
+  // its size or children) differ, false if only its descendants do.
+  bool contents_changed{false};
+};
+
+struct StructuralDiff {
+  // In tree order. A changed atom comes before the differences within it.
+  std::vector<Difference> differences;
+  // The bytes read and hashed, across both files.
+  uint64_t bytes_hashed{0};
+};
+
+// One side of a diff: the atoms read from `file_name`, unmodified, so their
+// positions refer to the file.
+struct FileToDiff {
+  char const* file_name;
+  AtomHolder& atoms;
+};
+
+// Compares the atom trees of two files. Each atom's subtree is hashed bottom
+// up from the bytes of the file: its own bytes (header and fields, with the
+// size masked out) and the hashes of its children. Hashing reads each file
+// once, in chunks spread over `thread_count` threads (0 uses one per hardware
+// thread).
+//
+// The trees are then matched by hash, level by level. Children with equal
+// hashes are paired and not walked further, wherever they are in the file, so
+// moved atoms aren't differences. Remaining children are paired by type, in
+// order, and walked, and any left over are added or removed. So only the
+// subtrees that differ are visited, and two large files differing in one
+// `udta` cost little more than reading them.
+//
+// Returns an error if a file can't be read, or the atoms' positions aren't
+// known (e.g. they were read from a pipe).
+Result<StructuralDiff, std::string> DiffFiles(FileToDiff const& left,
+                                              FileToDiff const& right,
+                                              size_t thread_count = 0);
+
+}  // namespace mp4_manipulator::analysis
+
+#endif  // MP4_MANIPULATOR_STRUCTURAL_DIFF_H_
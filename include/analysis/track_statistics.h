@@ -0,0 +1,69 @@
+#ifndef MP4_MANIPULATOR_TRACK_STATISTICS_H_
+#define MP4_MANIPULATOR_TRACK_STATISTICS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "parsing/atom_holder.h"
+
+namespace mp4_manipulator::analysis {
+// Peak bitrate is the most bits in any window of this many seconds of decode
+// time, divided by its length.
+constexpr double kDefaultPeakBitrateWindow = 1.0;
+
+struct TrackStatistics {
+  uint32_t track_id{0};
+  // The handler type from hdlr, e.g. "vide" or "soun".
+  std::string handler_type;
+  // Units per second of the track's times, from mdhd.
+  uint32_t timescale{0};
+  uint64_t sample_count{0};
+  uint64_t total_bytes{0};
+  // Seconds from the first sample's decode time to the end of the last.
+  double duration{0};
+
+  // Begin bitrates, in bits per second.
+  double average_bitrate{0};
+  double peak_bitrate{0};
+  // Seconds from the track's first decode time to the start of the peak
+  // window.
+  double peak_bitrate_time{0};
+  // The bitrate of each second of decode time, in order.
+  std::vector<double> bitrate_over_time;
+  // End bitrates.
+
+  // Begin keyframes. Keyframes are sync samples, from stss, or from sample
+  // flags in fragments. Intervals are seconds of decode time between
+  // consecutive keyframes, and are 0 with fewer than two keyframes.
+  uint64_t keyframe_count{0};
+  double min_keyframe_interval{0};
+  double average_keyframe_interval{0};
+  double max_keyframe_interval{0};
+  // End keyframes.
+
+  // Begin timing. Composition offsets are presentation minus decode time, in
+  // seconds, from ctts or trun, and are 0 if the track has none.
+  double min_composition_offset{0};
+  double max_composition_offset{0};
+  // Samples whose decode time is later than their presentation time, which
+  // players can't show on time.
+  uint64_t late_sample_count{0};
+  // End timing.
+};
+
+// Computes statistics for each track from its sample tables (stts, ctts,
+// stss and stsz or stz2, and the truns of movie fragments), in track order.
+// Media data is never read.
+//
+// Each track's tables are expanded into arrays of sizes, durations, offsets
+// and flags, then the statistics are computed in passes over those arrays.
+// Tracks are processed in parallel on `thread_count` threads (0 uses one per
+// hardware thread).
+std::vector<TrackStatistics> ComputeTrackStatistics(
+    AtomHolder& atoms, double peak_bitrate_window = kDefaultPeakBitrateWindow,
+    size_t thread_count = 0);
+
+}  // namespace mp4_manipulator::analysis
+
+#endif  // MP4_MANIPULATOR_TRACK_STATISTICS_H_
@@ -0,0 +1,100 @@
+#ifndef MP4_MANIPULATOR_BATCH_PROCESSOR_H_
+#define MP4_MANIPULATOR_BATCH_PROCESSOR_H_
+
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Ap4.h"
+#include "result.h"
+
+namespace mp4_manipulator::batch {
+// Applies the same operation to many files in parallel, for example to clean
+// up a directory of tens of thousands of files overnight. Each file is handled
+// independently using the same code paths as the GUI: `utility::ReadAtoms`,
+// the `EditingProcessor` commands and `AtomHolder::SaveAtoms`.
+
+enum class Operation {
+  // Removes atoms of `Options::atom_types` and writes the result to the output
+  // directory.
+  kStrip,
+  // Writes each atom of `Options::atom_types` to its own file in the output
+  // directory.
+  kDump,
+  // Checks that the file's structure is sound.
+  kValidate,
+  // Records the top level layout, track count and duration of the file in the
+  // manifest. Only box headers and moov are read, see summary_scan.h.
+  kSummary,
+  // Writes each track to an elementary stream file in the output directory,
+  // see extraction::ExtractTracks.
+  kExtract,
+};
+
+struct Options {
+  Operation operation{Operation::kValidate};
+  // The types removed by kStrip, or written by kDump.
+  std::vector<AP4_Atom::Type> atom_types;
+  // Where kStrip, kDump and kExtract write their output. The layout of input
+  // directories is mirrored under it.
+  QString output_directory;
+  // The number of files processed at once. If 0, one per hardware thread.
+  size_t worker_count{0};
+};
+
+// A file to process.
+struct Job {
+  QString input_file_name;
+  // The path outputs are named after, relative to the output directory. For
+  // files found in an input directory, this is their path within it.
+  QString output_name;
+};
+
+struct JobResult {
+  bool succeeded{false};
+  // Describes what was done, or why it failed.
+  QString message;
+  QStringList output_file_names;
+  // Operation specific details, written to the manifest as is.
+  QJsonObject details;
+  qint64 elapsed_ms{0};
+};
+
+// Returns a failed JobResult with `message` as the reason.
+JobResult Failure(QString message);
+
+// Parses a comma separated list of four ccs, e.g. "udta,free,skip".
+Result<std::vector<AP4_Atom::Type>, std::string> ParseAtomTypes(
+    QString const& types);
+
+// Collects the files to process. `inputs` may be files or directories, which
+// are searched recursively for files matching `name_filters`. If
+// `file_list_name` isn't empty, it names a file listing one input file per
+// line (blank lines and lines starting with '#' are ignored).
+Result<std::vector<Job>, std::string> CollectJobs(
+    QStringList const& inputs, QString const& file_list_name,
+    QStringList const& name_filters);
+
+// Processes a single file. Safe to call from multiple threads at once for
+// different jobs.
+JobResult RunJob(Job const& job, Options const& options);
+
+// Processes all `jobs` on a WorkStealingPool. Returns results in the same
+// order as `jobs`. `on_job_finished` is called (from worker threads, one at a
+// time) as each job finishes, e.g. to report progress.
+std::vector<JobResult> RunJobs(
+    std::vector<Job> const& jobs, Options const& options,
+    std::function<void(size_t finished_count)> const& on_job_finished = {});
+
+// Writes a manifest with one JSON object per line, one line per job, in job
+// order.
+Result<std::monostate, std::string> WriteManifest(
+    QString const& manifest_file_name, std::vector<Job> const& jobs,
+    std::vector<JobResult> const& results);
+
+}  // namespace mp4_manipulator::batch
+
+#endif  // MP4_MANIPULATOR_BATCH_PROCESSOR_H_
@@ -0,0 +1,33 @@
+#ifndef MP4_MANIPULATOR_SUMMARY_SCAN_H_
+#define MP4_MANIPULATOR_SUMMARY_SCAN_H_
+
+#include <functional>
+#include <vector>
+
+#include "batch/batch_processor.h"
+
+namespace mp4_manipulator::batch {
+// Summaries (Operation::kSummary) only need a file's top level layout and its
+// moov, so rather than parsing whole files they're built from box headers and
+// moov alone. For a fragmented file this reads a few KiB of headers per
+// fragment instead of parsing every moof.
+
+// Summarizes a single file, reading it on the calling thread.
+JobResult SummarizeFile(Job const& job);
+
+// Summarizes all `jobs`. Reading headers is dominated by the latency of many
+// small reads that each depend on the last (the next header is found from the
+// size in the previous one), so rather than a thread per file, the reads of
+// many files are kept in flight at once with a BatchedFileReader (io_uring on
+// Linux). As each file's reads finish, its moov is parsed and its summary
+// built on a pool of `options.worker_count` workers.
+//
+// Returns results in the same order as `jobs`. `on_job_finished` is called
+// as for RunJobs.
+std::vector<JobResult> SummarizeFiles(
+    std::vector<Job> const& jobs, Options const& options,
+    std::function<void(size_t finished_count)> const& on_job_finished = {});
+
+}  // namespace mp4_manipulator::batch
+
+#endif  // MP4_MANIPULATOR_SUMMARY_SCAN_H_
@@ -0,0 +1,58 @@
+#ifndef MP4_MANIPULATOR_CENC_DECRYPTION_H_
+#define MP4_MANIPULATOR_CENC_DECRYPTION_H_
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "result.h"
+
+namespace mp4_manipulator::crypto {
+using Key = std::array<uint8_t, 16>;
+using KeyId = std::array<uint8_t, 16>;
+
+// Content keys, found by the track they're for or by their key id.
+struct KeySet {
+  std::map<KeyId, Key> by_key_id;
+  std::map<uint32_t, Key> by_track_id;
+};
+
+// Reads a key file, with one key per line as `<key id>:<key>` or
+// `<track id>:<key>`, where key ids and keys are 32 hex digits (as taken by
+// Bento4's mp4decrypt). Blank lines and lines starting with '#' are ignored.
+Result<KeySet, std::string> ReadKeyFile(char const* file_name);
+
+struct DecryptionSummary {
+  // Tracks that were decrypted, and protected tracks left as they were
+  // because there was no key for them.
+  std::vector<uint32_t> decrypted_track_ids;
+  std::vector<uint32_t> skipped_track_ids;
+  uint64_t sample_count{0};
+  uint64_t bytes_decrypted{0};
+};
+
+// Writes a clear copy of the Common Encryption (ISO/IEC 23001-7) protected
+// file `input_file_name` to `output_file_name`. All four schemes (cenc, cens,
+// cbc1 and cbcs) are supported, with per sample IVs and subsample ranges
+// from `senc`, and the track's `tenc` defaults.
+//
+// The output has the same layout as the input, so no offsets need updating:
+// samples are decrypted in place, protected sample entries get back their
+// original format, and `sinf`, `pssh`, `senc`, `saiz` and `saio` boxes are
+// turned into `free` boxes of the same size. The file is split into batches
+// of whole samples, which are read and decrypted on `thread_count` threads
+// (0 uses one per hardware thread) while the calling thread writes finished
+// batches in order, so decryption scales with cores and the output is
+// written sequentially.
+//
+// Returns an error if the file can't be read or written, or its encryption
+// information is inconsistent or only given by `saiz` and `saio`.
+Result<DecryptionSummary, std::string> DecryptFile(
+    char const* input_file_name, char const* output_file_name,
+    KeySet const& keys, size_t thread_count = 0);
+
+}  // namespace mp4_manipulator::crypto
+
+#endif  // MP4_MANIPULATOR_CENC_DECRYPTION_H_
@@ -0,0 +1,58 @@
+#ifndef MP4_MANIPULATOR_TRACK_EXTRACTION_H_
+#define MP4_MANIPULATOR_TRACK_EXTRACTION_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "parsing/atom_holder.h"
+#include "result.h"
+
+namespace mp4_manipulator::extraction {
+enum class ElementaryStreamFormat {
+  // H.264 with start codes, the parameter sets of avcC first.
+  kAnnexBH264,
+  // HEVC with start codes, the parameter sets of hvcC first.
+  kAnnexBHevc,
+  // AAC with an ADTS header in front of each frame, built from the
+  // AudioSpecificConfig of esds.
+  kAdtsAac,
+  // The samples as they are stored, one after another. Used for any other
+  // coding, e.g. MP3, whose samples already form an elementary stream.
+  kRaw,
+};
+
+// Returns the file extension used for `format`, e.g. "h264".
+char const* GetFileExtension(ElementaryStreamFormat format);
+
+struct ExtractedTrack {
+  uint32_t track_id{0};
+  ElementaryStreamFormat format{ElementaryStreamFormat::kRaw};
+  std::string output_file_name;
+  uint64_t sample_count{0};
+  uint64_t bytes_written{0};
+  // Why the track couldn't be extracted completely, or empty if it was. The
+  // output file holds the samples before the problem.
+  std::string error;
+};
+
+// Writes each track of `input_file_name`, whose atoms are `atoms`, to its own
+// elementary stream file, named `<output_prefix>.track<id>.<extension>`.
+// Samples are located from the sample tables of moov and any fragments (see
+// LocateTrackSamples and LocateFragmentSamples) and written in decode order.
+//
+// Tracks are extracted at once on `thread_count` threads (0 uses one per
+// hardware thread). The input is memory mapped, so workers read the samples
+// without copying them; if it can't be mapped, each worker reads its track
+// with large reads of runs of contiguous samples instead. Output is written
+// in large blocks, so extraction runs at close to disk throughput.
+//
+// Returns an error if the input can't be read or the atoms' positions aren't
+// known. Problems with single tracks are reported in their ExtractedTrack.
+Result<std::vector<ExtractedTrack>, std::string> ExtractTracks(
+    char const* input_file_name, AtomHolder& atoms,
+    std::string const& output_prefix, size_t thread_count = 0);
+
+}  // namespace mp4_manipulator::extraction
+
+#endif  // MP4_MANIPULATOR_TRACK_EXTRACTION_H_
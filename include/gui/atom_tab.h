@@ -0,0 +1,193 @@
+#ifndef MP4_MANIPULATOR_ATOM_TAB_H_
+#define MP4_MANIPULATOR_ATOM_TAB_H_
+
+#include <QWidget>
+#include <vector>
+
+#include "analysis/structural_diff.h"
+#include "gui/atom_tree_view.h"
+#include "gui/hex_view.h"
+#include "parsing/atom_holder.h"
+#include "parsing/resource_deleters.h"
+
+QT_FORWARD_DECLARE_CLASS(QCheckBox)
+QT_FORWARD_DECLARE_CLASS(QFileSystemWatcher)
+QT_FORWARD_DECLARE_CLASS(QLabel)
+QT_FORWARD_DECLARE_CLASS(QLineEdit)
+QT_FORWARD_DECLARE_CLASS(QListWidget)
+QT_FORWARD_DECLARE_CLASS(QTimer)
+
+namespace mp4_manipulator {
+// The contents of each tab in the UI. Holds the tree view for a file, along
+// with a search bar for finding atoms and fields within it.
+class AtomTab : public QWidget {
+  Q_OBJECT
+ public:
+  // `file_name` is the file the atoms were read from. It's used to show the
+  // raw bytes of atoms. Atoms read from elsewhere (e.g. a URL) pass false for
+  // `is_local_file`, in which case `file_name` is only used as a name, and
+  // the features that need the file on disk are unavailable.
+  AtomTab(QString const& file_name, std::unique_ptr<AtomHolder>&& atom_holder,
+          bool is_local_file = true, QWidget* parent = nullptr);
+
+  // Shows a segment set (see utility::SegmentSet), named by its init
+  // segment's `file_name`. Segment sets are read only, and the features that
+  // work on a single file are unavailable, other than showing bytes.
+  AtomTab(QString const& file_name,
+          std::unique_ptr<utility::SegmentSet>&& segment_set,
+          QWidget* parent = nullptr);
+
+  // Shows a file dialog and then saves (dumps all) atoms to the file.
+  void SaveAtoms();
+
+  [[nodiscard]] QString const& GetFileName() const;
+
+  // Returns true if the atoms are loaded and were read from a local file,
+  // unmodified, so their positions refer to the file (e.g. so it can be
+  // compared with another).
+  [[nodiscard]] bool IsBackedByLocalFile() const;
+
+  // Returns true if the tab shows a segment set rather than a single file.
+  [[nodiscard]] bool IsSegmentSet() const;
+
+  // Returns the tab's atoms, or nullptr if the tab is evicted.
+  [[nodiscard]] AtomHolder* GetAtomHolder() const;
+
+  // Highlights the atoms that differ in `diff`, which compared this tab's file
+  // as the left file if `is_left` is true, or the right if not, and expands
+  // the tree to show them.
+  void ShowDifferences(analysis::StructuralDiff const& diff, bool is_left);
+
+  // Shows a file dialog and then writes a copy of the file with `moov` moved
+  // in front of the media data. The copy is made from the file on disk, so
+  // this is refused if the atoms have been modified.
+  void SaveFaststartCopy();
+
+  // Shows a file dialog and then writes a fragmented copy of the file, see
+  // utility::WriteFragmented. As for SaveFaststartCopy, this is refused if
+  // the atoms have been modified.
+  void SaveFragmentedCopy();
+
+  // Checks that the samples referenced by the atoms lie within the media
+  // data, see analysis::VerifySampleReferences, and lists the problems found
+  // in the results list, so selecting one jumps to the atom referencing the
+  // sample.
+  void VerifySampleReferences();
+
+  // Checks the atoms against the conformance rules, see
+  // analysis::CheckConformance. Atoms with issues are highlighted (red for
+  // errors, yellow for warnings), with the issues as their tool tips, and
+  // the issues are listed in the results list.
+  void CheckConformance();
+
+  // Begin memory management.
+  // Tabs that aren't being looked at can be evicted to free memory. Evicting
+  // drops the atoms and model, leaving only a lightweight stub that knows
+  // which file to reload. Only unmodified tabs can be evicted, as modified
+  // atoms can't be recovered from the file.
+  [[nodiscard]] bool CanEvict() const;
+  [[nodiscard]] bool IsEvicted() const;
+  void Evict();
+  // Reloads the atoms of an evicted tab from the file. Returns false if the
+  // file could not be read, in which case the tab stays evicted.
+  bool Rehydrate();
+
+  // Returns the estimated memory used by the tab's atoms and model, in bytes.
+  // This is 0 for evicted tabs.
+  [[nodiscard]] size_t GetMemoryUsage() const;
+
+  // Used to track which tabs were used least recently. The tick should
+  // increase with each activation.
+  void MarkActivated(uint64_t activation_tick);
+  [[nodiscard]] uint64_t GetLastActivationTick() const;
+  // End memory management.
+
+  // Begin following.
+  // A tab can follow its file while it's being written, e.g. a fragmented
+  // recording or live stream capture. While following, top level boxes
+  // appended to the file are parsed and added to the end of the tree. Only
+  // the new data is read, so each update costs time proportional to what was
+  // appended. Following stops if the atoms are modified, or the file shrinks.
+  [[nodiscard]] bool IsFollowing() const;
+  void SetFollowing(bool following);
+  // End following.
+
+ signals:
+  // Emitted when the value returned by GetMemoryUsage changes.
+  void MemoryUsageChanged();
+  // Emitted with a message for the status bar, see
+  // AtomTreeView::StatusMessage.
+  void StatusMessage(QString const& message);
+
+ private:
+  AtomTab(QString const& file_name, AtomTreeView* atom_tree_view,
+          bool is_local_file, QWidget* parent);
+
+  // Clears the search results, e.g. because they point into a tree that's
+  // been replaced.
+  void ClearSearchResults();
+
+  // Called when the atoms no longer match the file on disk (e.g. after an atom
+  // has been removed), meaning their positions can't be used to read bytes
+  // from the file.
+  void OnAtomsModified();
+
+  // Recomputes `memory_usage_` and emits MemoryUsageChanged.
+  void UpdateMemoryUsage();
+
+  // Reads the boxes appended to the file since the last read and adds them
+  // to the tree.
+  void ReadAppendedAtoms();
+
+  QString file_name_;
+  // False for atoms read from elsewhere, e.g. a URL.
+  bool is_local_file_;
+  // True while the atoms' positions refer to `file_name_`, or for a segment
+  // set, to the files they were read from.
+  bool is_backed_by_file_{true};
+  bool is_segment_set_{false};
+
+  // Cached, as estimating requires walking the whole tree.
+  size_t memory_usage_{0};
+  uint64_t last_activation_tick_{0};
+
+  AtomTreeView* atom_tree_view_;
+  HexView* hex_view_;
+
+  // Begin search widgets.
+  QLineEdit* search_line_edit_;
+  QLabel* search_status_label_;
+  QListWidget* search_results_list_;
+  // End search widgets.
+
+  // Begin follow members.
+  QCheckBox* follow_check_box_;
+  // Watches the file while following. This uses inotify on Linux.
+  QFileSystemWatcher* file_watcher_;
+  // Writers often append in many small writes, so change notifications are
+  // coalesced with this timer rather than each causing a read.
+  QTimer* follow_timer_;
+  bool is_following_{false};
+  // Where the next appended box is expected to start.
+  uint64_t followed_end_offset_{0};
+  // The followed file, opened once when following starts. Appended atoms
+  // that aren't parsed (e.g. mdat) read their payload through it, so every
+  // read shares it rather than each holding a file descriptor of its own.
+  utility::ByteStreamPointer followed_stream_;
+  // End follow members.
+
+  // The atoms matching the current search, or of the sample reference issues
+  // listed. The list widget shows (a prefix of) these, in the same order.
+  std::vector<AtomOrDescriptorBase const*> search_results_;
+
+ private slots:
+  // Runs the query in the search bar and lists the results.
+  void RunSearch();
+  // Jumps the tree view to the search result at `row`.
+  void JumpToSearchResult(int row);
+  // Shows the bytes of `atom_or_descriptor` in the hex view.
+  void ShowBytes(AtomOrDescriptorBase* atom_or_descriptor);
+};
+}  // namespace mp4_manipulator
+
+#endif  // MP4_MANIPULATOR_ATOM_TAB_H_
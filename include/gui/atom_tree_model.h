@@ -2,9 +2,12 @@
 #define MP4_MANIPULATOR_ATOM_TREE_MODEL_H_
 
 #include <QAbstractItemModel>
+#include <QColor>
+#include <unordered_map>
 
 #include "parsing/atom.h"
 #include "parsing/atom_holder.h"
+#include "parsing/segment_set.h"
 #include "result.h"
 
 namespace mp4_manipulator {
@@ -12,21 +15,41 @@ namespace mp4_manipulator {
 // TODO(bryce): this could be subclassed so that the atom and field versions
 // avoid having redundant members.
 struct ModelItem {
-  enum class Type { kUnset = -1, kAtom = 0, kDescriptor = 1, kField = 2 };
+  enum class Type {
+    kUnset = -1,
+    kAtom = 0,
+    kDescriptor = 1,
+    kField = 2,
+    // A file of a segment set, whose children are the file's atoms.
+    kFile = 3,
+  };
 
   QString name;
   Type type{Type::kUnset};
 
   // Atom specific members
   std::optional<uint32_t> header_size{std::nullopt};
-  std::optional<uint32_t> size{std::nullopt};
+  std::optional<uint64_t> size{std::nullopt};
   std::optional<uint32_t> position{std::nullopt};
+  // True once the atom has been inspected at full depth, see
+  // AtomTreeModel::InspectDeeply.
+  bool inspected_deeply{false};
   // End atom specific members
 
   // Field specific members
   std::optional<QString> value{std::nullopt};
   // End field specific members
 
+  // File specific members. Files also use `value`, for a summary, and
+  // `size`.
+  // The index of the media segment in the segment set, or unset for the
+  // init segment.
+  std::optional<size_t> segment_index{std::nullopt};
+  // True once the file's atoms have model items, see
+  // AtomTreeModel::fetchMore.
+  bool atoms_loaded{false};
+  // End file specific members
+
   ModelItem* parent{nullptr};
   std::vector<std::unique_ptr<ModelItem>> children;
 
@@ -34,6 +57,7 @@ struct ModelItem {
 };
 
 class AtomTreeModel : public QAbstractItemModel {
+  Q_OBJECT
  public:
   explicit AtomTreeModel(QObject* parent = nullptr);
   ~AtomTreeModel() override = default;
@@ -52,20 +76,131 @@ class AtomTreeModel : public QAbstractItemModel {
       QModelIndex const& parent = QModelIndex()) const override;
   [[nodiscard]] int columnCount(
       QModelIndex const& parent = QModelIndex()) const override;
+  [[nodiscard]] bool hasChildren(
+      QModelIndex const& parent = QModelIndex()) const override;
+  // The media segments of a segment set are parsed and get model items when
+  // they're expanded. Fetching a segment also parses the next few unparsed
+  // segments in parallel with it, so expanding many segments in turn (e.g.
+  // with "Expand all") parses them in parallel batches.
+  [[nodiscard]] bool canFetchMore(QModelIndex const& parent) const override;
+  void fetchMore(QModelIndex const& parent) override;
   // End QAbstractItemModel overrides.
 
   void SetAtoms(std::unique_ptr<AtomHolder>&& atom_holder);
 
+  // Shows `segment_set` as a row per file: the init segment, with its atoms,
+  // then a summary row per media segment, whose atoms are only parsed when
+  // it's expanded (see fetchMore). Segment sets can't be edited or saved,
+  // and replace any atoms set with SetAtoms.
+  void SetSegmentSet(std::unique_ptr<utility::SegmentSet>&& segment_set);
+
+  // Returns the segment set shown by the model, or nullptr if it shows the
+  // atoms of a single file.
+  [[nodiscard]] utility::SegmentSet* GetSegmentSet() const;
+
+  // Returns the name of the segment set file that `atom_or_descriptor` was
+  // read from, or std::nullopt if the model isn't showing a segment set or
+  // the atom isn't in it.
+  [[nodiscard]] std::optional<std::string> GetSegmentFileName(
+      AtomOrDescriptorBase const* atom_or_descriptor) const;
+
+  // Adds `appended_atoms` after the current top level atoms, e.g. atoms read
+  // from the end of a file that is still being written. Unlike `SetAtoms`,
+  // this inserts rows rather than resetting the model, so views keep their
+  // expansion, selection and scroll position, and only the new atoms get
+  // model items built. Trailing unparsed atoms are removed first, as the
+  // appended atoms start where they did.
+  void AppendAtoms(std::unique_ptr<AtomHolder>&& appended_atoms);
+
+  // Returns the offset just past the last parsed top level atom, i.e. where a
+  // file being followed should next be read from. Trailing unparsed atoms are
+  // skipped, as they're usually a box that was still being written. Returns
+  // std::nullopt if the model has no parsed atoms, or their positions aren't
+  // known.
+  [[nodiscard]] std::optional<uint64_t> GetTopLevelAtomsEnd() const;
+
+  // Releases the atoms and model items, leaving the model empty. Used to free
+  // memory, the atoms can later be restored with `SetAtoms`.
+  void UnloadAtoms();
+
+  // Returns true if the model currently holds atoms (or a segment set).
+  [[nodiscard]] bool HasAtoms() const;
+
+  // Returns the atoms shown by the model, or nullptr if it has none. For a
+  // segment set these are the atoms of the init segment.
+  [[nodiscard]] AtomHolder* GetAtomHolder() const;
+
+  // Returns an estimate of the heap memory used by the atoms and the model
+  // items, in bytes.
+  [[nodiscard]] size_t EstimateMemoryUsage() const;
+
   Result<std::monostate, std::string> RemoveAtom(Atom* atom);
 
   Result<std::monostate, std::string> SaveAtoms(QString const& file_name);
 
+  // Returns the atoms and descriptors matching `query`, in tree order. See
+  // AtomSearchIndex for the query syntax. For a segment set, the init
+  // segment and the media segments that have been expanded are searched.
+  [[nodiscard]] std::vector<AtomOrDescriptorBase*> Search(
+      QString const& query) const;
+
+  // Inspects the atom at `index` at full depth (see AtomHolder::InspectDeeply)
+  // and adds rows for the fields that were skipped when it was read. Called
+  // as atoms are expanded, so the entries of a sample table are only
+  // inspected if someone looks at them. Does nothing for descriptors, fields,
+  // or atoms that have already been inspected deeply.
+  void InspectDeeply(QModelIndex const& index);
+
+  // Colors the rows of the atoms in `highlights`, e.g. to show differences
+  // from another file, replacing any previous highlights. Highlights are
+  // dropped when the atoms are replaced or edited.
+  void SetHighlights(
+      std::unordered_map<AtomOrDescriptorBase const*, QColor>&& highlights);
+
+  // Sets the tool tips of the rows of the atoms in `annotations`, e.g. the
+  // conformance issues found in them, replacing any previous annotations.
+  // Like highlights, annotations are dropped when the atoms are replaced or
+  // edited.
+  void SetAnnotations(
+      std::unordered_map<AtomOrDescriptorBase const*, QString>&& annotations);
+
+  // Returns the index of the row showing `atom_or_descriptor`, or an invalid
+  // index if it isn't in the model.
+  [[nodiscard]] QModelIndex IndexForAtom(
+      AtomOrDescriptorBase const* atom_or_descriptor) const;
+
+ signals:
+  // Emitted after the atoms have been edited, meaning they no longer match
+  // the file they were read from.
+  void AtomsModified();
+
  private:
   // Update the model item based on the current state of the atoms.
   void UpdateModelItems();
 
+  // Recursively constructs the model items for `atom_or_descriptor` and its
+  // fields and children, and adds them to `parent`.
+  void AddModelItem(ModelItem* parent,
+                    AtomOrDescriptorBase* atom_or_descriptor);
+
+  // Returns the row of `item` within its parent.
+  [[nodiscard]] std::optional<int> GetRowOfItem(ModelItem const* item) const;
+
+  // Returns the top level row of `item`, which is its file for a segment
+  // set.
+  [[nodiscard]] ModelItem const* GetTopLevelItem(ModelItem const* item) const;
+
+  // Returns the holder of the atom shown by `item`.
+  [[nodiscard]] AtomHolder* GetAtomHolderOfItem(ModelItem const* item) const;
+
+  // Sets the summary shown in the row of the media segment `item`.
+  void UpdateSegmentSummary(ModelItem& item) const;
+
   std::unique_ptr<AtomHolder> atom_holder_;
 
+  // Set instead of `atom_holder_` when showing a segment set.
+  std::unique_ptr<utility::SegmentSet> segment_set_;
+
   // We store model items instead of directly deriving the data from the atoms.
   // This simplifies handling the different data types involved, i.e. we can
   // just reduce all atoms, descriptors, and fields to ModelItems.
@@ -73,6 +208,16 @@ class AtomTreeModel : public QAbstractItemModel {
   // This is the (dummy) root of our tree, all the root atoms will be children
   // of this item.
   std::unique_ptr<ModelItem> model_root_;
+
+  // Maps atoms and descriptors to the model items that show them. Rebuilt
+  // along with the model items.
+  std::unordered_map<AtomOrDescriptorBase const*, ModelItem*>
+      atom_to_model_item_;
+
+  // The background colors of highlighted rows, see SetHighlights.
+  std::unordered_map<AtomOrDescriptorBase const*, QColor> highlights_;
+  // The tool tips of annotated rows, see SetAnnotations.
+  std::unordered_map<AtomOrDescriptorBase const*, QString> annotations_;
 };
 
 }  // namespace mp4_manipulator
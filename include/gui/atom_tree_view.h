@@ -2,9 +2,11 @@
 #define MP4_MANIPULATOR_ATOM_TREE_VIEW_H_
 
 #include <QTreeView>
+#include <vector>
 
 #include "Ap4.h"
 #include "gui/atom_tree_model.h"
+#include "gui/incremental_expander.h"
 
 namespace mp4_manipulator {
 // A QTreeView that also encapsulates the atom data displayed in the tree.
@@ -13,23 +15,67 @@ class AtomTreeView : public QTreeView {
   Q_OBJECT
  public:
   AtomTreeView(std::unique_ptr<AtomHolder>&& atom_holder);
+  // Shows a segment set, see AtomTreeModel::SetSegmentSet.
+  explicit AtomTreeView(std::unique_ptr<utility::SegmentSet>&& segment_set);
 
   // Shows a file dialog and then saves (dumps all) atoms to the file.
   void SaveAtoms();
 
+  // Expands the tree down to the row for `atom_or_descriptor`, scrolls to it
+  // and selects it.
+  void JumpToAtom(AtomOrDescriptorBase const* atom_or_descriptor);
+
+  // Expands the tree down to the rows for `atoms`, so they're all visible
+  // (e.g. the differences from another file), then jumps to the first.
+  void RevealAtoms(std::vector<AtomOrDescriptorBase const*> const& atoms);
+
+  [[nodiscard]] AtomTreeModel* GetAtomTreeModel() const;
+
+ signals:
+  // Emitted when the current row changes. `atom_or_descriptor` is the atom or
+  // descriptor shown by the row, or, for field rows, the one that owns the
+  // field. May be nullptr.
+  void CurrentAtomChanged(AtomOrDescriptorBase* atom_or_descriptor);
+  // Emitted with a message for the status bar, e.g. when an expansion ends.
+  void StatusMessage(QString const& message);
+
+ protected:
+  // QTreeView overrides.
+  void currentChanged(QModelIndex const& current,
+                      QModelIndex const& previous) override;
+  // End QTreeView overrides.
+
  private:
+  // Sets up the view and its actions, with an empty model.
+  AtomTreeView();
+
+  // Starts expanding `root` and its descendants, skipping sample tables if
+  // `skip_sample_tables` is true. If `root` is invalid the whole tree is
+  // expanded.
+  void StartExpand(QModelIndex const& root, bool skip_sample_tables,
+                   std::optional<int> max_depth = std::nullopt);
+
   AtomTreeModel* atom_tree_model_;
+  // Used instead of QTreeView::expandAll, which blocks the UI on large trees.
+  IncrementalExpander* expander_;
 
   // Begin context menu actions.
   // Actions to expand and collapse all items in our tree view.
   QAction* collapse_tree_action_;
   QAction* expand_tree_action_;
+  QAction* expand_tree_skipping_sample_tables_action_;
+  // Cancels an expansion started by one of the expand actions.
+  QAction* cancel_expand_action_;
   // End QActions for `tree_view_` context menu.
  private slots:
   // Show a menu when right clicking on the tree model. This menu exposes
   // functionality to manipulate the tree and its contents.
   void ShowContextMenu(QPoint const& point);
 
+  // Reports how an expansion ended in the status bar, see
+  // IncrementalExpander::Finished.
+  void OnExpandFinished(size_t expanded_row_count, bool completed);
+
   // Shows a file dialog and then dumps the passed atom to the file.
   void DumpAtom(AP4_Atom& atom);
 
@@ -0,0 +1,66 @@
+#ifndef MP4_MANIPULATOR_HEX_VIEW_H_
+#define MP4_MANIPULATOR_HEX_VIEW_H_
+
+#include <QAbstractScrollArea>
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <cstdint>
+
+namespace mp4_manipulator {
+// Shows a range of bytes from a file as hex and ASCII. Only the rows that are
+// visible are read from the file, so memory use is constant regardless of the
+// size of the range (e.g. for a multi-GB mdat).
+class HexView : public QAbstractScrollArea {
+  Q_OBJECT
+ public:
+  explicit HexView(QWidget* parent = nullptr);
+
+  // Shows `size` bytes of `file_name` starting at `offset`. Offsets shown in
+  // the view are offsets into the file.
+  void SetRange(QString const& file_name, uint64_t offset, uint64_t size);
+
+  // Clears the view and shows `message` instead of bytes.
+  void ShowMessage(QString const& message);
+
+ protected:
+  // QAbstractScrollArea overrides.
+  void paintEvent(QPaintEvent* event) override;
+  void resizeEvent(QResizeEvent* event) override;
+  // End QAbstractScrollArea overrides.
+
+ private:
+  // Updates the scroll bar range for the current range and viewport size.
+  void UpdateScrollBar();
+
+  // Returns the index of the first row shown, relative to the range start.
+  [[nodiscard]] uint64_t GetFirstVisibleRow() const;
+
+  // Returns how many rows fit in the viewport.
+  [[nodiscard]] int GetVisibleRowCount() const;
+
+  // Makes `window_` hold the bytes for [offset, offset + length) of the file,
+  // reading them only if they're not already loaded. Returns false if the
+  // read fails.
+  bool LoadWindow(uint64_t offset, uint64_t length);
+
+  QFile file_;
+
+  // The range of the file being shown.
+  uint64_t range_offset_{0};
+  uint64_t range_size_{0};
+
+  // Scroll bars are int based, so for very large ranges each scroll bar step
+  // covers multiple rows.
+  uint64_t rows_per_scroll_step_{1};
+
+  // The most recently read bytes, which cover (at least) the visible rows.
+  QByteArray window_;
+  uint64_t window_offset_{0};
+
+  // If non-empty, shown instead of any bytes.
+  QString message_;
+};
+}  // namespace mp4_manipulator
+
+#endif  // MP4_MANIPULATOR_HEX_VIEW_H_
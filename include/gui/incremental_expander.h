@@ -0,0 +1,74 @@
+#ifndef MP4_MANIPULATOR_INCREMENTAL_EXPANDER_H_
+#define MP4_MANIPULATOR_INCREMENTAL_EXPANDER_H_
+
+#include <QObject>
+#include <QPersistentModelIndex>
+#include <deque>
+#include <functional>
+#include <optional>
+
+QT_FORWARD_DECLARE_CLASS(QTimer)
+QT_FORWARD_DECLARE_CLASS(QTreeView)
+
+namespace mp4_manipulator {
+// Expands the rows of a QTreeView in time sliced chunks on the event loop.
+// QTreeView::expandAll does all of its work in one go, which locks up the UI
+// on trees with hundreds of thousands of rows. This instead expands a chunk of
+// rows, returns to the event loop, and continues later, so the UI stays
+// responsive and the expansion can be cancelled.
+class IncrementalExpander : public QObject {
+  Q_OBJECT
+ public:
+  struct Options {
+    // Rows more than this many levels below the root are not expanded. A
+    // depth of 1 expands only the root(s). If unset there's no limit.
+    std::optional<int> max_depth{std::nullopt};
+    // Stops once this many rows have been expanded.
+    size_t row_budget{100'000};
+    // If set, rows for which this returns false are not expanded, and neither
+    // are their descendants.
+    std::function<bool(QModelIndex const&)> should_expand{};
+  };
+
+  explicit IncrementalExpander(QTreeView* tree_view);
+
+  // Starts expanding `root` and its descendants. If `root` is invalid the top
+  // level rows are expanded. Cancels any expansion already in progress.
+  void Start(QModelIndex const& root, Options options);
+
+  // Stops expanding. Rows already expanded stay expanded.
+  void Cancel();
+
+  [[nodiscard]] bool IsRunning() const;
+
+ signals:
+  // Emitted when an expansion ends. `completed` is false if it was cancelled
+  // or ran out of row budget before expanding everything.
+  void Finished(size_t expanded_row_count, bool completed);
+
+ private slots:
+  // Expands rows until the time slice is used up, then reschedules itself.
+  void ExpandChunk();
+
+ private:
+  struct PendingRow {
+    QPersistentModelIndex index;
+    // Depth of the row, the root(s) are at depth 1.
+    int depth;
+  };
+
+  // Ends the current expansion and emits Finished.
+  void Finish(bool completed);
+
+  QTreeView* tree_view_;
+  QTimer* timer_;
+
+  Options options_;
+  // Rows waiting to be expanded, in breadth first order so shallow rows are
+  // expanded first if we run out of budget.
+  std::deque<PendingRow> pending_rows_;
+  size_t expanded_row_count_{0};
+};
+}  // namespace mp4_manipulator
+
+#endif  // MP4_MANIPULATOR_INCREMENTAL_EXPANDER_H_
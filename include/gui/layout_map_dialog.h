@@ -0,0 +1,27 @@
+#ifndef MP4_MANIPULATOR_LAYOUT_MAP_DIALOG_H_
+#define MP4_MANIPULATOR_LAYOUT_MAP_DIALOG_H_
+
+#include <QDialog>
+
+#include "analysis/layout_map.h"
+
+namespace mp4_manipulator {
+class LayoutMapView;
+
+// Shows where a file's boxes and the chunks of each of its tracks lie, see
+// analysis::LayoutMap, as a horizontal strip over the file that can be zoomed
+// (mouse wheel) and panned (drag), with a summary of how well the file is
+// laid out for progressive download.
+class LayoutMapDialog : public QDialog {
+  Q_OBJECT
+ public:
+  LayoutMapDialog(QString const& file_name, analysis::LayoutMap&& map,
+                  QWidget* parent = nullptr);
+
+ private:
+  analysis::LayoutMap map_;
+  LayoutMapView* view_;
+};
+}  // namespace mp4_manipulator
+
+#endif  // MP4_MANIPULATOR_LAYOUT_MAP_DIALOG_H_
@@ -7,14 +7,18 @@
 #include "Ap4.h"
 #include "gui/atom_tree_model.h"
 
+QT_FORWARD_DECLARE_CLASS(QLabel)
 QT_FORWARD_DECLARE_CLASS(QTreeView)
 
 namespace mp4_manipulator {
 
+class AtomTab;
+
 class MainWindow : public QMainWindow {
   Q_OBJECT
  public:
   explicit MainWindow(QWidget* parent = nullptr);
+  ~MainWindow() override;
 
  protected:
   void dragEnterEvent(QDragEnterEvent* event) override;
@@ -25,26 +29,93 @@ class MainWindow : public QMainWindow {
   // Helpers for setting up specific UI elements.
   void SetupMenuBar();
   void SetupTabbedWidget();
+  void SetupStatusBar();
 
   void SetupNewTab(QString const& file_name,
-                   std::unique_ptr<AtomHolder>&& atom_holder);
+                   std::unique_ptr<AtomHolder>&& atom_holder,
+                   bool is_local_file = true);
+  // Adds `atom_tab` as a tab titled `title`, and shows it.
+  void AddTab(AtomTab* atom_tab, QString const& title);
 
   void OpenFile(QString const& file_name);
+  // Reads the atoms of a remote file with range requests, fetching only the
+  // parts of the file that are parsed. The file is read on a worker thread,
+  // and opens in a new tab once it's been parsed.
+  void OpenUrl(QUrl const& url);
+
+  // Begin memory management.
+  // Returns the memory budget for all tabs, in bytes, from the settings.
+  [[nodiscard]] uint64_t GetMemoryBudget() const;
+  // Evicts inactive, unmodified tabs, least recently used first, until the
+  // total memory used by tabs is within the budget (or nothing else can be
+  // evicted).
+  void EnforceMemoryBudget();
+  // Updates the status bar and tab tool tips with current memory usage.
+  void UpdateMemoryStatus();
+  // End memory management.
 
   QMenu* file_menu_;
+  QMenu* settings_menu_;
 
   QTabWidget* tabbed_widget_;
 
+  // Shows memory usage of the current tab and of all tabs.
+  QLabel* memory_status_label_;
+
+  // Incremented each time a tab is activated, used to find the least recently
+  // used tabs.
+  uint64_t activation_tick_{0};
+
   // Begin QActions for menu bar.
   QAction* open_file_action_;
+  QAction* open_url_action_;
+  QAction* open_segment_set_action_;
   QAction* save_file_action_;
+  QAction* save_faststart_copy_action_;
+  QAction* save_fragmented_copy_action_;
+  QAction* compare_action_;
+  QAction* verify_samples_action_;
+  QAction* check_conformance_action_;
+  QAction* track_statistics_action_;
+  QAction* layout_map_action_;
+  QAction* extract_tracks_action_;
+  QAction* memory_budget_action_;
   // End QActions for menu bar.
 
  private slots:
   // Open a file in the UI.
   void OpenFileUsingDialog();
-  // Requests the current AtomTreeView saves its atoms.
+  // Open a remote file in the UI.
+  void OpenUrlUsingDialog();
+  // Opens an init segment and its media segments, chosen with dialogs, as
+  // one tab, see utility::SegmentSet.
+  void OpenSegmentSetUsingDialog();
+  // Requests the current AtomTab saves its atoms.
   void SaveFile();
+  // Requests the current AtomTab writes a faststart copy of its file.
+  void SaveFaststartCopy();
+  // Requests the current AtomTab writes a fragmented copy of its file.
+  void SaveFragmentedCopy();
+  // Opens another file and compares it with the current tab's file, see
+  // analysis::DiffFiles. The differences are highlighted in both tabs.
+  void CompareWithFileUsingDialog();
+  // Requests the current AtomTab verifies its sample references.
+  void VerifySampleReferences();
+  // Requests the current AtomTab checks its atoms against the conformance
+  // rules.
+  void CheckConformance();
+  // Shows the statistics of the current tab's tracks in a dialog.
+  void ShowTrackStatistics();
+  // Shows the layout of the current tab's file in a dialog.
+  void ShowLayoutMap();
+  // Writes each track of the current tab's file to an elementary stream in
+  // a directory chosen with a dialog, see extraction::ExtractTracks.
+  void ExtractTracksUsingDialog();
+  // Reloads the newly current tab if it was evicted, and enforces the memory
+  // budget.
+  void OnCurrentTabChanged(int tab_index);
+  // Shows a dialog to set the memory budget.
+  void SetMemoryBudgetUsingDialog();
 };
 
 }  // namespace mp4_manipulator
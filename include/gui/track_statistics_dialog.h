@@ -0,0 +1,35 @@
+#ifndef MP4_MANIPULATOR_TRACK_STATISTICS_DIALOG_H_
+#define MP4_MANIPULATOR_TRACK_STATISTICS_DIALOG_H_
+
+#include <QDialog>
+#include <vector>
+
+#include "analysis/track_statistics.h"
+
+QT_FORWARD_DECLARE_CLASS(QTableWidget)
+
+namespace mp4_manipulator {
+class BitrateChart;
+
+// Shows the statistics of a file's tracks, see analysis::TrackStatistics,
+// with a row per track and a chart of the bitrate over time of the selected
+// track.
+class TrackStatisticsDialog : public QDialog {
+  Q_OBJECT
+ public:
+  TrackStatisticsDialog(QString const& file_name,
+                        std::vector<analysis::TrackStatistics>&& statistics,
+                        QWidget* parent = nullptr);
+
+ private:
+  std::vector<analysis::TrackStatistics> statistics_;
+  QTableWidget* table_;
+  BitrateChart* chart_;
+
+ private slots:
+  // Charts the bitrate of the track at `row`.
+  void ShowTrack(int row);
+};
+}  // namespace mp4_manipulator
+
+#endif  // MP4_MANIPULATOR_TRACK_STATISTICS_DIALOG_H_
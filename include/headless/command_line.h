@@ -0,0 +1,24 @@
+#ifndef MP4_MANIPULATOR_COMMAND_LINE_H_
+#define MP4_MANIPULATOR_COMMAND_LINE_H_
+
+namespace mp4_manipulator::headless {
+// The app runs without a GUI when its first argument names a headless command,
+// e.g. `mp4-manipulator batch --operation validate videos/`,
+// `mp4-manipulator inspect video.mp4`, `mp4-manipulator diff a.mp4 b.mp4`,
+// `mp4-manipulator stats video.mp4`, `mp4-manipulator check video.mp4`,
+// `mp4-manipulator decrypt --keys keys.txt in.mp4 out.mp4`,
+// `mp4-manipulator fragment in.mp4 out.mp4`,
+// `mp4-manipulator concat -o out.mp4 a.mp4 b.mp4` or
+// `mp4-manipulator patch --language 1=eng video.mp4`.
+
+// Returns true if the arguments name a headless command.
+bool IsHeadlessInvocation(int argc, char* argv[]);
+
+// Runs the headless command named by the arguments. Returns the process exit
+// code: 0 on success, 1 if the command ran but some work failed, and 2 if
+// the arguments were invalid.
+int RunHeadless(int argc, char* argv[]);
+
+}  // namespace mp4_manipulator::headless
+
+#endif  // MP4_MANIPULATOR_COMMAND_LINE_H_
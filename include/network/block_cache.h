@@ -0,0 +1,51 @@
+#ifndef MP4_MANIPULATOR_BLOCK_CACHE_H_
+#define MP4_MANIPULATOR_BLOCK_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mp4_manipulator::network {
+// A thread safe least recently used cache of fixed size blocks of a remote
+// file, keyed on block index. The cache is split into shards, each with its
+// own lock and LRU list, so threads reading different blocks rarely contend.
+class BlockCache {
+ public:
+  using Block = std::shared_ptr<std::vector<uint8_t> const>;
+
+  // `capacity` is the number of blocks held, across all shards.
+  explicit BlockCache(size_t capacity, size_t shard_count = 8);
+  BlockCache(BlockCache const&) = delete;
+  BlockCache& operator=(BlockCache const&) = delete;
+
+  // Returns the block at `index` and marks it most recently used, or returns
+  // nullptr if it isn't cached.
+  Block Find(uint64_t index);
+
+  // Adds (or replaces) the block at `index`, evicting the least recently used
+  // block of its shard if the shard is full.
+  void Insert(uint64_t index, Block block);
+
+ private:
+  // Most recently used first.
+  using LruList = std::list<std::pair<uint64_t, Block>>;
+
+  struct Shard {
+    std::mutex mutex;
+    LruList lru;
+    std::unordered_map<uint64_t, LruList::iterator> entries;
+  };
+
+  Shard& GetShard(uint64_t index);
+
+  size_t shard_capacity_;
+  std::vector<Shard> shards_;
+};
+
+}  // namespace mp4_manipulator::network
+
+#endif  // MP4_MANIPULATOR_BLOCK_CACHE_H_
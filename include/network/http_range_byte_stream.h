@@ -0,0 +1,119 @@
+#ifndef MP4_MANIPULATOR_HTTP_RANGE_BYTE_STREAM_H_
+#define MP4_MANIPULATOR_HTTP_RANGE_BYTE_STREAM_H_
+
+#include <QUrl>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Ap4.h"
+#include "network/block_cache.h"
+#include "result.h"
+
+QT_FORWARD_DECLARE_CLASS(QNetworkAccessManager)
+
+namespace mp4_manipulator::network {
+
+struct HttpRangeOptions {
+  // Data is fetched and cached in blocks of this size.
+  size_t block_size{64 * 1024};
+  // How much data the block cache holds.
+  size_t cache_size{64 * 1024 * 1024};
+  // The most data fetched ahead of sequential reads (e.g. while parsing a
+  // large moov). Read ahead starts at one block and doubles up to this.
+  size_t max_read_ahead{1024 * 1024};
+  // How long a request can stall before it's abandoned.
+  int timeout_ms{30000};
+};
+
+struct HttpRangeStats {
+  uint64_t request_count{0};
+  uint64_t bytes_fetched{0};
+};
+
+// A read only AP4_ByteStream over a file served over HTTP(S), e.g. by an
+// object store. Rather than downloading the file, byte ranges are fetched on
+// demand with range requests and kept in a BlockCache. Reading the atoms of a
+// file only touches box headers and the boxes AP4 parses (e.g. moov), large
+// payloads like mdat are seeked over, so opening a remote file fetches a
+// small fraction of it.
+//
+// Reads of missing neighbouring blocks are coalesced into one request, and
+// sequential reads fetch ahead of the reader.
+//
+// Requests block the calling thread, which runs a local event loop while
+// waiting. User input isn't handled by that loop, so a read on the GUI thread
+// can't re-enter the UI, but the GUI should still open (and parse) remote
+// files on a worker thread. The stream may be read from one thread at a time,
+// and can be handed between threads (e.g. parsed on a worker, then saved from
+// the GUI thread), in which case a network access manager is created on the
+// new thread.
+class HttpRangeByteStream : public AP4_ByteStream {
+ public:
+  // Opens `url`, fetching the first block to learn the size of the file.
+  // Returns an error if the file can't be fetched, or the server doesn't
+  // support range requests. On success the caller holds a reference to the
+  // stream, and should Release it when done.
+  static Result<HttpRangeByteStream*, std::string> Open(
+      QUrl const& url, HttpRangeOptions const& options = {});
+
+  HttpRangeByteStream(HttpRangeByteStream const&) = delete;
+  HttpRangeByteStream& operator=(HttpRangeByteStream const&) = delete;
+
+  // AP4_ByteStream overrides.
+  AP4_Result ReadPartial(void* buffer, AP4_Size bytes_to_read,
+                         AP4_Size& bytes_read) override;
+  // Always fails, the stream is read only.
+  AP4_Result WritePartial(void const* buffer, AP4_Size bytes_to_write,
+                          AP4_Size& bytes_written) override;
+  AP4_Result Seek(AP4_Position position) override;
+  AP4_Result Tell(AP4_Position& position) override;
+  AP4_Result GetSize(AP4_LargeSize& size) override;
+  void AddReference() override;
+  void Release() override;
+  // End AP4_ByteStream overrides.
+
+  // Returns how many requests have been made, and how much data fetched,
+  // since the stream was opened.
+  [[nodiscard]] HttpRangeStats GetStats() const;
+
+  // Returns the last error from fetching data, for reporting after a read
+  // fails.
+  [[nodiscard]] std::string const& GetLastError() const;
+
+ private:
+  HttpRangeByteStream(QUrl url, HttpRangeOptions const& options);
+  ~HttpRangeByteStream() override;
+
+  // Returns the network access manager of the calling thread, creating it if
+  // the stream was last read from another thread.
+  QNetworkAccessManager& GetNetworkAccessManager();
+
+  // Fetches `block_count` blocks from `first_block` with a single range
+  // request, adds them to the cache and returns them. Also learns the size of
+  // the file from the response.
+  Result<std::vector<BlockCache::Block>, std::string> FetchBlocks(
+      uint64_t first_block, uint64_t block_count);
+
+  QUrl url_;
+  HttpRangeOptions options_;
+  // Lives on the thread that last read from the stream.
+  std::unique_ptr<QNetworkAccessManager> network_access_manager_;
+  BlockCache cache_;
+  // Unknown until the first response.
+  uint64_t size_{0};
+  uint64_t position_{0};
+  // The last block read, used to detect sequential reads.
+  uint64_t last_read_block_{0};
+  // How many blocks to fetch ahead of the next read, if it's sequential.
+  uint64_t read_ahead_blocks_{0};
+  HttpRangeStats stats_;
+  std::string last_error_;
+  std::atomic<int> reference_count_{1};
+};
+
+}  // namespace mp4_manipulator::network
+
+#endif  // MP4_MANIPULATOR_HTTP_RANGE_BYTE_STREAM_H_
@@ -0,0 +1,61 @@
+#ifndef MP4_MANIPULATOR_BATCHED_FILE_READER_H_
+#define MP4_MANIPULATOR_BATCHED_FILE_READER_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mp4_manipulator::parallel {
+// A read of part of a file, identified to its completion by `id`.
+struct ReadRequest {
+  uint64_t id;
+  // A descriptor from OpenFileForReading.
+  int file_descriptor;
+  uint64_t offset;
+  uint32_t length;
+};
+
+struct ReadCompletion {
+  uint64_t id{0};
+  // The bytes read. Shorter than requested if the file ended first.
+  std::vector<uint8_t> data;
+  // 0 on success, otherwise the errno of the failed read.
+  int error{0};
+};
+
+// Reads many small ranges of many files with lots of reads in flight at once,
+// so the latency of each read (e.g. a box header on a network file system)
+// overlaps with the others rather than adding up. Used to scan the layout of
+// thousands of files, where each file only needs a few small reads.
+//
+// Reads are queued with Submit, and their results collected with
+// WaitForCompletions, from a single thread.
+class BatchedFileReader {
+ public:
+  virtual ~BatchedFileReader() = default;
+
+  // Queues a read. It starts as soon as there's room in flight.
+  virtual void Submit(ReadRequest const& request) = 0;
+
+  // Blocks until at least one queued read completes, then returns all the
+  // reads that have completed, in no particular order. Returns an empty
+  // vector if no reads are queued.
+  virtual std::vector<ReadCompletion> WaitForCompletions() = 0;
+};
+
+// Creates a reader with up to `queue_depth` reads in flight. On Linux this
+// uses io_uring, which submits and reaps many reads with a single system
+// call. Where io_uring is unavailable (other platforms, old kernels, or
+// sandboxes that block it) reads are made with pread on a pool of
+// `thread_count` threads instead. If `thread_count` is 0, one thread per
+// hardware thread is used.
+std::unique_ptr<BatchedFileReader> CreateBatchedFileReader(
+    uint32_t queue_depth, size_t thread_count = 0);
+
+// Opens a file for reading with a BatchedFileReader. Returns -1 on failure.
+int OpenFileForReading(char const* file_name);
+void CloseFile(int file_descriptor);
+
+}  // namespace mp4_manipulator::parallel
+
+#endif  // MP4_MANIPULATOR_BATCHED_FILE_READER_H_
@@ -0,0 +1,81 @@
+#ifndef MP4_MANIPULATOR_WORK_STEALING_POOL_H_
+#define MP4_MANIPULATOR_WORK_STEALING_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mp4_manipulator::parallel {
+// A fixed size thread pool where each worker has its own queue of tasks.
+// Workers take tasks from the back of their own queue, and when it's empty
+// steal from the front of other workers' queues. This keeps workers busy when
+// task costs vary wildly (e.g. processing a directory where most files are
+// small but a few are huge), without every worker contending on one queue.
+//
+// Tasks are passed the index of the worker running them, in
+// [0, GetWorkerCount()), so callers can keep per-worker state (buffers,
+// streams, etc.) without locking.
+class WorkStealingPool {
+ public:
+  using Task = std::function<void(size_t worker_index)>;
+
+  // Starts `worker_count` workers. If `worker_count` is 0, one worker per
+  // hardware thread is started.
+  explicit WorkStealingPool(size_t worker_count = 0);
+  // Waits for all submitted tasks to finish, then stops the workers.
+  ~WorkStealingPool();
+
+  WorkStealingPool(WorkStealingPool const&) = delete;
+  WorkStealingPool& operator=(WorkStealingPool const&) = delete;
+  WorkStealingPool(WorkStealingPool&&) = delete;
+  WorkStealingPool& operator=(WorkStealingPool&&) = delete;
+
+  // Queues `task`. Safe to call from any thread, including from within a
+  // task, in which case the task is queued on the calling worker.
+  void Submit(Task task);
+
+  // Blocks until all submitted tasks (including those submitted by tasks)
+  // have finished. Must not be called from within a task.
+  void Wait();
+
+  [[nodiscard]] size_t GetWorkerCount() const;
+
+ private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void RunWorker(size_t worker_index);
+  // Takes a task from `worker_index`'s queue, or steals one from another
+  // worker. Returns an empty task if there was nothing to take.
+  Task TakeTask(size_t worker_index);
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> workers_;
+
+  // Used to spread tasks submitted from outside the pool across the queues.
+  std::atomic<size_t> next_queue_{0};
+
+  // Guards sleeping and waking, along with the counts below.
+  std::mutex state_mutex_;
+  // Signalled when tasks are queued, or the pool is stopping.
+  std::condition_variable work_available_;
+  // Signalled when the last unfinished task finishes.
+  std::condition_variable all_finished_;
+  // Tasks in the queues that no worker has claimed yet. Idle workers sleep
+  // until this is non-zero, then claim a task by decrementing it.
+  size_t queued_count_{0};
+  // Tasks that are queued or running.
+  size_t unfinished_count_{0};
+  bool stopping_{false};
+};
+}  // namespace mp4_manipulator::parallel
+
+#endif  // MP4_MANIPULATOR_WORK_STEALING_POOL_H_
@@ -48,6 +48,10 @@ class AtomOrDescriptorBase {
 
   [[nodiscard]] std::vector<Field> const& GetFields() const;
   void AddField(QString&& name, QString&& data);
+  // Replaces the fields, e.g. with those of a deeper inspection.
+  void SetFields(std::vector<Field>&& fields);
+  // Moves the fields out, leaving the atom or descriptor with none.
+  std::vector<Field> TakeFields();
 
   [[nodiscard]] AtomOrDescriptorBase* GetParent() const;
   void SetParent(AtomOrDescriptorBase* parent);
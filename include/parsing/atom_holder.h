@@ -5,21 +5,69 @@
 #include <vector>
 
 #include "atom.h"
+#include "parsing/atom_search_index.h"
 #include "result.h"
 
 namespace mp4_manipulator {
 
+class EditingProcessor;
+
 class AtomHolder {
  public:
   AtomHolder(
       std::vector<std::unique_ptr<AtomOrDescriptorBase>>&& top_level_atoms,
-      std::vector<std::unique_ptr<AP4_Atom>>&& top_level_ap4_atoms);
+      std::vector<std::unique_ptr<AP4_Atom>>&& top_level_ap4_atoms,
+      std::unique_ptr<AtomSearchIndex>&& search_index = nullptr);
   std::vector<std::unique_ptr<AtomOrDescriptorBase>>& GetTopLevelAtoms();
 
+  // Returns the index over the inspected atoms, or nullptr if the atoms were
+  // read without one.
+  [[nodiscard]] AtomSearchIndex const* GetSearchIndex() const;
+
+  // Returns true if parts of the stream couldn't be parsed, and are held as
+  // UnparsedAtoms. Such holders can't be edited.
+  [[nodiscard]] bool HasUnparsedAtoms() const;
+
+  // Returns true if the payloads of some atoms were skipped rather than read
+  // (e.g. when reading from a pipe), and are held as SkippedAtoms. Such
+  // holders can't be edited or saved.
+  [[nodiscard]] bool HasSkippedAtoms() const;
+
+  // Returns an estimate of the heap memory used by the holder (the inspected
+  // atoms, the AP4 atoms and the search index), in bytes.
+  [[nodiscard]] size_t EstimateMemoryUsage() const;
+
+  // Moves the atoms (and search index entries) of `appended_atoms` after the
+  // atoms of this holder, e.g. atoms read from the end of a file that is
+  // still being written.
+  void AppendAtoms(std::unique_ptr<AtomHolder>&& appended_atoms);
+
+  // Returns the number of UnparsedAtoms at the end of the top level atoms.
+  // When a file is read while it's being written these are usually a box
+  // that was still being written.
+  [[nodiscard]] size_t GetTrailingUnparsedAtomCount() const;
+
+  // Removes the trailing UnparsedAtoms (see GetTrailingUnparsedAtomCount)
+  // and their search index entries, so the bytes they stood in for can be
+  // read again and appended.
+  void RemoveTrailingUnparsedAtoms();
+
+  // Atoms are usually read at InspectionDepth::kSummary. Re-inspects `atom`
+  // at full depth, replacing its fields so they include e.g. the entries of
+  // a sample table, and adds the new fields to the search index. Only leaf
+  // atoms are re-inspected: a container's detail is in its children, which
+  // have their own atoms. Returns true if the fields changed.
+  bool InspectDeeply(AtomOrDescriptorBase& atom);
+
   // Searches the model for `atom_to_remove` and removes it.Returns a result, on
   // failure this result has a string explaining the error.
   Result<std::monostate, std::string> RemoveAtom(Atom* atom_to_remove);
 
+  // Runs the commands in `processor` over the atoms, then regenerates the
+  // atoms held by the holder. Returns a result, on failure this result has a
+  // string explaining the error.
+  Result<std::monostate, std::string> ApplyEdits(EditingProcessor& processor);
+
   // Saves the atoms in the model to a file. Returns a result, on failure
   // this result has a string explaining the error.
   Result<std::monostate, std::string> SaveAtoms(char const* file_name);
@@ -27,6 +75,7 @@ class AtomHolder {
  private:
   std::vector<std::unique_ptr<AtomOrDescriptorBase>> top_level_atoms_;
   std::vector<std::unique_ptr<AP4_Atom>> top_level_ap4_atoms_;
+  std::unique_ptr<AtomSearchIndex> search_index_;
 
   // Walks the parsed AP4 atom tree and mp4_manipulator trees and sets pointers
   // on the mp4_manipulator atoms to their AP4 counterparts.
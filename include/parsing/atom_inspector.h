@@ -6,12 +6,24 @@
 
 #include "Ap4.h"
 #include "parsing/atom.h"
+#include "parsing/atom_search_index.h"
 
 namespace mp4_manipulator {
 
+// How much of each atom an AtomInspector records.
+enum class InspectionDepth {
+  // Headers and summary fields only. The per entry fields of tables (e.g. the
+  // sample sizes in stsz, or the samples in trun) are skipped, which for
+  // sample heavy files is most of the fields. Atoms can be inspected fully
+  // later, see AtomHolder::InspectDeeply.
+  kSummary,
+  // Every field, including the entries of tables.
+  kFull,
+};
+
 class AtomInspector : public AP4_AtomInspector {
  public:
-  AtomInspector();
+  explicit AtomInspector(InspectionDepth depth = InspectionDepth::kSummary);
   // AP4_AtomInspector overrides
   void StartAtom(char const* name, AP4_UI08 version, AP4_UI32 flags,
                  AP4_Size header_size, AP4_UI64 size) override;
@@ -34,7 +46,16 @@ class AtomInspector : public AP4_AtomInspector {
   // empty after the call.
   std::vector<std::unique_ptr<AtomOrDescriptorBase>> TakeAtoms();
 
+  // Sets an index that inspected atoms, descriptors and fields will be added
+  // to as they're emitted. May be nullptr to disable indexing. The index must
+  // outlive the inspection.
+  void SetSearchIndex(AtomSearchIndex* search_index);
+
  private:
+  // Adds the most recently added field of `current_atom_or_descriptor_` to the
+  // search index, if we have one.
+  void IndexLastField();
+
   // Get the atom or descriptor that preceded the current atom or descriptor.
   // This will return nullptr if current_atom_or_descriptor_ is the first
   // atom or descriptor at the current level.
@@ -46,6 +67,8 @@ class AtomInspector : public AP4_AtomInspector {
   // The inspector stores parsed atoms in a tree, these are the atoms at the
   // root of the tree.
   std::vector<std::unique_ptr<AtomOrDescriptorBase>> top_level_atoms_;
+  // Not owned.
+  AtomSearchIndex* search_index_ = nullptr;
 };
 
 }  // namespace mp4_manipulator
@@ -1,3 +1,6 @@
+#ifndef MP4_MANIPULATOR_ATOM_PATH_UTILS_H_
+#define MP4_MANIPULATOR_ATOM_PATH_UTILS_H_
+
 #include <optional>
 #include <vector>
 
@@ -32,4 +35,6 @@ Ap4CompatiblePath GetAp4Path(AP4_Atom* atom, AP4_AtomParent& top_level);
 std::optional<AP4_Atom*> GetAp4AtomFromPath(Ap4CompatiblePath& path,
                                             AP4_List<AP4_Atom>& top_level);
 std::optional<AP4_Atom*> GetAp4AtomFromPath(Ap4CompatiblePath& path,
-                                            AP4_AtomParent& top_level);
\ No newline at end of file
+                                            AP4_AtomParent& top_level);
+
+#endif  // MP4_MANIPULATOR_ATOM_PATH_UTILS_H_
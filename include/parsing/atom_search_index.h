@@ -0,0 +1,88 @@
+#ifndef MP4_MANIPULATOR_ATOM_SEARCH_INDEX_H_
+#define MP4_MANIPULATOR_ATOM_SEARCH_INDEX_H_
+
+#include <QHash>
+#include <QString>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "parsing/atom.h"
+
+namespace mp4_manipulator {
+
+// An inverted index over inspected atoms and descriptors. The index is built
+// incrementally as the AtomInspector emits atoms and fields, so searching
+// doesn't need to walk (or expand) the tree.
+//
+// Queries are made up of whitespace separated terms, all of which must match
+// for a node to be returned. Terms take the following forms (matching is case
+// insensitive):
+// - `trun`: a node whose four cc, a field name, or a field value (or a word
+//   within a value) is `trun`.
+// - `sample_count=12`: a node with a field `sample_count` whose value is 12.
+//   Byte array values can be written with or without the brackets and spaces
+//   the inspector uses, and uuid style dashes are ignored. E.g.
+//   `system_id=edef8ba9-79d6-4ace-a3c8-27dcd51d21ed`.
+// - `type:pssh`, `name:sample_count`, `value:12`: restrict a term to matching
+//   only four ccs, field names or field values respectively.
+class AtomSearchIndex {
+ public:
+  AtomSearchIndex() = default;
+  AtomSearchIndex(AtomSearchIndex const&) = delete;
+  AtomSearchIndex& operator=(AtomSearchIndex const&) = delete;
+  AtomSearchIndex(AtomSearchIndex&&) = default;
+  AtomSearchIndex& operator=(AtomSearchIndex&&) = default;
+
+  // Adds an atom or descriptor to the index, keyed on its name. Nodes should
+  // be added in tree order (i.e. the order the inspector emits them) so that
+  // search results come back in tree order.
+  void AddNode(AtomOrDescriptorBase* node);
+
+  // Adds a field of `node` to the index. If `node` has not been added via
+  // `AddNode` it is added first.
+  void AddField(AtomOrDescriptorBase* node, QString const& name,
+                QString const& value);
+
+  // Appends all the nodes of `other` after the nodes of this index, leaving
+  // `other` empty. Used to stitch together indexes built separately for
+  // consecutive parts of a file.
+  void Append(AtomSearchIndex&& other);
+
+  // Removes `node`, and every node added after it, from the index. Used to
+  // drop atoms at the end of a file that are about to be read again, e.g. a
+  // box that was still being written. Does nothing if `node` isn't indexed.
+  void RemoveNodesFrom(AtomOrDescriptorBase* node);
+
+  // Returns the nodes matching `query`, in tree order. An empty (or all
+  // whitespace) query matches nothing.
+  [[nodiscard]] std::vector<AtomOrDescriptorBase*> Search(
+      QString const& query) const;
+
+  [[nodiscard]] size_t GetNodeCount() const;
+
+  // Returns an estimate of the heap memory used by the index, in bytes.
+  [[nodiscard]] size_t EstimateMemoryUsage() const;
+
+ private:
+  using NodeId = uint32_t;
+  using PostingList = std::vector<NodeId>;
+
+  NodeId GetOrAddNodeId(AtomOrDescriptorBase* node);
+  void AddPosting(QString const& key, NodeId id);
+  // Returns the posting list for `key`, or nullptr if there is none.
+  PostingList const* FindPostings(QString const& key) const;
+  // Returns the sorted ids matching a single query term.
+  PostingList MatchTerm(QString const& term) const;
+
+  // Maps node ids to nodes. Ids are assigned in the order nodes are added.
+  std::vector<AtomOrDescriptorBase*> nodes_;
+  std::unordered_map<AtomOrDescriptorBase*, NodeId> node_ids_;
+  // Maps a prefixed key (e.g. "t:trun" for a four cc, or "f:name=value" for
+  // a field) to the sorted ids of the nodes with that key.
+  QHash<QString, PostingList> postings_;
+};
+
+}  // namespace mp4_manipulator
+
+#endif  // MP4_MANIPULATOR_ATOM_SEARCH_INDEX_H_
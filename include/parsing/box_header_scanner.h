@@ -0,0 +1,62 @@
+#ifndef MP4_MANIPULATOR_BOX_HEADER_SCANNER_H_
+#define MP4_MANIPULATOR_BOX_HEADER_SCANNER_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Ap4.h"
+#include "result.h"
+
+namespace mp4_manipulator::utility {
+// The header of a box (atom), without its payload.
+struct BoxHeader {
+  AP4_Atom::Type type;
+  // Offset of the start of the box (its header) in the stream.
+  uint64_t offset;
+  // Size of the header: 8 bytes, or 16 if the box uses a 64 bit size.
+  uint32_t header_size;
+  // Size of the whole box, including the header. Boxes with a size of 0 (which
+  // extend to the end of the stream) have their actual size filled in.
+  uint64_t size;
+};
+
+// How to handle a box that extends past the end of the stream.
+enum class TruncatedBoxHandling {
+  // Return an error.
+  kError,
+  // Stop scanning, returning the headers of the complete boxes before it.
+  // Used for files that are still being written, where the last box may be
+  // only partly written. Boxes with a size of 0 (which extend to the end of
+  // the stream) are also treated as incomplete, as the end isn't known yet.
+  kStop,
+};
+
+// Reads the headers of the top level boxes in `stream`, seeking over their
+// payloads. This is much cheaper than parsing the boxes, so it's useful for
+// operations that only need to know the layout of a file (e.g. where `moov`
+// and `mdat` are). Scanning starts at `start_offset`, which should be the
+// start of a top level box.
+//
+// Returns an error if a header is malformed, or (depending on
+// `truncated_box_handling`) if a box extends past the end of the stream.
+Result<std::vector<BoxHeader>, std::string> ScanTopLevelBoxHeaders(
+    AP4_ByteStream& stream, uint64_t start_offset = 0,
+    TruncatedBoxHandling truncated_box_handling = TruncatedBoxHandling::kError);
+
+// Parses the header of the box at `offset` from `data`, which holds `size`
+// bytes of the stream starting at `offset`. For callers that read headers into
+// their own buffers (e.g. many files at once) rather than through a stream.
+// Returns std::nullopt if `data` is too short to hold the whole header, in
+// which case more should be read. Returns an error, as ScanTopLevelBoxHeaders
+// does, if the header is malformed or the box extends past `stream_size`.
+Result<std::optional<BoxHeader>, std::string> ParseBoxHeader(
+    uint8_t const* data, size_t size, uint64_t offset, uint64_t stream_size);
+
+// Returns a printable version of a four cc, e.g. "moov".
+std::string FourCcToString(AP4_Atom::Type type);
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_BOX_HEADER_SCANNER_H_
@@ -0,0 +1,30 @@
+#ifndef MP4_MANIPULATOR_BOX_RESYNC_H_
+#define MP4_MANIPULATOR_BOX_RESYNC_H_
+
+#include <cstdint>
+#include <optional>
+
+#include "Ap4.h"
+
+namespace mp4_manipulator::utility {
+// Searches `stream` from `start_offset` up to `end_offset` for the start of
+// the next plausible top level box, so parsing can resume after a corrupt or
+// truncated box rather than giving up on the rest of the file.
+//
+// A position is plausible if it holds the header of a box type expected at
+// the top level (e.g. moof, mdat) whose size fits before `end_offset`, and
+// which is followed by another such header (or ends at `end_offset`). Checking
+// the following header makes false matches in media data very unlikely.
+//
+// The bytes are scanned in large chunks, with the common case (bytes that
+// can't start a box type) rejected a block at a time using SIMD where it's
+// available, so the scan is limited by I/O rather than by checking.
+//
+// Returns std::nullopt if there's no plausible box in the range.
+std::optional<uint64_t> FindNextPlausibleBox(AP4_ByteStream& stream,
+                                             uint64_t start_offset,
+                                             uint64_t end_offset);
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_BOX_RESYNC_H_
@@ -0,0 +1,54 @@
+#ifndef MP4_MANIPULATOR_CONCATENATION_H_
+#define MP4_MANIPULATOR_CONCATENATION_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "result.h"
+
+namespace mp4_manipulator::utility {
+struct ConcatenationSummary {
+  // Whether the inputs were fragmented, and so their fragments were appended
+  // rather than their sample tables merged.
+  bool is_fragmented{false};
+  uint64_t sample_count{0};
+  // Bytes of media data (mdat boxes) copied.
+  uint64_t media_data_size{0};
+};
+
+// Writes the files `input_file_names` one after another as a single file,
+// `output_file_name`, without re-encoding, e.g. to join the chunks a
+// recorder splits its recordings into. The files must have the same tracks,
+// with the same ids, timescales and sample descriptions.
+//
+// For progressive files, the sample tables of each track are merged into
+// those of the first file's `moov`, the durations are summed, and the chunk
+// offsets are rewritten for where each `mdat` lands in the output (using
+// `co64` if they don't fit in 32 bits). Edit lists, which only describe the
+// first file, are removed, as are per sample tables we don't merge (`sdtp`,
+// `sbgp` and `subs`).
+//
+// For fragmented files, the first file's `moov` is kept and every file's
+// fragments are appended, with their sequence numbers renumbered and their
+// decode times (`tfdt`) shifted to follow on from the previous file. Each
+// file after the first is shifted as a whole, so its earliest fragment
+// starts where the previous files end, and tracks that start at different
+// times (e.g. audio slightly after video) keep their offsets. `sidx` and
+// `mfra`, which would no longer be right, are dropped. The tracks' `trex`
+// defaults must also match, as the fragments of every file fall back on the
+// first file's.
+//
+// Only `moov` and `moof` boxes are parsed, and `mdat` boxes are copied by
+// range using `CopyFileRange`, so memory use is proportional to the merged
+// metadata and the time taken is close to that of copying the media data.
+//
+// Returns an error if fewer than two files are given, the files can't be
+// concatenated, or any can't be read or written.
+Result<ConcatenationSummary, std::string> ConcatenateFiles(
+    std::vector<std::string> const& input_file_names,
+    char const* output_file_name);
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_CONCATENATION_H_
@@ -0,0 +1,89 @@
+#ifndef MP4_MANIPULATOR_EDITING_PROCESSOR_H_
+#define MP4_MANIPULATOR_EDITING_PROCESSOR_H_
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Ap4.h"
+#include "parsing/atom_path_utils.h"
+#include "result.h"
+
+namespace mp4_manipulator {
+// Base class for commands for the processor.
+class Command {
+ public:
+  virtual Result<std::monostate, std::string> Do(AP4_AtomParent& top_level) = 0;
+  Command() = default;
+  Command(Command const&) = default;
+  Command& operator=(Command const&) = default;
+  Command(Command&&) = default;
+  Command& operator=(Command&&) = default;
+  virtual ~Command() = default;
+};
+
+// Removes the atom at a path.
+class RemoveCommand : public Command {
+ public:
+  RemoveCommand(Ap4CompatiblePath path_to_remove)
+      : path_to_remove_(std::move(path_to_remove)) {}
+  Result<std::monostate, std::string> Do(AP4_AtomParent& top_level) override;
+
+ private:
+  Ap4CompatiblePath path_to_remove_;
+};
+
+// Removes all atoms of the given types, at any depth. Removing no atoms is not
+// an error, so this can be applied to files that may or may not contain the
+// types.
+class RemoveAtomsOfTypesCommand : public Command {
+ public:
+  RemoveAtomsOfTypesCommand(std::vector<AP4_Atom::Type> types_to_remove)
+      : types_to_remove_(std::move(types_to_remove)) {}
+  Result<std::monostate, std::string> Do(AP4_AtomParent& top_level) override;
+
+  // Returns how many atoms were removed by the last call to `Do`.
+  [[nodiscard]] size_t GetRemovedCount() const;
+
+ private:
+  void RemoveFrom(AP4_AtomParent& parent);
+
+  std::vector<AP4_Atom::Type> types_to_remove_;
+  size_t removed_count_{0};
+};
+
+// Based on AP4_EditingProcessor from Mp4Edit.cpp in the Ap4 lib.
+class EditingProcessor : public AP4_Processor {
+ public:
+  EditingProcessor() = default;
+  EditingProcessor(EditingProcessor const&) = delete;
+  EditingProcessor& operator=(EditingProcessor const&) = delete;
+  EditingProcessor(EditingProcessor&& other) noexcept
+      : commands_(std::move(other.commands_)) {}
+  EditingProcessor& operator=(EditingProcessor&& other) noexcept {
+    if (this == &other) {
+      return *this;
+    }
+    this->commands_ = std::move(other.commands_);
+    return *this;
+  }
+  // EditingProcessor(EditingProcessor&& other) = default;
+  ~EditingProcessor() override = default;
+
+  AP4_Result Initialize(AP4_AtomParent& top_level, AP4_ByteStream& stream,
+                        ProgressListener* listener) override;
+  void AddCommand(std::unique_ptr<Command> command);
+
+  std::optional<std::string> GetInitializationError() const;
+
+ private:
+  std::vector<std::unique_ptr<Command>> commands_;
+
+  // If `Initialize()` failed, this will contain the error.
+  std::optional<std::string> initialization_error_;
+};
+
+}  // namespace mp4_manipulator
+
+#endif  // MP4_MANIPULATOR_EDITING_PROCESSOR_H_
@@ -0,0 +1,34 @@
+#ifndef MP4_MANIPULATOR_FASTSTART_H_
+#define MP4_MANIPULATOR_FASTSTART_H_
+
+#include <string>
+
+#include "result.h"
+
+namespace mp4_manipulator::utility {
+enum class FaststartOutcome {
+  // `moov` was moved in front of the media data.
+  kRelocated,
+  // `moov` was already in front of the media data, so the file was copied
+  // as is.
+  kAlreadyFaststart,
+};
+
+// Writes a copy of `input_file_name` to `output_file_name` with `moov` placed
+// in front of the first `mdat`, so that players can start playback before
+// the whole file has been downloaded (what ffmpeg calls "faststart").
+//
+// Only `moov` is parsed, and all other boxes are copied as is using
+// `CopyFileRange`, so memory use is proportional to the size of `moov` rather
+// than the file, and the media data is copied at close to disk speed. The
+// chunk offsets in `stco` and `co64` boxes are updated for the new layout. If
+// an offset no longer fits in 32 bits, its `stco` is upgraded to a `co64`.
+//
+// Fragmented files, and files with offsets we don't know how to update (e.g.
+// `saio`), are rejected rather than being written with broken offsets.
+Result<FaststartOutcome, std::string> WriteFaststart(
+    char const* input_file_name, char const* output_file_name);
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_FASTSTART_H_
@@ -0,0 +1,101 @@
+#ifndef MP4_MANIPULATOR_FIELD_PATCHER_H_
+#define MP4_MANIPULATOR_FIELD_PATCHER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "Ap4.h"
+#include "parsing/atom.h"
+#include "result.h"
+
+namespace mp4_manipulator::utility {
+// An entry of an edit list (elst).
+struct EditListEntry {
+  uint64_t segment_duration;
+  // The start of the edit in media time, or -1 for an empty edit.
+  int64_t media_time;
+  // 16.16 fixed point, 0x10000 for normal speed.
+  int32_t media_rate{0x10000};
+};
+
+// Changes fixed size fields of a file's boxes in place, by writing the new
+// bytes straight to where the fields are on disk. No box changes size, so
+// unlike applying an edit and saving the atoms, nothing else in the file is
+// read or rewritten, and a patch takes the same time however large the file.
+//
+// Boxes are given as the parsed atoms of the file, whose positions locate
+// them. Before each write the box's header is read back from the file and
+// checked against the atom (type and size), and the field is checked to lie
+// within the box, so a stale or wrong atom can't corrupt the file.
+class FieldPatcher {
+ public:
+  // Opens `file_name` for patching.
+  static Result<std::unique_ptr<FieldPatcher>, std::string> Open(
+      char const* file_name);
+
+  FieldPatcher(FieldPatcher const&) = delete;
+  FieldPatcher& operator=(FieldPatcher const&) = delete;
+  ~FieldPatcher();
+
+  // Sets the enabled flag of the track whose tkhd is `tkhd`.
+  Result<std::monostate, std::string> SetTrackEnabled(
+      AtomOrDescriptorBase const& tkhd, bool enabled);
+
+  // Sets the language of mdhd `mdhd`, an ISO 639-2/T code such as "eng".
+  Result<std::monostate, std::string> SetMediaLanguage(
+      AtomOrDescriptorBase const& mdhd, std::string const& language);
+
+  // Sets the timescale of mdhd `mdhd`, or of mvhd `mvhd`. Durations and
+  // times are left as they are, so this fixes a wrongly written timescale
+  // rather than converting the track or movie to a new one.
+  Result<std::monostate, std::string> SetMediaTimescale(
+      AtomOrDescriptorBase const& mdhd, uint32_t timescale);
+  Result<std::monostate, std::string> SetMovieTimescale(
+      AtomOrDescriptorBase const& mvhd, uint32_t timescale);
+
+  // Replaces entry `index` (0-based) of elst `elst`. Returns an error if the
+  // elst has no such entry, or it's version 0 and the values don't fit in
+  // 32 bits.
+  Result<std::monostate, std::string> SetEditListEntry(
+      AtomOrDescriptorBase const& elst, uint32_t index,
+      EditListEntry const& entry);
+
+ private:
+  // The header of a full box, as read from the file.
+  struct FullBoxHeader {
+    uint64_t position;
+    uint64_t size;
+    // Offset of the box's fields after its version and flags, from
+    // `position`.
+    uint32_t fields_offset;
+    uint8_t version;
+  };
+
+  explicit FieldPatcher(int descriptor) : descriptor_{descriptor} {}
+
+  // Reads the header of `box` from the file, checking it's a full box of
+  // `type` with the size the parsed atom has.
+  Result<FullBoxHeader, std::string> ReadFullBoxHeader(
+      AtomOrDescriptorBase const& box, AP4_Atom::Type type);
+
+  // Writes `size` bytes at `offset` from the start of `header`'s box, if
+  // they lie within the box.
+  Result<std::monostate, std::string> WriteWithinBox(
+      FullBoxHeader const& header, uint64_t offset, uint8_t const* data,
+      size_t size);
+
+  Result<std::monostate, std::string> SetTimescale(
+      AtomOrDescriptorBase const& box, AP4_Atom::Type type,
+      uint32_t timescale);
+
+  [[nodiscard]] bool ReadAt(uint64_t offset, uint8_t* data, size_t size);
+  [[nodiscard]] bool WriteAt(uint64_t offset, uint8_t const* data,
+                             size_t size);
+
+  int descriptor_;
+};
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_FIELD_PATCHER_H_
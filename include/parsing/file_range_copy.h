@@ -0,0 +1,42 @@
+#ifndef MP4_MANIPULATOR_FILE_RANGE_COPY_H_
+#define MP4_MANIPULATOR_FILE_RANGE_COPY_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "result.h"
+
+namespace mp4_manipulator::utility {
+// Copies `length` bytes starting at `input_offset` in `input` to the current
+// position of `output`, leaving `output` positioned after the copied bytes.
+//
+// On Linux the copy is done by the kernel (`copy_file_range`), so the data
+// isn't copied through user space, and file systems that support it can share
+// extents rather than copying at all. Elsewhere, or if the kernel can't copy
+// between the files, a buffered copy is used.
+//
+// Returns an error if `input` is shorter than the range, or on I/O failure.
+Result<std::monostate, std::string> CopyFileRange(std::FILE* input,
+                                                  uint64_t input_offset,
+                                                  uint64_t length,
+                                                  std::FILE* output);
+
+// Makes `output_file_name` a copy of `input_file_name`. On Linux file systems
+// that support it (e.g. Btrfs and XFS) the copy is a reflink, sharing the
+// input's extents, so it's made in constant time and only the blocks later
+// written to take space. Elsewhere the file is copied with CopyFileRange.
+Result<std::monostate, std::string> CloneFile(char const* input_file_name,
+                                              char const* output_file_name);
+
+// Seeks `file` to `offset`, supporting offsets past 2GiB on all platforms.
+// Returns false on failure.
+bool SeekFile(std::FILE* file, uint64_t offset);
+
+// Returns the position of `file`, or a negative value on failure. Supports
+// positions past 2GiB on all platforms.
+int64_t TellFile(std::FILE* file);
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_FILE_RANGE_COPY_H_
@@ -1,13 +1,17 @@
 #ifndef MP4_MANIPULATOR_FILE_PARSER_H_
 #define MP4_MANIPULATOR_FILE_PARSER_H_
 
+#include <cstdio>
 #include <memory>
 #include <optional>
+#include <string>
 #include <vector>
 
 #include "Ap4.h"
 #include "parsing/atom.h"
 #include "parsing/atom_holder.h"
+#include "parsing/atom_inspector.h"
+#include "result.h"
 
 namespace mp4_manipulator {
 namespace utility {
@@ -19,15 +23,86 @@ struct ParsedAtomHolder {
 // Reads atoms from a bytestream. Returns a holder which contains vectors of
 // the parsed atoms as AtomOrDescriptorBase and AP4_Atoms (these are different
 // representations of the same underlying data).
-std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(AP4_ByteStream* input);
+//
+// If the size of the stream is known, parsing recovers from damaged boxes:
+// the parser searches forward for the next plausible top level box and
+// carries on from there. The bytes skipped over are held as "unparsed" atoms
+// (see UnparsedAtom).
+//
+// Atoms are inspected to `depth`. The default, InspectionDepth::kSummary,
+// skips the entries of sample tables, which for long files are most of the
+// fields. AtomHolder::InspectDeeply adds them for an atom later.
+std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(
+    AP4_ByteStream* input, InspectionDepth depth = InspectionDepth::kSummary);
 
 // Reads atoms from a file. Returns a holder which contains vectors of the
 // parsed atoms as AtomOrDescriptorBase and AP4_Atoms (these are different
 // representations of the same underlying data).
-std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(char const* file_name);
+//
+// The top level box headers are scanned first, then the boxes are parsed and
+// inspected in parallel on up to `thread_count` threads (0 uses one per
+// hardware thread), each over its own range of the file. This makes opening
+// long fragmented files, which have many independent moof and mdat boxes,
+// scale with cores. Pass 1 to parse on the calling thread only, e.g. when
+// already reading many files in parallel. Damaged boxes are recovered from,
+// and atoms inspected to `depth`, as for streams.
+std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(
+    char const* file_name, size_t thread_count = 0,
+    InspectionDepth depth = InspectionDepth::kSummary);
 
-// Dumps an atom to a file.
-void DumpAtom(char const* output_file_name, AP4_Atom& atom);
+// Reads the complete top level atoms that start at `offset` in `input`, a
+// file that may still be being written, e.g. a fragmented recording. A
+// partly written box at the end of the file is left for a later read.
+// `end_offset` is set to the end of the last atom read (or `offset` if none
+// were), which is where the next read should start. Returns std::nullopt if
+// the file can't be read or is malformed from `offset`.
+//
+// Only the new boxes are parsed, so the cost of a read is proportional to
+// the amount of data appended since the last one. Atoms are inspected to
+// InspectionDepth::kSummary. Atoms that aren't parsed (e.g. mdat) keep a
+// reference to `input` to read their payload from, so callers reading a
+// file repeatedly should reuse one stream rather than opening one per read.
+std::optional<std::unique_ptr<AtomHolder>> ReadAppendedAtoms(
+    AP4_ByteStream& input, uint64_t offset, uint64_t& end_offset);
+
+// Reads only the first top level atom of `type` in `input`, e.g. moov. The
+// top level box headers are scanned to find it, so the other boxes are
+// neither read nor parsed. The atom is inspected to `depth`. Boxes after a
+// box cut off by the end of the stream aren't searched, but the truncated box
+// isn't an error. Returns std::nullopt if a header is malformed, there's no
+// complete atom of `type`, or it fails to parse.
+std::optional<std::unique_ptr<AtomHolder>> ReadTopLevelAtom(
+    AP4_ByteStream& input, AP4_Atom::Type type,
+    InspectionDepth depth = InspectionDepth::kSummary);
+
+struct StreamingReadOptions {
+  // Top level boxes larger than this are skipped rather than read into memory
+  // and parsed. Media data and free space are always skipped.
+  uint64_t max_buffered_box_size{64 * 1024 * 1024};
+  // How much of each parsed box is inspected.
+  InspectionDepth inspection_depth{InspectionDepth::kSummary};
+  // Shown in the UI for boxes whose payload was skipped.
+  std::string skipped_note{"Skipped while streaming."};
+};
+
+// Reads atoms from a stream that can only be read forwards, such as stdin or
+// a pipe, e.g. `curl ... | mp4-manipulator inspect`. Offsets are counted as
+// the stream is read rather than found by seeking. Each top level box is
+// either read into memory and parsed, or has its payload read past and
+// discarded, in which case it's held as a SkippedAtom. Media data, free space
+// and boxes larger than `options.max_buffered_box_size` are skipped, so
+// memory use is bounded by the largest buffered box (plus the parsed atoms)
+// however long the stream is.
+//
+// A box cut off by the end of the stream is also held as a SkippedAtom.
+// Returns an error if reading fails, or the stream isn't made of boxes.
+Result<std::unique_ptr<AtomHolder>, std::string> ReadAtomsFromPipe(
+    FILE* input, StreamingReadOptions const& options);
+
+// Dumps an atom to a file. Returns an error if the file can't be opened or
+// written.
+Result<std::monostate, std::string> DumpAtom(char const* output_file_name,
+                                             AP4_Atom& atom);
 
 }  // namespace utility
 }  // namespace mp4_manipulator
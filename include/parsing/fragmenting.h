@@ -0,0 +1,41 @@
+#ifndef MP4_MANIPULATOR_FRAGMENTING_H_
+#define MP4_MANIPULATOR_FRAGMENTING_H_
+
+#include <cstdint>
+#include <string>
+
+#include "result.h"
+
+namespace mp4_manipulator::utility {
+// The default target duration of fragments, in seconds.
+constexpr double kDefaultFragmentDuration = 2.0;
+
+struct FragmentingSummary {
+  uint64_t fragment_count{0};
+  uint64_t sample_count{0};
+};
+
+// Writes a fragmented (CMAF style) copy of the progressive file
+// `input_file_name` to `output_file_name`: an `ftyp` (with the `cmfc` brand
+// if there's a single track), `moov` with empty sample tables and an `mvex`,
+// then `moof`/`mdat` pairs.
+//
+// Fragments start on the sync samples of the first video track (or of the
+// first track, if there's no video) once they're at least
+// `fragment_duration` seconds long. Each fragment period has one `moof` and
+// `mdat` per track, holding the track's samples that start in the period.
+//
+// As for WriteFaststart, only `moov` is parsed. Fragments are built one at a
+// time from its sample tables and written as they're built, with their
+// sample data copied by range using `CopyFileRange`, so memory use is bounded
+// by the samples of one fragment however long the file is.
+//
+// Returns an error if the file is already fragmented, or has a track with
+// more than one sample description.
+Result<FragmentingSummary, std::string> WriteFragmented(
+    char const* input_file_name, char const* output_file_name,
+    double fragment_duration = kDefaultFragmentDuration);
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_FRAGMENTING_H_
@@ -0,0 +1,25 @@
+#ifndef MP4_MANIPULATOR_RESOURCE_DELETERS_H_
+#define MP4_MANIPULATOR_RESOURCE_DELETERS_H_
+
+#include <cstdio>
+#include <memory>
+
+#include "Ap4.h"
+
+namespace mp4_manipulator::utility {
+// Bento4 byte streams are reference counted, so they're released rather than
+// deleted.
+struct ByteStreamReleaser {
+  void operator()(AP4_ByteStream* stream) const { stream->Release(); }
+};
+
+struct FileCloser {
+  void operator()(std::FILE* file) const { std::fclose(file); }
+};
+
+using ByteStreamPointer = std::unique_ptr<AP4_ByteStream, ByteStreamReleaser>;
+using FilePointer = std::unique_ptr<std::FILE, FileCloser>;
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_RESOURCE_DELETERS_H_
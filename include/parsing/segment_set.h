@@ -0,0 +1,94 @@
+#ifndef MP4_MANIPULATOR_SEGMENT_SET_H_
+#define MP4_MANIPULATOR_SEGMENT_SET_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "parsing/atom_holder.h"
+#include "result.h"
+
+namespace mp4_manipulator::utility {
+// What's known about a media segment. The size and layout come from a scan
+// of its box headers when the set is opened, the rest once it's parsed.
+struct SegmentSummary {
+  uint64_t size{0};
+  // The types of the segment's top level boxes in the order they first
+  // appear, with counts for repeated types, e.g. "styp sidx moof x4 mdat x4".
+  std::string layout;
+  bool is_parsed{false};
+  // Set if the segment couldn't be scanned or parsed.
+  std::string error;
+  // Begin parsed members.
+  uint64_t sample_count{0};
+  // From the first moof's mfhd.
+  std::optional<uint32_t> sequence_number;
+  // From the first traf's tfdt, in the timescale of its track.
+  std::optional<uint64_t> base_decode_time;
+  // End parsed members.
+};
+
+// An initialization segment and the media segments that follow it, e.g. the
+// output of a DASH or HLS packager, viewed as one document. The init segment
+// is parsed once, up front. Media segments are only scanned for their box
+// headers (in parallel) when the set is opened, and are parsed on demand, in
+// parallel batches, so opening a set of 10k+ segments costs little more than
+// listing them and memory grows only with the segments looked at. Parsed
+// segments hold their media data as SkippedAtoms, so they don't keep their
+// files open.
+class SegmentSet {
+ public:
+  // Opens the set, parsing `init_file_name` and scanning
+  // `segment_file_names`, in order, on up to `thread_count` threads (0 uses
+  // one per hardware thread). A segment that can't be scanned gets an error
+  // in its summary rather than failing the set. Returns an error if the init
+  // segment can't be read.
+  static Result<std::unique_ptr<SegmentSet>, std::string> Open(
+      std::string init_file_name, std::vector<std::string> segment_file_names,
+      size_t thread_count = 0);
+
+  SegmentSet(SegmentSet const&) = delete;
+  SegmentSet& operator=(SegmentSet const&) = delete;
+
+  [[nodiscard]] std::string const& GetInitFileName() const;
+  [[nodiscard]] uint64_t GetInitSize() const;
+  [[nodiscard]] AtomHolder& GetInitAtoms() const;
+
+  [[nodiscard]] size_t GetSegmentCount() const;
+  [[nodiscard]] std::string const& GetSegmentFileName(size_t index) const;
+  [[nodiscard]] SegmentSummary const& GetSegmentSummary(size_t index) const;
+  // Returns the atoms of segment `index`, or nullptr if it hasn't been
+  // parsed or failed to parse.
+  [[nodiscard]] AtomHolder* GetSegmentAtoms(size_t index) const;
+
+  // Parses the segments in `indices` that haven't been parsed yet, in
+  // parallel, filling in their summaries.
+  void ParseSegments(std::vector<size_t> const& indices);
+
+  // Returns an estimate of the heap memory used by the parsed atoms, in
+  // bytes.
+  [[nodiscard]] size_t EstimateMemoryUsage() const;
+
+ private:
+  struct Segment {
+    std::string file_name;
+    SegmentSummary summary;
+    std::unique_ptr<AtomHolder> atoms;
+  };
+
+  SegmentSet(std::string init_file_name, uint64_t init_size,
+             std::unique_ptr<AtomHolder> init_atoms,
+             std::vector<Segment> segments, size_t thread_count);
+
+  std::string init_file_name_;
+  uint64_t init_size_;
+  std::unique_ptr<AtomHolder> init_atoms_;
+  std::vector<Segment> segments_;
+  size_t thread_count_;
+};
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_SEGMENT_SET_H_
@@ -0,0 +1,38 @@
+#ifndef MP4_MANIPULATOR_SKIPPED_ATOM_H_
+#define MP4_MANIPULATOR_SKIPPED_ATOM_H_
+
+#include <cstdint>
+#include <string>
+
+#include "Ap4.h"
+
+namespace mp4_manipulator {
+// An atom whose payload was skipped rather than read, e.g. the media data of
+// a file streamed through a pipe, which can't be seeked back to. The atom
+// keeps its type and size, so it's shown in the tree, but it has no payload
+// and so can't be written.
+class SkippedAtom : public AP4_Atom {
+ public:
+  AP4_IMPLEMENT_DYNAMIC_CAST_D(SkippedAtom, AP4_Atom)
+
+  // `size` is the size of the whole atom, including the header. If
+  // `has_large_size` is true, the header used a 64 bit size. `note` explains
+  // why the payload was skipped, and is shown in the UI.
+  SkippedAtom(AP4_Atom::Type type, uint64_t size, bool has_large_size,
+              std::string note);
+
+  // AP4_Atom overrides.
+  // Fails, as there's no payload to write.
+  AP4_Result WriteFields(AP4_ByteStream& stream) override;
+  AP4_Result InspectFields(AP4_AtomInspector& inspector) override;
+  AP4_Atom* Clone() override;
+  // End AP4_Atom overrides.
+
+ private:
+  bool has_large_size_;
+  std::string note_;
+};
+
+}  // namespace mp4_manipulator
+
+#endif  // MP4_MANIPULATOR_SKIPPED_ATOM_H_
@@ -0,0 +1,53 @@
+#ifndef MP4_MANIPULATOR_UNPARSED_ATOM_H_
+#define MP4_MANIPULATOR_UNPARSED_ATOM_H_
+
+#include <cstdint>
+#include <string>
+
+#include "Ap4.h"
+#include "parsing/atom.h"
+
+namespace mp4_manipulator {
+// Stands in for a range of a stream that couldn't be parsed, e.g. the damaged
+// part of a file from a crashed recorder. Unparsed atoms are inspected as
+// atoms named "unparsed", so the range shows up in the tree, and are written
+// back byte for byte, so saving doesn't lose the damaged data.
+//
+// Like AP4_UnknownAtom, the bytes aren't loaded, the atom keeps a reference
+// to the stream it was read from instead.
+class UnparsedAtom : public AP4_Atom {
+ public:
+  // Not a real four cc, this is never written to files. It's used to tell
+  // unparsed atoms apart from parsed ones.
+  static constexpr AP4_Atom::Type kType = AP4_ATOM_TYPE('~', 'u', 'n', 'p');
+
+  // Represents `size` bytes of `source` starting at `offset`. `reason`
+  // explains why the range wasn't parsed, and is shown in the UI.
+  UnparsedAtom(AP4_ByteStream& source, uint64_t offset, uint64_t size,
+               std::string reason);
+  ~UnparsedAtom() override;
+  UnparsedAtom(UnparsedAtom const&) = delete;
+  UnparsedAtom& operator=(UnparsedAtom const&) = delete;
+
+  // AP4_Atom overrides.
+  // The unparsed bytes are written as they are, without adding a header.
+  AP4_Result WriteHeader(AP4_ByteStream& stream) override;
+  AP4_Result WriteFields(AP4_ByteStream& stream) override;
+  AP4_Result Inspect(AP4_AtomInspector& inspector) override;
+  AP4_Atom* Clone() override;
+  // End AP4_Atom overrides.
+
+  [[nodiscard]] uint64_t GetSourceOffset() const;
+
+ private:
+  AP4_ByteStream* source_;
+  uint64_t source_offset_;
+  std::string reason_;
+};
+
+// Returns true if `atom` is the inspected version of an UnparsedAtom.
+[[nodiscard]] bool IsUnparsedAtom(AtomOrDescriptorBase const& atom);
+
+}  // namespace mp4_manipulator
+
+#endif  // MP4_MANIPULATOR_UNPARSED_ATOM_H_
@@ -0,0 +1,93 @@
+#ifndef MP4_MANIPULATOR_ALLOCATION_PROFILER_H_
+#define MP4_MANIPULATOR_ALLOCATION_PROFILER_H_
+
+#include <cstddef>
+#include <ostream>
+
+// Opt-in allocation profiling. When the build is configured with
+// `-D MP4_MANIPULATOR_ALLOCATION_PROFILING=ON` the global allocation functions
+// are replaced with counting versions, and every allocation is attributed to
+// the phase and site tags active on the allocating thread. Without that
+// option the tag macros below compile to nothing and the report is empty.
+//
+// Phases are coarse pipeline stages (parse, inspect, ...), sites are finer
+// grained names (usually the function doing the work). Tags nest, and the
+// innermost phase and site win. E.g. the reparse done during an edit is
+// counted as parsing, while the surrounding command handling is counted as
+// editing.
+
+namespace mp4_manipulator::profiling {
+
+enum class AllocationPhase {
+  kUntagged = 0,
+  kParse = 1,
+  kInspect = 2,
+  kMatch = 3,
+  kModelBuild = 4,
+  kEdit = 5,
+  kSave = 6,
+  // Number of phases, not a phase itself.
+  kCount = 7,
+};
+
+[[nodiscard]] char const* GetAllocationPhaseName(AllocationPhase phase);
+
+// Returns true if this is an allocation profiling build.
+[[nodiscard]] bool IsAllocationProfilingEnabled();
+
+// Sets the phase, and the site, for allocations made on this thread while the
+// tag is alive. `site` must be a string with static storage duration (e.g. a
+// literal) as it's used as a key.
+class ScopedAllocationPhase {
+ public:
+  ScopedAllocationPhase(AllocationPhase phase, char const* site);
+  ~ScopedAllocationPhase();
+  ScopedAllocationPhase(ScopedAllocationPhase const&) = delete;
+  ScopedAllocationPhase& operator=(ScopedAllocationPhase const&) = delete;
+
+ private:
+  AllocationPhase previous_phase_;
+  char const* previous_site_;
+};
+
+// Sets the site for allocations made on this thread while the tag is alive,
+// leaving the phase untouched. `site` must have static storage duration.
+class ScopedAllocationSite {
+ public:
+  explicit ScopedAllocationSite(char const* site);
+  ~ScopedAllocationSite();
+  ScopedAllocationSite(ScopedAllocationSite const&) = delete;
+  ScopedAllocationSite& operator=(ScopedAllocationSite const&) = delete;
+
+ private:
+  char const* previous_site_;
+};
+
+// Writes per phase totals followed by the `max_sites` (phase, site) pairs that
+// allocated the most bytes.
+void WriteAllocationReport(std::ostream& stream, size_t max_sites = 20);
+
+}  // namespace mp4_manipulator::profiling
+
+#define MP4_MANIPULATOR_ALLOCATION_CONCAT_INNER(a, b) a##b
+#define MP4_MANIPULATOR_ALLOCATION_CONCAT(a, b) \
+  MP4_MANIPULATOR_ALLOCATION_CONCAT_INNER(a, b)
+
+#if defined(MP4_MANIPULATOR_ALLOCATION_PROFILING)
+// Tags allocations until the end of the enclosing scope with `phase` (an
+// AllocationPhase enumerator name, e.g. kParse) and `site`.
+#define MP4_MANIPULATOR_ALLOCATION_PHASE(phase, site)                 \
+  ::mp4_manipulator::profiling::ScopedAllocationPhase                 \
+  MP4_MANIPULATOR_ALLOCATION_CONCAT(allocation_phase_tag_, __LINE__) { \
+    ::mp4_manipulator::profiling::AllocationPhase::phase, site        \
+  }
+// Tags allocations until the end of the enclosing scope with `site`.
+#define MP4_MANIPULATOR_ALLOCATION_SITE(site) \
+  ::mp4_manipulator::profiling::ScopedAllocationSite \
+  MP4_MANIPULATOR_ALLOCATION_CONCAT(allocation_site_tag_, __LINE__) { site }
+#else
+#define MP4_MANIPULATOR_ALLOCATION_PHASE(phase, site)
+#define MP4_MANIPULATOR_ALLOCATION_SITE(site)
+#endif
+
+#endif  // MP4_MANIPULATOR_ALLOCATION_PROFILER_H_
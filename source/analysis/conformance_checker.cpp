@@ -0,0 +1,644 @@
+#include "analysis/conformance_checker.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+#include "analysis/atom_lookup.h"
+#include "parallel/work_stealing_pool.h"
+#include "parsing/box_header_scanner.h"
+
+namespace mp4_manipulator::analysis {
+namespace {
+// The most issues of each rule that are listed, see ConformanceReport.
+constexpr uint64_t kMaxListedIssuesPerRule = 100;
+
+AP4_UI32 const kBrandCmfc = AP4_ATOM_TYPE('c', 'm', 'f', 'c');
+AP4_UI32 const kBrandCmf2 = AP4_ATOM_TYPE('c', 'm', 'f', '2');
+AP4_UI32 const kBrandDash = AP4_ATOM_TYPE('d', 'a', 's', 'h');
+
+// What the rules know about the file as a whole, gathered before any atom is
+// checked so the checks can run in parallel without sharing state.
+struct FileContext {
+  // The major and compatible brands of the ftyp.
+  std::vector<AP4_UI32> brands;
+  bool is_cmaf{false};
+  std::vector<AtomOrDescriptorBase const*> top_level_atoms;
+  std::unordered_map<AtomOrDescriptorBase const*, size_t> top_level_indices;
+  std::optional<size_t> moov_index;
+  // False if the position of any top level atom isn't known.
+  bool positions_known{true};
+};
+
+// Collects the issues a rule finds, labelled with the rule's name.
+class IssueSink {
+ public:
+  IssueSink(char const* rule, std::vector<ConformanceIssue>& issues)
+      : rule_{rule}, issues_{issues} {}
+
+  void Error(AtomOrDescriptorBase const& atom, std::string description) {
+    issues_.push_back(ConformanceIssue{ConformanceSeverity::kError, rule_,
+                                       &atom, std::move(description)});
+  }
+
+  void Warning(AtomOrDescriptorBase const& atom, std::string description) {
+    issues_.push_back(ConformanceIssue{ConformanceSeverity::kWarning, rule_,
+                                       &atom, std::move(description)});
+  }
+
+ private:
+  char const* rule_;
+  std::vector<ConformanceIssue>& issues_;
+};
+
+using Check = void (*)(AtomOrDescriptorBase const& atom,
+                       FileContext const& file, IssueSink& sink);
+
+struct Rule {
+  // The four cc of the atoms the rule checks.
+  AP4_Atom::Type type;
+  char const* name;
+  Check check;
+};
+
+using RulesByType = std::unordered_map<AP4_Atom::Type, std::vector<Rule>>;
+
+// Boxes every file with an ftyp needs, and those that some brands add.
+struct BrandRequirement {
+  // 0 for every file.
+  AP4_UI32 brand;
+  // The path of the required box from the top level, ending at the first 0.
+  std::array<AP4_Atom::Type, 2> path;
+};
+
+BrandRequirement const kBrandRequirements[] = {
+    {0, {AP4_ATOM_TYPE_MOOV, 0}},
+    {kBrandCmfc, {AP4_ATOM_TYPE_MOOV, AP4_ATOM_TYPE_MVEX}},
+    {kBrandCmf2, {AP4_ATOM_TYPE_MOOV, AP4_ATOM_TYPE_MVEX}},
+    {kBrandDash, {AP4_ATOM_TYPE_MOOV, AP4_ATOM_TYPE_MVEX}},
+};
+
+// Boxes that a container needs. If `alternative` is set either box will do.
+// Boxes that are `first` should be the first child of their container, as
+// ISO 14496-12 recommends, and as some streaming parsers assume.
+struct RequiredChild {
+  AP4_Atom::Type container;
+  AP4_Atom::Type child;
+  AP4_Atom::Type alternative;
+  bool first;
+};
+
+RequiredChild const kRequiredChildren[] = {
+    {AP4_ATOM_TYPE_MOOV, AP4_ATOM_TYPE_MVHD, 0, true},
+    {AP4_ATOM_TYPE_TRAK, AP4_ATOM_TYPE_TKHD, 0, true},
+    {AP4_ATOM_TYPE_TRAK, AP4_ATOM_TYPE_MDIA, 0, false},
+    {AP4_ATOM_TYPE_MDIA, AP4_ATOM_TYPE_MDHD, 0, true},
+    {AP4_ATOM_TYPE_MDIA, AP4_ATOM_TYPE_HDLR, 0, false},
+    {AP4_ATOM_TYPE_MDIA, AP4_ATOM_TYPE_MINF, 0, false},
+    {AP4_ATOM_TYPE_MINF, AP4_ATOM_TYPE_DINF, 0, false},
+    {AP4_ATOM_TYPE_MINF, AP4_ATOM_TYPE_STBL, 0, false},
+    {AP4_ATOM_TYPE_STBL, AP4_ATOM_TYPE_STSD, 0, true},
+    {AP4_ATOM_TYPE_STBL, AP4_ATOM_TYPE_STTS, 0, false},
+    {AP4_ATOM_TYPE_STBL, AP4_ATOM_TYPE_STSC, 0, false},
+    {AP4_ATOM_TYPE_STBL, AP4_ATOM_TYPE_STSZ, AP4_ATOM_TYPE_STZ2, false},
+    {AP4_ATOM_TYPE_STBL, AP4_ATOM_TYPE_STCO, AP4_ATOM_TYPE_CO64, false},
+    {AP4_ATOM_TYPE_MVEX, AP4_ATOM_TYPE_TREX, 0, false},
+    {AP4_ATOM_TYPE_MOOF, AP4_ATOM_TYPE_MFHD, 0, true},
+    {AP4_ATOM_TYPE_TRAF, AP4_ATOM_TYPE_TFHD, 0, true},
+};
+
+// The versions and flags that full boxes define.
+struct FullBoxSpec {
+  AP4_Atom::Type type;
+  uint8_t max_version;
+  uint32_t defined_flags;
+};
+
+FullBoxSpec const kFullBoxSpecs[] = {
+    {AP4_ATOM_TYPE_MVHD, 1, 0},
+    // Enabled, in movie, in preview and size is aspect ratio.
+    {AP4_ATOM_TYPE_TKHD, 1, 0x00000f},
+    {AP4_ATOM_TYPE_MDHD, 1, 0},
+    {AP4_ATOM_TYPE_HDLR, 0, 0},
+    {AP4_ATOM_TYPE_ELST, 1, 0},
+    {AP4_ATOM_TYPE_STSD, 1, 0},
+    {AP4_ATOM_TYPE_STTS, 0, 0},
+    {AP4_ATOM_TYPE_CTTS, 1, 0},
+    {AP4_ATOM_TYPE_STSS, 0, 0},
+    {AP4_ATOM_TYPE_STSC, 0, 0},
+    {AP4_ATOM_TYPE_STSZ, 0, 0},
+    {AP4_ATOM_TYPE_STZ2, 0, 0},
+    {AP4_ATOM_TYPE_STCO, 0, 0},
+    {AP4_ATOM_TYPE_CO64, 0, 0},
+    {AP4_ATOM_TYPE_MEHD, 1, 0},
+    {AP4_ATOM_TYPE_TREX, 0, 0},
+    {AP4_ATOM_TYPE_MFHD, 0, 0},
+    // Base data offset, sample description index, default sample duration,
+    // size and flags, duration is empty and default base is moof.
+    {AP4_ATOM_TYPE_TFHD, 0, 0x03003b},
+    {AP4_ATOM_TYPE_TFDT, 1, 0},
+    // Data offset, first sample flags, and per sample duration, size, flags
+    // and composition time offset.
+    {AP4_ATOM_TYPE_TRUN, 1, 0x000f05},
+    {AP4_ATOM_TYPE_SIDX, 1, 0},
+};
+
+std::string TypeName(AP4_Atom::Type type) {
+  return utility::FourCcToString(type);
+}
+
+std::string FormatFlags(uint32_t flags) {
+  char buffer[16];
+  std::snprintf(buffer, sizeof(buffer), "0x%06x", flags);
+  return buffer;
+}
+
+// Returns e.g. "12.345s" for a duration of 12345 at a timescale of 1000.
+std::string FormatSeconds(uint64_t duration, uint32_t timescale) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.3fs",
+                static_cast<double>(duration) / timescale);
+  return buffer;
+}
+
+// Durations of all ones mean the duration isn't known.
+bool IsUnknownDuration(uint64_t duration) {
+  return duration == std::numeric_limits<uint32_t>::max() ||
+         duration == std::numeric_limits<uint64_t>::max();
+}
+
+bool HasBrand(FileContext const& file, AP4_UI32 brand) {
+  return std::find(file.brands.begin(), file.brands.end(), brand) !=
+         file.brands.end();
+}
+
+// Returns the first child atom of `atom` of `type`, or nullptr.
+AtomOrDescriptorBase const* FindChild(AtomOrDescriptorBase const& atom,
+                                      AP4_Atom::Type type) {
+  for (auto const& child : atom.GetChildAtoms()) {
+    if (HasType(*child, type)) {
+      return child.get();
+    }
+  }
+  return nullptr;
+}
+
+uint64_t GetPosition(AtomOrDescriptorBase const& atom) {
+  // Only called once FileContext::positions_known has been checked.
+  return atom.GetPositionInStream().value();
+}
+
+// Begin checks.
+void CheckVersionAndFlags(AtomOrDescriptorBase const& atom,
+                          FileContext const& /* file */, IssueSink& sink) {
+  AP4_Atom const* const ap4_atom = atom.GetAp4Atom();
+  auto const spec = std::find_if(
+      std::begin(kFullBoxSpecs), std::end(kFullBoxSpecs),
+      [ap4_atom](FullBoxSpec const& candidate) {
+        return candidate.type == ap4_atom->GetType();
+      });
+  assert(spec != std::end(kFullBoxSpecs));
+  std::string const name = TypeName(spec->type);
+  if (ap4_atom->GetVersion() > spec->max_version) {
+    sink.Error(atom, name + " has version " +
+                         std::to_string(ap4_atom->GetVersion()) +
+                         ", but only versions up to " +
+                         std::to_string(spec->max_version) +
+                         " are defined.");
+  }
+  uint32_t const undefined_flags = ap4_atom->GetFlags() & ~spec->defined_flags;
+  if (undefined_flags != 0) {
+    sink.Warning(atom, name + " sets flags " + FormatFlags(undefined_flags) +
+                           ", which aren't defined for it.");
+  }
+}
+
+void CheckTrackFragmentFlags(AtomOrDescriptorBase const& atom,
+                             FileContext const& file, IssueSink& sink) {
+  uint32_t const flags = atom.GetAp4Atom()->GetFlags();
+  bool const has_base_data_offset =
+      (flags & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) != 0;
+  bool const is_default_base_moof =
+      (flags & AP4_TFHD_FLAG_DEFAULT_BASE_IS_MOOF) != 0;
+  if (file.is_cmaf && (has_base_data_offset || !is_default_base_moof)) {
+    sink.Error(atom,
+               "CMAF track fragments must be addressed from their moof, so "
+               "tfhd must set default-base-is-moof and not "
+               "base-data-offset-present.");
+  } else if (has_base_data_offset && is_default_base_moof) {
+    sink.Warning(atom,
+                 "tfhd sets both base-data-offset-present and "
+                 "default-base-is-moof, so the latter is ignored.");
+  }
+}
+
+void CheckRequiredChildren(AtomOrDescriptorBase const& atom,
+                           FileContext const& /* file */, IssueSink& sink) {
+  AP4_Atom::Type const type = atom.GetAp4Atom()->GetType();
+  for (RequiredChild const& required : kRequiredChildren) {
+    if (required.container != type ||
+        FindChild(atom, required.child) != nullptr ||
+        (required.alternative != 0 &&
+         FindChild(atom, required.alternative) != nullptr)) {
+      continue;
+    }
+    std::string description =
+        TypeName(type) + " must contain " + TypeName(required.child);
+    if (required.alternative != 0) {
+      description += " or " + TypeName(required.alternative);
+    }
+    sink.Error(atom, description + ".");
+  }
+}
+
+void CheckChildOrder(AtomOrDescriptorBase const& atom,
+                     FileContext const& /* file */, IssueSink& sink) {
+  AP4_Atom::Type const type = atom.GetAp4Atom()->GetType();
+  for (RequiredChild const& required : kRequiredChildren) {
+    if (required.container != type || !required.first) {
+      continue;
+    }
+    AtomOrDescriptorBase const* const child = FindChild(atom, required.child);
+    if (child != nullptr && child != atom.GetChildAtoms().front().get()) {
+      sink.Warning(*child, TypeName(required.child) +
+                               " should be the first box in " +
+                               TypeName(type) + ".");
+    }
+  }
+}
+
+void CheckFtypPosition(AtomOrDescriptorBase const& atom,
+                       FileContext const& file, IssueSink& sink) {
+  auto const it = file.top_level_indices.find(&atom);
+  if (it == file.top_level_indices.end()) {
+    sink.Error(atom, "ftyp must be a top level box.");
+  } else if (it->second != 0) {
+    sink.Error(atom, "ftyp must be the first box of the file.");
+  }
+}
+
+void CheckBrandRequirements(AtomOrDescriptorBase const& atom,
+                            FileContext const& file, IssueSink& sink) {
+  for (BrandRequirement const& requirement : kBrandRequirements) {
+    if (requirement.brand != 0 && !HasBrand(file, requirement.brand)) {
+      continue;
+    }
+    auto const top_level = std::find_if(
+        file.top_level_atoms.begin(), file.top_level_atoms.end(),
+        [&requirement](AtomOrDescriptorBase const* candidate) {
+          return HasType(*candidate, requirement.path.at(0));
+        });
+    AtomOrDescriptorBase const* found =
+        top_level != file.top_level_atoms.end() ? *top_level : nullptr;
+    std::string path = TypeName(requirement.path.at(0));
+    if (found != nullptr && requirement.path.at(1) != 0) {
+      found = FindChild(*found, requirement.path.at(1));
+      path += "/" + TypeName(requirement.path.at(1));
+    }
+    if (found == nullptr) {
+      sink.Error(atom, (requirement.brand == 0
+                            ? std::string{"Files"}
+                            : "Files with the " +
+                                  TypeName(requirement.brand) + " brand") +
+                           " must have a " + path + ".");
+    }
+  }
+}
+
+void CheckFragmentPosition(AtomOrDescriptorBase const& atom,
+                           FileContext const& file, IssueSink& sink) {
+  auto const it = file.top_level_indices.find(&atom);
+  if (it == file.top_level_indices.end()) {
+    sink.Error(atom, "moof must be a top level box.");
+    return;
+  }
+  size_t const index = it->second;
+  if (file.moov_index.has_value() && index < file.moov_index.value()) {
+    sink.Error(atom, "moof comes before the moov.");
+  }
+  bool const is_followed_by_mdat =
+      index + 1 < file.top_level_atoms.size() &&
+      HasType(*file.top_level_atoms.at(index + 1), AP4_ATOM_TYPE_MDAT);
+  if (is_followed_by_mdat) {
+    return;
+  }
+  if (file.is_cmaf) {
+    sink.Error(atom, "In CMAF each moof must be followed by an mdat.");
+  } else {
+    sink.Warning(atom, "moof isn't followed by an mdat.");
+  }
+}
+
+void CheckMovieDuration(AtomOrDescriptorBase const& atom,
+                        FileContext const& /* file */, IssueSink& sink) {
+  AtomOrDescriptorBase const* const mvhd = FindChild(atom, AP4_ATOM_TYPE_MVHD);
+  AP4_MvhdAtom* const mvhd_atom =
+      mvhd != nullptr ? GetAp4AtomAs<AP4_MvhdAtom>(*mvhd) : nullptr;
+  if (mvhd_atom == nullptr) {
+    // Reported by required-boxes.
+    return;
+  }
+  uint32_t const timescale = mvhd_atom->GetTimeScale();
+  if (timescale == 0) {
+    sink.Error(*mvhd, "mvhd's timescale is 0.");
+    return;
+  }
+  uint64_t const movie_duration = mvhd_atom->GetDuration();
+  bool const is_fragmented = FindChild(atom, AP4_ATOM_TYPE_MVEX) != nullptr;
+  if (IsUnknownDuration(movie_duration) ||
+      (is_fragmented && movie_duration == 0)) {
+    return;
+  }
+  std::optional<uint64_t> longest_track_duration;
+  for (auto const& trak : atom.GetChildAtoms()) {
+    if (!HasType(*trak, AP4_ATOM_TYPE_TRAK)) {
+      continue;
+    }
+    AtomOrDescriptorBase const* const tkhd =
+        FindChild(*trak, AP4_ATOM_TYPE_TKHD);
+    AP4_TkhdAtom* const tkhd_atom =
+        tkhd != nullptr ? GetAp4AtomAs<AP4_TkhdAtom>(*tkhd) : nullptr;
+    if (tkhd_atom != nullptr && !IsUnknownDuration(tkhd_atom->GetDuration())) {
+      longest_track_duration = std::max(longest_track_duration.value_or(0),
+                                        tkhd_atom->GetDuration());
+    }
+  }
+  if (!longest_track_duration.has_value()) {
+    return;
+  }
+  std::string const durations =
+      "mvhd's duration is " + std::to_string(movie_duration) + " (" +
+      FormatSeconds(movie_duration, timescale) + "), the longest track's is " +
+      std::to_string(longest_track_duration.value()) + " (" +
+      FormatSeconds(longest_track_duration.value(), timescale) + ")";
+  if (movie_duration < longest_track_duration.value()) {
+    sink.Error(*mvhd, durations + ".");
+  } else if (!is_fragmented &&
+             movie_duration > longest_track_duration.value() + 1) {
+    // Fragments may extend the tracks past their tkhd durations.
+    sink.Warning(*mvhd, durations + ".");
+  }
+}
+
+void CheckTrackDuration(AtomOrDescriptorBase const& atom,
+                        FileContext const& /* file */, IssueSink& sink) {
+  AtomOrDescriptorBase const* const moov = atom.GetParent();
+  if (moov == nullptr || FindChild(atom, AP4_ATOM_TYPE_EDTS) != nullptr) {
+    // An edit list sets the track's duration, which needn't match its
+    // media's.
+    return;
+  }
+  AtomOrDescriptorBase const* const tkhd = FindChild(atom, AP4_ATOM_TYPE_TKHD);
+  AtomOrDescriptorBase const* const mdia = FindChild(atom, AP4_ATOM_TYPE_MDIA);
+  AtomOrDescriptorBase const* const mdhd =
+      mdia != nullptr ? FindChild(*mdia, AP4_ATOM_TYPE_MDHD) : nullptr;
+  AtomOrDescriptorBase const* const mvhd = FindChild(*moov, AP4_ATOM_TYPE_MVHD);
+  if (tkhd == nullptr || mdhd == nullptr || mvhd == nullptr) {
+    // Reported by required-boxes.
+    return;
+  }
+  AP4_TkhdAtom* const tkhd_atom = GetAp4AtomAs<AP4_TkhdAtom>(*tkhd);
+  AP4_MdhdAtom* const mdhd_atom = GetAp4AtomAs<AP4_MdhdAtom>(*mdhd);
+  AP4_MvhdAtom* const mvhd_atom = GetAp4AtomAs<AP4_MvhdAtom>(*mvhd);
+  if (tkhd_atom == nullptr || mdhd_atom == nullptr || mvhd_atom == nullptr) {
+    return;
+  }
+  uint32_t const media_timescale = mdhd_atom->GetTimeScale();
+  uint32_t const movie_timescale = mvhd_atom->GetTimeScale();
+  if (media_timescale == 0) {
+    sink.Error(*mdhd, "mdhd's timescale is 0.");
+    return;
+  }
+  uint64_t const track_duration = tkhd_atom->GetDuration();
+  uint64_t const media_duration = mdhd_atom->GetDuration();
+  if (movie_timescale == 0 || IsUnknownDuration(track_duration) ||
+      IsUnknownDuration(media_duration) ||
+      (track_duration == 0 && media_duration == 0)) {
+    // A zero movie timescale is reported for the moov, and fragmented files
+    // often leave both durations empty.
+    return;
+  }
+  // Allow for the rounding of the conversion between timescales.
+  double const expected_track_duration =
+      std::round(static_cast<double>(media_duration) * movie_timescale /
+                 media_timescale);
+  if (std::abs(static_cast<double>(track_duration) -
+               expected_track_duration) > 1) {
+    sink.Error(*tkhd, "tkhd's duration is " + std::to_string(track_duration) +
+                          " (" +
+                          FormatSeconds(track_duration, movie_timescale) +
+                          "), but mdhd's is " +
+                          std::to_string(media_duration) + " (" +
+                          FormatSeconds(media_duration, media_timescale) +
+                          ") and there's no edit list.");
+  }
+}
+
+void CheckSegmentIndex(AtomOrDescriptorBase const& atom,
+                       FileContext const& file, IssueSink& sink) {
+  auto const it = file.top_level_indices.find(&atom);
+  AP4_SidxAtom* const sidx = GetAp4AtomAs<AP4_SidxAtom>(atom);
+  if (!file.positions_known || it == file.top_level_indices.end() ||
+      sidx == nullptr) {
+    // The references are relative to the end of the sidx, so can only be
+    // followed if it's known where that is.
+    return;
+  }
+  std::vector<AtomOrDescriptorBase const*> const& boxes =
+      file.top_level_atoms;
+  uint64_t offset = GetPosition(atom) + atom.GetSize() + sidx->GetFirstOffset();
+  // Referenced boxes follow the sidx, in order, so one pass over the top
+  // level boxes finds them all.
+  size_t box_index = it->second + 1;
+  AP4_Array<AP4_SidxAtom::Reference> const& references =
+      sidx->GetReferences();
+  for (AP4_Cardinal i = 0; i < references.ItemCount(); ++i) {
+    AP4_SidxAtom::Reference const& reference = references[i];
+    std::string const label = "Reference " + std::to_string(i);
+    while (box_index < boxes.size() &&
+           GetPosition(*boxes.at(box_index)) < offset) {
+      ++box_index;
+    }
+    if (box_index == boxes.size() ||
+        GetPosition(*boxes.at(box_index)) != offset) {
+      sink.Error(atom, label + " starts at byte " + std::to_string(offset) +
+                           ", which isn't the start of a top level box.");
+      // The following references are relative to this one, so would only
+      // repeat the error.
+      return;
+    }
+    AtomOrDescriptorBase const& first_box = *boxes.at(box_index);
+    uint64_t const end = offset + reference.m_ReferencedSize;
+    bool has_moof = false;
+    uint64_t boxes_end = offset;
+    while (box_index < boxes.size() &&
+           GetPosition(*boxes.at(box_index)) < end) {
+      AtomOrDescriptorBase const& box = *boxes.at(box_index);
+      has_moof = has_moof || HasType(box, AP4_ATOM_TYPE_MOOF);
+      boxes_end = GetPosition(box) + box.GetSize();
+      ++box_index;
+    }
+    if (boxes_end != end) {
+      sink.Error(atom, label + " spans " +
+                           std::to_string(reference.m_ReferencedSize) +
+                           " bytes from byte " + std::to_string(offset) +
+                           ", but the boxes there end at byte " +
+                           std::to_string(boxes_end) + ".");
+      return;
+    }
+    if (reference.m_ReferenceType == 1) {
+      if (!HasType(first_box, AP4_ATOM_TYPE_SIDX)) {
+        sink.Error(atom, label + " references a sidx, but starts at " +
+                             first_box.GetName().toStdString() + ".");
+      }
+    } else if (!has_moof) {
+      sink.Error(atom, label + " references media, but the boxes it spans " +
+                           "have no moof.");
+    }
+    offset = end;
+  }
+}
+// End checks.
+
+// Rules that apply to a single type. The rules driven by the tables above
+// are added for each of their types by GetRulesByType.
+Rule const kRules[] = {
+    {AP4_ATOM_TYPE_FTYP, "box-order", CheckFtypPosition},
+    {AP4_ATOM_TYPE_FTYP, "required-boxes", CheckBrandRequirements},
+    {AP4_ATOM_TYPE_MOOF, "box-order", CheckFragmentPosition},
+    {AP4_ATOM_TYPE_MOOV, "duration-agreement", CheckMovieDuration},
+    {AP4_ATOM_TYPE_TRAK, "duration-agreement", CheckTrackDuration},
+    {AP4_ATOM_TYPE_TFHD, "version-flags", CheckTrackFragmentFlags},
+    {AP4_ATOM_TYPE_SIDX, "sidx-references", CheckSegmentIndex},
+};
+
+RulesByType const& GetRulesByType() {
+  static RulesByType const rules_by_type = [] {
+    RulesByType rules;
+    for (Rule const& rule : kRules) {
+      rules[rule.type].push_back(rule);
+    }
+    for (FullBoxSpec const& spec : kFullBoxSpecs) {
+      rules[spec.type].push_back(
+          Rule{spec.type, "version-flags", CheckVersionAndFlags});
+    }
+    // Each container gets one rule that checks all its required children,
+    // and one that checks their order.
+    for (RequiredChild const& required : kRequiredChildren) {
+      std::vector<Rule>& container_rules = rules[required.container];
+      auto const add_once = [&](char const* name, Check check) {
+        if (std::none_of(container_rules.begin(), container_rules.end(),
+                         [check](Rule const& rule) {
+                           return rule.check == check;
+                         })) {
+          container_rules.push_back(Rule{required.container, name, check});
+        }
+      };
+      add_once("required-boxes", CheckRequiredChildren);
+      if (required.first) {
+        add_once("box-order", CheckChildOrder);
+      }
+    }
+    return rules;
+  }();
+  return rules_by_type;
+}
+
+FileContext GatherFileContext(AtomHolder& atoms) {
+  FileContext file;
+  std::vector<std::unique_ptr<AtomOrDescriptorBase>> const& top_level_atoms =
+      atoms.GetTopLevelAtoms();
+  file.top_level_atoms.reserve(top_level_atoms.size());
+  for (size_t i = 0; i < top_level_atoms.size(); ++i) {
+    AtomOrDescriptorBase const* const atom = top_level_atoms.at(i).get();
+    file.top_level_atoms.push_back(atom);
+    file.top_level_indices.emplace(atom, i);
+    if (!atom->GetPositionInStream().has_value()) {
+      file.positions_known = false;
+    }
+    if (HasType(*atom, AP4_ATOM_TYPE_MOOV) && !file.moov_index.has_value()) {
+      file.moov_index = i;
+    }
+    AP4_FtypAtom* const ftyp = GetAp4AtomAs<AP4_FtypAtom>(*atom);
+    if (ftyp != nullptr && file.brands.empty()) {
+      file.brands.push_back(ftyp->GetMajorBrand());
+      AP4_Array<AP4_UI32>& compatible_brands = ftyp->GetCompatibleBrands();
+      for (AP4_Cardinal j = 0; j < compatible_brands.ItemCount(); ++j) {
+        file.brands.push_back(compatible_brands[j]);
+      }
+    }
+  }
+  file.is_cmaf = HasBrand(file, kBrandCmfc) || HasBrand(file, kBrandCmf2);
+  return file;
+}
+
+// Runs the rules for each atom of the subtree at `atom`, in pre-order,
+// adding their issues to `issues`. Returns the number of atoms checked.
+uint64_t CheckSubtree(AtomOrDescriptorBase const& atom,
+                      FileContext const& file, RulesByType const& rules,
+                      std::vector<ConformanceIssue>& issues) {
+  uint64_t checked_atom_count = 0;
+  if (atom.GetAp4Atom() != nullptr) {
+    auto const it = rules.find(atom.GetAp4Atom()->GetType());
+    if (it != rules.end()) {
+      ++checked_atom_count;
+      for (Rule const& rule : it->second) {
+        IssueSink sink{rule.name, issues};
+        rule.check(atom, file, sink);
+      }
+    }
+  }
+  for (auto const& child : atom.GetChildAtoms()) {
+    checked_atom_count += CheckSubtree(*child, file, rules, issues);
+  }
+  return checked_atom_count;
+}
+}  // namespace
+
+ConformanceReport CheckConformance(AtomHolder& atoms,
+                                   size_t thread_count /* = 0 */) {
+  RulesByType const& rules = GetRulesByType();
+  FileContext const file = GatherFileContext(atoms);
+
+  // Each top level atom is checked on its own task. Tasks write only to
+  // their own slots, so need no locking, and the issues can be merged in
+  // tree order.
+  size_t const task_count = file.top_level_atoms.size();
+  std::vector<std::vector<ConformanceIssue>> task_issues(task_count);
+  std::vector<uint64_t> task_checked_counts(task_count);
+  {
+    parallel::WorkStealingPool pool{thread_count};
+    for (size_t i = 0; i < task_count; ++i) {
+      pool.Submit([&, i](size_t /* worker_index */) {
+        task_checked_counts.at(i) = CheckSubtree(
+            *file.top_level_atoms.at(i), file, rules, task_issues.at(i));
+      });
+    }
+    pool.Wait();
+  }
+
+  ConformanceReport report;
+  std::unordered_map<std::string_view, uint64_t> counts_by_rule;
+  for (size_t i = 0; i < task_count; ++i) {
+    report.checked_atom_count += task_checked_counts.at(i);
+    for (ConformanceIssue& issue : task_issues.at(i)) {
+      if (issue.severity == ConformanceSeverity::kError) {
+        ++report.error_count;
+      } else {
+        ++report.warning_count;
+      }
+      if (counts_by_rule[issue.rule]++ < kMaxListedIssuesPerRule) {
+        report.issues.push_back(std::move(issue));
+      }
+    }
+  }
+  return report;
+}
+
+}  // namespace mp4_manipulator::analysis
@@ -0,0 +1,101 @@
+#include "analysis/content_hash.h"
+
+namespace mp4_manipulator::analysis {
+namespace {
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// Reads little endian values, as XXH64 is defined in terms of them.
+uint64_t Read64(uint8_t const* bytes) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+uint32_t Read32(uint8_t const* bytes) {
+  return uint32_t{bytes[0]} | (uint32_t{bytes[1]} << 8) |
+         (uint32_t{bytes[2]} << 16) | (uint32_t{bytes[3]} << 24);
+}
+
+uint64_t Round(uint64_t accumulator, uint64_t input) {
+  accumulator += input * kPrime2;
+  accumulator = RotateLeft(accumulator, 31);
+  return accumulator * kPrime1;
+}
+
+uint64_t MergeRound(uint64_t accumulator, uint64_t value) {
+  accumulator ^= Round(0, value);
+  return accumulator * kPrime1 + kPrime4;
+}
+
+uint64_t Avalanche(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+}  // namespace
+
+uint64_t HashBytes(void const* data, size_t size, uint64_t seed /* = 0 */) {
+  auto const* bytes = static_cast<uint8_t const*>(data);
+  uint8_t const* const end = bytes + size;
+  uint64_t hash = 0;
+  if (size >= 32) {
+    // Four independent lanes, so the multiplies overlap.
+    uint64_t lane1 = seed + kPrime1 + kPrime2;
+    uint64_t lane2 = seed + kPrime2;
+    uint64_t lane3 = seed;
+    uint64_t lane4 = seed - kPrime1;
+    uint8_t const* const last_stripe = end - 32;
+    do {
+      lane1 = Round(lane1, Read64(bytes));
+      lane2 = Round(lane2, Read64(bytes + 8));
+      lane3 = Round(lane3, Read64(bytes + 16));
+      lane4 = Round(lane4, Read64(bytes + 24));
+      bytes += 32;
+    } while (bytes <= last_stripe);
+    hash = RotateLeft(lane1, 1) + RotateLeft(lane2, 7) +
+           RotateLeft(lane3, 12) + RotateLeft(lane4, 18);
+    hash = MergeRound(hash, lane1);
+    hash = MergeRound(hash, lane2);
+    hash = MergeRound(hash, lane3);
+    hash = MergeRound(hash, lane4);
+  } else {
+    hash = seed + kPrime5;
+  }
+  hash += static_cast<uint64_t>(size);
+
+  while (end - bytes >= 8) {
+    hash ^= Round(0, Read64(bytes));
+    hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+    bytes += 8;
+  }
+  if (end - bytes >= 4) {
+    hash ^= uint64_t{Read32(bytes)} * kPrime1;
+    hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+    bytes += 4;
+  }
+  while (bytes < end) {
+    hash ^= *bytes * kPrime5;
+    hash = RotateLeft(hash, 11) * kPrime1;
+    ++bytes;
+  }
+  return Avalanche(hash);
+}
+
+uint64_t CombineHashes(uint64_t hash, uint64_t value) {
+  return Avalanche(MergeRound(hash, value));
+}
+
+}  // namespace mp4_manipulator::analysis
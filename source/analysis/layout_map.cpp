@@ -0,0 +1,267 @@
+#include "analysis/layout_map.h"
+
+#include <algorithm>
+#include <optional>
+
+#include "analysis/atom_lookup.h"
+#include "parallel/work_stealing_pool.h"
+
+namespace mp4_manipulator::analysis {
+namespace {
+// The finest level has at most this many bins, enough for a full screen strip
+// to show a multi-hour file at a few bins per pixel before drawing switches to
+// individual chunks.
+constexpr size_t kMaxFinestBinCount = 1 << 16;
+// Bins are no smaller than this, so small files don't have bins smaller than
+// their chunks.
+constexpr uint64_t kMinBinSize = 512;
+
+struct ExpandedTrack {
+  LayoutTrack track;
+  std::vector<LayoutChunk> chunks;
+};
+
+// Finds the chunks of a trak, numbering them as track `track_index`. Sample
+// sizes come from stsz or stz2, and their durations from stts.
+ExpandedTrack ExpandChunks(AtomOrDescriptorBase const& trak,
+                           uint32_t track_index) {
+  ExpandedTrack expanded;
+  LayoutTrack& track = expanded.track;
+  if (AP4_TkhdAtom* tkhd = FindDescendantAp4Atom<AP4_TkhdAtom>(trak)) {
+    track.track_id = tkhd->GetTrackId();
+  }
+  if (AP4_HdlrAtom* hdlr = FindDescendantAp4Atom<AP4_HdlrAtom>(trak)) {
+    char four_cc[5] = {};
+    AP4_FormatFourChars(four_cc, hdlr->GetHandlerType());
+    track.handler_type = four_cc;
+  }
+  AP4_MdhdAtom* const mdhd = FindDescendantAp4Atom<AP4_MdhdAtom>(trak);
+  AP4_StcoAtom* const stco = FindDescendantAp4Atom<AP4_StcoAtom>(trak);
+  AP4_Co64Atom* const co64 = FindDescendantAp4Atom<AP4_Co64Atom>(trak);
+  AP4_StscAtom* const stsc = FindDescendantAp4Atom<AP4_StscAtom>(trak);
+  AP4_StszAtom* const stsz = FindDescendantAp4Atom<AP4_StszAtom>(trak);
+  AP4_Stz2Atom* const stz2 = FindDescendantAp4Atom<AP4_Stz2Atom>(trak);
+  AP4_SttsAtom* const stts = FindDescendantAp4Atom<AP4_SttsAtom>(trak);
+  if (mdhd == nullptr || mdhd->GetTimeScale() == 0 ||
+      (stco == nullptr && co64 == nullptr) || stsc == nullptr ||
+      (stsz == nullptr && stz2 == nullptr) || stts == nullptr) {
+    return expanded;
+  }
+  double const timescale = mdhd->GetTimeScale();
+  uint32_t const chunk_count =
+      stco != nullptr ? stco->GetChunkCount() : co64->GetEntryCount();
+  uint32_t const sample_count =
+      stsz != nullptr ? stsz->GetSampleCount() : stz2->GetSampleCount();
+
+  // Walks stts alongside the samples, rather than expanding it.
+  AP4_Array<AP4_SttsTableEntry>& time_entries = stts->GetEntries();
+  AP4_Ordinal time_entry = 0;
+  uint32_t left_in_time_entry =
+      time_entries.ItemCount() > 0 ? time_entries[0].m_SampleCount : 0;
+  uint64_t decode_time = 0;
+  auto const next_duration = [&]() -> uint32_t {
+    while (left_in_time_entry == 0 &&
+           time_entry + 1 < time_entries.ItemCount()) {
+      ++time_entry;
+      left_in_time_entry = time_entries[time_entry].m_SampleCount;
+    }
+    if (left_in_time_entry == 0) {
+      return 0;
+    }
+    --left_in_time_entry;
+    return time_entries[time_entry].m_SampleDuration;
+  };
+
+  AP4_Array<AP4_StscTableEntry>& entries = stsc->GetEntries();
+  uint32_t sample = 1;
+  for (AP4_Ordinal i = 0; i < entries.ItemCount() && sample <= sample_count;
+       ++i) {
+    uint32_t const end_chunk =
+        std::min(i + 1 < entries.ItemCount() ? entries[i + 1].m_FirstChunk
+                                             : chunk_count + 1,
+                 chunk_count + 1);
+    for (uint32_t chunk = std::max(entries[i].m_FirstChunk, 1u);
+         chunk < end_chunk && sample <= sample_count; ++chunk) {
+      LayoutChunk layout_chunk{0, 0, track_index, decode_time / timescale, 0};
+      if (stco != nullptr) {
+        AP4_UI32 offset = 0;
+        stco->GetChunkOffset(chunk, offset);
+        layout_chunk.offset = offset;
+      } else {
+        co64->GetChunkOffset(chunk, layout_chunk.offset);
+      }
+      uint64_t const chunk_start_time = decode_time;
+      for (uint32_t j = 0;
+           j < entries[i].m_SamplesPerChunk && sample <= sample_count;
+           ++j, ++sample) {
+        AP4_Size size = 0;
+        if (stsz != nullptr) {
+          stsz->GetSampleSize(sample, size);
+        } else {
+          stz2->GetSampleSize(sample, size);
+        }
+        layout_chunk.size += size;
+        decode_time += next_duration();
+      }
+      layout_chunk.duration = (decode_time - chunk_start_time) / timescale;
+      track.bytes += layout_chunk.size;
+      expanded.chunks.push_back(layout_chunk);
+    }
+  }
+  track.chunk_count = expanded.chunks.size();
+  track.duration = decode_time / timescale;
+  return expanded;
+}
+
+// Computes the interleave depth at each chunk of `map`, which are in order of
+// offset, and the startup bytes.
+std::vector<float> ComputeStreamingStartup(LayoutMap& map) {
+  std::vector<float> depths(map.chunks.size(), 0);
+  // How far each track has been read, in seconds.
+  std::vector<double> time_read(map.tracks.size(), 0);
+  for (size_t i = 0; i < map.chunks.size(); ++i) {
+    LayoutChunk const& chunk = map.chunks.at(i);
+    double& track_time = time_read.at(chunk.track);
+    track_time = std::max(track_time, chunk.start_time + chunk.duration);
+
+    // Tracks that have been read to their end don't hold the others back.
+    std::optional<double> furthest_behind;
+    double furthest_ahead = 0;
+    for (size_t track = 0; track < map.tracks.size(); ++track) {
+      if (map.tracks.at(track).chunk_count == 0) {
+        continue;
+      }
+      furthest_ahead = std::max(furthest_ahead, time_read.at(track));
+      if (time_read.at(track) < map.tracks.at(track).duration) {
+        furthest_behind = std::min(
+            furthest_behind.value_or(time_read.at(track)), time_read.at(track));
+      }
+    }
+    double const depth =
+        furthest_behind.has_value() ? furthest_ahead - furthest_behind.value()
+                                    : 0;
+    depths.at(i) = static_cast<float>(depth);
+    if (depth > map.max_interleave_depth) {
+      map.max_interleave_depth = depth;
+      map.max_interleave_depth_offset = chunk.offset;
+    }
+    if (chunk.start_time < kStartupSeconds) {
+      map.startup_bytes =
+          std::max(map.startup_bytes, chunk.offset + chunk.size);
+    }
+  }
+  for (LayoutBox const& box : map.boxes) {
+    if (box.type == "moov") {
+      map.startup_bytes = std::max(map.startup_bytes, box.offset + box.size);
+    }
+  }
+  map.startup_bytes = std::min(map.startup_bytes, map.file_size);
+  return depths;
+}
+
+// Builds the finest level from the chunks, then each coarser level from the
+// one before.
+void BuildLevels(LayoutMap& map, std::vector<float> const& depths) {
+  if (map.file_size == 0) {
+    return;
+  }
+  size_t const track_count = map.tracks.size();
+  LayoutLevel finest;
+  finest.bin_size = std::max(
+      kMinBinSize,
+      (map.file_size + kMaxFinestBinCount - 1) / kMaxFinestBinCount);
+  finest.bin_count = static_cast<size_t>(
+      (map.file_size + finest.bin_size - 1) / finest.bin_size);
+  finest.track_bytes.assign(finest.bin_count * track_count, 0);
+  finest.interleave_depth.assign(finest.bin_count, 0);
+  for (size_t i = 0; i < map.chunks.size(); ++i) {
+    LayoutChunk const& chunk = map.chunks.at(i);
+    if (chunk.offset >= map.file_size) {
+      continue;
+    }
+    uint64_t const end =
+        std::min(map.file_size, chunk.offset + chunk.size);
+    size_t bin = static_cast<size_t>(chunk.offset / finest.bin_size);
+    float& depth = finest.interleave_depth.at(bin);
+    depth = std::max(depth, depths.at(i));
+    // A chunk larger than a bin is spread over the bins it covers.
+    for (uint64_t position = chunk.offset; position < end; ++bin) {
+      uint64_t const bin_end = std::min(end, (bin + 1) * finest.bin_size);
+      finest.track_bytes.at(bin * track_count + chunk.track) +=
+          bin_end - position;
+      position = bin_end;
+    }
+  }
+  map.levels.push_back(std::move(finest));
+
+  while (map.levels.back().bin_count > 1) {
+    LayoutLevel const& finer = map.levels.back();
+    LayoutLevel coarser;
+    coarser.bin_size = finer.bin_size * 2;
+    coarser.bin_count = (finer.bin_count + 1) / 2;
+    coarser.track_bytes.assign(coarser.bin_count * track_count, 0);
+    coarser.interleave_depth.assign(coarser.bin_count, 0);
+    for (size_t bin = 0; bin < finer.bin_count; ++bin) {
+      for (size_t track = 0; track < track_count; ++track) {
+        coarser.track_bytes.at(bin / 2 * track_count + track) +=
+            finer.track_bytes.at(bin * track_count + track);
+      }
+      float& depth = coarser.interleave_depth.at(bin / 2);
+      depth = std::max(depth, finer.interleave_depth.at(bin));
+    }
+    map.levels.push_back(std::move(coarser));
+  }
+}
+}  // namespace
+
+Result<LayoutMap, std::string> ComputeLayoutMap(AtomHolder& atoms,
+                                                size_t thread_count /* = 0 */) {
+  using LayoutResult = Result<LayoutMap, std::string>;
+  LayoutMap map;
+  std::vector<AtomOrDescriptorBase const*> traks;
+  for (auto const& atom : atoms.GetTopLevelAtoms()) {
+    std::optional<uint64_t> const position = atom->GetPositionInStream();
+    if (!position.has_value()) {
+      return LayoutResult::Err(
+          "The positions of the atoms aren't known, so the layout can't be "
+          "mapped.");
+    }
+    map.boxes.push_back(LayoutBox{atom->GetName().toStdString(),
+                                  position.value(), atom->GetSize()});
+    map.file_size = std::max(map.file_size, position.value() + atom->GetSize());
+    if (HasType(*atom, AP4_ATOM_TYPE_MOOV)) {
+      for (auto const& child : atom->GetChildAtoms()) {
+        if (HasType(*child, AP4_ATOM_TYPE_TRAK)) {
+          traks.push_back(child.get());
+        }
+      }
+    }
+  }
+
+  std::vector<ExpandedTrack> expanded(traks.size());
+  {
+    parallel::WorkStealingPool pool{thread_count};
+    for (size_t i = 0; i < traks.size(); ++i) {
+      pool.Submit([&, i](size_t /* worker_index */) {
+        expanded.at(i) =
+            ExpandChunks(*traks.at(i), static_cast<uint32_t>(i));
+      });
+    }
+    pool.Wait();
+  }
+  for (ExpandedTrack& track : expanded) {
+    map.tracks.push_back(std::move(track.track));
+    map.chunks.insert(map.chunks.end(), track.chunks.begin(),
+                      track.chunks.end());
+  }
+  std::sort(map.chunks.begin(), map.chunks.end(),
+            [](LayoutChunk const& a, LayoutChunk const& b) {
+              return a.offset < b.offset;
+            });
+
+  std::vector<float> const depths = ComputeStreamingStartup(map);
+  BuildLevels(map, depths);
+  return LayoutResult::Ok(std::move(map));
+}
+
+}  // namespace mp4_manipulator::analysis
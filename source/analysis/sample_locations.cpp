@@ -0,0 +1,198 @@
+#include "analysis/sample_locations.h"
+
+#include <optional>
+
+#include "analysis/atom_lookup.h"
+
+namespace mp4_manipulator::analysis {
+bool IsError(SampleIssueKind kind) {
+  return kind != SampleIssueKind::kUnreferencedMediaData;
+}
+
+SampleLocations LocateTrackSamples(AtomOrDescriptorBase const& trak) {
+  SampleLocations locations;
+  AtomOrDescriptorBase const* tkhd = FindDescendant<AP4_TkhdAtom>(trak);
+  uint32_t const track_id =
+      tkhd != nullptr ? GetAp4AtomAs<AP4_TkhdAtom>(*tkhd)->GetTrackId() : 0;
+  auto const add_table_issue = [&](AtomOrDescriptorBase const& atom,
+                                   std::string description) {
+    locations.issues.push_back(
+        SampleIssue{SampleIssueKind::kInconsistentTables, &atom,
+                    "Track " + std::to_string(track_id) + ": " +
+                        std::move(description)});
+  };
+
+  AtomOrDescriptorBase const* offsets = FindDescendant<AP4_StcoAtom>(trak);
+  if (offsets == nullptr) {
+    offsets = FindDescendant<AP4_Co64Atom>(trak);
+  }
+  AtomOrDescriptorBase const* stsc = FindDescendant<AP4_StscAtom>(trak);
+  AtomOrDescriptorBase const* sizes = FindDescendant<AP4_StszAtom>(trak);
+  if (sizes == nullptr) {
+    sizes = FindDescendant<AP4_Stz2Atom>(trak);
+  }
+  if (offsets == nullptr || stsc == nullptr || sizes == nullptr) {
+    add_table_issue(trak,
+                    "the sample table is missing its chunk offsets (stco or "
+                    "co64), sample to chunk (stsc) or sample sizes (stsz or "
+                    "stz2).");
+    return locations;
+  }
+  locations.sources.push_back(SampleSource{offsets, track_id, false});
+
+  AP4_StcoAtom* const stco = GetAp4AtomAs<AP4_StcoAtom>(*offsets);
+  AP4_Co64Atom* const co64 = GetAp4AtomAs<AP4_Co64Atom>(*offsets);
+  uint32_t const chunk_count =
+      stco != nullptr ? stco->GetChunkCount() : co64->GetEntryCount();
+  auto const get_chunk_offset = [&](AP4_Ordinal chunk) -> uint64_t {
+    if (stco != nullptr) {
+      AP4_UI32 offset = 0;
+      stco->GetChunkOffset(chunk, offset);
+      return offset;
+    }
+    AP4_UI64 offset = 0;
+    co64->GetChunkOffset(chunk, offset);
+    return offset;
+  };
+  AP4_StszAtom* const stsz = GetAp4AtomAs<AP4_StszAtom>(*sizes);
+  AP4_Stz2Atom* const stz2 = GetAp4AtomAs<AP4_Stz2Atom>(*sizes);
+  uint32_t const sample_count =
+      stsz != nullptr ? stsz->GetSampleCount() : stz2->GetSampleCount();
+  auto const get_sample_size = [&](AP4_Ordinal sample) -> uint32_t {
+    AP4_Size size = 0;
+    if (stsz != nullptr) {
+      stsz->GetSampleSize(sample, size);
+    } else {
+      stz2->GetSampleSize(sample, size);
+    }
+    return size;
+  };
+
+  AP4_Array<AP4_StscTableEntry>& entries =
+      GetAp4AtomAs<AP4_StscAtom>(*stsc)->GetEntries();
+  if (entries.ItemCount() > 0 && entries[0].m_FirstChunk != 1) {
+    add_table_issue(*stsc, "the first stsc entry doesn't start at chunk 1.");
+  }
+  locations.samples.reserve(sample_count);
+  uint32_t sample = 1;
+  for (AP4_Ordinal i = 0; i < entries.ItemCount(); ++i) {
+    uint32_t const first_chunk = entries[i].m_FirstChunk;
+    // Each entry runs up to the next, and the last to the final chunk.
+    uint32_t const end_chunk = i + 1 < entries.ItemCount()
+                                   ? entries[i + 1].m_FirstChunk
+                                   : chunk_count + 1;
+    if (first_chunk == 0 || first_chunk >= end_chunk ||
+        end_chunk > chunk_count + 1) {
+      add_table_issue(*stsc, "stsc entry " + std::to_string(i + 1) +
+                                 " refers to chunks that stco or co64 don't "
+                                 "have, or aren't in order.");
+      return locations;
+    }
+    for (uint32_t chunk = first_chunk; chunk < end_chunk; ++chunk) {
+      uint64_t offset = get_chunk_offset(chunk);
+      for (uint32_t j = 0; j < entries[i].m_SamplesPerChunk; ++j) {
+        if (sample > sample_count) {
+          add_table_issue(*stsc, "stsc maps more samples than the " +
+                                     std::to_string(sample_count) +
+                                     " the sample size table has.");
+          return locations;
+        }
+        uint32_t const size = get_sample_size(sample);
+        locations.samples.push_back(SampleRange{offset, size, 0, sample});
+        offset += size;
+        ++sample;
+      }
+    }
+  }
+  if (sample - 1 < sample_count) {
+    add_table_issue(*sizes, "the sample size table has " +
+                                std::to_string(sample_count) +
+                                " samples, but stsc maps only " +
+                                std::to_string(sample - 1) + ".");
+  }
+  return locations;
+}
+
+SampleLocations LocateFragmentSamples(
+    AtomOrDescriptorBase const& moof, uint64_t moof_position,
+    std::unordered_map<uint32_t, uint32_t> const& default_sample_sizes) {
+  SampleLocations locations;
+  bool is_first_traf = true;
+  // Where the previous traf's data ended, the default base of the next.
+  uint64_t previous_data_end = moof_position;
+  for (auto const& traf : moof.GetChildAtoms()) {
+    if (!HasType(*traf, AP4_ATOM_TYPE_TRAF)) {
+      continue;
+    }
+    AtomOrDescriptorBase const* tfhd_atom = FindDescendant<AP4_TfhdAtom>(*traf);
+    if (tfhd_atom == nullptr) {
+      locations.issues.push_back(
+          SampleIssue{SampleIssueKind::kInconsistentTables, traf.get(),
+                      "A traf has no tfhd, so its samples can't be found."});
+      continue;
+    }
+    AP4_TfhdAtom const& tfhd = *GetAp4AtomAs<AP4_TfhdAtom>(*tfhd_atom);
+    uint32_t const flags = tfhd.GetFlags();
+    uint64_t base = previous_data_end;
+    if ((flags & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) != 0) {
+      base = tfhd.GetBaseDataOffset();
+    } else if ((flags & AP4_TFHD_FLAG_DEFAULT_BASE_IS_MOOF) != 0 ||
+               is_first_traf) {
+      base = moof_position;
+    }
+    is_first_traf = false;
+    std::optional<uint32_t> default_size;
+    if ((flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_SIZE_PRESENT) != 0) {
+      default_size = tfhd.GetDefaultSampleSize();
+    } else if (auto it = default_sample_sizes.find(tfhd.GetTrackId());
+               it != default_sample_sizes.end()) {
+      default_size = it->second;
+    }
+
+    uint64_t data_end = base;
+    for (auto const& trun_atom : traf->GetChildAtoms()) {
+      AP4_TrunAtom* const trun = GetAp4AtomAs<AP4_TrunAtom>(*trun_atom);
+      if (trun == nullptr) {
+        continue;
+      }
+      std::string const track =
+          "Track " + std::to_string(tfhd.GetTrackId()) + ": ";
+      bool const has_sizes =
+          (trun->GetFlags() & AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT) != 0;
+      if (!has_sizes && !default_size.has_value()) {
+        locations.issues.push_back(SampleIssue{
+            SampleIssueKind::kInconsistentTables, trun_atom.get(),
+            track + "neither the trun, tfhd nor trex give sample sizes."});
+        continue;
+      }
+      // Without a data offset, a trun's data follows the previous trun's.
+      uint64_t offset = data_end;
+      if ((trun->GetFlags() & AP4_TRUN_FLAG_DATA_OFFSET_PRESENT) != 0) {
+        int64_t const data_offset = trun->GetDataOffset();
+        if (data_offset < 0 && static_cast<uint64_t>(-data_offset) > base) {
+          locations.issues.push_back(SampleIssue{
+              SampleIssueKind::kOutOfFileBounds, trun_atom.get(),
+              track + "the trun's data offset is before the start of the "
+                      "file."});
+          continue;
+        }
+        offset = base + data_offset;
+      }
+      auto const source = static_cast<uint32_t>(locations.sources.size());
+      locations.sources.push_back(
+          SampleSource{trun_atom.get(), tfhd.GetTrackId(), true});
+      AP4_Array<AP4_TrunAtom::Entry> const& entries = trun->GetEntries();
+      for (AP4_Ordinal i = 0; i < entries.ItemCount(); ++i) {
+        uint32_t const size =
+            has_sizes ? entries[i].sample_size : default_size.value();
+        locations.samples.push_back(SampleRange{offset, size, source, i + 1});
+        offset += size;
+      }
+      data_end = offset;
+    }
+    previous_data_end = data_end;
+  }
+  return locations;
+}
+
+}  // namespace mp4_manipulator::analysis
@@ -0,0 +1,214 @@
+#include "analysis/sample_reference_verifier.h"
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <unordered_map>
+
+#include "analysis/atom_lookup.h"
+#include "parallel/work_stealing_pool.h"
+
+namespace mp4_manipulator::analysis {
+namespace {
+// The most issues of each kind that are listed, see SampleVerification.
+constexpr uint64_t kMaxListedIssuesPerKind = 100;
+constexpr size_t kIssueKindCount = 5;
+
+// The payload of an mdat, and how far into it samples have been seen during
+// the sweep.
+struct MediaData {
+  AtomOrDescriptorBase const* atom;
+  uint64_t begin;
+  uint64_t end;
+  uint64_t covered_until;
+};
+
+std::string FormatRange(uint64_t offset, uint64_t size) {
+  return "bytes " + std::to_string(offset) + "-" +
+         std::to_string(offset + size);
+}
+
+std::string DescribeSample(SampleRange const& sample,
+                           std::vector<SampleSource> const& sources) {
+  SampleSource const& source = sources.at(sample.source);
+  return "sample " + std::to_string(sample.number) +
+         (source.is_fragment ? " of a trun of track " : " of track ") +
+         std::to_string(source.track_id) + " (" +
+         FormatRange(sample.offset, sample.size) + ")";
+}
+
+// Adds `issue` to `verification`, counting it, but listing it only if there
+// aren't already too many of its kind.
+void AddIssue(SampleVerification& verification,
+              std::array<uint64_t, kIssueKindCount>& counts,
+              SampleIssue&& issue) {
+  if (IsError(issue.kind)) {
+    ++verification.error_count;
+  } else {
+    ++verification.unreferenced_range_count;
+  }
+  uint64_t& count = counts.at(static_cast<size_t>(issue.kind));
+  if (count++ < kMaxListedIssuesPerKind) {
+    verification.issues.push_back(std::move(issue));
+  }
+}
+}  // namespace
+
+Result<SampleVerification, std::string> VerifySampleReferences(
+    AtomHolder& atoms, size_t thread_count /* = 0 */) {
+  using VerifyResult = Result<SampleVerification, std::string>;
+  std::vector<AtomOrDescriptorBase const*> traks;
+  std::vector<std::pair<AtomOrDescriptorBase const*, uint64_t>> moofs;
+  std::vector<MediaData> media_data;
+  std::unordered_map<uint32_t, uint32_t> default_sample_sizes;
+  uint64_t file_end = 0;
+  for (auto const& atom : atoms.GetTopLevelAtoms()) {
+    std::optional<uint64_t> const position = atom->GetPositionInStream();
+    if (!position.has_value()) {
+      return VerifyResult::Err(
+          "The positions of the atoms aren't known, so the samples can't be "
+          "located.");
+    }
+    file_end = std::max(file_end, position.value() + atom->GetSize());
+    if (HasType(*atom, AP4_ATOM_TYPE_MDAT)) {
+      uint64_t const begin = position.value() + atom->GetHeaderSize();
+      uint64_t const end = position.value() + atom->GetSize();
+      media_data.push_back(MediaData{atom.get(), begin, end, begin});
+    } else if (HasType(*atom, AP4_ATOM_TYPE_MOOF)) {
+      moofs.emplace_back(atom.get(), position.value());
+    } else if (HasType(*atom, AP4_ATOM_TYPE_MOOV)) {
+      for (auto const& child : atom->GetChildAtoms()) {
+        if (HasType(*child, AP4_ATOM_TYPE_TRAK)) {
+          traks.push_back(child.get());
+        } else if (HasType(*child, AP4_ATOM_TYPE_MVEX)) {
+          for (auto const& trex_atom : child->GetChildAtoms()) {
+            if (AP4_TrexAtom* trex = GetAp4AtomAs<AP4_TrexAtom>(*trex_atom)) {
+              default_sample_sizes[trex->GetTrackId()] =
+                  trex->GetDefaultSampleSize();
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Expand each trak and moof on its own task. Tasks write only to their own
+  // slot, so need no locking.
+  std::vector<SampleLocations> expanded(traks.size() + moofs.size());
+  {
+    parallel::WorkStealingPool pool{thread_count};
+    for (size_t i = 0; i < traks.size(); ++i) {
+      pool.Submit([&, i](size_t /* worker_index */) {
+        expanded.at(i) = LocateTrackSamples(*traks.at(i));
+      });
+    }
+    for (size_t i = 0; i < moofs.size(); ++i) {
+      pool.Submit([&, i](size_t /* worker_index */) {
+        expanded.at(traks.size() + i) = LocateFragmentSamples(
+            *moofs.at(i).first, moofs.at(i).second, default_sample_sizes);
+      });
+    }
+    pool.Wait();
+  }
+
+  SampleVerification verification;
+  verification.track_count = traks.size();
+  std::array<uint64_t, kIssueKindCount> counts{};
+  std::vector<SampleSource> sources;
+  std::vector<SampleRange> samples;
+  size_t total_samples = 0;
+  for (SampleLocations const& part : expanded) {
+    total_samples += part.samples.size();
+  }
+  samples.reserve(total_samples);
+  for (SampleLocations& part : expanded) {
+    auto const first_source = static_cast<uint32_t>(sources.size());
+    sources.insert(sources.end(), part.sources.begin(), part.sources.end());
+    for (SampleRange sample : part.samples) {
+      sample.source += first_source;
+      samples.push_back(sample);
+    }
+    for (SampleIssue& issue : part.issues) {
+      AddIssue(verification, counts, std::move(issue));
+    }
+    part = {};
+  }
+  verification.sample_count = samples.size();
+
+  std::sort(samples.begin(), samples.end(),
+            [](SampleRange const& a, SampleRange const& b) {
+              return a.offset < b.offset ||
+                     (a.offset == b.offset && a.size < b.size);
+            });
+  std::sort(media_data.begin(), media_data.end(),
+            [](MediaData const& a, MediaData const& b) {
+              return a.begin < b.begin;
+            });
+
+  auto const add_gap = [&](MediaData const& mdat, uint64_t gap_end) {
+    if (gap_end > mdat.covered_until) {
+      AddIssue(verification, counts,
+               SampleIssue{SampleIssueKind::kUnreferencedMediaData, mdat.atom,
+                           "No sample references " +
+                               FormatRange(mdat.covered_until,
+                                           gap_end - mdat.covered_until) +
+                               " of the mdat."});
+    }
+  };
+  // Samples and mdats are both in order of offset, so one pass over each
+  // checks containment and finds the gaps between samples.
+  size_t mdat_index = 0;
+  // The furthest end of any sample so far, and the sample with that end.
+  uint64_t max_end = 0;
+  SampleRange const* max_end_sample = nullptr;
+  for (SampleRange const& sample : samples) {
+    AtomOrDescriptorBase const* const source_atom =
+        sources.at(sample.source).atom;
+    if (sample.offset > file_end || sample.size > file_end - sample.offset) {
+      AddIssue(verification, counts,
+               SampleIssue{SampleIssueKind::kOutOfFileBounds, source_atom,
+                           "The end of " + DescribeSample(sample, sources) +
+                               " is past the end of the file, at " +
+                               std::to_string(file_end) + "."});
+      continue;
+    }
+    uint64_t const end = sample.offset + sample.size;
+
+    while (mdat_index < media_data.size() &&
+           media_data.at(mdat_index).end <= sample.offset) {
+      add_gap(media_data.at(mdat_index), media_data.at(mdat_index).end);
+      ++mdat_index;
+    }
+    if (mdat_index < media_data.size() &&
+        media_data.at(mdat_index).begin <= sample.offset &&
+        end <= media_data.at(mdat_index).end) {
+      MediaData& mdat = media_data.at(mdat_index);
+      add_gap(mdat, sample.offset);
+      mdat.covered_until = std::max(mdat.covered_until, end);
+    } else if (sample.size > 0) {
+      AddIssue(verification, counts,
+               SampleIssue{SampleIssueKind::kOutsideMediaData, source_atom,
+                           "No mdat contains " +
+                               DescribeSample(sample, sources) + "."});
+    }
+
+    if (sample.offset < max_end) {
+      AddIssue(verification, counts,
+               SampleIssue{SampleIssueKind::kOverlap, source_atom,
+                           "Overlapping samples: " +
+                               DescribeSample(*max_end_sample, sources) +
+                               " and " + DescribeSample(sample, sources) +
+                               "."});
+    }
+    if (end > max_end) {
+      max_end = end;
+      max_end_sample = &sample;
+    }
+  }
+  for (; mdat_index < media_data.size(); ++mdat_index) {
+    add_gap(media_data.at(mdat_index), media_data.at(mdat_index).end);
+  }
+  return VerifyResult::Ok(std::move(verification));
+}
+
+}  // namespace mp4_manipulator::analysis
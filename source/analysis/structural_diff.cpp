@@ -0,0 +1,319 @@
+#include "analysis/structural_diff.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+
+#include "analysis/content_hash.h"
+#include "parallel/work_stealing_pool.h"
+#include "parsing/unparsed_atom.h"
+
+namespace mp4_manipulator::analysis {
+namespace {
+// Payloads are hashed in chunks of up to this size, so a single large box
+// (e.g. mdat) is spread over all the threads.
+constexpr uint64_t kChunkSize = 8 * 1024 * 1024;
+
+// A range of a file that's read and hashed as a unit.
+struct HashChunk {
+  uint64_t offset;
+  uint32_t size;
+  // True for the first chunk of a box, whose size field is zeroed before
+  // hashing. Otherwise a change deep in a tree would change the size, and so
+  // the contents, of every ancestor.
+  bool masks_size_field;
+  uint64_t hash{0};
+};
+
+// An atom of one of the files, with the chunks covering its own bytes (i.e.
+// excluding those of its children).
+struct HashNode {
+  AtomOrDescriptorBase const* atom;
+  std::vector<size_t> chunks;
+  std::vector<size_t> children;
+  // Hash of the atom's own bytes.
+  uint64_t contents_hash{0};
+  // Hash of the atom's own bytes and its children's subtree hashes.
+  uint64_t subtree_hash{0};
+};
+
+struct HashedFile {
+  // In pre-order, so children come after their parents.
+  std::vector<HashNode> nodes;
+  std::vector<size_t> top_level_nodes;
+  std::vector<HashChunk> chunks;
+};
+
+// Adds chunks covering [begin, end) to the node at `node_index`. If
+// `header_offset` is set, the chunk starting there has its size field masked.
+void AddChunks(HashedFile& file, size_t node_index, uint64_t begin,
+               uint64_t end, std::optional<uint64_t> header_offset) {
+  for (uint64_t offset = begin; offset < end; offset += kChunkSize) {
+    auto const size =
+        static_cast<uint32_t>(std::min<uint64_t>(kChunkSize, end - offset));
+    file.nodes.at(node_index).chunks.push_back(file.chunks.size());
+    file.chunks.push_back(HashChunk{offset, size, header_offset == offset});
+  }
+}
+
+// Adds a node for `atom`, which starts at `position`, and its descendants to
+// `file`. Returns the index of the atom's node.
+size_t AddHashNode(HashedFile& file, AtomOrDescriptorBase const& atom,
+                   uint64_t position) {
+  size_t const node_index = file.nodes.size();
+  file.nodes.emplace_back().atom = &atom;
+  uint64_t const end = position + atom.GetSize();
+  // Unparsed atoms have no header, so no size field to mask.
+  std::optional<uint64_t> const header_offset =
+      IsUnparsedAtom(atom) ? std::nullopt : std::optional<uint64_t>{position};
+  uint64_t cursor = position;
+  for (auto const& child : atom.GetChildAtoms()) {
+    std::optional<uint64_t> const child_position =
+        child->GetPositionInStream();
+    // A child whose position isn't known is hashed as part of its parent's
+    // bytes.
+    if (!child_position.has_value() || child_position.value() < cursor ||
+        child_position.value() + child->GetSize() > end) {
+      continue;
+    }
+    AddChunks(file, node_index, cursor, child_position.value(),
+              header_offset);
+    size_t const child_index =
+        AddHashNode(file, *child, child_position.value());
+    file.nodes.at(node_index).children.push_back(child_index);
+    cursor = child_position.value() + child->GetSize();
+  }
+  AddChunks(file, node_index, cursor, end, header_offset);
+  return node_index;
+}
+
+Result<HashedFile, std::string> BuildHashNodes(FileToDiff const& file) {
+  using BuildResult = Result<HashedFile, std::string>;
+  HashedFile hashed_file;
+  for (auto const& atom : file.atoms.GetTopLevelAtoms()) {
+    std::optional<uint64_t> const position = atom->GetPositionInStream();
+    if (!position.has_value()) {
+      return BuildResult::Err(
+          std::string{"The positions of the atoms in "} + file.file_name +
+          " aren't known.");
+    }
+    hashed_file.top_level_nodes.push_back(
+        AddHashNode(hashed_file, *atom, position.value()));
+  }
+  return BuildResult::Ok(std::move(hashed_file));
+}
+
+// Zeroes the size field of the box header at the start of `bytes`.
+void MaskSizeField(uint8_t* bytes, size_t size) {
+  constexpr size_t kCompactSizeLength = 4;
+  constexpr size_t kLargeSizeOffset = 8;
+  constexpr size_t kLargeSizeEnd = 16;
+  if (size < kCompactSizeLength) {
+    return;
+  }
+  // A compact size of 1 means a 64 bit size follows the type.
+  bool const has_large_size =
+      bytes[0] == 0 && bytes[1] == 0 && bytes[2] == 0 && bytes[3] == 1;
+  std::fill(bytes, bytes + kCompactSizeLength, 0);
+  if (has_large_size && size >= kLargeSizeEnd) {
+    std::fill(bytes + kLargeSizeOffset, bytes + kLargeSizeEnd, 0);
+  }
+}
+
+// Reads and hashes the chunks of both files on `thread_count` threads.
+// Consecutive small chunks (e.g. the headers of many small boxes) are
+// grouped into one task.
+Result<std::monostate, std::string> HashChunks(
+    std::vector<FileToDiff const*> const& files,
+    std::vector<HashedFile*> const& hashed_files, size_t thread_count) {
+  using HashResult = Result<std::monostate, std::string>;
+  parallel::WorkStealingPool pool{thread_count};
+  size_t const worker_count = pool.GetWorkerCount();
+  // Each worker reads through its own streams, so workers never contend on a
+  // stream's position.
+  std::vector<std::vector<AP4_ByteStream*>> worker_streams(
+      files.size(), std::vector<AP4_ByteStream*>(worker_count, nullptr));
+  std::vector<std::vector<uint8_t>> worker_buffers(worker_count);
+  std::atomic<bool> open_failed{false};
+  std::atomic<bool> read_failed{false};
+
+  for (size_t file_index = 0; file_index < files.size(); ++file_index) {
+    std::vector<HashChunk>& chunks = hashed_files.at(file_index)->chunks;
+    size_t first_chunk = 0;
+    while (first_chunk < chunks.size()) {
+      size_t end_chunk = first_chunk + 1;
+      uint64_t task_size = chunks.at(first_chunk).size;
+      while (end_chunk < chunks.size() &&
+             task_size + chunks.at(end_chunk).size <= kChunkSize) {
+        task_size += chunks.at(end_chunk).size;
+        ++end_chunk;
+      }
+      pool.Submit([&, file_index, first_chunk,
+                   end_chunk](size_t worker_index) {
+        AP4_ByteStream*& stream =
+            worker_streams.at(file_index).at(worker_index);
+        if (stream == nullptr &&
+            AP4_FAILED(AP4_FileByteStream::Create(
+                files.at(file_index)->file_name,
+                AP4_FileByteStream::STREAM_MODE_READ, stream))) {
+          stream = nullptr;
+          open_failed = true;
+          return;
+        }
+        std::vector<uint8_t>& buffer = worker_buffers.at(worker_index);
+        for (size_t i = first_chunk; i < end_chunk; ++i) {
+          HashChunk& chunk = chunks.at(i);
+          buffer.resize(chunk.size);
+          if (AP4_FAILED(stream->Seek(chunk.offset)) ||
+              AP4_FAILED(stream->Read(buffer.data(), chunk.size))) {
+            read_failed = true;
+            return;
+          }
+          if (chunk.masks_size_field) {
+            MaskSizeField(buffer.data(), buffer.size());
+          }
+          chunk.hash = HashBytes(buffer.data(), buffer.size());
+        }
+      });
+      first_chunk = end_chunk;
+    }
+  }
+  pool.Wait();
+
+  for (std::vector<AP4_ByteStream*> const& streams : worker_streams) {
+    for (AP4_ByteStream* stream : streams) {
+      if (stream != nullptr) {
+        stream->Release();
+      }
+    }
+  }
+  if (open_failed) {
+    return HashResult::Err("Could not open the files to compare.");
+  }
+  if (read_failed) {
+    return HashResult::Err(
+        "Failed to read the files to compare, they may have changed since "
+        "they were opened.");
+  }
+  return HashResult::Ok({});
+}
+
+// Combines the chunk hashes into node hashes, children before parents.
+void HashNodes(HashedFile& file) {
+  for (auto node = file.nodes.rbegin(); node != file.nodes.rend(); ++node) {
+    uint64_t contents_hash = 0;
+    for (size_t chunk_index : node->chunks) {
+      contents_hash =
+          CombineHashes(contents_hash, file.chunks.at(chunk_index).hash);
+    }
+    node->contents_hash = contents_hash;
+    uint64_t subtree_hash = contents_hash;
+    for (size_t child_index : node->children) {
+      subtree_hash =
+          CombineHashes(subtree_hash, file.nodes.at(child_index).subtree_hash);
+    }
+    node->subtree_hash = subtree_hash;
+  }
+}
+
+// Matches the children `left_nodes` of a left atom with the children
+// `right_nodes` of a right atom, adding the differences to `differences` and
+// walking into the children that changed.
+void DiffChildren(HashedFile const& left, std::vector<size_t> const& left_nodes,
+                  HashedFile const& right,
+                  std::vector<size_t> const& right_nodes,
+                  std::vector<Difference>& differences) {
+  // Pair children with equal subtrees, first come first served.
+  std::unordered_map<uint64_t, std::deque<size_t>> right_by_hash;
+  for (size_t i = 0; i < right_nodes.size(); ++i) {
+    right_by_hash[right.nodes.at(right_nodes.at(i)).subtree_hash].push_back(i);
+  }
+  std::vector<bool> left_matched(left_nodes.size(), false);
+  std::vector<bool> right_matched(right_nodes.size(), false);
+  for (size_t i = 0; i < left_nodes.size(); ++i) {
+    auto it = right_by_hash.find(left.nodes.at(left_nodes.at(i)).subtree_hash);
+    if (it != right_by_hash.end() && !it->second.empty()) {
+      right_matched.at(it->second.front()) = true;
+      it->second.pop_front();
+      left_matched.at(i) = true;
+    }
+  }
+  // Pair the rest by type, in order. These are the changed atoms.
+  std::unordered_map<QString, std::deque<size_t>> right_by_type;
+  for (size_t i = 0; i < right_nodes.size(); ++i) {
+    if (!right_matched.at(i)) {
+      right_by_type[right.nodes.at(right_nodes.at(i)).atom->GetName()]
+          .push_back(i);
+    }
+  }
+  for (size_t i = 0; i < left_nodes.size(); ++i) {
+    if (left_matched.at(i)) {
+      continue;
+    }
+    HashNode const& left_node = left.nodes.at(left_nodes.at(i));
+    auto it = right_by_type.find(left_node.atom->GetName());
+    if (it == right_by_type.end() || it->second.empty()) {
+      differences.push_back(
+          Difference{DifferenceKind::kRemoved, left_node.atom, nullptr});
+      continue;
+    }
+    size_t const right_index = it->second.front();
+    it->second.pop_front();
+    right_matched.at(right_index) = true;
+    HashNode const& right_node = right.nodes.at(right_nodes.at(right_index));
+    differences.push_back(
+        Difference{DifferenceKind::kChanged, left_node.atom, right_node.atom,
+                   left_node.contents_hash != right_node.contents_hash});
+    DiffChildren(left, left_node.children, right, right_node.children,
+                 differences);
+  }
+  for (size_t i = 0; i < right_nodes.size(); ++i) {
+    if (!right_matched.at(i)) {
+      differences.push_back(
+          Difference{DifferenceKind::kAdded, nullptr,
+                     right.nodes.at(right_nodes.at(i)).atom});
+    }
+  }
+}
+}  // namespace
+
+Result<StructuralDiff, std::string> DiffFiles(FileToDiff const& left,
+                                              FileToDiff const& right,
+                                              size_t thread_count /* = 0 */) {
+  using DiffResult = Result<StructuralDiff, std::string>;
+  Result<HashedFile, std::string> left_result = BuildHashNodes(left);
+  if (left_result.IsErr()) {
+    left_result.MarkErrorHandled();
+    return DiffResult::Err(std::move(left_result).GetErr());
+  }
+  Result<HashedFile, std::string> right_result = BuildHashNodes(right);
+  if (right_result.IsErr()) {
+    right_result.MarkErrorHandled();
+    return DiffResult::Err(std::move(right_result).GetErr());
+  }
+  HashedFile left_file = std::move(left_result).GetOk();
+  HashedFile right_file = std::move(right_result).GetOk();
+
+  Result<std::monostate, std::string> hash_result =
+      HashChunks({&left, &right}, {&left_file, &right_file}, thread_count);
+  if (hash_result.IsErr()) {
+    hash_result.MarkErrorHandled();
+    return DiffResult::Err(std::move(hash_result).GetErr());
+  }
+  HashNodes(left_file);
+  HashNodes(right_file);
+
+  StructuralDiff diff;
+  for (HashedFile const* file : {&left_file, &right_file}) {
+    for (HashChunk const& chunk : file->chunks) {
+      diff.bytes_hashed += chunk.size;
+    }
+  }
+  DiffChildren(left_file, left_file.top_level_nodes, right_file,
+               right_file.top_level_nodes, diff.differences);
+  return DiffResult::Ok(std::move(diff));
+}
+
+}  // namespace mp4_manipulator::analysis
@@ -0,0 +1,364 @@
+#include "analysis/track_statistics.h"
+
+#include <algorithm>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
+
+#include "analysis/atom_lookup.h"
+#include "parallel/work_stealing_pool.h"
+
+namespace mp4_manipulator::analysis {
+namespace {
+// Set in fragment sample flags for samples that aren't sync samples, see ISO
+// 14496-12's Track Extends Box.
+constexpr uint32_t kSampleIsNonSyncFlag = 0x00010000;
+
+// Bitrate over time is kept for at most this many seconds (about 12 days), so
+// a corrupt decode time can't make it huge. Later samples count towards the
+// last second.
+constexpr size_t kMaxBitrateSeconds = 1 << 20;
+
+// A track's samples, one array per property, so each statistic is a pass over
+// one or two contiguous arrays.
+struct SampleArrays {
+  std::vector<uint32_t> sizes;
+  std::vector<uint64_t> decode_times;
+  std::vector<uint32_t> durations;
+  std::vector<int32_t> composition_offsets;
+  std::vector<uint8_t> is_sync;
+
+  void Resize(size_t count) {
+    sizes.resize(count);
+    decode_times.resize(count);
+    durations.resize(count);
+    composition_offsets.resize(count);
+    is_sync.resize(count);
+  }
+};
+
+// The defaults trex gives a track's fragment samples.
+struct FragmentDefaults {
+  uint32_t duration{0};
+  uint32_t size{0};
+  uint32_t flags{0};
+};
+
+// Appends the samples of a trak's sample tables to `samples`.
+void ExpandSampleTables(AtomOrDescriptorBase const& trak,
+                        SampleArrays& samples) {
+  AP4_SttsAtom* const stts = FindDescendantAp4Atom<AP4_SttsAtom>(trak);
+  AP4_StszAtom* const stsz = FindDescendantAp4Atom<AP4_StszAtom>(trak);
+  AP4_Stz2Atom* const stz2 = FindDescendantAp4Atom<AP4_Stz2Atom>(trak);
+  if (stts == nullptr || (stsz == nullptr && stz2 == nullptr)) {
+    return;
+  }
+  size_t const count =
+      stsz != nullptr ? stsz->GetSampleCount() : stz2->GetSampleCount();
+  samples.Resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    AP4_Size size = 0;
+    auto const sample = static_cast<AP4_Ordinal>(i + 1);
+    if (stsz != nullptr) {
+      stsz->GetSampleSize(sample, size);
+    } else {
+      stz2->GetSampleSize(sample, size);
+    }
+    samples.sizes[i] = size;
+  }
+
+  // The run length encoded tables are expanded with fills, which leaves the
+  // passes below free of branches on table entries.
+  size_t next = 0;
+  AP4_Array<AP4_SttsTableEntry>& time_entries = stts->GetEntries();
+  for (AP4_Ordinal i = 0; i < time_entries.ItemCount() && next < count;
+       ++i) {
+    size_t const run = std::min<size_t>(time_entries[i].m_SampleCount,
+                                        count - next);
+    std::fill_n(samples.durations.begin() + next, run,
+                time_entries[i].m_SampleDuration);
+    next += run;
+  }
+  std::exclusive_scan(samples.durations.begin(), samples.durations.end(),
+                      samples.decode_times.begin(), uint64_t{0});
+
+  if (AP4_CttsAtom* ctts = FindDescendantAp4Atom<AP4_CttsAtom>(trak)) {
+    next = 0;
+    AP4_Array<AP4_CttsTableEntry>& offset_entries = ctts->GetEntries();
+    for (AP4_Ordinal i = 0; i < offset_entries.ItemCount() && next < count;
+         ++i) {
+      size_t const run = std::min<size_t>(offset_entries[i].m_SampleCount,
+                                          count - next);
+      // Version 1 offsets are signed, and version 0 offsets past 2^31 are
+      // treated the same way by players.
+      std::fill_n(samples.composition_offsets.begin() + next, run,
+                  static_cast<int32_t>(offset_entries[i].m_SampleOffset));
+      next += run;
+    }
+  }
+
+  // Without stss every sample is a sync sample.
+  if (AP4_StssAtom* stss = FindDescendantAp4Atom<AP4_StssAtom>(trak)) {
+    AP4_Array<AP4_UI32> const& sync_samples = stss->GetEntries();
+    for (AP4_Ordinal i = 0; i < sync_samples.ItemCount(); ++i) {
+      if (sync_samples[i] >= 1 && sync_samples[i] <= count) {
+        samples.is_sync[sync_samples[i] - 1] = 1;
+      }
+    }
+  } else {
+    std::fill(samples.is_sync.begin(), samples.is_sync.end(), 1);
+  }
+}
+
+// Appends the samples of the trafs for `track_id` in `moofs`, in order, to
+// `samples`.
+void ExpandFragments(std::vector<AtomOrDescriptorBase const*> const& moofs,
+                     uint32_t track_id, FragmentDefaults const& defaults,
+                     SampleArrays& samples) {
+  // Fragments without tfdt continue from the end of the previous fragment.
+  uint64_t next_decode_time =
+      samples.decode_times.empty()
+          ? 0
+          : samples.decode_times.back() + samples.durations.back();
+  for (AtomOrDescriptorBase const* moof : moofs) {
+    for (auto const& traf : moof->GetChildAtoms()) {
+      AP4_TfhdAtom* const tfhd = FindDescendantAp4Atom<AP4_TfhdAtom>(*traf);
+      if (!HasType(*traf, AP4_ATOM_TYPE_TRAF) || tfhd == nullptr ||
+          tfhd->GetTrackId() != track_id) {
+        continue;
+      }
+      uint32_t const tfhd_flags = tfhd->GetFlags();
+      uint32_t const default_duration =
+          (tfhd_flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_DURATION_PRESENT) != 0
+              ? tfhd->GetDefaultSampleDuration()
+              : defaults.duration;
+      uint32_t const default_size =
+          (tfhd_flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_SIZE_PRESENT) != 0
+              ? tfhd->GetDefaultSampleSize()
+              : defaults.size;
+      uint32_t const default_flags =
+          (tfhd_flags & AP4_TFHD_FLAG_DEFAULT_SAMPLE_FLAGS_PRESENT) != 0
+              ? tfhd->GetDefaultSampleFlags()
+              : defaults.flags;
+      if (AP4_TfdtAtom* tfdt = FindDescendantAp4Atom<AP4_TfdtAtom>(*traf)) {
+        next_decode_time = tfdt->GetBaseMediaDecodeTime();
+      }
+
+      for (auto const& trun_atom : traf->GetChildAtoms()) {
+        AP4_TrunAtom* const trun = GetAp4AtomAs<AP4_TrunAtom>(*trun_atom);
+        if (trun == nullptr) {
+          continue;
+        }
+        uint32_t const flags = trun->GetFlags();
+        bool const has_durations =
+            (flags & AP4_TRUN_FLAG_SAMPLE_DURATION_PRESENT) != 0;
+        bool const has_sizes =
+            (flags & AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT) != 0;
+        bool const has_flags =
+            (flags & AP4_TRUN_FLAG_SAMPLE_FLAGS_PRESENT) != 0;
+        bool const has_offsets =
+            (flags & AP4_TRUN_FLAG_SAMPLE_COMPOSITION_TIME_OFFSET_PRESENT) !=
+            0;
+        bool const has_first_flags =
+            (flags & AP4_TRUN_FLAG_FIRST_SAMPLE_FLAGS_PRESENT) != 0;
+        AP4_Array<AP4_TrunAtom::Entry> const& entries = trun->GetEntries();
+        size_t const first = samples.sizes.size();
+        samples.Resize(first + entries.ItemCount());
+        for (AP4_Ordinal i = 0; i < entries.ItemCount(); ++i) {
+          AP4_TrunAtom::Entry const& entry = entries[i];
+          size_t const index = first + i;
+          uint32_t sample_flags =
+              has_flags ? entry.sample_flags : default_flags;
+          if (i == 0 && has_first_flags) {
+            sample_flags = trun->GetFirstSampleFlags();
+          }
+          samples.sizes[index] = has_sizes ? entry.sample_size : default_size;
+          samples.durations[index] =
+              has_durations ? entry.sample_duration : default_duration;
+          samples.composition_offsets[index] =
+              has_offsets
+                  ? static_cast<int32_t>(entry.sample_composition_time_offset)
+                  : 0;
+          samples.is_sync[index] = (sample_flags & kSampleIsNonSyncFlag) == 0;
+          samples.decode_times[index] = next_decode_time;
+          next_decode_time += samples.durations[index];
+        }
+      }
+    }
+  }
+}
+
+// Fills in the statistics of `statistics` that are computed from `samples`.
+void ComputeFromSamples(SampleArrays const& samples, double window,
+                        TrackStatistics& statistics) {
+  size_t const count = samples.sizes.size();
+  statistics.sample_count = count;
+  statistics.total_bytes = std::transform_reduce(
+      samples.sizes.begin(), samples.sizes.end(), uint64_t{0}, std::plus<>{},
+      [](uint32_t size) { return uint64_t{size}; });
+  if (count == 0 || statistics.timescale == 0) {
+    return;
+  }
+  double const timescale = statistics.timescale;
+  uint64_t const start = samples.decode_times.front();
+  uint64_t const end = samples.decode_times.back() + samples.durations.back();
+  statistics.duration = end > start ? (end - start) / timescale : 0;
+  if (statistics.duration > 0) {
+    statistics.average_bitrate =
+        statistics.total_bytes * 8.0 / statistics.duration;
+  }
+
+  // Bitrate over time, in one second bins of decode time.
+  size_t const bin_count =
+      std::min(static_cast<size_t>(statistics.duration) + 1,
+               kMaxBitrateSeconds);
+  std::vector<uint64_t> bin_bytes(bin_count, 0);
+  for (size_t i = 0; i < count; ++i) {
+    auto const bin = std::min<size_t>(
+        (samples.decode_times[i] - std::min(samples.decode_times[i], start)) /
+            statistics.timescale,
+        bin_count - 1);
+    bin_bytes[bin] += samples.sizes[i];
+  }
+  statistics.bitrate_over_time.resize(bin_count);
+  std::transform(bin_bytes.begin(), bin_bytes.end(),
+                 statistics.bitrate_over_time.begin(),
+                 [](uint64_t bytes) { return bytes * 8.0; });
+
+  // Peak bitrate over a sliding window starting at each sample, keeping a
+  // running total of the bytes in the window.
+  auto const window_ticks =
+      std::max<uint64_t>(1, static_cast<uint64_t>(window * timescale));
+  uint64_t window_bytes = 0;
+  uint64_t peak_bytes = 0;
+  size_t window_end = 0;
+  for (size_t window_start = 0; window_start < count; ++window_start) {
+    uint64_t const limit = samples.decode_times[window_start] + window_ticks;
+    while (window_end < count && samples.decode_times[window_end] < limit) {
+      window_bytes += samples.sizes[window_end];
+      ++window_end;
+    }
+    if (window_bytes > peak_bytes) {
+      peak_bytes = window_bytes;
+      statistics.peak_bitrate_time =
+          (samples.decode_times[window_start] - start) / timescale;
+    }
+    window_bytes -= samples.sizes[window_start];
+  }
+  statistics.peak_bitrate = peak_bytes * 8.0 / (window_ticks / timescale);
+
+  // Keyframe intervals.
+  statistics.keyframe_count = std::count(samples.is_sync.begin(),
+                                         samples.is_sync.end(), uint8_t{1});
+  std::optional<uint64_t> previous_keyframe_time;
+  uint64_t min_interval = UINT64_MAX;
+  uint64_t max_interval = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (samples.is_sync[i] == 0) {
+      continue;
+    }
+    if (previous_keyframe_time.has_value()) {
+      uint64_t const interval =
+          samples.decode_times[i] - previous_keyframe_time.value();
+      min_interval = std::min(min_interval, interval);
+      max_interval = std::max(max_interval, interval);
+    }
+    previous_keyframe_time = samples.decode_times[i];
+  }
+  if (statistics.keyframe_count > 1) {
+    auto const first_keyframe = static_cast<size_t>(
+        std::find(samples.is_sync.begin(), samples.is_sync.end(), 1) -
+        samples.is_sync.begin());
+    statistics.min_keyframe_interval = min_interval / timescale;
+    statistics.max_keyframe_interval = max_interval / timescale;
+    statistics.average_keyframe_interval =
+        (previous_keyframe_time.value() -
+         samples.decode_times[first_keyframe]) /
+        timescale / static_cast<double>(statistics.keyframe_count - 1);
+  }
+
+  // Composition offsets.
+  auto const [min_offset, max_offset] = std::minmax_element(
+      samples.composition_offsets.begin(), samples.composition_offsets.end());
+  statistics.min_composition_offset = *min_offset / timescale;
+  statistics.max_composition_offset = *max_offset / timescale;
+  statistics.late_sample_count =
+      std::count_if(samples.composition_offsets.begin(),
+                    samples.composition_offsets.end(),
+                    [](int32_t offset) { return offset < 0; });
+}
+
+TrackStatistics ComputeForTrack(
+    AtomOrDescriptorBase const& trak,
+    std::vector<AtomOrDescriptorBase const*> const& moofs,
+    std::unordered_map<uint32_t, FragmentDefaults> const& fragment_defaults,
+    double window) {
+  TrackStatistics statistics;
+  if (AP4_TkhdAtom* tkhd = FindDescendantAp4Atom<AP4_TkhdAtom>(trak)) {
+    statistics.track_id = tkhd->GetTrackId();
+  }
+  if (AP4_MdhdAtom* mdhd = FindDescendantAp4Atom<AP4_MdhdAtom>(trak)) {
+    statistics.timescale = mdhd->GetTimeScale();
+  }
+  if (AP4_HdlrAtom* hdlr = FindDescendantAp4Atom<AP4_HdlrAtom>(trak)) {
+    char four_cc[5] = {};
+    AP4_FormatFourChars(four_cc, hdlr->GetHandlerType());
+    statistics.handler_type = four_cc;
+  }
+
+  SampleArrays samples;
+  ExpandSampleTables(trak, samples);
+  if (!moofs.empty()) {
+    auto const it = fragment_defaults.find(statistics.track_id);
+    ExpandFragments(moofs, statistics.track_id,
+                    it != fragment_defaults.end() ? it->second
+                                                  : FragmentDefaults{},
+                    samples);
+  }
+  ComputeFromSamples(samples, window, statistics);
+  return statistics;
+}
+}  // namespace
+
+std::vector<TrackStatistics> ComputeTrackStatistics(
+    AtomHolder& atoms,
+    double peak_bitrate_window /* = kDefaultPeakBitrateWindow */,
+    size_t thread_count /* = 0 */) {
+  std::vector<AtomOrDescriptorBase const*> traks;
+  std::vector<AtomOrDescriptorBase const*> moofs;
+  std::unordered_map<uint32_t, FragmentDefaults> fragment_defaults;
+  for (auto const& atom : atoms.GetTopLevelAtoms()) {
+    if (HasType(*atom, AP4_ATOM_TYPE_MOOF)) {
+      moofs.push_back(atom.get());
+    } else if (HasType(*atom, AP4_ATOM_TYPE_MOOV)) {
+      for (auto const& child : atom->GetChildAtoms()) {
+        if (HasType(*child, AP4_ATOM_TYPE_TRAK)) {
+          traks.push_back(child.get());
+        } else if (HasType(*child, AP4_ATOM_TYPE_MVEX)) {
+          for (auto const& trex_atom : child->GetChildAtoms()) {
+            if (AP4_TrexAtom* trex = GetAp4AtomAs<AP4_TrexAtom>(*trex_atom)) {
+              fragment_defaults[trex->GetTrackId()] = FragmentDefaults{
+                  trex->GetDefaultSampleDuration(),
+                  trex->GetDefaultSampleSize(),
+                  trex->GetDefaultSampleFlags()};
+            }
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<TrackStatistics> statistics(traks.size());
+  parallel::WorkStealingPool pool{thread_count};
+  for (size_t i = 0; i < traks.size(); ++i) {
+    pool.Submit([&, i](size_t /* worker_index */) {
+      statistics.at(i) = ComputeForTrack(*traks.at(i), moofs,
+                                         fragment_defaults,
+                                         peak_bitrate_window);
+    });
+  }
+  pool.Wait();
+  return statistics;
+}
+
+}  // namespace mp4_manipulator::analysis
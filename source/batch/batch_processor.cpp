@@ -0,0 +1,451 @@
+#include "batch/batch_processor.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSet>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+
+#include "analysis/sample_reference_verifier.h"
+#include "batch/summary_scan.h"
+#include "extraction/track_extraction.h"
+#include "parallel/work_stealing_pool.h"
+#include "parsing/box_header_scanner.h"
+#include "parsing/editing_processor.h"
+#include "parsing/file_utils.h"
+#include "parsing/resource_deleters.h"
+
+namespace mp4_manipulator::batch {
+JobResult Failure(QString message) {
+  JobResult result;
+  result.message = std::move(message);
+  return result;
+}
+
+namespace {
+std::optional<std::unique_ptr<AtomHolder>> ReadFile(QString const& file_name) {
+  QByteArray const file_name_bytes = QFile::encodeName(file_name);
+  // Files are already read in parallel, so read each on one thread.
+  return utility::ReadAtoms(file_name_bytes.constData(), /*thread_count=*/1);
+}
+
+// Returns the path of `output_name` in the output directory, creating any
+// directories it needs.
+QString MakeOutputPath(Options const& options, QString const& output_name) {
+  QString const path = QDir{options.output_directory}.filePath(output_name);
+  QDir{}.mkpath(QFileInfo{path}.absolutePath());
+  return path;
+}
+
+// Appends `atom` and its descendants whose type is in `types` to `matches`.
+void CollectAtomsOfTypes(AtomOrDescriptorBase const& atom,
+                         std::vector<AP4_Atom::Type> const& types,
+                         std::vector<AP4_Atom*>& matches) {
+  AP4_Atom* ap4_atom = atom.GetAp4Atom();
+  if (ap4_atom != nullptr && std::find(types.begin(), types.end(),
+                                       ap4_atom->GetType()) != types.end()) {
+    matches.push_back(ap4_atom);
+  }
+  for (auto const& child : atom.GetChildAtoms()) {
+    CollectAtomsOfTypes(*child, types, matches);
+  }
+}
+
+JobResult Strip(Job const& job, Options const& options) {
+  std::optional<std::unique_ptr<AtomHolder>> holder =
+      ReadFile(job.input_file_name);
+  if (!holder.has_value()) {
+    return Failure("Failed to read the file.");
+  }
+
+  EditingProcessor processor;
+  std::unique_ptr<RemoveAtomsOfTypesCommand> command =
+      std::make_unique<RemoveAtomsOfTypesCommand>(options.atom_types);
+  RemoveAtomsOfTypesCommand const* remove_command = command.get();
+  processor.AddCommand(std::move(command));
+  Result<std::monostate, std::string> edit_result =
+      holder.value()->ApplyEdits(processor);
+  if (edit_result.IsErr()) {
+    edit_result.MarkErrorHandled();
+    return Failure(QString::fromStdString(edit_result.GetErr()));
+  }
+
+  QString const output_file_name = MakeOutputPath(options, job.output_name);
+  QByteArray const output_file_name_bytes = QFile::encodeName(output_file_name);
+  Result<std::monostate, std::string> save_result =
+      holder.value()->SaveAtoms(output_file_name_bytes.constData());
+  if (save_result.IsErr()) {
+    save_result.MarkErrorHandled();
+    return Failure(QString::fromStdString(save_result.GetErr()));
+  }
+
+  JobResult result;
+  result.succeeded = true;
+  result.message = QStringLiteral("Removed %1 atoms.")
+                       .arg(remove_command->GetRemovedCount());
+  result.output_file_names.append(output_file_name);
+  result.details.insert("removed_count",
+                        static_cast<qint64>(remove_command->GetRemovedCount()));
+  return result;
+}
+
+JobResult Dump(Job const& job, Options const& options) {
+  std::optional<std::unique_ptr<AtomHolder>> holder =
+      ReadFile(job.input_file_name);
+  if (!holder.has_value()) {
+    return Failure("Failed to read the file.");
+  }
+
+  std::vector<AP4_Atom*> matches;
+  for (auto const& atom : holder.value()->GetTopLevelAtoms()) {
+    CollectAtomsOfTypes(*atom, options.atom_types, matches);
+  }
+
+  JobResult result;
+  QHash<AP4_Atom::Type, int> type_counts;
+  for (AP4_Atom* atom : matches) {
+    // E.g. "dir/video.mp4.pssh.0.bin".
+    QString const output_name =
+        QStringLiteral("%1.%2.%3.bin")
+            .arg(job.output_name,
+                 QString::fromStdString(
+                     utility::FourCcToString(atom->GetType())))
+            .arg(type_counts[atom->GetType()]++);
+    QString const output_file_name = MakeOutputPath(options, output_name);
+    QByteArray const output_file_name_bytes =
+        QFile::encodeName(output_file_name);
+    Result<std::monostate, std::string> dump_result =
+        utility::DumpAtom(output_file_name_bytes.constData(), *atom);
+    if (dump_result.IsErr()) {
+      dump_result.MarkErrorHandled();
+      return Failure(QString::fromStdString(dump_result.GetErr()));
+    }
+    result.output_file_names.append(output_file_name);
+  }
+  result.succeeded = true;
+  result.message = QStringLiteral("Dumped %1 atoms.").arg(matches.size());
+  return result;
+}
+
+JobResult Extract(Job const& job, Options const& options) {
+  std::optional<std::unique_ptr<AtomHolder>> holder =
+      ReadFile(job.input_file_name);
+  if (!holder.has_value()) {
+    return Failure("Failed to read the file.");
+  }
+
+  // E.g. "dir/video.mp4.track1.h264".
+  QByteArray const output_prefix =
+      QFile::encodeName(MakeOutputPath(options, job.output_name));
+  QByteArray const file_name_bytes = QFile::encodeName(job.input_file_name);
+  // Files are already extracted in parallel, so extract each file's tracks
+  // on one thread.
+  Result<std::vector<extraction::ExtractedTrack>, std::string> extract_result =
+      extraction::ExtractTracks(file_name_bytes.constData(), *holder.value(),
+                                output_prefix.toStdString(), 1);
+  if (extract_result.IsErr()) {
+    extract_result.MarkErrorHandled();
+    return Failure(QString::fromStdString(extract_result.GetErr()));
+  }
+  std::vector<extraction::ExtractedTrack> const tracks =
+      std::move(extract_result).GetOk();
+
+  JobResult result;
+  QStringList problems;
+  qint64 bytes_written = 0;
+  for (extraction::ExtractedTrack const& track : tracks) {
+    result.output_file_names.append(
+        QFile::decodeName(track.output_file_name.c_str()));
+    bytes_written += static_cast<qint64>(track.bytes_written);
+    if (!track.error.empty()) {
+      problems.append(QStringLiteral("Track %1: %2")
+                          .arg(track.track_id)
+                          .arg(QString::fromStdString(track.error)));
+    }
+  }
+  result.succeeded = problems.empty();
+  result.message =
+      problems.empty()
+          ? QStringLiteral("Extracted %1 tracks.").arg(tracks.size())
+          : problems.join(' ');
+  result.details.insert("track_count", static_cast<qint64>(tracks.size()));
+  result.details.insert("bytes_written", bytes_written);
+  return result;
+}
+
+JobResult Validate(Job const& job) {
+  QByteArray const file_name_bytes = QFile::encodeName(job.input_file_name);
+  AP4_ByteStream* raw_stream = nullptr;
+  if (AP4_FAILED(AP4_FileByteStream::Create(
+          file_name_bytes.constData(), AP4_FileByteStream::STREAM_MODE_READ,
+          raw_stream))) {
+    return Failure("Failed to open the file.");
+  }
+  utility::ByteStreamPointer stream{raw_stream};
+
+  // Check the top level structure before parsing, as the parser skips over
+  // some problems (e.g. truncated boxes) that we want to report.
+  Result<std::vector<utility::BoxHeader>, std::string> scan_result =
+      utility::ScanTopLevelBoxHeaders(*stream);
+  if (scan_result.IsErr()) {
+    scan_result.MarkErrorHandled();
+    return Failure(QString::fromStdString(scan_result.GetErr()));
+  }
+  std::vector<utility::BoxHeader> const headers =
+      std::move(scan_result).GetOk();
+
+  QStringList problems;
+  auto const has_box = [&headers](AP4_Atom::Type type) {
+    return std::any_of(
+        headers.begin(), headers.end(),
+        [type](utility::BoxHeader const& header) {
+          return header.type == type;
+        });
+  };
+  if (!has_box(AP4_ATOM_TYPE_FTYP) && !has_box(AP4_ATOM_TYPE_STYP)) {
+    problems.append("No ftyp or styp box.");
+  }
+  if (!has_box(AP4_ATOM_TYPE_MOOV) && !has_box(AP4_ATOM_TYPE_MOOF)) {
+    problems.append("No moov or moof box.");
+  }
+
+  stream->Seek(0);
+  std::optional<std::unique_ptr<AtomHolder>> holder =
+      utility::ReadAtoms(stream.get());
+  if (!holder.has_value()) {
+    problems.append("Failed to parse the file.");
+  } else if (holder.value()->GetTopLevelAtoms().size() != headers.size()) {
+    problems.append(QStringLiteral("Parsed %1 top level boxes, expected %2.")
+                        .arg(holder.value()->GetTopLevelAtoms().size())
+                        .arg(headers.size()));
+  }
+
+  JobResult result;
+  if (holder.has_value()) {
+    // Jobs already run in parallel, so each verifies on a single thread.
+    Result<analysis::SampleVerification, std::string> verify_result =
+        analysis::VerifySampleReferences(*holder.value(), 1);
+    if (verify_result.IsErr()) {
+      verify_result.MarkErrorHandled();
+      problems.append(QString::fromStdString(verify_result.GetErr()));
+    } else {
+      analysis::SampleVerification const verification =
+          std::move(verify_result).GetOk();
+      // Unreferenced media data is reported, but isn't a failure.
+      auto const first_error = std::find_if(
+          verification.issues.begin(), verification.issues.end(),
+          [](analysis::SampleIssue const& issue) {
+            return analysis::IsError(issue.kind);
+          });
+      if (first_error != verification.issues.end()) {
+        problems.append(
+            QStringLiteral("%1 sample reference problems, the first: %2")
+                .arg(verification.error_count)
+                .arg(QString::fromStdString(first_error->description)));
+      }
+      result.details.insert(
+          "sample_count", static_cast<qint64>(verification.sample_count));
+      result.details.insert(
+          "sample_reference_errors",
+          static_cast<qint64>(verification.error_count));
+      result.details.insert(
+          "unreferenced_media_data_ranges",
+          static_cast<qint64>(verification.unreferenced_range_count));
+    }
+  }
+
+  result.succeeded = problems.empty();
+  result.message = problems.empty() ? "Valid." : problems.join(' ');
+  result.details.insert("box_count", static_cast<qint64>(headers.size()));
+  return result;
+}
+}  // namespace
+
+Result<std::vector<AP4_Atom::Type>, std::string> ParseAtomTypes(
+    QString const& types) {
+  using ParseResult = Result<std::vector<AP4_Atom::Type>, std::string>;
+  std::vector<AP4_Atom::Type> parsed_types;
+  for (QString const& type : types.split(',', Qt::SkipEmptyParts)) {
+    QByteArray const four_cc = type.trimmed().toLatin1();
+    if (four_cc.size() != 4) {
+      return ParseResult::Err("\"" + type.toStdString() +
+                              "\" is not a four cc.");
+    }
+    parsed_types.push_back(AP4_Atom::TypeFromString(four_cc.constData()));
+  }
+  if (parsed_types.empty()) {
+    return ParseResult::Err("No atom types given.");
+  }
+  return ParseResult::Ok(std::move(parsed_types));
+}
+
+Result<std::vector<Job>, std::string> CollectJobs(
+    QStringList const& inputs, QString const& file_list_name,
+    QStringList const& name_filters) {
+  using CollectResult = Result<std::vector<Job>, std::string>;
+  std::vector<Job> jobs;
+  auto const add_file = [&jobs](QString const& file_name) {
+    jobs.push_back({file_name, QFileInfo{file_name}.fileName()});
+  };
+
+  for (QString const& input : inputs) {
+    QFileInfo const input_info{input};
+    if (input_info.isDir()) {
+      QDir const directory{input};
+      QStringList file_names;
+      QDirIterator iterator{input, name_filters, QDir::Files,
+                            QDirIterator::Subdirectories};
+      while (iterator.hasNext()) {
+        file_names.append(iterator.next());
+      }
+      // Directory order varies between file systems, sort so runs (and their
+      // manifests) are reproducible.
+      file_names.sort();
+      for (QString const& file_name : file_names) {
+        jobs.push_back({file_name, directory.relativeFilePath(file_name)});
+      }
+    } else if (input_info.isFile()) {
+      add_file(input);
+    } else {
+      return CollectResult::Err(input.toStdString() + " does not exist.");
+    }
+  }
+
+  if (!file_list_name.isEmpty()) {
+    QFile file_list{file_list_name};
+    if (!file_list.open(QIODevice::ReadOnly | QIODevice::Text)) {
+      return CollectResult::Err("Could not open file list " +
+                                file_list_name.toStdString() + ".");
+    }
+    while (!file_list.atEnd()) {
+      QString const line = QString::fromUtf8(file_list.readLine()).trimmed();
+      if (line.isEmpty() || line.startsWith('#')) {
+        continue;
+      }
+      add_file(line);
+    }
+  }
+
+  // Files given individually are output under their file name, which may
+  // collide. Refuse rather than have one overwrite another.
+  QSet<QString> output_names;
+  for (Job const& job : jobs) {
+    if (output_names.contains(job.output_name)) {
+      return CollectResult::Err(
+          "More than one input would be written to " +
+          job.output_name.toStdString() +
+          ". Pass their directory instead to keep their paths distinct.");
+    }
+    output_names.insert(job.output_name);
+  }
+  return CollectResult::Ok(std::move(jobs));
+}
+
+JobResult RunJob(Job const& job, Options const& options) {
+  QElapsedTimer timer;
+  timer.start();
+  JobResult result;
+  switch (options.operation) {
+    case Operation::kStrip:
+      result = Strip(job, options);
+      break;
+    case Operation::kDump:
+      result = Dump(job, options);
+      break;
+    case Operation::kValidate:
+      result = Validate(job);
+      break;
+    case Operation::kSummary:
+      result = SummarizeFile(job);
+      break;
+    case Operation::kExtract:
+      result = Extract(job, options);
+      break;
+  }
+  result.elapsed_ms = timer.elapsed();
+  return result;
+}
+
+std::vector<JobResult> RunJobs(
+    std::vector<Job> const& jobs, Options const& options,
+    std::function<void(size_t finished_count)> const&
+        on_job_finished /* = {} */) {
+  if (options.operation == Operation::kSummary) {
+    // Summaries are bound by the latency of small reads rather than by
+    // parsing, so they batch their I/O across files instead.
+    return SummarizeFiles(jobs, options, on_job_finished);
+  }
+  std::vector<JobResult> results(jobs.size());
+
+  // Start the biggest files first, so a huge file picked up at the end
+  // doesn't leave one worker running long after the others have finished.
+  std::vector<qint64> file_sizes;
+  file_sizes.reserve(jobs.size());
+  for (Job const& job : jobs) {
+    file_sizes.push_back(QFileInfo{job.input_file_name}.size());
+  }
+  std::vector<size_t> order(jobs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&file_sizes](size_t a, size_t b) {
+                     return file_sizes.at(a) > file_sizes.at(b);
+                   });
+
+  std::mutex progress_mutex;
+  size_t finished_count = 0;
+  parallel::WorkStealingPool pool{options.worker_count};
+  for (size_t const index : order) {
+    // Each job opens its own streams, so workers don't share any I/O state.
+    pool.Submit([&, index](size_t /*worker_index*/) {
+      results.at(index) = RunJob(jobs.at(index), options);
+      if (on_job_finished) {
+        std::lock_guard<std::mutex> lock{progress_mutex};
+        on_job_finished(++finished_count);
+      }
+    });
+  }
+  pool.Wait();
+  return results;
+}
+
+Result<std::monostate, std::string> WriteManifest(
+    QString const& manifest_file_name, std::vector<Job> const& jobs,
+    std::vector<JobResult> const& results) {
+  assert(jobs.size() == results.size());
+  QFile manifest{manifest_file_name};
+  if (!manifest.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    return Result<std::monostate, std::string>::Err(
+        "Could not open manifest " + manifest_file_name.toStdString() + ".");
+  }
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    JobResult const& result = results.at(i);
+    QJsonObject line;
+    line.insert("file", jobs.at(i).input_file_name);
+    line.insert("status", result.succeeded ? "ok" : "error");
+    line.insert("message", result.message);
+    line.insert("outputs",
+                QJsonArray::fromStringList(result.output_file_names));
+    line.insert("elapsed_ms", result.elapsed_ms);
+    if (!result.details.isEmpty()) {
+      line.insert("details", result.details);
+    }
+    manifest.write(QJsonDocument{line}.toJson(QJsonDocument::Compact));
+    manifest.write("\n");
+  }
+  if (!manifest.flush()) {
+    return Result<std::monostate, std::string>::Err(
+        "Failed to write manifest " + manifest_file_name.toStdString() + ".");
+  }
+  return Result<std::monostate, std::string>::Ok();
+}
+
+}  // namespace mp4_manipulator::batch
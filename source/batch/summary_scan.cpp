@@ -0,0 +1,434 @@
+#include "batch/summary_scan.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "parallel/batched_file_reader.h"
+#include "parallel/work_stealing_pool.h"
+#include "parsing/box_header_scanner.h"
+#include "parsing/resource_deleters.h"
+
+namespace mp4_manipulator::batch {
+namespace {
+// How much of the start of a file is read first. Enough for ftyp and, in
+// faststart files, usually moov as well.
+constexpr uint32_t kInitialReadSize = 64 * 1024;
+// How much is read at each later box header. Boxes that follow within it
+// (e.g. the headers of small fragments) are parsed from the same read.
+constexpr uint32_t kHeaderReadSize = 4 * 1024;
+// Files with a larger moov fail rather than having it read into memory.
+constexpr uint64_t kMaxMoovSize = 256 * 1024 * 1024;
+// How much moov data is held at once, across the files being read and those
+// waiting to be summarized. Without this, every file in flight (and every
+// summary queued for a worker) could hold a moov of kMaxMoovSize.
+constexpr uint64_t kMoovMemoryBudget = 1024 * 1024 * 1024;
+// How many files are scanned at once. Each has one read in flight.
+constexpr size_t kMaxFilesInFlight = 256;
+
+// A semaphore on bytes, bounding the moov data held by SummarizeFiles.
+// Acquired on the reading thread, released by the workers that summarize.
+class MoovBudget {
+ public:
+  explicit MoovBudget(uint64_t capacity) : capacity_{capacity} {}
+
+  // Reserves `bytes` and returns true if they fit in what's left. A moov
+  // larger than the whole budget fits once nothing else is held, so it
+  // can't wait forever.
+  bool TryAcquire(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (used_ != 0 && used_ + bytes > capacity_) {
+      return false;
+    }
+    used_ += bytes;
+    return true;
+  }
+
+  void Release(uint64_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      assert(bytes <= used_);
+      used_ -= bytes;
+    }
+    released_.notify_all();
+  }
+
+  // Blocks until `bytes` would fit, see TryAcquire.
+  void WaitForRoom(uint64_t bytes) {
+    std::unique_lock<std::mutex> lock{mutex_};
+    released_.wait(lock,
+                   [&] { return used_ == 0 || used_ + bytes <= capacity_; });
+  }
+
+  [[nodiscard]] bool IsExhausted() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return used_ >= capacity_;
+  }
+
+ private:
+  uint64_t const capacity_;
+  mutable std::mutex mutex_;
+  std::condition_variable released_;
+  uint64_t used_{0};
+};
+
+// What a summary is built from.
+struct FileLayout {
+  std::vector<utility::BoxHeader> headers;
+  // The bytes of the first moov, if the file has one.
+  std::vector<uint8_t> moov;
+};
+
+// Returns the duration of the presentation in seconds, preferring the
+// fragment duration in mehd, as mvhd only covers the initial samples of a
+// fragmented file. Returns std::nullopt if the duration isn't known.
+std::optional<double> GetDurationSeconds(AP4_ContainerAtom& moov) {
+  AP4_MvhdAtom* mvhd =
+      AP4_DYNAMIC_CAST(AP4_MvhdAtom, moov.GetChild(AP4_ATOM_TYPE_MVHD));
+  if (mvhd == nullptr || mvhd->GetTimeScale() == 0) {
+    return std::nullopt;
+  }
+  uint64_t duration = mvhd->GetDuration();
+  AP4_MehdAtom* mehd =
+      AP4_DYNAMIC_CAST(AP4_MehdAtom, moov.FindChild("mvex/mehd"));
+  if (mehd != nullptr && mehd->GetDuration() != 0) {
+    duration = mehd->GetDuration();
+  }
+  if (duration == 0) {
+    return std::nullopt;
+  }
+  return static_cast<double>(duration) / mvhd->GetTimeScale();
+}
+
+JobResult SummarizeLayout(FileLayout const& layout) {
+  QJsonArray boxes;
+  qint64 fragment_count = 0;
+  for (utility::BoxHeader const& header : layout.headers) {
+    QJsonObject box;
+    box.insert("type", QString::fromStdString(
+                           utility::FourCcToString(header.type)));
+    box.insert("offset", static_cast<qint64>(header.offset));
+    box.insert("size", static_cast<qint64>(header.size));
+    boxes.append(box);
+    if (header.type == AP4_ATOM_TYPE_MOOF) {
+      ++fragment_count;
+    }
+  }
+
+  JobResult result;
+  qint64 track_count = 0;
+  if (!layout.moov.empty()) {
+    utility::ByteStreamPointer moov_stream{
+        new AP4_MemoryByteStream{layout.moov.data(),
+                                 static_cast<AP4_Size>(layout.moov.size())}};
+    AP4_Atom* moov_atom = nullptr;
+    AP4_AtomFactory atom_factory;
+    if (AP4_FAILED(
+            atom_factory.CreateAtomFromStream(*moov_stream, moov_atom))) {
+      return Failure("Failed to parse moov.");
+    }
+    std::unique_ptr<AP4_Atom> const moov_owner{moov_atom};
+    AP4_ContainerAtom* moov = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moov_atom);
+    if (moov == nullptr) {
+      return Failure("Failed to parse moov.");
+    }
+    for (AP4_List<AP4_Atom>::Item* item = moov->GetChildren().FirstItem();
+         item != nullptr; item = item->GetNext()) {
+      if (item->GetData()->GetType() == AP4_ATOM_TYPE_TRAK) {
+        ++track_count;
+      }
+    }
+    std::optional<double> const duration = GetDurationSeconds(*moov);
+    if (duration.has_value()) {
+      result.details.insert("duration_seconds", duration.value());
+    }
+  }
+
+  result.succeeded = true;
+  result.details.insert("boxes", boxes);
+  result.details.insert("track_count", track_count);
+  result.details.insert("fragment_count", fragment_count);
+  return result;
+}
+
+// A file being scanned by SummarizeFiles.
+struct FileScan {
+  int file_descriptor{-1};
+  uint64_t file_size{0};
+  // Where the next box header starts.
+  uint64_t next_offset{0};
+  // The read in flight.
+  uint64_t read_offset{0};
+  uint32_t read_length{0};
+  bool is_reading_moov{false};
+  // Set while the scan waits for room in the MoovBudget to read its moov.
+  std::optional<utility::BoxHeader> moov_waiting_for_budget;
+  // What the scan holds of the MoovBudget.
+  uint64_t reserved_moov_bytes{0};
+  FileLayout layout;
+  // Set if the scan failed.
+  std::optional<QString> error;
+  QElapsedTimer timer;
+};
+
+void SubmitRead(parallel::BatchedFileReader& reader, size_t job_index,
+                FileScan& scan, uint64_t offset, uint64_t length) {
+  scan.read_offset = offset;
+  scan.read_length = static_cast<uint32_t>(length);
+  reader.Submit({job_index, scan.file_descriptor, offset, scan.read_length});
+}
+
+// Reserves `moov`'s size in `budget` and submits a read of it.
+void SubmitMoovRead(parallel::BatchedFileReader& reader, size_t job_index,
+                    FileScan& scan, utility::BoxHeader const& moov) {
+  scan.reserved_moov_bytes = moov.size;
+  scan.is_reading_moov = true;
+  SubmitRead(reader, job_index, scan, moov.offset, moov.size);
+}
+
+// Parses the headers in a completed read of `scan`'s file, and submits the
+// next read if more are needed. Returns true once the scan has finished,
+// with `scan.error` set if it failed. Returns false without submitting a
+// read if the moov doesn't fit in `budget`, with
+// `scan.moov_waiting_for_budget` set.
+bool ContinueScan(parallel::BatchedFileReader& reader, MoovBudget& budget,
+                  size_t job_index, FileScan& scan,
+                  parallel::ReadCompletion&& completion) {
+  if (completion.error != 0) {
+    scan.error =
+        QStringLiteral("Failed to read at %1: %2")
+            .arg(scan.read_offset)
+            .arg(QString::fromLocal8Bit(std::strerror(completion.error)));
+    return true;
+  }
+  if (completion.data.size() < scan.read_length) {
+    scan.error = "The file got shorter while being read.";
+    return true;
+  }
+
+  if (scan.is_reading_moov) {
+    scan.layout.moov = std::move(completion.data);
+    scan.is_reading_moov = false;
+  } else {
+    std::vector<uint8_t> const& data = completion.data;
+    while (scan.next_offset < scan.file_size) {
+      size_t const position =
+          static_cast<size_t>(scan.next_offset - scan.read_offset);
+      if (position >= data.size()) {
+        break;
+      }
+      Result<std::optional<utility::BoxHeader>, std::string> parse_result =
+          utility::ParseBoxHeader(data.data() + position,
+                                  data.size() - position, scan.next_offset,
+                                  scan.file_size);
+      if (parse_result.IsErr()) {
+        parse_result.MarkErrorHandled();
+        scan.error = QString::fromStdString(parse_result.GetErr());
+        return true;
+      }
+      if (!parse_result.GetOk().has_value()) {
+        // The header straddles the end of the read.
+        break;
+      }
+      utility::BoxHeader const header = parse_result.GetOk().value();
+      scan.layout.headers.push_back(header);
+      scan.next_offset += header.size;
+      if (header.type != AP4_ATOM_TYPE_MOOV || !scan.layout.moov.empty()) {
+        continue;
+      }
+      if (header.size > kMaxMoovSize) {
+        scan.error = "moov is too large to summarize.";
+        return true;
+      }
+      if (!budget.TryAcquire(header.size)) {
+        // Read moov (and carry on after it) once summaries in progress
+        // release enough memory.
+        scan.moov_waiting_for_budget = header;
+        return false;
+      }
+      if (header.size <= data.size() - position) {
+        scan.reserved_moov_bytes = header.size;
+        scan.layout.moov.assign(data.begin() + position,
+                                data.begin() + position + header.size);
+      } else {
+        // Nothing in this read follows moov, so continue after reading it.
+        SubmitMoovRead(reader, job_index, scan, header);
+        return false;
+      }
+    }
+  }
+
+  if (scan.next_offset >= scan.file_size) {
+    return true;
+  }
+  SubmitRead(reader, job_index, scan, scan.next_offset,
+             std::min<uint64_t>(kHeaderReadSize,
+                                scan.file_size - scan.next_offset));
+  return false;
+}
+}  // namespace
+
+JobResult SummarizeFile(Job const& job) {
+  QByteArray const file_name_bytes = QFile::encodeName(job.input_file_name);
+  AP4_ByteStream* raw_stream = nullptr;
+  if (AP4_FAILED(AP4_FileByteStream::Create(
+          file_name_bytes.constData(), AP4_FileByteStream::STREAM_MODE_READ,
+          raw_stream))) {
+    return Failure("Failed to open the file.");
+  }
+  utility::ByteStreamPointer stream{raw_stream};
+
+  Result<std::vector<utility::BoxHeader>, std::string> scan_result =
+      utility::ScanTopLevelBoxHeaders(*stream);
+  if (scan_result.IsErr()) {
+    scan_result.MarkErrorHandled();
+    return Failure(QString::fromStdString(scan_result.GetErr()));
+  }
+  FileLayout layout;
+  layout.headers = std::move(scan_result).GetOk();
+  for (utility::BoxHeader const& header : layout.headers) {
+    if (header.type != AP4_ATOM_TYPE_MOOV) {
+      continue;
+    }
+    if (header.size > kMaxMoovSize) {
+      return Failure("moov is too large to summarize.");
+    }
+    layout.moov.resize(static_cast<size_t>(header.size));
+    if (AP4_FAILED(stream->Seek(header.offset)) ||
+        AP4_FAILED(stream->Read(layout.moov.data(),
+                                static_cast<AP4_Size>(header.size)))) {
+      return Failure("Failed to read moov.");
+    }
+    break;
+  }
+  return SummarizeLayout(layout);
+}
+
+std::vector<JobResult> SummarizeFiles(
+    std::vector<Job> const& jobs, Options const& options,
+    std::function<void(size_t finished_count)> const&
+        on_job_finished /* = {} */) {
+  std::vector<JobResult> results(jobs.size());
+  std::mutex progress_mutex;
+  size_t finished_count = 0;
+  // Called from the reading thread for failures, and from workers for
+  // summaries.
+  auto const finish_job = [&](size_t job_index, JobResult result,
+                              qint64 elapsed_ms) {
+    result.elapsed_ms = elapsed_ms;
+    results.at(job_index) = std::move(result);
+    if (on_job_finished) {
+      std::lock_guard<std::mutex> lock{progress_mutex};
+      on_job_finished(++finished_count);
+    }
+  };
+
+  std::unique_ptr<parallel::BatchedFileReader> const reader =
+      parallel::CreateBatchedFileReader(kMaxFilesInFlight,
+                                        options.worker_count);
+  // Declared before the pool, as its tasks release memory to it.
+  MoovBudget budget{kMoovMemoryBudget};
+  parallel::WorkStealingPool pool{options.worker_count};
+  std::unordered_map<size_t, FileScan> scans;
+  // Scans waiting to read their moov, oldest first.
+  std::deque<size_t> scans_waiting_for_budget;
+  size_t next_job_index = 0;
+  while (next_job_index < jobs.size() || !scans.empty()) {
+    // Resume the scans waiting for memory, in the order they started waiting.
+    while (!scans_waiting_for_budget.empty()) {
+      FileScan& scan = scans.at(scans_waiting_for_budget.front());
+      utility::BoxHeader const moov = scan.moov_waiting_for_budget.value();
+      if (!budget.TryAcquire(moov.size)) {
+        break;
+      }
+      scan.moov_waiting_for_budget.reset();
+      SubmitMoovRead(*reader, scans_waiting_for_budget.front(), scan, moov);
+      scans_waiting_for_budget.pop_front();
+    }
+
+    // Top up the files in flight, unless moovs already fill the budget, in
+    // which case new files would only end up waiting.
+    while (scans.size() < kMaxFilesInFlight && !budget.IsExhausted() &&
+           next_job_index < jobs.size()) {
+      size_t const job_index = next_job_index++;
+      QString const& file_name = jobs.at(job_index).input_file_name;
+      FileScan scan;
+      scan.timer.start();
+      scan.file_size = static_cast<uint64_t>(QFileInfo{file_name}.size());
+      scan.file_descriptor = parallel::OpenFileForReading(
+          QFile::encodeName(file_name).constData());
+      if (scan.file_descriptor < 0) {
+        finish_job(job_index, Failure("Failed to open the file."),
+                   scan.timer.elapsed());
+        continue;
+      }
+      if (scan.file_size == 0) {
+        parallel::CloseFile(scan.file_descriptor);
+        finish_job(job_index, SummarizeLayout(scan.layout),
+                   scan.timer.elapsed());
+        continue;
+      }
+      FileScan& added_scan =
+          scans.emplace(job_index, std::move(scan)).first->second;
+      SubmitRead(*reader, job_index, added_scan, 0,
+                 std::min<uint64_t>(kInitialReadSize, added_scan.file_size));
+    }
+
+    // Every scan that isn't waiting for memory has one read in flight.
+    if (scans.size() == scans_waiting_for_budget.size()) {
+      // Nothing to read until the workers release memory.
+      budget.WaitForRoom(
+          scans_waiting_for_budget.empty()
+              ? 1
+              : scans.at(scans_waiting_for_budget.front())
+                    .moov_waiting_for_budget->size);
+      continue;
+    }
+    for (parallel::ReadCompletion& completion :
+         reader->WaitForCompletions()) {
+      size_t const job_index = static_cast<size_t>(completion.id);
+      auto const scan_it = scans.find(job_index);
+      assert(scan_it != scans.end());
+      FileScan& scan = scan_it->second;
+      if (!ContinueScan(*reader, budget, job_index, scan,
+                        std::move(completion))) {
+        if (scan.moov_waiting_for_budget.has_value()) {
+          scans_waiting_for_budget.push_back(job_index);
+        }
+        continue;
+      }
+      parallel::CloseFile(scan.file_descriptor);
+      if (scan.error.has_value()) {
+        budget.Release(scan.reserved_moov_bytes);
+        finish_job(job_index, Failure(scan.error.value()),
+                   scan.timer.elapsed());
+      } else {
+        // Parsing moov is CPU work, keep it off the reading thread.
+        pool.Submit([&finish_job, &budget, job_index,
+                     scan = std::make_shared<FileScan>(std::move(scan))](
+                        size_t /*worker_index*/) {
+          JobResult result = SummarizeLayout(scan->layout);
+          // Free the moov before making room for the next one.
+          scan->layout.moov = {};
+          budget.Release(scan->reserved_moov_bytes);
+          finish_job(job_index, std::move(result), scan->timer.elapsed());
+        });
+      }
+      scans.erase(scan_it);
+    }
+  }
+  pool.Wait();
+  return results;
+}
+
+}  // namespace mp4_manipulator::batch
@@ -0,0 +1,814 @@
+#include "crypto/cenc_decryption.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "Ap4.h"
+#include "analysis/atom_lookup.h"
+#include "analysis/sample_locations.h"
+#include "parallel/work_stealing_pool.h"
+#include "parsing/box_header_scanner.h"
+#include "parsing/file_range_copy.h"
+#include "parsing/file_utils.h"
+#include "parsing/resource_deleters.h"
+
+namespace mp4_manipulator::crypto {
+namespace {
+using analysis::FindDescendantAp4Atom;
+using analysis::GetAp4AtomAs;
+using analysis::HasType;
+using analysis::SampleRange;
+
+using DecryptResult = Result<DecryptionSummary, std::string>;
+using PlanResult = Result<std::monostate, std::string>;
+
+// Batches are at least this large, then extended to end on a sample boundary.
+constexpr uint64_t kBatchSize = 8 << 20;
+// How many batches each worker may have read or decrypted ahead of the
+// writer, which bounds memory use to a few batches per worker.
+constexpr size_t kBatchesInFlightPerWorker = 2;
+constexpr size_t kIvSize = 16;
+constexpr uint32_t kTypeSize = 4;
+// senc flags.
+constexpr uint32_t kSencUseSubsampleEncryption = 0x2;
+
+// The encryption of a track, from the `schm` and `tenc` of its first
+// protected sample entry.
+struct ProtectedTrack {
+  uint32_t track_id;
+  uint32_t scheme;
+  Key key;
+  uint8_t per_sample_iv_size;
+  std::array<uint8_t, kIvSize> constant_iv;
+  uint8_t crypt_byte_block;
+  uint8_t skip_byte_block;
+};
+
+struct ProtectedSample {
+  uint64_t offset;
+  uint32_t size;
+  // Index into DecryptionPlan::tracks.
+  uint32_t track;
+  std::array<uint8_t, kIvSize> iv;
+  // The sample's range of DecryptionPlan::clear_bytes and encrypted_bytes.
+  // Samples without subsamples are encrypted whole.
+  uint32_t first_subsample;
+  uint32_t subsample_count;
+};
+
+// A box type to overwrite, e.g. to turn a box into `free`.
+struct TypePatch {
+  uint64_t offset;
+  uint32_t type;
+};
+
+struct DecryptionPlan {
+  std::vector<ProtectedTrack> tracks;
+  // In order of offset.
+  std::vector<ProtectedSample> samples;
+  // The subsamples of all samples, as separate arrays so a sample's can be
+  // passed to the decrypter as is.
+  std::vector<uint16_t> clear_bytes;
+  std::vector<uint32_t> encrypted_bytes;
+  // In order of offset.
+  std::vector<TypePatch> patches;
+};
+
+// A range of the file that's read, patched, decrypted and written as a unit.
+// Batches never split a sample or a patch.
+struct Batch {
+  uint64_t begin;
+  uint64_t end;
+  size_t first_sample;
+  size_t end_sample;
+  size_t first_patch;
+  size_t end_patch;
+  std::vector<uint8_t> data;
+  std::optional<std::string> error;
+  bool done{false};
+};
+
+// What each worker keeps between batches.
+struct WorkerState {
+  utility::FilePointer input;
+  // By track index, created when a worker first meets a track.
+  std::vector<std::unique_ptr<AP4_CencSingleSampleDecrypter>> decrypters;
+  AP4_DataBuffer encrypted;
+  AP4_DataBuffer decrypted;
+};
+
+std::optional<std::array<uint8_t, 16>> ParseHex16(std::string const& hex) {
+  if (hex.size() != 32) {
+    return std::nullopt;
+  }
+  std::array<uint8_t, 16> bytes{};
+  for (size_t i = 0; i < hex.size(); ++i) {
+    char const c = hex.at(i);
+    int digit = 0;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return std::nullopt;
+    }
+    bytes.at(i / 2) = static_cast<uint8_t>((bytes.at(i / 2) << 4) | digit);
+  }
+  return bytes;
+}
+
+// Reads big endian fields from the bytes of a box.
+class ByteReader {
+ public:
+  explicit ByteReader(std::vector<uint8_t> const& data) : data_{data} {}
+
+  bool ReadUint(uint32_t byte_count, uint64_t& value) {
+    if (data_.size() - position_ < byte_count) {
+      return false;
+    }
+    value = 0;
+    for (uint32_t i = 0; i < byte_count; ++i) {
+      value = (value << 8) | data_.at(position_++);
+    }
+    return true;
+  }
+
+  bool ReadBytes(uint8_t* output, size_t count) {
+    if (data_.size() - position_ < count) {
+      return false;
+    }
+    std::memcpy(output, data_.data() + position_, count);
+    position_ += count;
+    return true;
+  }
+
+ private:
+  std::vector<uint8_t> const& data_;
+  size_t position_{0};
+};
+
+std::optional<std::vector<uint8_t>> ReadBytes(std::FILE* file,
+                                              uint64_t offset, size_t size) {
+  std::vector<uint8_t> data(size);
+  if (!utility::SeekFile(file, offset) ||
+      std::fread(data.data(), 1, size, file) != size) {
+    return std::nullopt;
+  }
+  return data;
+}
+
+// Changes the type of `atom` to `type` in the output. Fails if the atom's
+// position isn't known, as the patch would otherwise land on another box.
+PlanResult AddTypePatch(AtomOrDescriptorBase const& atom, AP4_Atom::Type type,
+                        DecryptionPlan& plan) {
+  std::optional<uint64_t> const position = atom.GetPositionInStream();
+  if (!position.has_value()) {
+    return PlanResult::Err("The position of a " + atom.GetName().toStdString() +
+                           " isn't known, so it can't be patched.");
+  }
+  plan.patches.push_back(TypePatch{position.value() + kTypeSize, type});
+  return PlanResult::Ok();
+}
+
+PlanResult AddFreePatch(AtomOrDescriptorBase const& atom,
+                        DecryptionPlan& plan) {
+  return AddTypePatch(atom, AP4_ATOM_TYPE_FREE, plan);
+}
+
+// Turns the boxes that only describe encryption, and don't apply to the
+// clear output, in `container`'s children into free boxes.
+PlanResult AddEncryptionBoxPatches(AtomOrDescriptorBase const& container,
+                                   DecryptionPlan& plan) {
+  for (auto const& child : container.GetChildAtoms()) {
+    bool const is_encryption_box = HasType(*child, AP4_ATOM_TYPE_SENC) ||
+                                   HasType(*child, AP4_ATOM_TYPE_SAIZ) ||
+                                   HasType(*child, AP4_ATOM_TYPE_SAIO) ||
+                                   HasType(*child, AP4_ATOM_TYPE_PSSH);
+    PlanResult result = is_encryption_box
+                            ? AddFreePatch(*child, plan)
+                            : AddEncryptionBoxPatches(*child, plan);
+    if (result.IsErr()) {
+      return result;
+    }
+  }
+  return PlanResult::Ok();
+}
+
+// Returns the first child or descendant of `atom` of `type`, or nullptr.
+AtomOrDescriptorBase const* FindDescendantOfType(
+    AtomOrDescriptorBase const& atom, AP4_Atom::Type type) {
+  for (auto const& child : atom.GetChildAtoms()) {
+    if (HasType(*child, type)) {
+      return child.get();
+    }
+    if (AtomOrDescriptorBase const* found =
+            FindDescendantOfType(*child, type)) {
+      return found;
+    }
+  }
+  return nullptr;
+}
+
+void CollectDescendantsOfType(AtomOrDescriptorBase const& atom,
+                              AP4_Atom::Type type,
+                              std::vector<AtomOrDescriptorBase const*>& found) {
+  for (auto const& child : atom.GetChildAtoms()) {
+    if (HasType(*child, type)) {
+      found.push_back(child.get());
+    }
+    CollectDescendantsOfType(*child, type, found);
+  }
+}
+
+// Adds the samples of `samples`, all of track `track_index`, to the plan,
+// with their IVs and subsamples from `senc`.
+PlanResult AddSamples(std::FILE* input, AtomOrDescriptorBase const& senc,
+                      std::vector<SampleRange> const& samples,
+                      uint32_t track_index, DecryptionPlan& plan) {
+  ProtectedTrack const& track = plan.tracks.at(track_index);
+  std::string const context =
+      "Track " + std::to_string(track.track_id) + ": ";
+  std::optional<uint64_t> const position = senc.GetPositionInStream();
+  if (!position.has_value()) {
+    return PlanResult::Err(context + "the position of senc isn't known.");
+  }
+  std::optional<std::vector<uint8_t>> const box = ReadBytes(
+      input, position.value(), static_cast<size_t>(senc.GetSize()));
+  if (!box.has_value()) {
+    return PlanResult::Err(context + "reading senc failed.");
+  }
+  ByteReader reader{box.value()};
+  uint64_t size = 0;
+  uint64_t type = 0;
+  uint64_t version_and_flags = 0;
+  uint64_t sample_count = 0;
+  bool ok = reader.ReadUint(4, size) && reader.ReadUint(4, type);
+  if (ok && size == 1) {
+    ok = reader.ReadUint(8, size);
+  }
+  ok = ok && reader.ReadUint(4, version_and_flags) &&
+       reader.ReadUint(4, sample_count);
+  if (!ok) {
+    return PlanResult::Err(context + "senc is truncated.");
+  }
+  if (sample_count != samples.size()) {
+    return PlanResult::Err(context + "senc has " +
+                           std::to_string(sample_count) +
+                           " entries, but there are " +
+                           std::to_string(samples.size()) + " samples.");
+  }
+  bool const has_subsamples =
+      (version_and_flags & kSencUseSubsampleEncryption) != 0;
+  for (SampleRange const& sample : samples) {
+    auto const first_subsample =
+        static_cast<uint32_t>(plan.clear_bytes.size());
+    ProtectedSample protected_sample{sample.offset, sample.size,
+                                     track_index, track.constant_iv,
+                                     first_subsample, 0};
+    if (track.per_sample_iv_size > 0) {
+      // 8 byte IVs are the first half of the counter block, so are padded
+      // with zeros.
+      protected_sample.iv.fill(0);
+      ok = reader.ReadBytes(protected_sample.iv.data(),
+                            track.per_sample_iv_size);
+    }
+    uint64_t total = 0;
+    if (ok && has_subsamples) {
+      uint64_t subsample_count = 0;
+      ok = reader.ReadUint(2, subsample_count);
+      for (uint64_t i = 0; ok && i < subsample_count; ++i) {
+        uint64_t clear = 0;
+        uint64_t encrypted = 0;
+        ok = reader.ReadUint(2, clear) && reader.ReadUint(4, encrypted);
+        plan.clear_bytes.push_back(static_cast<uint16_t>(clear));
+        plan.encrypted_bytes.push_back(static_cast<uint32_t>(encrypted));
+        total += clear + encrypted;
+      }
+      protected_sample.subsample_count =
+          static_cast<uint32_t>(subsample_count);
+    }
+    if (!ok) {
+      return PlanResult::Err(context + "senc is truncated.");
+    }
+    if (protected_sample.subsample_count > 0 && total != sample.size) {
+      return PlanResult::Err(context + "the subsamples of sample " +
+                             std::to_string(sample.number) + " cover " +
+                             std::to_string(total) + " bytes, but it has " +
+                             std::to_string(sample.size) + ".");
+    }
+    plan.samples.push_back(protected_sample);
+  }
+  return PlanResult::Ok();
+}
+
+// Finds the protection of a trak, adding it to the plan if there's a key for
+// it, along with its samples if they're in moov, and the patches that clear
+// its sample entries. Returns the track's index in the plan, or std::nullopt
+// if it isn't protected or there's no key.
+Result<std::optional<uint32_t>, std::string> AddTrack(
+    std::FILE* input, AtomOrDescriptorBase const& trak, KeySet const& keys,
+    DecryptionPlan& plan, DecryptionSummary& summary) {
+  using TrackResult = Result<std::optional<uint32_t>, std::string>;
+  std::vector<AtomOrDescriptorBase const*> sinfs;
+  CollectDescendantsOfType(trak, AP4_ATOM_TYPE_SINF, sinfs);
+  AP4_TkhdAtom* const tkhd = FindDescendantAp4Atom<AP4_TkhdAtom>(trak);
+  if (sinfs.empty() || tkhd == nullptr) {
+    return TrackResult::Ok(std::nullopt);
+  }
+  uint32_t const track_id = tkhd->GetTrackId();
+  std::string const context = "Track " + std::to_string(track_id) + ": ";
+  AP4_SchmAtom* const schm = FindDescendantAp4Atom<AP4_SchmAtom>(*sinfs.at(0));
+  AP4_TencAtom* const tenc = FindDescendantAp4Atom<AP4_TencAtom>(*sinfs.at(0));
+  if (schm == nullptr || tenc == nullptr) {
+    return TrackResult::Err(context +
+                            "the sinf has no schm or tenc, so isn't Common "
+                            "Encryption.");
+  }
+  uint32_t const scheme = schm->GetSchemeType();
+  if (scheme != AP4_PROTECTION_SCHEME_TYPE_CENC &&
+      scheme != AP4_PROTECTION_SCHEME_TYPE_CENS &&
+      scheme != AP4_PROTECTION_SCHEME_TYPE_CBC1 &&
+      scheme != AP4_PROTECTION_SCHEME_TYPE_CBCS) {
+    return TrackResult::Err(context + "the protection scheme " +
+                            utility::FourCcToString(scheme) +
+                            " isn't Common Encryption.");
+  }
+
+  std::optional<Key> key;
+  if (auto it = keys.by_track_id.find(track_id);
+      it != keys.by_track_id.end()) {
+    key = it->second;
+  } else {
+    KeyId key_id{};
+    std::memcpy(key_id.data(), tenc->GetDefaultKid(), key_id.size());
+    if (auto it = keys.by_key_id.find(key_id); it != keys.by_key_id.end()) {
+      key = it->second;
+    }
+  }
+  if (!key.has_value()) {
+    summary.skipped_track_ids.push_back(track_id);
+    return TrackResult::Ok(std::nullopt);
+  }
+
+  ProtectedTrack track{track_id,
+                       scheme,
+                       key.value(),
+                       tenc->GetDefaultPerSampleIvSize(),
+                       {},
+                       0,
+                       0};
+  if (track.per_sample_iv_size == 0) {
+    std::memcpy(track.constant_iv.data(), tenc->GetDefaultConstantIv(),
+                std::min<size_t>(tenc->GetDefaultConstantIvSize(), kIvSize));
+  } else if (track.per_sample_iv_size != 8 &&
+             track.per_sample_iv_size != 16) {
+    return TrackResult::Err(context + "IVs of " +
+                            std::to_string(track.per_sample_iv_size) +
+                            " bytes aren't valid.");
+  }
+  // Only the pattern schemes use the pattern of tenc.
+  if (scheme == AP4_PROTECTION_SCHEME_TYPE_CENS ||
+      scheme == AP4_PROTECTION_SCHEME_TYPE_CBCS) {
+    track.crypt_byte_block = tenc->GetDefaultCryptByteBlock();
+    track.skip_byte_block = tenc->GetDefaultSkipByteBlock();
+  }
+  auto const track_index = static_cast<uint32_t>(plan.tracks.size());
+  plan.tracks.push_back(track);
+  summary.decrypted_track_ids.push_back(track_id);
+
+  // Give each protected sample entry back its original format, and free its
+  // sinf.
+  for (AtomOrDescriptorBase const* sinf : sinfs) {
+    AP4_FrmaAtom* const frma = FindDescendantAp4Atom<AP4_FrmaAtom>(*sinf);
+    AtomOrDescriptorBase const* const sample_entry = sinf->GetParent();
+    if (frma == nullptr || sample_entry == nullptr) {
+      return TrackResult::Err(context + "a sinf has no frma.");
+    }
+    PlanResult patch_result =
+        AddTypePatch(*sample_entry, frma->GetOriginalFormat(), plan);
+    if (patch_result.IsOk()) {
+      patch_result = AddFreePatch(*sinf, plan);
+    }
+    if (patch_result.IsErr()) {
+      patch_result.MarkErrorHandled();
+      return TrackResult::Err(context + std::move(patch_result).GetErr());
+    }
+  }
+
+  analysis::SampleLocations const locations =
+      analysis::LocateTrackSamples(trak);
+  for (analysis::SampleIssue const& issue : locations.issues) {
+    if (analysis::IsError(issue.kind)) {
+      return TrackResult::Err(context + issue.description);
+    }
+  }
+  if (!locations.samples.empty()) {
+    AtomOrDescriptorBase const* const senc =
+        FindDescendantOfType(trak, AP4_ATOM_TYPE_SENC);
+    if (senc == nullptr) {
+      return TrackResult::Err(
+          context + "there's no senc, and sample encryption information "
+                    "given only by saiz and saio isn't supported.");
+    }
+    PlanResult add_result =
+        AddSamples(input, *senc, locations.samples, track_index, plan);
+    if (add_result.IsErr()) {
+      add_result.MarkErrorHandled();
+      return TrackResult::Err(std::move(add_result).GetErr());
+    }
+    PlanResult patch_result = AddEncryptionBoxPatches(trak, plan);
+    if (patch_result.IsErr()) {
+      patch_result.MarkErrorHandled();
+      return TrackResult::Err(context + std::move(patch_result).GetErr());
+    }
+  }
+  return TrackResult::Ok(track_index);
+}
+
+// Adds the samples of the trafs of a moof whose tracks are being decrypted.
+PlanResult AddFragment(
+    std::FILE* input, AtomOrDescriptorBase const& moof, uint64_t moof_position,
+    std::unordered_map<uint32_t, uint32_t> const& default_sample_sizes,
+    std::unordered_map<uint32_t, uint32_t> const& track_indices,
+    DecryptionPlan& plan) {
+  analysis::SampleLocations const locations =
+      analysis::LocateFragmentSamples(moof, moof_position,
+                                      default_sample_sizes);
+  for (auto const& traf : moof.GetChildAtoms()) {
+    if (HasType(*traf, AP4_ATOM_TYPE_PSSH)) {
+      // Not a traf, but moofs can carry pssh boxes too.
+      PlanResult patch_result = AddFreePatch(*traf, plan);
+      if (patch_result.IsErr()) {
+        return patch_result;
+      }
+      continue;
+    }
+    AP4_TfhdAtom* const tfhd = FindDescendantAp4Atom<AP4_TfhdAtom>(*traf);
+    if (!HasType(*traf, AP4_ATOM_TYPE_TRAF) || tfhd == nullptr) {
+      continue;
+    }
+    auto const track_index = track_indices.find(tfhd->GetTrackId());
+    if (track_index == track_indices.end()) {
+      continue;
+    }
+    // The samples of the traf's truns, in order.
+    std::vector<SampleRange> samples;
+    for (SampleRange const& sample : locations.samples) {
+      if (locations.sources.at(sample.source).atom->GetParent() ==
+          traf.get()) {
+        samples.push_back(sample);
+      }
+    }
+    for (analysis::SampleIssue const& issue : locations.issues) {
+      if (analysis::IsError(issue.kind) &&
+          (issue.atom == traf.get() || issue.atom->GetParent() == traf.get())) {
+        return PlanResult::Err(issue.description);
+      }
+    }
+    if (samples.empty()) {
+      continue;
+    }
+    AtomOrDescriptorBase const* const senc =
+        FindDescendantOfType(*traf, AP4_ATOM_TYPE_SENC);
+    if (senc == nullptr) {
+      return PlanResult::Err(
+          "Track " + std::to_string(tfhd->GetTrackId()) +
+          ": a traf has no senc, and sample encryption information given "
+          "only by saiz and saio isn't supported.");
+    }
+    PlanResult add_result =
+        AddSamples(input, *senc, samples, track_index->second, plan);
+    if (add_result.IsErr()) {
+      return add_result;
+    }
+    PlanResult patch_result = AddEncryptionBoxPatches(*traf, plan);
+    if (patch_result.IsErr()) {
+      return patch_result;
+    }
+  }
+  return PlanResult::Ok();
+}
+
+// Splits the file into batches of at least kBatchSize bytes that don't split
+// samples or patches.
+std::vector<Batch> PlanBatches(DecryptionPlan const& plan,
+                               uint64_t file_size) {
+  std::vector<Batch> batches;
+  size_t sample = 0;
+  size_t patch = 0;
+  for (uint64_t begin = 0; begin < file_size;) {
+    Batch batch{begin, std::min(file_size, begin + kBatchSize),
+                sample, sample, patch, patch, {}, std::nullopt, false};
+    for (bool extended = true; extended;) {
+      extended = false;
+      while (sample < plan.samples.size() &&
+             plan.samples.at(sample).offset < batch.end) {
+        ProtectedSample const& protected_sample = plan.samples.at(sample++);
+        batch.end = std::max(batch.end,
+                             protected_sample.offset + protected_sample.size);
+        extended = true;
+      }
+      while (patch < plan.patches.size() &&
+             plan.patches.at(patch).offset < batch.end) {
+        batch.end =
+            std::max(batch.end, plan.patches.at(patch++).offset + kTypeSize);
+        extended = true;
+      }
+    }
+    batch.end_sample = sample;
+    batch.end_patch = patch;
+    begin = batch.end;
+    batches.push_back(std::move(batch));
+  }
+  return batches;
+}
+
+// Reads a batch from the input, patches its box types and decrypts its
+// samples in place.
+void ProcessBatch(char const* input_file_name, DecryptionPlan const& plan,
+                  WorkerState& state, Batch& batch) {
+  if (state.input == nullptr) {
+    state.input.reset(std::fopen(input_file_name, "rb"));
+    state.decrypters.resize(plan.tracks.size());
+  }
+  std::optional<std::vector<uint8_t>> data =
+      state.input != nullptr
+          ? ReadBytes(state.input.get(), batch.begin,
+                      static_cast<size_t>(batch.end - batch.begin))
+          : std::nullopt;
+  if (!data.has_value()) {
+    batch.error = "Reading bytes " + std::to_string(batch.begin) + "-" +
+                  std::to_string(batch.end) + " failed.";
+    return;
+  }
+  batch.data = std::move(data).value();
+
+  for (size_t i = batch.first_patch; i < batch.end_patch; ++i) {
+    TypePatch const& patch = plan.patches.at(i);
+    uint8_t* const type = batch.data.data() + (patch.offset - batch.begin);
+    for (uint32_t byte = 0; byte < kTypeSize; ++byte) {
+      type[byte] = static_cast<uint8_t>(patch.type >> (8 * (3 - byte)));
+    }
+  }
+
+  for (size_t i = batch.first_sample; i < batch.end_sample; ++i) {
+    ProtectedSample const& sample = plan.samples.at(i);
+    ProtectedTrack const& track = plan.tracks.at(sample.track);
+    std::unique_ptr<AP4_CencSingleSampleDecrypter>& decrypter =
+        state.decrypters.at(sample.track);
+    if (decrypter == nullptr) {
+      bool const is_cbc = track.scheme == AP4_PROTECTION_SCHEME_TYPE_CBC1 ||
+                          track.scheme == AP4_PROTECTION_SCHEME_TYPE_CBCS;
+      AP4_CencSingleSampleDecrypter* created = nullptr;
+      // cbcs restarts the chain at each subsample with the same IV.
+      if (AP4_FAILED(AP4_CencSingleSampleDecrypter::Create(
+              is_cbc ? AP4_CENC_CIPHER_AES_128_CBC
+                     : AP4_CENC_CIPHER_AES_128_CTR,
+              track.key.data(), static_cast<AP4_Size>(track.key.size()),
+              track.crypt_byte_block, track.skip_byte_block, nullptr,
+              track.scheme == AP4_PROTECTION_SCHEME_TYPE_CBCS, created))) {
+        batch.error = "Track " + std::to_string(track.track_id) +
+                      ": creating a decrypter failed.";
+        return;
+      }
+      decrypter.reset(created);
+    }
+    uint8_t* const sample_data =
+        batch.data.data() + (sample.offset - batch.begin);
+    state.encrypted.SetData(sample_data, sample.size);
+    bool const has_subsamples = sample.subsample_count > 0;
+    if (AP4_FAILED(decrypter->DecryptSampleData(
+            state.encrypted, state.decrypted, sample.iv.data(),
+            sample.subsample_count,
+            has_subsamples ? &plan.clear_bytes.at(sample.first_subsample)
+                           : nullptr,
+            has_subsamples ? &plan.encrypted_bytes.at(sample.first_subsample)
+                           : nullptr)) ||
+        state.decrypted.GetDataSize() != sample.size) {
+      batch.error = "Track " + std::to_string(track.track_id) +
+                    ": decrypting the sample at " +
+                    std::to_string(sample.offset) + " failed.";
+      return;
+    }
+    std::memcpy(sample_data, state.decrypted.GetData(), sample.size);
+  }
+}
+}  // namespace
+
+Result<KeySet, std::string> ReadKeyFile(char const* file_name) {
+  using KeyResult = Result<KeySet, std::string>;
+  std::ifstream file{file_name};
+  if (!file) {
+    return KeyResult::Err(std::string{"Could not open "} + file_name + ".");
+  }
+  KeySet keys;
+  std::string line;
+  for (size_t line_number = 1; std::getline(file, line); ++line_number) {
+    line.erase(0, line.find_first_not_of(" \t"));
+    line.erase(line.find_last_not_of(" \t\r") + 1);
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+    size_t const colon = line.find(':');
+    std::optional<Key> const key =
+        colon != std::string::npos ? ParseHex16(line.substr(colon + 1))
+                                   : std::nullopt;
+    std::string const id = line.substr(0, colon);
+    if (!key.has_value()) {
+      return KeyResult::Err("Line " + std::to_string(line_number) +
+                            ": expected <key id or track id>:<32 hex digit "
+                            "key>.");
+    }
+    if (std::optional<KeyId> const key_id = ParseHex16(id)) {
+      keys.by_key_id[key_id.value()] = key.value();
+    } else if (!id.empty() && id.size() <= 9 &&
+               id.find_first_not_of("0123456789") == std::string::npos) {
+      keys.by_track_id[static_cast<uint32_t>(std::stoul(id))] = key.value();
+    } else {
+      return KeyResult::Err("Line " + std::to_string(line_number) + ": \"" +
+                            id + "\" is neither a key id nor a track id.");
+    }
+  }
+  return KeyResult::Ok(std::move(keys));
+}
+
+Result<DecryptionSummary, std::string> DecryptFile(
+    char const* input_file_name, char const* output_file_name,
+    KeySet const& keys, size_t thread_count /* = 0 */) {
+  std::error_code error;
+  if (std::filesystem::equivalent(input_file_name, output_file_name, error)) {
+    return DecryptResult::Err("The output can't be the input.");
+  }
+  uint64_t const file_size =
+      std::filesystem::file_size(input_file_name, error);
+  if (error) {
+    return DecryptResult::Err(std::string{"Could not open "} +
+                              input_file_name + ".");
+  }
+  std::optional<std::unique_ptr<AtomHolder>> atoms =
+      utility::ReadAtoms(input_file_name, thread_count);
+  utility::FilePointer input{std::fopen(input_file_name, "rb")};
+  if (!atoms.has_value() || input == nullptr) {
+    return DecryptResult::Err(std::string{"Could not read "} +
+                              input_file_name + ".");
+  }
+
+  // Plan the decryption from moov and the moofs.
+  DecryptionSummary summary;
+  DecryptionPlan plan;
+  std::unordered_map<uint32_t, uint32_t> track_indices;
+  std::unordered_map<uint32_t, uint32_t> default_sample_sizes;
+  std::vector<std::pair<AtomOrDescriptorBase const*, uint64_t>> moofs;
+  for (auto const& atom : atoms.value()->GetTopLevelAtoms()) {
+    if (!atom->GetPositionInStream().has_value()) {
+      return DecryptResult::Err(
+          "The positions of the atoms aren't known, so the samples can't be "
+          "located.");
+    }
+    if (HasType(*atom, AP4_ATOM_TYPE_MOOF)) {
+      moofs.emplace_back(atom.get(), atom->GetPositionInStream().value());
+      continue;
+    }
+    if (!HasType(*atom, AP4_ATOM_TYPE_MOOV)) {
+      continue;
+    }
+    for (auto const& child : atom->GetChildAtoms()) {
+      if (HasType(*child, AP4_ATOM_TYPE_PSSH)) {
+        PlanResult patch_result = AddFreePatch(*child, plan);
+        if (patch_result.IsErr()) {
+          patch_result.MarkErrorHandled();
+          return DecryptResult::Err(std::move(patch_result).GetErr());
+        }
+      } else if (HasType(*child, AP4_ATOM_TYPE_MVEX)) {
+        for (auto const& trex_atom : child->GetChildAtoms()) {
+          if (AP4_TrexAtom* trex = GetAp4AtomAs<AP4_TrexAtom>(*trex_atom)) {
+            default_sample_sizes[trex->GetTrackId()] =
+                trex->GetDefaultSampleSize();
+          }
+        }
+      } else if (HasType(*child, AP4_ATOM_TYPE_TRAK)) {
+        Result<std::optional<uint32_t>, std::string> track_result =
+            AddTrack(input.get(), *child, keys, plan, summary);
+        if (track_result.IsErr()) {
+          track_result.MarkErrorHandled();
+          return DecryptResult::Err(std::move(track_result).GetErr());
+        }
+        if (std::optional<uint32_t> const index = track_result.GetOk()) {
+          track_indices[plan.tracks.at(index.value()).track_id] =
+              index.value();
+        }
+      }
+    }
+  }
+  for (auto const& [moof, position] : moofs) {
+    PlanResult fragment_result =
+        AddFragment(input.get(), *moof, position, default_sample_sizes,
+                    track_indices, plan);
+    if (fragment_result.IsErr()) {
+      fragment_result.MarkErrorHandled();
+      return DecryptResult::Err(std::move(fragment_result).GetErr());
+    }
+  }
+  input.reset();
+  if (plan.tracks.empty()) {
+    return DecryptResult::Err(
+        summary.skipped_track_ids.empty()
+            ? "The file has no Common Encryption protected tracks."
+            : "There are no keys for the file's protected tracks.");
+  }
+
+  std::sort(plan.samples.begin(), plan.samples.end(),
+            [](ProtectedSample const& a, ProtectedSample const& b) {
+              return a.offset < b.offset;
+            });
+  std::sort(plan.patches.begin(), plan.patches.end(),
+            [](TypePatch const& a, TypePatch const& b) {
+              return a.offset < b.offset;
+            });
+  for (size_t i = 0; i < plan.samples.size(); ++i) {
+    ProtectedSample const& sample = plan.samples.at(i);
+    if (sample.offset + sample.size > file_size) {
+      return DecryptResult::Err("A sample of track " +
+                                std::to_string(
+                                    plan.tracks.at(sample.track).track_id) +
+                                " lies beyond the end of the file.");
+    }
+    if (i > 0 && plan.samples.at(i - 1).offset + plan.samples.at(i - 1).size >
+                     sample.offset) {
+      return DecryptResult::Err("Samples overlap at " +
+                                std::to_string(sample.offset) + ".");
+    }
+    summary.bytes_decrypted += sample.size;
+  }
+  summary.sample_count = plan.samples.size();
+
+  utility::FilePointer output{std::fopen(output_file_name, "wb")};
+  if (output == nullptr) {
+    return DecryptResult::Err(std::string{"Could not open "} +
+                              output_file_name + " for writing.");
+  }
+
+  // Workers read and decrypt batches ahead of the writer, which writes them
+  // in order as they finish. The pool is declared after everything its
+  // tasks use, so its destructor waits for any running batches before what
+  // they use is destroyed.
+  std::vector<Batch> batches = PlanBatches(plan, file_size);
+  std::mutex mutex;
+  std::condition_variable batch_done;
+  std::vector<WorkerState> states;
+  parallel::WorkStealingPool pool{thread_count};
+  states.resize(pool.GetWorkerCount());
+  size_t const max_in_flight =
+      pool.GetWorkerCount() * kBatchesInFlightPerWorker;
+  size_t submitted_count = 0;
+  std::optional<std::string> failure;
+  for (size_t i = 0; i < batches.size() && !failure.has_value(); ++i) {
+    for (; submitted_count < batches.size() &&
+           submitted_count < i + max_in_flight;
+         ++submitted_count) {
+      pool.Submit([&, index = submitted_count](size_t worker_index) {
+        ProcessBatch(input_file_name, plan, states.at(worker_index),
+                     batches.at(index));
+        {
+          std::lock_guard<std::mutex> lock{mutex};
+          batches.at(index).done = true;
+        }
+        batch_done.notify_all();
+      });
+    }
+    Batch& batch = batches.at(i);
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      batch_done.wait(lock, [&batch] { return batch.done; });
+    }
+    if (batch.error.has_value()) {
+      failure = batch.error;
+    } else if (std::fwrite(batch.data.data(), 1, batch.data.size(),
+                           output.get()) != batch.data.size()) {
+      failure = "Writing " + std::string{output_file_name} + " failed.";
+    }
+    std::vector<uint8_t>{}.swap(batch.data);
+  }
+  pool.Wait();
+  if (!failure.has_value() && std::fclose(output.release()) != 0) {
+    failure = "Writing " + std::string{output_file_name} + " failed.";
+  }
+  if (failure.has_value()) {
+    output.reset();
+    std::remove(output_file_name);
+    return DecryptResult::Err(std::move(failure).value());
+  }
+  return DecryptResult::Ok(std::move(summary));
+}
+
+}  // namespace mp4_manipulator::crypto
@@ -0,0 +1,493 @@
+#include "extraction/track_extraction.h"
+
+#include <QFile>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+#include "analysis/atom_lookup.h"
+#include "analysis/sample_locations.h"
+#include "parallel/work_stealing_pool.h"
+#include "parsing/file_range_copy.h"
+#include "parsing/resource_deleters.h"
+
+namespace mp4_manipulator::extraction {
+namespace {
+using analysis::FindDescendantAp4Atom;
+using analysis::GetAp4AtomAs;
+using analysis::HasType;
+using analysis::SampleLocations;
+using analysis::SampleRange;
+
+// The most bytes of contiguous samples read at once when the input isn't
+// mapped, and the most output buffered before it's written.
+constexpr uint64_t kMaxReadSize = 8 << 20;
+constexpr size_t kOutputBufferSize = 8 << 20;
+
+constexpr uint8_t kStartCode[] = {0, 0, 0, 1};
+constexpr size_t kAdtsHeaderSize = 7;
+// The frame length field of an ADTS header has 13 bits.
+constexpr uint32_t kMaxAdtsFrameSize = (1 << 13) - 1;
+// MPEG-4 audio object types that signal SBR or PS explicitly, which are
+// followed by the extension sampling frequency and the core object type.
+constexpr uint32_t kSbrObjectType = 5;
+constexpr uint32_t kPsObjectType = 29;
+constexpr uint32_t kEscapeObjectType = 31;
+constexpr uint32_t kExplicitFrequencyIndex = 15;
+
+// The fields of an AudioSpecificConfig that an ADTS header repeats.
+struct AdtsConfig {
+  uint32_t object_type;
+  uint32_t frequency_index;
+  uint32_t channel_configuration;
+};
+
+// How a track's samples are turned into its elementary stream.
+struct TrackFormat {
+  ElementaryStreamFormat format{ElementaryStreamFormat::kRaw};
+  // Written before the first sample, e.g. parameter sets.
+  std::vector<uint8_t> header;
+  uint32_t nalu_length_size{4};
+  AdtsConfig adts{};
+};
+
+// Reads bits most significant first, as the fields of an AudioSpecificConfig
+// are stored.
+class BitReader {
+ public:
+  BitReader(uint8_t const* data, size_t size) : data_{data}, size_{size} {}
+
+  std::optional<uint32_t> Read(uint32_t bit_count) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < bit_count; ++i, ++position_) {
+      if (position_ / 8 >= size_) {
+        return std::nullopt;
+      }
+      uint32_t const bit = (data_[position_ / 8] >> (7 - position_ % 8)) & 1;
+      value = (value << 1) | bit;
+    }
+    return value;
+  }
+
+ private:
+  uint8_t const* data_;
+  size_t size_;
+  size_t position_{0};
+};
+
+// Parses the start of an AudioSpecificConfig. Returns std::nullopt if it
+// can't be described by an ADTS header, which only has two bits for the
+// object type and can't give an explicit sampling frequency. Explicit SBR and
+// PS are described by their core object type, as players detect them from
+// the stream.
+std::optional<AdtsConfig> ParseAudioSpecificConfig(AP4_DataBuffer const& data) {
+  BitReader reader{data.GetData(), data.GetDataSize()};
+  std::optional<uint32_t> object_type = reader.Read(5);
+  std::optional<uint32_t> const frequency_index = reader.Read(4);
+  std::optional<uint32_t> const channel_configuration = reader.Read(4);
+  if (!object_type.has_value() || !frequency_index.has_value() ||
+      !channel_configuration.has_value() ||
+      object_type.value() == kEscapeObjectType ||
+      frequency_index.value() == kExplicitFrequencyIndex) {
+    return std::nullopt;
+  }
+  if (object_type.value() == kSbrObjectType ||
+      object_type.value() == kPsObjectType) {
+    // The extension sampling frequency, with its explicit frequency if it
+    // has one.
+    std::optional<uint32_t> const extension_index = reader.Read(4);
+    if (extension_index == kExplicitFrequencyIndex) {
+      reader.Read(24);
+    }
+    object_type = reader.Read(5);
+  }
+  if (!object_type.has_value() || object_type.value() < 1 ||
+      object_type.value() > 4) {
+    return std::nullopt;
+  }
+  return AdtsConfig{object_type.value(), frequency_index.value(),
+                    channel_configuration.value()};
+}
+
+void AppendNalUnit(std::vector<uint8_t>& output, AP4_DataBuffer const& nal) {
+  output.insert(output.end(), std::begin(kStartCode), std::end(kStartCode));
+  output.insert(output.end(), nal.GetData(), nal.GetData() + nal.GetDataSize());
+}
+
+// Works out the format of a trak from its first sample description.
+TrackFormat DetectFormat(AtomOrDescriptorBase const& trak) {
+  TrackFormat format;
+  if (AP4_AvccAtom* avcc = FindDescendantAp4Atom<AP4_AvccAtom>(trak)) {
+    format.format = ElementaryStreamFormat::kAnnexBH264;
+    format.nalu_length_size = avcc->GetNaluLengthSize();
+    for (AP4_Ordinal i = 0; i < avcc->GetSequenceParameters().ItemCount();
+         ++i) {
+      AppendNalUnit(format.header, avcc->GetSequenceParameters()[i]);
+    }
+    for (AP4_Ordinal i = 0; i < avcc->GetPictureParameters().ItemCount();
+         ++i) {
+      AppendNalUnit(format.header, avcc->GetPictureParameters()[i]);
+    }
+  } else if (AP4_HvccAtom* hvcc = FindDescendantAp4Atom<AP4_HvccAtom>(trak)) {
+    format.format = ElementaryStreamFormat::kAnnexBHevc;
+    format.nalu_length_size = hvcc->GetNaluLengthSize();
+    // hvcC lists VPS, SPS and PPS arrays in that order.
+    AP4_Array<AP4_HvccAtom::Sequence> const& sequences = hvcc->GetSequences();
+    for (AP4_Ordinal i = 0; i < sequences.ItemCount(); ++i) {
+      for (AP4_Ordinal j = 0; j < sequences[i].m_Nalus.ItemCount(); ++j) {
+        AppendNalUnit(format.header, sequences[i].m_Nalus[j]);
+      }
+    }
+  } else if (AP4_EsdsAtom* esds = FindDescendantAp4Atom<AP4_EsdsAtom>(trak)) {
+    AP4_EsDescriptor const* es = esds->GetEsDescriptor();
+    AP4_DecoderConfigDescriptor const* config =
+        es != nullptr ? es->GetDecoderConfigDescriptor() : nullptr;
+    if (config == nullptr ||
+        config->GetDecoderSpecificInfoDescriptor() == nullptr) {
+      return format;
+    }
+    AP4_UI08 const object_type = config->GetObjectTypeIndication();
+    if (object_type != AP4_OTI_MPEG4_AUDIO &&
+        object_type != AP4_OTI_MPEG2_AAC_AUDIO_MAIN &&
+        object_type != AP4_OTI_MPEG2_AAC_AUDIO_LC &&
+        object_type != AP4_OTI_MPEG2_AAC_AUDIO_SSRP) {
+      return format;
+    }
+    std::optional<AdtsConfig> const adts = ParseAudioSpecificConfig(
+        config->GetDecoderSpecificInfoDescriptor()->GetDecoderSpecificInfo());
+    if (adts.has_value()) {
+      format.format = ElementaryStreamFormat::kAdtsAac;
+      format.adts = adts.value();
+    }
+  }
+  return format;
+}
+
+// Buffers output and writes it in large blocks.
+class OutputWriter {
+ public:
+  explicit OutputWriter(std::FILE* file) : file_{file} {
+    buffer_.reserve(kOutputBufferSize);
+  }
+
+  bool Append(uint8_t const* data, size_t size) {
+    if (buffer_.size() + size > kOutputBufferSize && !Flush()) {
+      return false;
+    }
+    if (size >= kOutputBufferSize) {
+      bytes_written_ += size;
+      return std::fwrite(data, 1, size, file_) == size;
+    }
+    buffer_.insert(buffer_.end(), data, data + size);
+    bytes_written_ += size;
+    return true;
+  }
+
+  bool Flush() {
+    bool const ok =
+        std::fwrite(buffer_.data(), 1, buffer_.size(), file_) == buffer_.size();
+    buffer_.clear();
+    return ok;
+  }
+
+  [[nodiscard]] uint64_t GetBytesWritten() const { return bytes_written_; }
+
+ private:
+  std::FILE* file_;
+  std::vector<uint8_t> buffer_;
+  uint64_t bytes_written_{0};
+};
+
+// Gives access to ranges of the input, from its memory map if it has one, or
+// by reading them into a buffer. Each worker has its own.
+class InputReader {
+ public:
+  InputReader(char const* file_name, uint8_t const* mapped)
+      : file_name_{file_name}, mapped_{mapped} {}
+
+  // Returns the bytes [offset, offset + size), which stay valid until the
+  // next call, or nullptr if they can't be read.
+  uint8_t const* Read(uint64_t offset, uint64_t size) {
+    if (mapped_ != nullptr) {
+      return mapped_ + offset;
+    }
+    if (file_ == nullptr) {
+      file_.reset(std::fopen(file_name_, "rb"));
+    }
+    buffer_.resize(size);
+    if (file_ == nullptr || !utility::SeekFile(file_.get(), offset) ||
+        std::fread(buffer_.data(), 1, size, file_.get()) != size) {
+      return nullptr;
+    }
+    return buffer_.data();
+  }
+
+ private:
+  char const* file_name_;
+  uint8_t const* mapped_;
+  utility::FilePointer file_;
+  std::vector<uint8_t> buffer_;
+};
+
+// Writes one sample to `writer` in `format`. Returns a description of the
+// problem if the sample can't be converted or written.
+std::optional<std::string> WriteSample(TrackFormat const& format,
+                                       uint8_t const* data, uint32_t size,
+                                       OutputWriter& writer) {
+  switch (format.format) {
+    case ElementaryStreamFormat::kAnnexBH264:
+    case ElementaryStreamFormat::kAnnexBHevc: {
+      uint32_t const length_size = format.nalu_length_size;
+      for (uint32_t position = 0; position < size;) {
+        if (size - position < length_size) {
+          return "a NAL unit length is cut off by the end of the sample.";
+        }
+        uint32_t length = 0;
+        for (uint32_t i = 0; i < length_size; ++i) {
+          length = (length << 8) | data[position++];
+        }
+        if (length > size - position) {
+          return "a NAL unit runs past the end of the sample.";
+        }
+        if (!writer.Append(kStartCode, sizeof(kStartCode)) ||
+            !writer.Append(data + position, length)) {
+          return "writing failed.";
+        }
+        position += length;
+      }
+      return std::nullopt;
+    }
+    case ElementaryStreamFormat::kAdtsAac: {
+      uint32_t const frame_size = size + kAdtsHeaderSize;
+      if (frame_size > kMaxAdtsFrameSize) {
+        return "the sample is too large for an ADTS frame.";
+      }
+      AdtsConfig const& config = format.adts;
+      // MPEG-4, layer 0, no CRC, a variable buffer fullness and one raw data
+      // block.
+      uint8_t const header[kAdtsHeaderSize] = {
+          0xFF,
+          0xF1,
+          static_cast<uint8_t>(((config.object_type - 1) << 6) |
+                               (config.frequency_index << 2) |
+                               (config.channel_configuration >> 2)),
+          static_cast<uint8_t>(((config.channel_configuration & 3) << 6) |
+                               (frame_size >> 11)),
+          static_cast<uint8_t>(frame_size >> 3),
+          static_cast<uint8_t>(((frame_size & 7) << 5) | 0x1F),
+          0xFC};
+      if (!writer.Append(header, kAdtsHeaderSize) ||
+          !writer.Append(data, size)) {
+        return "writing failed.";
+      }
+      return std::nullopt;
+    }
+    case ElementaryStreamFormat::kRaw:
+      if (!writer.Append(data, size)) {
+        return "writing failed.";
+      }
+      return std::nullopt;
+  }
+  return std::nullopt;
+}
+
+// Writes the samples of a track, in order, to `track.output_file_name`.
+// Runs of contiguous samples are read together.
+void ExtractTrack(TrackFormat const& format,
+                  std::vector<SampleRange> const& samples,
+                  InputReader& reader, uint64_t file_size,
+                  ExtractedTrack& track) {
+  utility::FilePointer output{std::fopen(track.output_file_name.c_str(), "wb")};
+  if (output == nullptr) {
+    track.error = "Could not open " + track.output_file_name + " for writing.";
+    return;
+  }
+  OutputWriter writer{output.get()};
+  std::optional<std::string> error;
+  if (!writer.Append(format.header.data(), format.header.size())) {
+    error = "Writing failed.";
+  }
+  for (size_t begin = 0; begin < samples.size() && !error.has_value();) {
+    uint64_t const run_offset = samples.at(begin).offset;
+    uint64_t run_end = run_offset + samples.at(begin).size;
+    size_t end = begin + 1;
+    while (end < samples.size() && samples.at(end).offset == run_end &&
+           run_end + samples.at(end).size - run_offset <= kMaxReadSize) {
+      run_end += samples.at(end).size;
+      ++end;
+    }
+    if (run_end > file_size) {
+      error = "Sample " + std::to_string(begin + 1) +
+              " or one after it lies beyond the end of the file.";
+      break;
+    }
+    uint8_t const* const data = reader.Read(run_offset, run_end - run_offset);
+    if (data == nullptr) {
+      error = "Reading samples " + std::to_string(begin + 1) + "-" +
+              std::to_string(end) + " failed.";
+      break;
+    }
+    for (size_t i = begin; i < end; ++i) {
+      SampleRange const& sample = samples.at(i);
+      error = WriteSample(format, data + (sample.offset - run_offset),
+                          sample.size, writer);
+      if (error.has_value()) {
+        error = "Sample " + std::to_string(i + 1) + ": " + error.value();
+        break;
+      }
+      ++track.sample_count;
+    }
+    begin = end;
+  }
+  if (!writer.Flush() || std::fclose(output.release()) != 0) {
+    error = error.value_or("Writing failed.");
+  }
+  track.bytes_written = writer.GetBytesWritten();
+  if (error.has_value() && track.error.empty()) {
+    track.error = std::move(error).value();
+  }
+}
+
+// Returns the id of the track of the traf that `atom` belongs to, if any.
+std::optional<uint32_t> GetFragmentTrackId(AtomOrDescriptorBase const* atom) {
+  while (atom != nullptr && !HasType(*atom, AP4_ATOM_TYPE_TRAF)) {
+    atom = atom->GetParent();
+  }
+  if (atom == nullptr) {
+    return std::nullopt;
+  }
+  AP4_TfhdAtom* const tfhd = FindDescendantAp4Atom<AP4_TfhdAtom>(*atom);
+  if (tfhd == nullptr) {
+    return std::nullopt;
+  }
+  return tfhd->GetTrackId();
+}
+}  // namespace
+
+char const* GetFileExtension(ElementaryStreamFormat format) {
+  switch (format) {
+    case ElementaryStreamFormat::kAnnexBH264:
+      return "h264";
+    case ElementaryStreamFormat::kAnnexBHevc:
+      return "h265";
+    case ElementaryStreamFormat::kAdtsAac:
+      return "aac";
+    case ElementaryStreamFormat::kRaw:
+      return "bin";
+  }
+  return "bin";
+}
+
+Result<std::vector<ExtractedTrack>, std::string> ExtractTracks(
+    char const* input_file_name, AtomHolder& atoms,
+    std::string const& output_prefix, size_t thread_count /* = 0 */) {
+  using ExtractResult = Result<std::vector<ExtractedTrack>, std::string>;
+  std::vector<AtomOrDescriptorBase const*> traks;
+  std::vector<std::pair<AtomOrDescriptorBase const*, uint64_t>> moofs;
+  std::unordered_map<uint32_t, uint32_t> default_sample_sizes;
+  for (auto const& atom : atoms.GetTopLevelAtoms()) {
+    std::optional<uint64_t> const position = atom->GetPositionInStream();
+    if (!position.has_value()) {
+      return ExtractResult::Err(
+          "The positions of the atoms aren't known, so the samples can't be "
+          "located.");
+    }
+    if (HasType(*atom, AP4_ATOM_TYPE_MOOF)) {
+      moofs.emplace_back(atom.get(), position.value());
+    } else if (HasType(*atom, AP4_ATOM_TYPE_MOOV)) {
+      for (auto const& child : atom->GetChildAtoms()) {
+        if (HasType(*child, AP4_ATOM_TYPE_TRAK)) {
+          traks.push_back(child.get());
+        } else if (HasType(*child, AP4_ATOM_TYPE_MVEX)) {
+          for (auto const& trex_atom : child->GetChildAtoms()) {
+            if (AP4_TrexAtom* trex = GetAp4AtomAs<AP4_TrexAtom>(*trex_atom)) {
+              default_sample_sizes[trex->GetTrackId()] =
+                  trex->GetDefaultSampleSize();
+            }
+          }
+        }
+      }
+    }
+  }
+
+  QFile input{QFile::decodeName(input_file_name)};
+  if (!input.open(QIODevice::ReadOnly)) {
+    return ExtractResult::Err(std::string{"Could not open "} +
+                              input_file_name + ".");
+  }
+  auto const file_size = static_cast<uint64_t>(input.size());
+  // Mapping fails for files larger than the address space, and on some file
+  // systems, in which case workers read instead.
+  uint8_t const* const mapped =
+      file_size > 0 ? input.map(0, input.size()) : nullptr;
+
+  // Locate the samples of each trak and moof on its own task, then extract
+  // each track on its own task. Tasks write only to their own slot, so need
+  // no locking.
+  std::vector<SampleLocations> locations(traks.size() + moofs.size());
+  std::vector<ExtractedTrack> tracks(traks.size());
+  std::vector<TrackFormat> formats(traks.size());
+  {
+    parallel::WorkStealingPool pool{thread_count};
+    for (size_t i = 0; i < traks.size(); ++i) {
+      pool.Submit([&, i](size_t /* worker_index */) {
+        locations.at(i) = analysis::LocateTrackSamples(*traks.at(i));
+        formats.at(i) = DetectFormat(*traks.at(i));
+        if (AP4_TkhdAtom* tkhd =
+                FindDescendantAp4Atom<AP4_TkhdAtom>(*traks.at(i))) {
+          tracks.at(i).track_id = tkhd->GetTrackId();
+        }
+      });
+    }
+    for (size_t i = 0; i < moofs.size(); ++i) {
+      pool.Submit([&, i](size_t /* worker_index */) {
+        locations.at(traks.size() + i) = analysis::LocateFragmentSamples(
+            *moofs.at(i).first, moofs.at(i).second, default_sample_sizes);
+      });
+    }
+    pool.Wait();
+  }
+
+  {
+    parallel::WorkStealingPool pool{thread_count};
+    for (size_t i = 0; i < traks.size(); ++i) {
+      pool.Submit([&, i](size_t /* worker_index */) {
+        ExtractedTrack& track = tracks.at(i);
+        track.format = formats.at(i).format;
+        track.output_file_name = output_prefix + ".track" +
+                                 std::to_string(track.track_id) + "." +
+                                 GetFileExtension(track.format);
+        // The samples of moov, then those of each fragment in file order.
+        std::vector<SampleRange> samples = locations.at(i).samples;
+        for (analysis::SampleIssue const& issue : locations.at(i).issues) {
+          if (analysis::IsError(issue.kind) && track.error.empty()) {
+            track.error = issue.description;
+          }
+        }
+        for (size_t j = traks.size(); j < locations.size(); ++j) {
+          SampleLocations const& fragment = locations.at(j);
+          for (SampleRange const& sample : fragment.samples) {
+            if (fragment.sources.at(sample.source).track_id ==
+                track.track_id) {
+              samples.push_back(sample);
+            }
+          }
+          for (analysis::SampleIssue const& issue : fragment.issues) {
+            if (analysis::IsError(issue.kind) && track.error.empty() &&
+                GetFragmentTrackId(issue.atom) == track.track_id) {
+              track.error = issue.description;
+            }
+          }
+        }
+        InputReader reader{input_file_name, mapped};
+        ExtractTrack(formats.at(i), samples, reader, file_size, track);
+      });
+    }
+    pool.Wait();
+  }
+  return ExtractResult::Ok(std::move(tracks));
+}
+
+}  // namespace mp4_manipulator::extraction
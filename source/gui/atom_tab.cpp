@@ -0,0 +1,707 @@
+#include "gui/atom_tab.h"
+
+#include <QCheckBox>
+#include <QFileDialog>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QLineEdit>
+#include <QListWidget>
+#include <QMessageBox>
+#include <QSplitter>
+#include <QScrollBar>
+#include <QStringList>
+#include <QTimer>
+#include <QVBoxLayout>
+#include <algorithm>
+#include <iterator>
+
+#include "analysis/conformance_checker.h"
+#include "analysis/sample_reference_verifier.h"
+#include "parsing/faststart.h"
+#include "parsing/fragmenting.h"
+#include "parsing/file_utils.h"
+
+namespace mp4_manipulator {
+namespace {
+// Listing every match of a broad query (e.g. "trak") would be slow and not
+// useful, so we only list this many.
+constexpr size_t kMaxListedSearchResults = 1000;
+
+// How long to wait after a change to a followed file before reading it, so a
+// burst of writes results in one read.
+constexpr int kFollowCoalesceMs = 100;
+
+// Backgrounds for the rows of atoms that differ from another file.
+QColor const kChangedColor{255, 224, 130};
+QColor const kChildChangedColor{255, 245, 214};
+QColor const kRemovedColor{255, 205, 210};
+QColor const kAddedColor{200, 230, 201};
+
+// Backgrounds for the rows of atoms with conformance issues.
+QColor const kConformanceErrorColor{255, 205, 210};
+QColor const kConformanceWarningColor{255, 224, 130};
+
+// Returns a description of a search result such as "moov/trak/tkhd @ 1234".
+QString DescribeSearchResult(AtomOrDescriptorBase const* atom_or_descriptor) {
+  QStringList path;
+  for (AtomOrDescriptorBase const* current = atom_or_descriptor;
+       current != nullptr; current = current->GetParent()) {
+    path.prepend(current->GetName());
+  }
+  QString description = path.join('/');
+  std::optional<uint64_t> const position =
+      atom_or_descriptor->GetPositionInStream();
+  if (position.has_value()) {
+    description += QStringLiteral(" @ %1").arg(position.value());
+  }
+  return description;
+}
+}  // namespace
+
+AtomTab::AtomTab(QString const& file_name,
+                 std::unique_ptr<AtomHolder>&& atom_holder,
+                 bool is_local_file /* = true */,
+                 QWidget* parent /* = nullptr */)
+    : AtomTab{file_name, new AtomTreeView{std::move(atom_holder)},
+              is_local_file, parent} {}
+
+AtomTab::AtomTab(QString const& file_name,
+                 std::unique_ptr<utility::SegmentSet>&& segment_set,
+                 QWidget* parent /* = nullptr */)
+    : AtomTab{file_name, new AtomTreeView{std::move(segment_set)},
+              /*is_local_file=*/true, parent} {
+  is_segment_set_ = true;
+  follow_check_box_->setEnabled(false);
+  // Segments' atoms are added as they're expanded.
+  [[maybe_unused]] bool ok =
+      connect(atom_tree_view_->GetAtomTreeModel(),
+              &QAbstractItemModel::rowsInserted, this,
+              &AtomTab::UpdateMemoryUsage);
+  assert(ok);
+}
+
+AtomTab::AtomTab(QString const& file_name, AtomTreeView* atom_tree_view,
+                 bool is_local_file, QWidget* parent)
+    : QWidget{parent},
+      file_name_{file_name},
+      is_local_file_{is_local_file},
+      is_backed_by_file_{is_local_file},
+      atom_tree_view_{atom_tree_view},
+      hex_view_{new HexView{this}},
+      search_line_edit_{new QLineEdit{this}},
+      search_status_label_{new QLabel{this}},
+      search_results_list_{new QListWidget{this}},
+      follow_check_box_{new QCheckBox{"Follow file", this}},
+      file_watcher_{new QFileSystemWatcher{this}},
+      follow_timer_{new QTimer{this}} {
+  search_line_edit_->setPlaceholderText(
+      "Search four ccs, field names and values, e.g. "
+      "\"trun sample_count=12\"");
+  search_line_edit_->setClearButtonEnabled(true);
+  search_results_list_->setUniformItemSizes(true);
+  search_results_list_->hide();
+  follow_check_box_->setToolTip(
+      "Add boxes to the tree as they're appended to the file, e.g. while a "
+      "fragmented file is being recorded.");
+  follow_timer_->setSingleShot(true);
+  follow_timer_->setInterval(kFollowCoalesceMs);
+
+  QHBoxLayout* search_layout = new QHBoxLayout{};
+  search_layout->addWidget(search_line_edit_);
+  search_layout->addWidget(search_status_label_);
+  search_layout->addWidget(follow_check_box_);
+
+  QSplitter* tree_splitter = new QSplitter{Qt::Vertical};
+  tree_splitter->addWidget(search_results_list_);
+  tree_splitter->addWidget(atom_tree_view_);
+  tree_splitter->setStretchFactor(1, 1);
+
+  // The hex view sits to the right of the tree.
+  QSplitter* splitter = new QSplitter{Qt::Horizontal, this};
+  splitter->addWidget(tree_splitter);
+  splitter->addWidget(hex_view_);
+  splitter->setStretchFactor(0, 1);
+
+  QVBoxLayout* layout = new QVBoxLayout{this};
+  layout->setContentsMargins(0, 0, 0, 0);
+  layout->addLayout(search_layout);
+  layout->addWidget(splitter);
+
+  [[maybe_unused]] bool ok =
+      connect(search_line_edit_, &QLineEdit::returnPressed, this,
+              &AtomTab::RunSearch);
+  assert(ok);
+  ok = connect(search_results_list_, &QListWidget::currentRowChanged, this,
+               &AtomTab::JumpToSearchResult);
+  assert(ok);
+  // Also jump when the current result is clicked again, e.g. after scrolling
+  // the tree away from it.
+  ok = connect(search_results_list_, &QListWidget::itemClicked, this,
+               [this](QListWidgetItem* item) {
+                 JumpToSearchResult(search_results_list_->row(item));
+               });
+  assert(ok);
+  // Results point into the tree, so they're invalid once the tree is rebuilt
+  // (e.g. after removing an atom).
+  ok = connect(atom_tree_view_->GetAtomTreeModel(),
+               &QAbstractItemModel::modelReset, this,
+               &AtomTab::ClearSearchResults);
+  assert(ok);
+  ok = connect(atom_tree_view_->GetAtomTreeModel(),
+               &AtomTreeModel::AtomsModified, this,
+               &AtomTab::OnAtomsModified);
+  assert(ok);
+  ok = connect(atom_tree_view_, &AtomTreeView::CurrentAtomChanged, this,
+               &AtomTab::ShowBytes);
+  assert(ok);
+  ok = connect(atom_tree_view_, &AtomTreeView::StatusMessage, this,
+               &AtomTab::StatusMessage);
+  assert(ok);
+  ok = connect(follow_check_box_, &QCheckBox::toggled, this,
+               &AtomTab::SetFollowing);
+  assert(ok);
+  ok = connect(file_watcher_, &QFileSystemWatcher::fileChanged, follow_timer_,
+               qOverload<>(&QTimer::start));
+  assert(ok);
+  ok = connect(follow_timer_, &QTimer::timeout, this,
+               &AtomTab::ReadAppendedAtoms);
+  assert(ok);
+
+  if (!is_local_file_) {
+    follow_check_box_->setEnabled(false);
+    hex_view_->ShowMessage(
+        "This file isn't stored locally, so its bytes can't be shown.");
+  }
+  UpdateMemoryUsage();
+}
+
+void AtomTab::SaveAtoms() { atom_tree_view_->SaveAtoms(); }
+
+void AtomTab::SaveFaststartCopy() {
+  QMessageBox message_box;
+  if (is_segment_set_) {
+    message_box.setText(
+        "Copies are made of single files. Open a segment on its own to make "
+        "a faststart copy of it.");
+    message_box.exec();
+    return;
+  }
+  if (!is_local_file_) {
+    message_box.setText(
+        "This file isn't stored locally. Save it to disk and open the saved "
+        "file before making a faststart copy.");
+    message_box.exec();
+    return;
+  }
+  if (!is_backed_by_file_) {
+    message_box.setText(
+        "The atoms have been modified. Save and reopen the file before making "
+        "a faststart copy.");
+    message_box.exec();
+    return;
+  }
+  QString const output_file_name = QFileDialog::getSaveFileName(this);
+  if (output_file_name.isEmpty()) {
+    return;
+  }
+
+  QByteArray const input_file_name_bytes = file_name_.toLocal8Bit();
+  QByteArray const output_file_name_bytes = output_file_name.toLocal8Bit();
+  Result<utility::FaststartOutcome, std::string> result =
+      utility::WriteFaststart(input_file_name_bytes.constData(),
+                              output_file_name_bytes.constData());
+  if (result.IsErr()) {
+    result.MarkErrorHandled();
+    message_box.setText("Writing faststart copy failed.");
+    message_box.setDetailedText(QString::fromStdString(result.GetErr()));
+    message_box.exec();
+    return;
+  }
+  if (result.GetOk() == utility::FaststartOutcome::kAlreadyFaststart) {
+    message_box.setText(
+        "moov was already in front of the media data, so the file was copied "
+        "unchanged.");
+    message_box.exec();
+  }
+}
+
+void AtomTab::SaveFragmentedCopy() {
+  QMessageBox message_box;
+  if (is_segment_set_) {
+    message_box.setText(
+        "Copies are made of single files. Open a segment on its own to make "
+        "a fragmented copy of it.");
+    message_box.exec();
+    return;
+  }
+  if (!is_local_file_) {
+    message_box.setText(
+        "This file isn't stored locally. Save it to disk and open the saved "
+        "file before making a fragmented copy.");
+    message_box.exec();
+    return;
+  }
+  if (!is_backed_by_file_) {
+    message_box.setText(
+        "The atoms have been modified. Save and reopen the file before making "
+        "a fragmented copy.");
+    message_box.exec();
+    return;
+  }
+  QString const output_file_name = QFileDialog::getSaveFileName(this);
+  if (output_file_name.isEmpty()) {
+    return;
+  }
+
+  QByteArray const input_file_name_bytes = file_name_.toLocal8Bit();
+  QByteArray const output_file_name_bytes = output_file_name.toLocal8Bit();
+  Result<utility::FragmentingSummary, std::string> result =
+      utility::WriteFragmented(input_file_name_bytes.constData(),
+                               output_file_name_bytes.constData());
+  if (result.IsErr()) {
+    result.MarkErrorHandled();
+    message_box.setText("Writing fragmented copy failed.");
+    message_box.setDetailedText(QString::fromStdString(result.GetErr()));
+    message_box.exec();
+  }
+}
+
+QString const& AtomTab::GetFileName() const { return file_name_; }
+
+void AtomTab::VerifySampleReferences() {
+  QMessageBox message_box;
+  if (is_segment_set_) {
+    // Sample offsets are relative to each segment's own file, so a single
+    // layout can't be checked across the set.
+    message_box.setText(
+        "Sample references can't be verified across a segment set. Open a "
+        "segment together with its init segment as a single file instead.");
+    message_box.exec();
+    return;
+  }
+  if (!is_backed_by_file_) {
+    message_box.setText(
+        "The atoms have been modified. Save and reopen the file before "
+        "verifying its sample references.");
+    message_box.exec();
+    return;
+  }
+  Result<analysis::SampleVerification, std::string> result =
+      analysis::VerifySampleReferences(*GetAtomHolder());
+  if (result.IsErr()) {
+    result.MarkErrorHandled();
+    message_box.setText("Verifying the sample references failed.");
+    message_box.setDetailedText(QString::fromStdString(result.GetErr()));
+    message_box.exec();
+    return;
+  }
+  analysis::SampleVerification const& verification = result.GetOk();
+
+  ClearSearchResults();
+  QString const summary =
+      QStringLiteral("%1 samples in %2 tracks and fragments: %3 errors, %4 "
+                     "unreferenced ranges")
+          .arg(verification.sample_count)
+          .arg(verification.track_count)
+          .arg(verification.error_count)
+          .arg(verification.unreferenced_range_count);
+  if (verification.issues.size() <
+      verification.error_count + verification.unreferenced_range_count) {
+    search_status_label_->setText(
+        summary + QStringLiteral(" (first %1 listed)")
+                      .arg(verification.issues.size()));
+  } else {
+    search_status_label_->setText(summary);
+  }
+  if (verification.issues.empty()) {
+    return;
+  }
+  search_results_list_->blockSignals(true);
+  for (analysis::SampleIssue const& issue : verification.issues) {
+    search_results_.push_back(issue.atom);
+    search_results_list_->addItem(
+        QStringLiteral("%1: %2")
+            .arg(DescribeSearchResult(issue.atom),
+                 QString::fromStdString(issue.description)));
+  }
+  search_results_list_->setCurrentRow(-1);
+  search_results_list_->blockSignals(false);
+  search_results_list_->show();
+}
+
+void AtomTab::CheckConformance() {
+  AtomTreeModel* const model = atom_tree_view_->GetAtomTreeModel();
+  // A segment set's media segments are checked once they've been parsed.
+  std::vector<AtomHolder*> holders{GetAtomHolder()};
+  if (utility::SegmentSet const* segment_set = model->GetSegmentSet()) {
+    for (size_t i = 0; i < segment_set->GetSegmentCount(); ++i) {
+      if (AtomHolder* segment_atoms = segment_set->GetSegmentAtoms(i)) {
+        holders.push_back(segment_atoms);
+      }
+    }
+  }
+  std::vector<analysis::ConformanceIssue> issues;
+  uint64_t error_count = 0;
+  uint64_t warning_count = 0;
+  uint64_t checked_atom_count = 0;
+  for (AtomHolder* holder : holders) {
+    analysis::ConformanceReport report = analysis::CheckConformance(*holder);
+    issues.insert(issues.end(), std::make_move_iterator(report.issues.begin()),
+                  std::make_move_iterator(report.issues.end()));
+    error_count += report.error_count;
+    warning_count += report.warning_count;
+    checked_atom_count += report.checked_atom_count;
+  }
+
+  // Atoms with several issues are shown in the color of the worst, with all
+  // of them in the tool tip.
+  std::unordered_map<AtomOrDescriptorBase const*, QColor> highlights;
+  std::unordered_map<AtomOrDescriptorBase const*, QString> annotations;
+  std::vector<AtomOrDescriptorBase const*> annotated_atoms;
+  for (analysis::ConformanceIssue const& issue : issues) {
+    bool const is_error =
+        issue.severity == analysis::ConformanceSeverity::kError;
+    QString const line =
+        QStringLiteral("%1 (%2): %3")
+            .arg(QLatin1String{is_error ? "Error" : "Warning"},
+                 QLatin1String{issue.rule},
+                 QString::fromStdString(issue.description));
+    QString& annotation = annotations[issue.atom];
+    if (annotation.isEmpty()) {
+      annotated_atoms.push_back(issue.atom);
+      highlights[issue.atom] = kConformanceWarningColor;
+    } else {
+      annotation += '\n';
+    }
+    annotation += line;
+    if (is_error) {
+      highlights[issue.atom] = kConformanceErrorColor;
+    }
+  }
+  model->SetHighlights(std::move(highlights));
+  model->SetAnnotations(std::move(annotations));
+  atom_tree_view_->RevealAtoms(annotated_atoms);
+
+  ClearSearchResults();
+  QString const summary =
+      QStringLiteral("Checked %1 atoms: %2 errors, %3 warnings")
+          .arg(checked_atom_count)
+          .arg(error_count)
+          .arg(warning_count);
+  if (issues.size() < error_count + warning_count) {
+    search_status_label_->setText(
+        summary + QStringLiteral(" (first %1 listed)").arg(issues.size()));
+  } else {
+    search_status_label_->setText(summary);
+  }
+  if (issues.empty()) {
+    return;
+  }
+  search_results_list_->blockSignals(true);
+  for (analysis::ConformanceIssue const& issue : issues) {
+    search_results_.push_back(issue.atom);
+    search_results_list_->addItem(
+        QStringLiteral("%1: %2")
+            .arg(DescribeSearchResult(issue.atom),
+                 QString::fromStdString(issue.description)));
+  }
+  search_results_list_->setCurrentRow(-1);
+  search_results_list_->blockSignals(false);
+  search_results_list_->show();
+}
+
+bool AtomTab::IsBackedByLocalFile() const {
+  return is_backed_by_file_ && !IsEvicted() && !is_segment_set_;
+}
+
+bool AtomTab::IsSegmentSet() const { return is_segment_set_; }
+
+AtomHolder* AtomTab::GetAtomHolder() const {
+  return atom_tree_view_->GetAtomTreeModel()->GetAtomHolder();
+}
+
+void AtomTab::ShowDifferences(analysis::StructuralDiff const& diff,
+                              bool is_left) {
+  std::unordered_map<AtomOrDescriptorBase const*, QColor> highlights;
+  std::vector<AtomOrDescriptorBase const*> differing_atoms;
+  for (analysis::Difference const& difference : diff.differences) {
+    AtomOrDescriptorBase const* atom =
+        is_left ? difference.left : difference.right;
+    if (atom == nullptr) {
+      // Only in the other file.
+      continue;
+    }
+    switch (difference.kind) {
+      case analysis::DifferenceKind::kChanged:
+        // Atoms that only differ in their children are paler, so the atoms
+        // that actually changed stand out.
+        highlights[atom] = difference.contents_changed ? kChangedColor
+                                                       : kChildChangedColor;
+        break;
+      case analysis::DifferenceKind::kRemoved:
+        highlights[atom] = kRemovedColor;
+        break;
+      case analysis::DifferenceKind::kAdded:
+        highlights[atom] = kAddedColor;
+        break;
+    }
+    differing_atoms.push_back(atom);
+  }
+  atom_tree_view_->GetAtomTreeModel()->SetHighlights(std::move(highlights));
+  atom_tree_view_->RevealAtoms(differing_atoms);
+}
+
+bool AtomTab::CanEvict() const {
+  // Followed tabs are being watched, and would have to reread the whole file
+  // to catch up. Segment sets only hold the segments that have been looked
+  // at, and reloading would lose track of which those were.
+  return is_backed_by_file_ && !IsEvicted() && !IsFollowing() &&
+         !is_segment_set_;
+}
+
+bool AtomTab::IsEvicted() const {
+  return !atom_tree_view_->GetAtomTreeModel()->HasAtoms();
+}
+
+void AtomTab::Evict() {
+  assert(CanEvict());
+  atom_tree_view_->GetAtomTreeModel()->UnloadAtoms();
+  search_line_edit_->setDisabled(true);
+  follow_check_box_->setDisabled(true);
+  hex_view_->ShowMessage(
+      "This file was unloaded to stay within the memory budget. It will be "
+      "reloaded when the tab is shown.");
+  UpdateMemoryUsage();
+}
+
+bool AtomTab::Rehydrate() {
+  assert(IsEvicted());
+  QByteArray file_name_bytes = file_name_.toLocal8Bit();
+  std::optional<std::unique_ptr<AtomHolder>> possible_atoms =
+      utility::ReadAtoms(file_name_bytes.data());
+  if (!possible_atoms.has_value()) {
+    hex_view_->ShowMessage(
+        QStringLiteral("Failed to reload %1.").arg(file_name_));
+    return false;
+  }
+  atom_tree_view_->GetAtomTreeModel()->SetAtoms(
+      std::move(possible_atoms.value()));
+  search_line_edit_->setEnabled(true);
+  follow_check_box_->setEnabled(true);
+  hex_view_->ShowMessage("Select an atom to view its bytes.");
+  UpdateMemoryUsage();
+  return true;
+}
+
+size_t AtomTab::GetMemoryUsage() const { return memory_usage_; }
+
+void AtomTab::MarkActivated(uint64_t activation_tick) {
+  last_activation_tick_ = activation_tick;
+}
+
+uint64_t AtomTab::GetLastActivationTick() const {
+  return last_activation_tick_;
+}
+
+bool AtomTab::IsFollowing() const { return is_following_; }
+
+void AtomTab::SetFollowing(bool following) {
+  if (following == is_following_) {
+    return;
+  }
+  if (following) {
+    std::optional<uint64_t> const end_offset =
+        atom_tree_view_->GetAtomTreeModel()->GetTopLevelAtomsEnd();
+    if (!is_backed_by_file_ || IsEvicted() || !end_offset.has_value() ||
+        !file_watcher_->addPath(file_name_)) {
+      follow_check_box_->setChecked(false);
+      search_status_label_->setText("Can't follow this file");
+      return;
+    }
+    followed_end_offset_ = end_offset.value();
+  } else {
+    if (!file_watcher_->files().isEmpty()) {
+      file_watcher_->removePaths(file_watcher_->files());
+    }
+    // Atoms read while following keep their own reference to the stream.
+    followed_stream_.reset();
+  }
+  is_following_ = following;
+  follow_timer_->stop();
+  // Keep the check box in sync when following is changed programmatically.
+  // This re-enters, but returns early as the state already matches.
+  follow_check_box_->setChecked(following);
+  if (following) {
+    // Catch up on anything written since the file was read.
+    ReadAppendedAtoms();
+  }
+}
+
+void AtomTab::ReadAppendedAtoms() {
+  if (!IsFollowing()) {
+    return;
+  }
+  QFileInfo const file_info{file_name_};
+  if (!file_info.exists() ||
+      static_cast<uint64_t>(file_info.size()) < followed_end_offset_) {
+    // The file was replaced or truncated, so the tree no longer describes it.
+    SetFollowing(false);
+    search_status_label_->setText(
+        "Stopped following, the file shrank or was removed");
+    return;
+  }
+  // Some writers replace the file rather than appending to it, which drops
+  // the watch. The stream would still read the replaced file, so reopen it.
+  if (!file_watcher_->files().contains(file_name_)) {
+    file_watcher_->addPath(file_name_);
+    followed_stream_.reset();
+  }
+  if (static_cast<uint64_t>(file_info.size()) == followed_end_offset_) {
+    return;
+  }
+
+  if (followed_stream_ == nullptr) {
+    QByteArray const file_name_bytes = file_name_.toLocal8Bit();
+    AP4_ByteStream* raw_stream = nullptr;
+    if (AP4_FAILED(AP4_FileByteStream::Create(
+            file_name_bytes.constData(), AP4_FileByteStream::STREAM_MODE_READ,
+            raw_stream))) {
+      SetFollowing(false);
+      search_status_label_->setText(
+          "Stopped following, the file can't be read");
+      return;
+    }
+    followed_stream_.reset(raw_stream);
+  }
+  uint64_t end_offset = followed_end_offset_;
+  std::optional<std::unique_ptr<AtomHolder>> possible_atoms =
+      utility::ReadAppendedAtoms(*followed_stream_, followed_end_offset_,
+                                 end_offset);
+  if (!possible_atoms.has_value()) {
+    SetFollowing(false);
+    search_status_label_->setText(
+        "Stopped following, the appended data is malformed");
+    return;
+  }
+  followed_end_offset_ = end_offset;
+  if (possible_atoms.value()->GetTopLevelAtoms().empty()) {
+    // Only part of the next box has been written so far.
+    return;
+  }
+
+  // Keep the newest boxes in view, unless the user has scrolled up to look
+  // at something else.
+  QScrollBar const* scroll_bar = atom_tree_view_->verticalScrollBar();
+  bool const was_at_bottom = scroll_bar->value() == scroll_bar->maximum();
+  atom_tree_view_->GetAtomTreeModel()->AppendAtoms(
+      std::move(possible_atoms.value()));
+  if (was_at_bottom) {
+    atom_tree_view_->scrollToBottom();
+  }
+  UpdateMemoryUsage();
+}
+
+void AtomTab::UpdateMemoryUsage() {
+  memory_usage_ = atom_tree_view_->GetAtomTreeModel()->EstimateMemoryUsage();
+  emit MemoryUsageChanged();
+}
+
+void AtomTab::ClearSearchResults() {
+  search_results_.clear();
+  search_results_list_->clear();
+  search_results_list_->hide();
+  search_status_label_->clear();
+}
+
+void AtomTab::OnAtomsModified() {
+  is_backed_by_file_ = false;
+  SetFollowing(false);
+  follow_check_box_->setEnabled(false);
+  UpdateMemoryUsage();
+  if (!is_local_file_) {
+    // The view is already showing a message explaining why bytes aren't
+    // shown.
+    return;
+  }
+  hex_view_->ShowMessage(
+      "The atoms have been modified, so their bytes no longer match the file "
+      "on disk. Save and reopen the file to view bytes.");
+}
+
+void AtomTab::RunSearch() {
+  ClearSearchResults();
+  QString const query = search_line_edit_->text();
+  if (query.trimmed().isEmpty()) {
+    return;
+  }
+
+  std::vector<AtomOrDescriptorBase*> const results =
+      atom_tree_view_->GetAtomTreeModel()->Search(query);
+  search_results_.assign(results.begin(), results.end());
+  if (search_results_.empty()) {
+    search_status_label_->setText("No matches");
+    return;
+  }
+
+  size_t const listed_count =
+      std::min(search_results_.size(), kMaxListedSearchResults);
+  if (listed_count < search_results_.size()) {
+    search_status_label_->setText(QStringLiteral("%1 matches (first %2 listed)")
+                                      .arg(search_results_.size())
+                                      .arg(listed_count));
+  } else {
+    search_status_label_->setText(
+        QStringLiteral("%1 matches").arg(search_results_.size()));
+  }
+  search_results_.resize(listed_count);
+
+  // Block signals while populating, otherwise adding the first item will
+  // select it and jump the tree before the user has chosen a result.
+  search_results_list_->blockSignals(true);
+  for (AtomOrDescriptorBase const* result : search_results_) {
+    search_results_list_->addItem(DescribeSearchResult(result));
+  }
+  search_results_list_->setCurrentRow(-1);
+  search_results_list_->blockSignals(false);
+  search_results_list_->show();
+}
+
+void AtomTab::JumpToSearchResult(int row) {
+  if (row < 0 || static_cast<size_t>(row) >= search_results_.size()) {
+    return;
+  }
+  atom_tree_view_->JumpToAtom(search_results_.at(row));
+}
+
+void AtomTab::ShowBytes(AtomOrDescriptorBase* atom_or_descriptor) {
+  if (!is_backed_by_file_) {
+    // The view is already showing a message explaining why.
+    return;
+  }
+  if (atom_or_descriptor == nullptr) {
+    hex_view_->ShowMessage("Select an atom to view its bytes.");
+    return;
+  }
+  std::optional<uint64_t> const position =
+      atom_or_descriptor->GetPositionInStream();
+  if (!position.has_value()) {
+    // E.g. descriptors, which we don't track positions for.
+    hex_view_->ShowMessage(
+        QStringLiteral("The position of %1 in the file is not known.")
+            .arg(atom_or_descriptor->GetName()));
+    return;
+  }
+  // The atoms of a segment set come from several files.
+  std::optional<std::string> const segment_file_name =
+      atom_tree_view_->GetAtomTreeModel()->GetSegmentFileName(
+          atom_or_descriptor);
+  hex_view_->SetRange(segment_file_name.has_value()
+                          ? QFile::decodeName(segment_file_name->c_str())
+                          : file_name_,
+                      position.value(), atom_or_descriptor->GetSize());
+}
+
+}  // namespace mp4_manipulator
@@ -1,8 +1,31 @@
 #include "gui/atom_tree_model.h"
 
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
 #include <algorithm>  // std::find
+#include <iterator>
+#include <thread>
+
+#include "parsing/unparsed_atom.h"
+#include "profiling/allocation_profiler.h"
 
 namespace mp4_manipulator {
+namespace {
+// Media segments are on the rows after the init segment.
+constexpr int kFirstSegmentRow = 1;
+
+// Returns a model item showing `field`, a field of `parent`.
+std::unique_ptr<ModelItem> MakeFieldModelItem(ModelItem* parent,
+                                              Field const& field) {
+  std::unique_ptr<ModelItem> model_field = std::make_unique<ModelItem>();
+  model_field->type = ModelItem::Type::kField;
+  model_field->name = field.name;
+  model_field->value = field.data;
+  model_field->parent = parent;
+  return model_field;
+}
+}  // namespace
 
 AtomTreeModel::AtomTreeModel(QObject* parent /*= nullptr */)
     : QAbstractItemModel{parent} {}
@@ -12,11 +35,26 @@ QVariant AtomTreeModel::data(QModelIndex const& index, int role) const {
     return QVariant();
   }
 
+  ModelItem* item = static_cast<ModelItem*>(index.internalPointer());
+  if (role == Qt::BackgroundRole) {
+    auto it = highlights_.find(item->underlying_item);
+    if (item->underlying_item == nullptr || it == highlights_.end()) {
+      return QVariant();
+    }
+    return it->second;
+  }
+  if (role == Qt::ToolTipRole) {
+    auto it = annotations_.find(item->underlying_item);
+    if (item->underlying_item == nullptr || it == annotations_.end()) {
+      return QVariant();
+    }
+    return it->second;
+  }
+
   if (role != Qt::DisplayRole) {
     return QVariant();
   }
 
-  ModelItem* item = static_cast<ModelItem*>(index.internalPointer());
   switch (index.column()) {
     case 0:  // Name
       return item->name;
@@ -41,6 +79,9 @@ QVariant AtomTreeModel::data(QModelIndex const& index, int role) const {
         QTextStream(&size_string) << item->size.value();
         return size_string;
       }
+      if (item->type == ModelItem::Type::kFile && item->size.has_value()) {
+        return QVariant{static_cast<qulonglong>(item->size.value())};
+      }
       return QVariant{};
     default:
       assert(false);
@@ -110,27 +151,13 @@ QModelIndex AtomTreeModel::parent(QModelIndex const& index) const {
   // handled above.
   assert(parent->parent != nullptr);
 
-  // Get the vector containing our parent and it's siblings.
-  std::vector<std::unique_ptr<ModelItem>> const& parent_and_siblings =
-      parent->parent->children;
-
-  // A predicate to check if our unique pointers match the raw pointer of
-  // parent.
-  auto predicate = [&parent](std::unique_ptr<ModelItem> const& element) {
-    return parent == element.get();
-  };
-  // Find our parent in the vector.
-  auto iterator = std::find_if(parent_and_siblings.begin(),
-                               parent_and_siblings.end(), predicate);
-  assert(iterator != parent_and_siblings.end());
-  if (iterator == parent_and_siblings.end()) {
-    // This shouldn't happen (per the assert), but gracefully handle just in
-    // case.
+  std::optional<int> const parent_row = GetRowOfItem(parent);
+  if (!parent_row.has_value()) {
+    // This shouldn't happen (GetRowOfItem asserts), but gracefully handle just
+    // in case.
     return QModelIndex();
   }
-  // Get the parent's index in the vector.
-  int const parent_index = iterator - parent_and_siblings.begin();
-  return createIndex(parent_index, 0, parent);
+  return createIndex(parent_row.value(), 0, parent);
 }
 
 int AtomTreeModel::rowCount(
@@ -164,11 +191,80 @@ int AtomTreeModel::columnCount(
   return 4;
 }
 
+bool AtomTreeModel::hasChildren(
+    QModelIndex const& parent /* = QModelIndex() */) const {
+  if (parent.isValid()) {
+    ModelItem const* item = static_cast<ModelItem*>(parent.internalPointer());
+    if (item->type == ModelItem::Type::kFile && !item->atoms_loaded) {
+      // Show an expander, the atoms are fetched when it's used.
+      return true;
+    }
+  }
+  return QAbstractItemModel::hasChildren(parent);
+}
+
+bool AtomTreeModel::canFetchMore(QModelIndex const& parent) const {
+  if (!parent.isValid()) {
+    return false;
+  }
+  ModelItem const* item = static_cast<ModelItem*>(parent.internalPointer());
+  return item->type == ModelItem::Type::kFile && !item->atoms_loaded;
+}
+
+void AtomTreeModel::fetchMore(QModelIndex const& parent) {
+  if (!canFetchMore(parent)) {
+    return;
+  }
+  assert(segment_set_ != nullptr);
+  ModelItem* item = static_cast<ModelItem*>(parent.internalPointer());
+  assert(item->segment_index.has_value());
+  item->atoms_loaded = true;
+  size_t const index = item->segment_index.value();
+
+  if (!segment_set_->GetSegmentSummary(index).is_parsed) {
+    // Parse ahead, so the segments after this one are ready when they're
+    // expanded.
+    size_t const batch_size = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> batch;
+    for (size_t i = index;
+         i < segment_set_->GetSegmentCount() && batch.size() < batch_size;
+         ++i) {
+      if (!segment_set_->GetSegmentSummary(i).is_parsed) {
+        batch.push_back(i);
+      }
+    }
+    segment_set_->ParseSegments(batch);
+    for (size_t const parsed_index : batch) {
+      int const row = kFirstSegmentRow + static_cast<int>(parsed_index);
+      ModelItem& parsed_item = *model_root_->children.at(row);
+      UpdateSegmentSummary(parsed_item);
+      QModelIndex const changed = createIndex(row, 1, &parsed_item);
+      emit dataChanged(changed, changed, {Qt::DisplayRole});
+    }
+  }
+
+  AtomHolder* atoms = segment_set_->GetSegmentAtoms(index);
+  if (atoms == nullptr || atoms->GetTopLevelAtoms().empty()) {
+    // The summary says why.
+    return;
+  }
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kModelBuild, "AtomTreeModel::fetchMore");
+  std::vector<std::unique_ptr<AtomOrDescriptorBase>>& top_level_atoms =
+      atoms->GetTopLevelAtoms();
+  beginInsertRows(parent.siblingAtColumn(0), 0,
+                  static_cast<int>(top_level_atoms.size()) - 1);
+  for (std::unique_ptr<AtomOrDescriptorBase>& atom : top_level_atoms) {
+    AddModelItem(item, atom.get());
+  }
+  endInsertRows();
+}
+
 void AtomTreeModel::SetAtoms(std::unique_ptr<AtomHolder>&& atom_holder) {
   // Since we're setting new atoms, notify a model reset -- we should
   // invalidate the old model.
   beginResetModel();
 
+  segment_set_.reset();
   atom_holder_ = std::move(atom_holder);
   UpdateModelItems();
 
@@ -177,7 +273,191 @@ void AtomTreeModel::SetAtoms(std::unique_ptr<AtomHolder>&& atom_holder) {
   endResetModel();
 }
 
+void AtomTreeModel::SetSegmentSet(
+    std::unique_ptr<utility::SegmentSet>&& segment_set) {
+  beginResetModel();
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kModelBuild,
+                                   "AtomTreeModel::SetSegmentSet");
+  atom_holder_.reset();
+  segment_set_ = std::move(segment_set);
+  model_root_ = std::make_unique<ModelItem>();
+  atom_to_model_item_.clear();
+  highlights_.clear();
+  annotations_.clear();
+
+  // The init segment is small, so its atoms get model items up front.
+  std::unique_ptr<ModelItem> init_item = std::make_unique<ModelItem>();
+  init_item->type = ModelItem::Type::kFile;
+  init_item->name =
+      QFileInfo{QFile::decodeName(segment_set_->GetInitFileName().c_str())}
+          .fileName();
+  init_item->value = QStringLiteral("Initialization segment");
+  init_item->size = segment_set_->GetInitSize();
+  init_item->atoms_loaded = true;
+  init_item->parent = model_root_.get();
+  for (std::unique_ptr<AtomOrDescriptorBase>& atom :
+       segment_set_->GetInitAtoms().GetTopLevelAtoms()) {
+    AddModelItem(init_item.get(), atom.get());
+  }
+  model_root_->children.push_back(std::move(init_item));
+
+  // Only a summary row per media segment, see fetchMore.
+  model_root_->children.reserve(kFirstSegmentRow +
+                                segment_set_->GetSegmentCount());
+  for (size_t i = 0; i < segment_set_->GetSegmentCount(); ++i) {
+    std::unique_ptr<ModelItem> segment_item = std::make_unique<ModelItem>();
+    segment_item->type = ModelItem::Type::kFile;
+    QString const file_name =
+        QFile::decodeName(segment_set_->GetSegmentFileName(i).c_str());
+    segment_item->name = QFileInfo{file_name}.fileName();
+    segment_item->size = segment_set_->GetSegmentSummary(i).size;
+    segment_item->segment_index = i;
+    segment_item->parent = model_root_.get();
+    UpdateSegmentSummary(*segment_item);
+    model_root_->children.push_back(std::move(segment_item));
+  }
+  endResetModel();
+}
+
+utility::SegmentSet* AtomTreeModel::GetSegmentSet() const {
+  return segment_set_.get();
+}
+
+std::optional<std::string> AtomTreeModel::GetSegmentFileName(
+    AtomOrDescriptorBase const* atom_or_descriptor) const {
+  if (segment_set_ == nullptr) {
+    return std::nullopt;
+  }
+  auto it = atom_to_model_item_.find(atom_or_descriptor);
+  if (it == atom_to_model_item_.end()) {
+    return std::nullopt;
+  }
+  ModelItem const* file_item = GetTopLevelItem(it->second);
+  if (!file_item->segment_index.has_value()) {
+    return segment_set_->GetInitFileName();
+  }
+  return segment_set_->GetSegmentFileName(file_item->segment_index.value());
+}
+
+void AtomTreeModel::AppendAtoms(
+    std::unique_ptr<AtomHolder>&& appended_atoms) {
+  assert(atom_holder_ != nullptr && model_root_ != nullptr);
+  std::vector<std::unique_ptr<AtomOrDescriptorBase>>& new_atoms =
+      appended_atoms->GetTopLevelAtoms();
+  if (new_atoms.empty()) {
+    return;
+  }
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kModelBuild, "AtomTreeModel::AppendAtoms");
+  // Trailing unparsed atoms are a box that was still being written, which
+  // the appended atoms read again, so they'd otherwise be shown (and saved)
+  // twice.
+  size_t const unparsed_count = atom_holder_->GetTrailingUnparsedAtomCount();
+  if (unparsed_count > 0) {
+    int const row_count = static_cast<int>(model_root_->children.size());
+    beginRemoveRows(QModelIndex(), row_count - static_cast<int>(unparsed_count),
+                    row_count - 1);
+    for (size_t i = 0; i < unparsed_count; ++i) {
+      AtomOrDescriptorBase const* const atom =
+          model_root_->children.back()->underlying_item;
+      // Unparsed atoms have no children, so only their own rows point at
+      // them.
+      atom_to_model_item_.erase(atom);
+      highlights_.erase(atom);
+      annotations_.erase(atom);
+      model_root_->children.pop_back();
+    }
+    atom_holder_->RemoveTrailingUnparsedAtoms();
+    endRemoveRows();
+  }
+  int const first_row = static_cast<int>(model_root_->children.size());
+  int const last_row = first_row + static_cast<int>(new_atoms.size()) - 1;
+  beginInsertRows(QModelIndex(), first_row, last_row);
+  for (std::unique_ptr<AtomOrDescriptorBase>& atom : new_atoms) {
+    AddModelItem(model_root_.get(), atom.get());
+  }
+  // Moving the atoms doesn't move the objects the model items point at.
+  atom_holder_->AppendAtoms(std::move(appended_atoms));
+  endInsertRows();
+}
+
+std::optional<uint64_t> AtomTreeModel::GetTopLevelAtomsEnd() const {
+  if (atom_holder_ == nullptr) {
+    return std::nullopt;
+  }
+  std::vector<std::unique_ptr<AtomOrDescriptorBase>> const& top_level_atoms =
+      atom_holder_->GetTopLevelAtoms();
+  // A file read while it was being written usually ends part way through a
+  // box, which is held as unparsed. Reading should resume at that box.
+  auto last_parsed_atom = std::find_if(
+      top_level_atoms.rbegin(), top_level_atoms.rend(),
+      [](std::unique_ptr<AtomOrDescriptorBase> const& atom) {
+        return !IsUnparsedAtom(*atom);
+      });
+  if (last_parsed_atom == top_level_atoms.rend()) {
+    return std::nullopt;
+  }
+  AtomOrDescriptorBase const& last_atom = **last_parsed_atom;
+  std::optional<uint64_t> const position = last_atom.GetPositionInStream();
+  if (!position.has_value()) {
+    return std::nullopt;
+  }
+  return position.value() + last_atom.GetSize();
+}
+
+void AtomTreeModel::UnloadAtoms() {
+  beginResetModel();
+  atom_holder_.reset();
+  segment_set_.reset();
+  model_root_.reset();
+  atom_to_model_item_.clear();
+  highlights_.clear();
+  annotations_.clear();
+  endResetModel();
+}
+
+bool AtomTreeModel::HasAtoms() const {
+  return atom_holder_ != nullptr || segment_set_ != nullptr;
+}
+
+AtomHolder* AtomTreeModel::GetAtomHolder() const {
+  if (segment_set_ != nullptr) {
+    return &segment_set_->GetInitAtoms();
+  }
+  return atom_holder_.get();
+}
+
+size_t AtomTreeModel::EstimateMemoryUsage() const {
+  if (!HasAtoms()) {
+    return 0;
+  }
+  // The model items' strings are implicitly shared with the atoms' fields, so
+  // only the items themselves (and the lookup map) add to the usage.
+  constexpr size_t kMapEntryOverhead = 32;
+  size_t usage = segment_set_ != nullptr
+                     ? segment_set_->EstimateMemoryUsage()
+                     : atom_holder_->EstimateMemoryUsage();
+  std::function<size_t(ModelItem const&)> estimate_item =
+      [&estimate_item](ModelItem const& item) -> size_t {
+    size_t item_usage = sizeof(ModelItem) + sizeof(std::unique_ptr<ModelItem>);
+    for (auto const& child : item.children) {
+      item_usage += estimate_item(*child);
+    }
+    return item_usage;
+  };
+  if (model_root_ != nullptr) {
+    usage += estimate_item(*model_root_);
+  }
+  usage += atom_to_model_item_.size() *
+           (sizeof(AtomOrDescriptorBase*) + sizeof(ModelItem*) +
+            kMapEntryOverhead);
+  return usage;
+}
+
 Result<std::monostate, std::string> AtomTreeModel::RemoveAtom(Atom* atom) {
+  if (segment_set_ != nullptr) {
+    return Result<std::monostate, std::string>::Err(
+        "Segment sets can't be edited.");
+  }
   // TODO(bryce): We can be smarter than a total model reset.
   beginResetModel();
 
@@ -187,70 +467,269 @@ Result<std::monostate, std::string> AtomTreeModel::RemoveAtom(Atom* atom) {
   // Notify that the reset has been completed, it's now safe to query the new
   // model data.
   endResetModel();
+  emit AtomsModified();
   return result;
 }
 
 Result<std::monostate, std::string> AtomTreeModel::SaveAtoms(
     QString const& file_name) {
+  if (segment_set_ != nullptr) {
+    return Result<std::monostate, std::string>::Err(
+        "Segment sets can't be saved, open a segment on its own to save it.");
+  }
   QByteArray file_name_bytes = file_name.toLocal8Bit();
   char const* c_str_file_name = file_name_bytes.data();
 
   return atom_holder_->SaveAtoms(c_str_file_name);
 }
 
-void AtomTreeModel::UpdateModelItems() {
-  // Helper function that takes a ModelItem parent and a AtomOrDescriptorBase
-  // and recursively constructs and adds to the parent the appropriate model
-  // TODO(bryce): this would be more readable as a non-lambda in an anonymous
-  // namespace
-  std::function<void(ModelItem*, AtomOrDescriptorBase*)>
-      add_atom_or_descriptor =
-          [&add_atom_or_descriptor](
-              ModelItem* parent,
-              AtomOrDescriptorBase* atom_or_descriptor) -> void {
-    std::unique_ptr<ModelItem> current_item = std::make_unique<ModelItem>();
-    current_item->underlying_item = atom_or_descriptor;
-    current_item->type =
-        atom_or_descriptor->GetType() == AtomOrDescriptorBase::Type::kAtom
-            ? ModelItem::Type::kAtom
-            : ModelItem::Type::kDescriptor;
-    current_item->name = atom_or_descriptor->GetName();
-    current_item->header_size = atom_or_descriptor->GetHeaderSize();
-    current_item->size = atom_or_descriptor->GetSize();
-    current_item->position = atom_or_descriptor->GetPositionInStream();
-    current_item->parent = parent;
-    // Add the fields.
-    for (Field const& field : atom_or_descriptor->GetFields()) {
-      std::unique_ptr<ModelItem> model_field = std::make_unique<ModelItem>();
-      model_field->type = ModelItem::Type::kField;
-      model_field->name = field.name;
-      model_field->value = field.data;
-      model_field->parent = current_item.get();
-      current_item->children.push_back(std::move(model_field));
+std::vector<AtomOrDescriptorBase*> AtomTreeModel::Search(
+    QString const& query) const {
+  if (segment_set_ != nullptr) {
+    // Only the segments with model items, so the results can be shown.
+    std::vector<AtomOrDescriptorBase*> results;
+    for (std::unique_ptr<ModelItem> const& file_item : model_root_->children) {
+      AtomHolder const* atoms =
+          file_item->atoms_loaded ? GetAtomHolderOfItem(file_item.get())
+                                  : nullptr;
+      if (atoms == nullptr || atoms->GetSearchIndex() == nullptr) {
+        continue;
+      }
+      std::vector<AtomOrDescriptorBase*> const file_results =
+          atoms->GetSearchIndex()->Search(query);
+      results.insert(results.end(), file_results.begin(), file_results.end());
     }
-    // Handle child descriptors.
-    std::vector<std::unique_ptr<AtomOrDescriptorBase>> const&
-        child_descriptors = atom_or_descriptor->GetChildDescriptors();
-    for (size_t i = 0; i < child_descriptors.size(); ++i) {
-      AtomOrDescriptorBase* child = child_descriptors.at(i).get();
-      add_atom_or_descriptor(current_item.get(), child);
+    return results;
+  }
+  if (atom_holder_ == nullptr || atom_holder_->GetSearchIndex() == nullptr) {
+    return {};
+  }
+  return atom_holder_->GetSearchIndex()->Search(query);
+}
+
+void AtomTreeModel::InspectDeeply(QModelIndex const& index) {
+  if (!index.isValid() || !HasAtoms()) {
+    return;
+  }
+  ModelItem* item = static_cast<ModelItem*>(index.internalPointer());
+  if (item->type != ModelItem::Type::kAtom || item->inspected_deeply) {
+    return;
+  }
+  item->inspected_deeply = true;
+  AtomHolder* atoms = GetAtomHolderOfItem(item);
+  if (atoms == nullptr || !atoms->InspectDeeply(*item->underlying_item)) {
+    return;
+  }
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kModelBuild, "AtomTreeModel::InspectDeeply");
+  std::vector<Field> const& fields = item->underlying_item->GetFields();
+  std::vector<std::unique_ptr<ModelItem>>& children = item->children;
+  // The field rows come before any descriptor or atom rows.
+  size_t old_field_count = 0;
+  while (old_field_count < children.size() &&
+         children.at(old_field_count)->type == ModelItem::Type::kField) {
+    ++old_field_count;
+  }
+  // The deeper fields usually extend the summary fields, in which case rows
+  // are only inserted, and the view keeps its selection and scroll position.
+  size_t unchanged_count = 0;
+  while (unchanged_count < old_field_count && unchanged_count < fields.size() &&
+         children.at(unchanged_count)->name ==
+             fields.at(unchanged_count).name &&
+         children.at(unchanged_count)->value ==
+             fields.at(unchanged_count).data) {
+    ++unchanged_count;
+  }
+  QModelIndex const parent = index.siblingAtColumn(0);
+  auto const first_changed = static_cast<ptrdiff_t>(unchanged_count);
+  if (unchanged_count < old_field_count) {
+    beginRemoveRows(parent, static_cast<int>(unchanged_count),
+                    static_cast<int>(old_field_count) - 1);
+    children.erase(children.begin() + first_changed,
+                   children.begin() + static_cast<ptrdiff_t>(old_field_count));
+    endRemoveRows();
+  }
+  if (unchanged_count < fields.size()) {
+    std::vector<std::unique_ptr<ModelItem>> new_items;
+    new_items.reserve(fields.size() - unchanged_count);
+    for (size_t i = unchanged_count; i < fields.size(); ++i) {
+      new_items.push_back(MakeFieldModelItem(item, fields.at(i)));
+    }
+    beginInsertRows(parent, static_cast<int>(unchanged_count),
+                    static_cast<int>(fields.size()) - 1);
+    children.insert(children.begin() + first_changed,
+                    std::make_move_iterator(new_items.begin()),
+                    std::make_move_iterator(new_items.end()));
+    endInsertRows();
+  }
+}
+
+void AtomTreeModel::SetHighlights(
+    std::unordered_map<AtomOrDescriptorBase const*, QColor>&& highlights) {
+  std::vector<AtomOrDescriptorBase const*> changed_atoms;
+  changed_atoms.reserve(highlights_.size() + highlights.size());
+  for (auto const& [atom, color] : highlights_) {
+    changed_atoms.push_back(atom);
+  }
+  for (auto const& [atom, color] : highlights) {
+    changed_atoms.push_back(atom);
+  }
+  highlights_ = std::move(highlights);
+  for (AtomOrDescriptorBase const* atom : changed_atoms) {
+    QModelIndex const index = IndexForAtom(atom);
+    if (index.isValid()) {
+      emit dataChanged(index, index.siblingAtColumn(columnCount() - 1),
+                       {Qt::BackgroundRole});
     }
-    // Handle child atoms.
-    std::vector<std::unique_ptr<AtomOrDescriptorBase>> const& child_atoms =
-        atom_or_descriptor->GetChildAtoms();
-    for (size_t i = 0; i < child_atoms.size(); ++i) {
-      AtomOrDescriptorBase* child = child_atoms.at(i).get();
-      add_atom_or_descriptor(current_item.get(), child);
+  }
+}
+
+void AtomTreeModel::SetAnnotations(
+    std::unordered_map<AtomOrDescriptorBase const*, QString>&& annotations) {
+  std::vector<AtomOrDescriptorBase const*> changed_atoms;
+  changed_atoms.reserve(annotations_.size() + annotations.size());
+  for (auto const& [atom, annotation] : annotations_) {
+    changed_atoms.push_back(atom);
+  }
+  for (auto const& [atom, annotation] : annotations) {
+    changed_atoms.push_back(atom);
+  }
+  annotations_ = std::move(annotations);
+  for (AtomOrDescriptorBase const* atom : changed_atoms) {
+    QModelIndex const index = IndexForAtom(atom);
+    if (index.isValid()) {
+      emit dataChanged(index, index.siblingAtColumn(columnCount() - 1),
+                       {Qt::ToolTipRole});
     }
-    parent->children.push_back(std::move(current_item));
+  }
+}
+
+QModelIndex AtomTreeModel::IndexForAtom(
+    AtomOrDescriptorBase const* atom_or_descriptor) const {
+  auto it = atom_to_model_item_.find(atom_or_descriptor);
+  if (it == atom_to_model_item_.end()) {
+    return QModelIndex();
+  }
+  ModelItem* item = it->second;
+  std::optional<int> const row = GetRowOfItem(item);
+  if (!row.has_value()) {
+    return QModelIndex();
+  }
+  return createIndex(row.value(), 0, item);
+}
+
+std::optional<int> AtomTreeModel::GetRowOfItem(ModelItem const* item) const {
+  assert(item->parent != nullptr);
+  // Get the vector containing our item and it's siblings.
+  std::vector<std::unique_ptr<ModelItem>> const& item_and_siblings =
+      item->parent->children;
+
+  // A predicate to check if our unique pointers match the raw pointer of
+  // item.
+  auto predicate = [&item](std::unique_ptr<ModelItem> const& element) {
+    return item == element.get();
   };
+  // Find our item in the vector.
+  auto iterator = std::find_if(item_and_siblings.begin(),
+                               item_and_siblings.end(), predicate);
+  assert(iterator != item_and_siblings.end());
+  if (iterator == item_and_siblings.end()) {
+    return std::nullopt;
+  }
+  // Get the item's index in the vector.
+  return static_cast<int>(iterator - item_and_siblings.begin());
+}
+
+ModelItem const* AtomTreeModel::GetTopLevelItem(ModelItem const* item) const {
+  while (item->parent != model_root_.get()) {
+    assert(item->parent != nullptr);
+    item = item->parent;
+  }
+  return item;
+}
 
+AtomHolder* AtomTreeModel::GetAtomHolderOfItem(ModelItem const* item) const {
+  if (segment_set_ == nullptr) {
+    return atom_holder_.get();
+  }
+  ModelItem const* file_item = GetTopLevelItem(item);
+  if (!file_item->segment_index.has_value()) {
+    return &segment_set_->GetInitAtoms();
+  }
+  return segment_set_->GetSegmentAtoms(file_item->segment_index.value());
+}
+
+void AtomTreeModel::UpdateSegmentSummary(ModelItem& item) const {
+  assert(segment_set_ != nullptr && item.segment_index.has_value());
+  utility::SegmentSummary const& summary =
+      segment_set_->GetSegmentSummary(item.segment_index.value());
+  QString const layout = QString::fromStdString(summary.layout);
+  if (!summary.error.empty()) {
+    item.value = QString::fromStdString(summary.error);
+    return;
+  }
+  if (!summary.is_parsed) {
+    item.value = layout;
+    return;
+  }
+  QStringList parts;
+  if (summary.sequence_number.has_value()) {
+    parts.append(
+        QStringLiteral("sequence %1").arg(summary.sequence_number.value()));
+  }
+  parts.append(QStringLiteral("%1 samples").arg(summary.sample_count));
+  if (summary.base_decode_time.has_value()) {
+    parts.append(QStringLiteral("decode time %1")
+                     .arg(summary.base_decode_time.value()));
+  }
+  item.value = QStringLiteral("%1 (%2)").arg(parts.join(", "), layout);
+}
+
+void AtomTreeModel::UpdateModelItems() {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kModelBuild,
+                                   "AtomTreeModel::UpdateModelItems");
   std::vector<std::unique_ptr<AtomOrDescriptorBase>>& top_level_atoms =
       atom_holder_->GetTopLevelAtoms();
   model_root_ = std::make_unique<ModelItem>();
+  atom_to_model_item_.clear();
+  highlights_.clear();
+  annotations_.clear();
   for (size_t i = 0; i < top_level_atoms.size(); ++i) {
-    add_atom_or_descriptor(model_root_.get(), top_level_atoms.at(i).get());
+    AddModelItem(model_root_.get(), top_level_atoms.at(i).get());
+  }
+}
+
+void AtomTreeModel::AddModelItem(ModelItem* parent,
+                                 AtomOrDescriptorBase* atom_or_descriptor) {
+  std::unique_ptr<ModelItem> current_item = std::make_unique<ModelItem>();
+  current_item->underlying_item = atom_or_descriptor;
+  atom_to_model_item_[atom_or_descriptor] = current_item.get();
+  current_item->type =
+      atom_or_descriptor->GetType() == AtomOrDescriptorBase::Type::kAtom
+          ? ModelItem::Type::kAtom
+          : ModelItem::Type::kDescriptor;
+  current_item->name = atom_or_descriptor->GetName();
+  current_item->header_size = atom_or_descriptor->GetHeaderSize();
+  current_item->size = atom_or_descriptor->GetSize();
+  current_item->position = atom_or_descriptor->GetPositionInStream();
+  current_item->parent = parent;
+  // Add the fields.
+  for (Field const& field : atom_or_descriptor->GetFields()) {
+    current_item->children.push_back(
+        MakeFieldModelItem(current_item.get(), field));
+  }
+  // Handle child descriptors.
+  std::vector<std::unique_ptr<AtomOrDescriptorBase>> const& child_descriptors =
+      atom_or_descriptor->GetChildDescriptors();
+  for (size_t i = 0; i < child_descriptors.size(); ++i) {
+    AddModelItem(current_item.get(), child_descriptors.at(i).get());
+  }
+  // Handle child atoms.
+  std::vector<std::unique_ptr<AtomOrDescriptorBase>> const& child_atoms =
+      atom_or_descriptor->GetChildAtoms();
+  for (size_t i = 0; i < child_atoms.size(); ++i) {
+    AddModelItem(current_item.get(), child_atoms.at(i).get());
   }
+  parent->children.push_back(std::move(current_item));
 }
 
 }  // namespace mp4_manipulator
@@ -3,16 +3,40 @@
 #include <QFileDialog>
 #include <QMenu>
 #include <QMessageBox>
+#include <algorithm>
 
 #include "parsing/file_utils.h"
 
 namespace mp4_manipulator {
+namespace {
+// Stop expanding after this many rows. Beyond this the tree is too large to
+// usefully browse expanded, and the view gets sluggish.
+constexpr size_t kExpandRowBudget = 100'000;
+// How many levels the "Expand children" action expands.
+constexpr int kExpandChildrenDepth = 2;
+// How many atoms RevealAtoms expands the tree down to.
+constexpr size_t kMaxRevealedAtoms = 1000;
+}  // namespace
+
 AtomTreeView::AtomTreeView(std::unique_ptr<AtomHolder>&& atom_holder)
-    : atom_tree_model_{new AtomTreeModel{this}},
-      collapse_tree_action_{new QAction{"&Collapse all", this}},
-      expand_tree_action_{new QAction{"&Expand all", this}} {
+    : AtomTreeView{} {
   atom_tree_model_->SetAtoms(std::move(atom_holder));
+}
 
+AtomTreeView::AtomTreeView(
+    std::unique_ptr<utility::SegmentSet>&& segment_set)
+    : AtomTreeView{} {
+  atom_tree_model_->SetSegmentSet(std::move(segment_set));
+}
+
+AtomTreeView::AtomTreeView()
+    : atom_tree_model_{new AtomTreeModel{this}},
+      expander_{new IncrementalExpander{this}},
+      collapse_tree_action_{new QAction{"&Collapse all", this}},
+      expand_tree_action_{new QAction{"&Expand all", this}},
+      expand_tree_skipping_sample_tables_action_{
+          new QAction{"Expand all, &skipping sample tables", this}},
+      cancel_expand_action_{new QAction{"C&ancel expand", this}} {
   // Avoid warnings/footguns for virtual call in ctor, don't call on `this`,
   // explicitly use the QTreeView func.
   QTreeView::setModel(atom_tree_model_);
@@ -22,18 +46,73 @@ AtomTreeView::AtomTreeView(std::unique_ptr<AtomHolder>&& atom_holder)
   // size hints instead.
   setUniformRowHeights(true);
 
+  // Atoms are read with summary fields only. Fill in the rest of an atom's
+  // fields (e.g. a sample table's entries) when it's expanded.
+  [[maybe_unused]] bool ok =
+      connect(this, &QTreeView::expanded, atom_tree_model_,
+              &AtomTreeModel::InspectDeeply);
+  assert(ok);
+
   // Setup context menu items.
   setContextMenuPolicy(Qt::CustomContextMenu);
-  [[maybe_unused]] bool ok =
-      connect(this, &QTreeView::customContextMenuRequested, this,
-              &AtomTreeView::ShowContextMenu);
+  ok = connect(this, &QTreeView::customContextMenuRequested, this,
+               &AtomTreeView::ShowContextMenu);
+  assert(ok);
+  ok = connect(collapse_tree_action_, &QAction::triggered, this, [this]() {
+    // Don't let a running expansion undo the collapse.
+    expander_->Cancel();
+    collapseAll();
+  });
+  assert(ok);
+  ok = connect(expand_tree_action_, &QAction::triggered, this, [this]() {
+    StartExpand(QModelIndex{}, /*skip_sample_tables=*/false);
+  });
   assert(ok);
-  ok = connect(collapse_tree_action_, &QAction::triggered, this,
-               &QTreeView::collapseAll);
+  ok = connect(expand_tree_skipping_sample_tables_action_, &QAction::triggered,
+               this, [this]() {
+                 StartExpand(QModelIndex{}, /*skip_sample_tables=*/true);
+               });
   assert(ok);
-  ok = connect(expand_tree_action_, &QAction::triggered, this,
-               &QTreeView::expandAll);
+  ok = connect(cancel_expand_action_, &QAction::triggered, expander_,
+               &IncrementalExpander::Cancel);
   assert(ok);
+  ok = connect(expander_, &IncrementalExpander::Finished, this,
+               &AtomTreeView::OnExpandFinished);
+  assert(ok);
+}
+
+void AtomTreeView::StartExpand(QModelIndex const& root,
+                               bool skip_sample_tables,
+                               std::optional<int> max_depth /* = nullopt */) {
+  IncrementalExpander::Options options;
+  options.max_depth = max_depth;
+  options.row_budget = kExpandRowBudget;
+  options.should_expand = [skip_sample_tables](QModelIndex const& index) {
+    ModelItem const* item = static_cast<ModelItem*>(index.internalPointer());
+    if (item->type == ModelItem::Type::kField) {
+      return false;
+    }
+    // Sample tables (and their children) are where the bulk of the rows in
+    // most files are.
+    return !(skip_sample_tables && item->name == QStringLiteral("stbl"));
+  };
+  expander_->Start(root, std::move(options));
+}
+
+void AtomTreeView::OnExpandFinished(size_t expanded_row_count,
+                                    bool completed) {
+  QString message;
+  if (completed) {
+    message = QStringLiteral("Expanded %1 rows");
+  } else if (expanded_row_count >= kExpandRowBudget) {
+    // Say so, otherwise the tree just looks partly expanded.
+    message = QStringLiteral(
+        "Stopped expanding after %1 rows, expand the rows of interest to see "
+        "more");
+  } else {
+    message = QStringLiteral("Expanding cancelled after %1 rows");
+  }
+  emit StatusMessage(message.arg(expanded_row_count));
 }
 
 void AtomTreeView::ShowContextMenu(QPoint const& point) {
@@ -52,6 +131,10 @@ void AtomTreeView::ShowContextMenu(QPoint const& point) {
   // Add collapse and expand actions.
   menu.addAction(collapse_tree_action_);
   menu.addAction(expand_tree_action_);
+  menu.addAction(expand_tree_skipping_sample_tables_action_);
+  if (expander_->IsRunning()) {
+    menu.addAction(cancel_expand_action_);
+  }
   menu.addSeparator();
 
   if (index.isValid()) {
@@ -61,6 +144,34 @@ void AtomTreeView::ShowContextMenu(QPoint const& point) {
 
     AtomOrDescriptorBase* atom_or_descriptor = item->underlying_item;
 
+    if (item->type != ModelItem::Type::kField && !item->children.empty()) {
+      // Expand actions for the item's subtree. These are also created on
+      // demand as they need the index.
+      QPersistentModelIndex const persistent_index{index};
+      QAction* expand_children_action =
+          new QAction("Expand c&hildren", &menu);
+      [[maybe_unused]] bool ok =
+          connect(expand_children_action, &QAction::triggered,
+                  [this, persistent_index]() {
+                    StartExpand(persistent_index,
+                                /*skip_sample_tables=*/false,
+                                kExpandChildrenDepth);
+                  });
+      assert(ok);
+      menu.addAction(expand_children_action);
+
+      QAction* expand_descendants_action =
+          new QAction("Expand &descendants, skipping sample tables", &menu);
+      ok = connect(expand_descendants_action, &QAction::triggered,
+                   [this, persistent_index]() {
+                     StartExpand(persistent_index,
+                                 /*skip_sample_tables=*/true);
+                   });
+      assert(ok);
+      menu.addAction(expand_descendants_action);
+      menu.addSeparator();
+    }
+
     AP4_Atom* ap4_atom = item->underlying_item != nullptr
                              ? item->underlying_item->GetAp4Atom()
                              : nullptr;
@@ -78,8 +189,10 @@ void AtomTreeView::ShowContextMenu(QPoint const& point) {
       menu.addAction(dump_action);
     }
 
+    // Segment sets are read only.
     if (atom_or_descriptor != nullptr &&
-        atom_or_descriptor->GetType() == AtomOrDescriptorBase::Type::kAtom) {
+        atom_or_descriptor->GetType() == AtomOrDescriptorBase::Type::kAtom &&
+        atom_tree_model_->GetSegmentSet() == nullptr) {
       Atom* atom = static_cast<Atom*>(atom_or_descriptor);
       QAction* remove_action = new QAction("&Remove atom", &menu);
       // These need to be on the same thread so the connection below will use
@@ -103,10 +216,23 @@ void AtomTreeView::ShowContextMenu(QPoint const& point) {
 
 void AtomTreeView::DumpAtom(AP4_Atom& atom) {
   QString const file_name = QFileDialog::getSaveFileName(this);
+  if (file_name.isEmpty()) {
+    // The dialog was cancelled.
+    return;
+  }
   QByteArray file_name_bytes = file_name.toLocal8Bit();
   char const* c_str_file_name = file_name_bytes.data();
 
-  utility::DumpAtom(c_str_file_name, atom);
+  Result<std::monostate, std::string> result =
+      utility::DumpAtom(c_str_file_name, atom);
+  if (result.IsErr()) {
+    result.MarkErrorHandled();
+
+    QMessageBox message_box;
+    message_box.setText("Dumping the atom failed.");
+    message_box.setDetailedText(QString::fromStdString(result.GetErr()));
+    message_box.exec();
+  }
 }
 
 void AtomTreeView::SaveAtoms() {
@@ -124,6 +250,60 @@ void AtomTreeView::SaveAtoms() {
   }
 }
 
+void AtomTreeView::JumpToAtom(AtomOrDescriptorBase const* atom_or_descriptor) {
+  QModelIndex const index = atom_tree_model_->IndexForAtom(atom_or_descriptor);
+  if (!index.isValid()) {
+    return;
+  }
+  // Only expand the ancestors of the row, rather than anything around it.
+  for (QModelIndex ancestor = index.parent(); ancestor.isValid();
+       ancestor = ancestor.parent()) {
+    expand(ancestor);
+  }
+  scrollTo(index, QAbstractItemView::PositionAtCenter);
+  setCurrentIndex(index);
+}
+
+void AtomTreeView::RevealAtoms(
+    std::vector<AtomOrDescriptorBase const*> const& atoms) {
+  if (atoms.empty()) {
+    return;
+  }
+  // Expanding is cheap for the ancestors of a few atoms, but not for every
+  // moof of a long file.
+  size_t const revealed_count = std::min(atoms.size(), kMaxRevealedAtoms);
+  for (size_t i = 0; i < revealed_count; ++i) {
+    QModelIndex const index = atom_tree_model_->IndexForAtom(atoms.at(i));
+    for (QModelIndex ancestor = index.parent(); ancestor.isValid();
+         ancestor = ancestor.parent()) {
+      if (isExpanded(ancestor)) {
+        break;
+      }
+      expand(ancestor);
+    }
+  }
+  JumpToAtom(atoms.front());
+}
+
+AtomTreeModel* AtomTreeView::GetAtomTreeModel() const {
+  return atom_tree_model_;
+}
+
+void AtomTreeView::currentChanged(QModelIndex const& current,
+                                  QModelIndex const& previous) {
+  QTreeView::currentChanged(current, previous);
+  AtomOrDescriptorBase* atom_or_descriptor = nullptr;
+  if (current.isValid()) {
+    ModelItem* item = static_cast<ModelItem*>(current.internalPointer());
+    if (item->type == ModelItem::Type::kField && item->parent != nullptr) {
+      // Fields don't have an underlying item, use the one that owns them.
+      item = item->parent;
+    }
+    atom_or_descriptor = item->underlying_item;
+  }
+  emit CurrentAtomChanged(atom_or_descriptor);
+}
+
 Result<std::monostate, std::string> AtomTreeView::RemoveAtom(Atom* atom) {
   return atom_tree_model_->RemoveAtom(atom);
 }
@@ -0,0 +1,189 @@
+#include "gui/hex_view.h"
+
+#include <QFontDatabase>
+#include <QPaintEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <algorithm>
+#include <limits>
+#include <string>
+
+namespace mp4_manipulator {
+namespace {
+constexpr int kBytesPerRow = 16;
+// Characters per row: a 16 digit offset, 2 spaces, 3 characters per byte, a
+// space, then the ASCII column.
+constexpr int kCharactersPerRow = 16 + 2 + 3 * kBytesPerRow + 1 + kBytesPerRow;
+
+char HexDigit(uint8_t nibble) {
+  return static_cast<char>(nibble < 10 ? '0' + nibble : 'a' + nibble - 10);
+}
+
+// Formats a row of the view. `bytes` may be shorter than kBytesPerRow for the
+// last row of a range.
+QString FormatRow(uint64_t address, char const* bytes, int byte_count) {
+  std::string row;
+  row.reserve(kCharactersPerRow);
+  for (int shift = 60; shift >= 0; shift -= 4) {
+    row.push_back(HexDigit((address >> shift) & 0xf));
+  }
+  row.append("  ");
+  for (int i = 0; i < kBytesPerRow; ++i) {
+    if (i < byte_count) {
+      uint8_t const byte = static_cast<uint8_t>(bytes[i]);
+      row.push_back(HexDigit(byte >> 4));
+      row.push_back(HexDigit(byte & 0xf));
+      row.push_back(' ');
+    } else {
+      row.append("   ");
+    }
+  }
+  row.push_back(' ');
+  for (int i = 0; i < byte_count; ++i) {
+    uint8_t const byte = static_cast<uint8_t>(bytes[i]);
+    row.push_back(byte >= 0x20 && byte < 0x7f ? static_cast<char>(byte) : '.');
+  }
+  return QString::fromStdString(row);
+}
+}  // namespace
+
+HexView::HexView(QWidget* parent /* = nullptr */)
+    : QAbstractScrollArea{parent} {
+  setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  setHorizontalScrollBarPolicy(Qt::ScrollBarAsNeeded);
+  ShowMessage("Select an atom to view its bytes.");
+}
+
+void HexView::SetRange(QString const& file_name, uint64_t offset,
+                       uint64_t size) {
+  if (file_.fileName() != file_name || !file_.isOpen()) {
+    file_.close();
+    file_.setFileName(file_name);
+    if (!file_.open(QIODevice::ReadOnly)) {
+      ShowMessage(QStringLiteral("Could not open %1.").arg(file_name));
+      return;
+    }
+  }
+  message_.clear();
+  range_offset_ = offset;
+  range_size_ = size;
+  window_.clear();
+  window_offset_ = 0;
+  UpdateScrollBar();
+  verticalScrollBar()->setValue(0);
+  viewport()->update();
+}
+
+void HexView::ShowMessage(QString const& message) {
+  message_ = message;
+  range_offset_ = 0;
+  range_size_ = 0;
+  window_.clear();
+  UpdateScrollBar();
+  viewport()->update();
+}
+
+void HexView::paintEvent(QPaintEvent* event) {
+  Q_UNUSED(event);
+  QPainter painter{viewport()};
+  QFontMetrics const metrics{font()};
+  int const line_height = metrics.height();
+  int const x = -horizontalScrollBar()->value();
+
+  if (!message_.isEmpty()) {
+    painter.drawText(viewport()->rect().adjusted(4, 4, -4, -4),
+                     Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap,
+                     message_);
+    return;
+  }
+
+  uint64_t const total_rows = (range_size_ + kBytesPerRow - 1) / kBytesPerRow;
+  uint64_t const first_row = GetFirstVisibleRow();
+  if (first_row >= total_rows) {
+    return;
+  }
+  uint64_t const row_count = std::min<uint64_t>(
+      static_cast<uint64_t>(GetVisibleRowCount()), total_rows - first_row);
+
+  uint64_t const first_byte = first_row * kBytesPerRow;
+  uint64_t const byte_count =
+      std::min(row_count * kBytesPerRow, range_size_ - first_byte);
+  if (!LoadWindow(range_offset_ + first_byte, byte_count)) {
+    painter.drawText(4, line_height, "Failed to read from file.");
+    return;
+  }
+
+  char const* window_bytes =
+      window_.constData() + (range_offset_ + first_byte - window_offset_);
+  for (uint64_t row = 0; row < row_count; ++row) {
+    uint64_t const row_start = row * kBytesPerRow;
+    int const row_byte_count = static_cast<int>(
+        std::min<uint64_t>(kBytesPerRow, byte_count - row_start));
+    QString const text =
+        FormatRow(range_offset_ + first_byte + row_start,
+                  window_bytes + row_start, row_byte_count);
+    int const baseline =
+        static_cast<int>(row + 1) * line_height - metrics.descent();
+    painter.drawText(x + 4, baseline, text);
+  }
+}
+
+void HexView::resizeEvent(QResizeEvent* event) {
+  QAbstractScrollArea::resizeEvent(event);
+  UpdateScrollBar();
+}
+
+void HexView::UpdateScrollBar() {
+  QFontMetrics const metrics{font()};
+  int const row_width =
+      metrics.horizontalAdvance(QChar('0')) * kCharactersPerRow + 8;
+  horizontalScrollBar()->setRange(
+      0, std::max(0, row_width - viewport()->width()));
+  horizontalScrollBar()->setPageStep(viewport()->width());
+
+  uint64_t const total_rows = (range_size_ + kBytesPerRow - 1) / kBytesPerRow;
+  uint64_t const visible_rows = static_cast<uint64_t>(GetVisibleRowCount());
+  uint64_t const scrollable_rows =
+      total_rows > visible_rows ? total_rows - visible_rows : 0;
+  uint64_t const max_steps =
+      static_cast<uint64_t>(std::numeric_limits<int>::max());
+  rows_per_scroll_step_ = scrollable_rows / max_steps + 1;
+  verticalScrollBar()->setRange(
+      0, static_cast<int>(scrollable_rows / rows_per_scroll_step_));
+  verticalScrollBar()->setPageStep(static_cast<int>(
+      std::max<uint64_t>(1, visible_rows / rows_per_scroll_step_)));
+  verticalScrollBar()->setSingleStep(1);
+}
+
+uint64_t HexView::GetFirstVisibleRow() const {
+  return static_cast<uint64_t>(verticalScrollBar()->value()) *
+         rows_per_scroll_step_;
+}
+
+int HexView::GetVisibleRowCount() const {
+  QFontMetrics const metrics{font()};
+  return std::max(1, viewport()->height() / metrics.height());
+}
+
+bool HexView::LoadWindow(uint64_t offset, uint64_t length) {
+  if (offset >= window_offset_ &&
+      offset + length <=
+          window_offset_ + static_cast<uint64_t>(window_.size())) {
+    // Already loaded, e.g. we're repainting without having scrolled.
+    return true;
+  }
+  if (!file_.seek(static_cast<qint64>(offset))) {
+    return false;
+  }
+  // Reuses the existing allocation where possible.
+  window_.resize(static_cast<qsizetype>(length));
+  qint64 const read = file_.read(window_.data(), static_cast<qint64>(length));
+  if (read != static_cast<qint64>(length)) {
+    window_.clear();
+    return false;
+  }
+  window_offset_ = offset;
+  return true;
+}
+
+}  // namespace mp4_manipulator
@@ -0,0 +1,108 @@
+#include "gui/incremental_expander.h"
+
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QTreeView>
+
+namespace mp4_manipulator {
+namespace {
+// How long each chunk of expansion may run before returning to the event
+// loop. Short enough that input and painting stay smooth.
+constexpr qint64 kTimeSliceMs = 8;
+}  // namespace
+
+IncrementalExpander::IncrementalExpander(QTreeView* tree_view)
+    : QObject{tree_view}, tree_view_{tree_view}, timer_{new QTimer{this}} {
+  // A zero interval timer fires as soon as the event loop has processed any
+  // pending events.
+  timer_->setInterval(0);
+  [[maybe_unused]] bool ok = connect(timer_, &QTimer::timeout, this,
+                                     &IncrementalExpander::ExpandChunk);
+  assert(ok);
+}
+
+void IncrementalExpander::Start(QModelIndex const& root, Options options) {
+  if (IsRunning()) {
+    Cancel();
+  }
+  options_ = std::move(options);
+  expanded_row_count_ = 0;
+  pending_rows_.clear();
+
+  QAbstractItemModel* model = tree_view_->model();
+  if (model == nullptr) {
+    return;
+  }
+  if (root.isValid()) {
+    pending_rows_.push_back({QPersistentModelIndex{root}, 1});
+  } else {
+    for (int row = 0; row < model->rowCount(); ++row) {
+      pending_rows_.push_back({QPersistentModelIndex{model->index(row, 0)}, 1});
+    }
+  }
+  timer_->start();
+}
+
+void IncrementalExpander::Cancel() {
+  if (IsRunning()) {
+    Finish(/*completed=*/false);
+  }
+}
+
+bool IncrementalExpander::IsRunning() const { return timer_->isActive(); }
+
+void IncrementalExpander::ExpandChunk() {
+  QAbstractItemModel* model = tree_view_->model();
+  QElapsedTimer elapsed;
+  elapsed.start();
+
+  while (!pending_rows_.empty() && elapsed.elapsed() < kTimeSliceMs) {
+    if (expanded_row_count_ >= options_.row_budget) {
+      Finish(/*completed=*/false);
+      return;
+    }
+
+    PendingRow pending_row = std::move(pending_rows_.front());
+    pending_rows_.pop_front();
+    // Persistent indexes are invalidated if the model is reset (e.g. an atom
+    // is removed) while we're running.
+    if (!pending_row.index.isValid()) {
+      continue;
+    }
+    QModelIndex const index = pending_row.index;
+    if (!model->hasChildren(index)) {
+      continue;
+    }
+    if (options_.should_expand && !options_.should_expand(index)) {
+      continue;
+    }
+
+    tree_view_->expand(index);
+    ++expanded_row_count_;
+
+    if (options_.max_depth.has_value() &&
+        pending_row.depth >= options_.max_depth.value()) {
+      continue;
+    }
+    for (int row = 0; row < model->rowCount(index); ++row) {
+      QModelIndex const child = model->index(row, 0, index);
+      // Skip leaves up front so they don't take up queue space.
+      if (model->hasChildren(child)) {
+        pending_rows_.push_back(
+            {QPersistentModelIndex{child}, pending_row.depth + 1});
+      }
+    }
+  }
+
+  if (pending_rows_.empty()) {
+    Finish(/*completed=*/true);
+  }
+}
+
+void IncrementalExpander::Finish(bool completed) {
+  timer_->stop();
+  pending_rows_.clear();
+  emit Finished(expanded_row_count_, completed);
+}
+
+}  // namespace mp4_manipulator
@@ -0,0 +1,358 @@
+#include "gui/layout_map_dialog.h"
+
+#include <QFontMetrics>
+#include <QLabel>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QToolTip>
+#include <QVBoxLayout>
+#include <QWheelEvent>
+#include <algorithm>
+#include <cmath>
+
+namespace mp4_manipulator {
+namespace {
+constexpr int kLabelWidth = 90;
+constexpr int kBoxRowHeight = 22;
+constexpr int kTrackRowHeight = 26;
+constexpr int kDepthRowHeight = 40;
+constexpr int kRowGap = 2;
+// Zooming in stops when this many bytes span the strip.
+constexpr double kMinVisibleBytes = 64;
+// Each step of the mouse wheel zooms by this factor.
+constexpr double kZoomStep = 1.25;
+// The angle, in eighths of a degree, of a typical mouse wheel step.
+constexpr double kWheelStepAngle = 120;
+// Columns with only a little of a track are shaded at least this strongly,
+// so a lone small chunk isn't lost.
+constexpr double kMinShade = 0.25;
+constexpr int kDialogWidth = 1100;
+constexpr int kDialogHeight = 360;
+
+// Spreads the tracks' colours around the hue circle.
+QColor GetTrackColor(size_t track) {
+  constexpr int kGoldenAngle = 137;
+  return QColor::fromHsv(static_cast<int>(track * kGoldenAngle % 360), 200,
+                         210);
+}
+}  // namespace
+
+// The strip itself. Drawing uses the coarsest level of the map whose bins are
+// no larger than a pixel, so each column sums a few bins whatever the zoom,
+// and individual chunks once zoomed in past the finest level.
+class LayoutMapView : public QWidget {
+ public:
+  LayoutMapView(analysis::LayoutMap const& map, QWidget* parent)
+      : QWidget{parent}, map_{map}, visible_bytes_(map.file_size) {
+    setMouseTracking(true);
+    setMinimumHeight(kBoxRowHeight + kDepthRowHeight +
+                     static_cast<int>(map.tracks.size()) *
+                         (kTrackRowHeight + kRowGap) +
+                     2 * kRowGap);
+  }
+
+ protected:
+  // QWidget overrides.
+  void paintEvent(QPaintEvent* event) override {
+    Q_UNUSED(event);
+    QPainter painter{this};
+    painter.fillRect(rect(), palette().base());
+    if (map_.file_size == 0 || GetStripWidth() <= 0) {
+      return;
+    }
+    int y = 0;
+    PaintBoxes(painter, y);
+    y += kBoxRowHeight + kRowGap;
+    for (size_t track = 0; track < map_.tracks.size(); ++track) {
+      painter.setPen(palette().text().color());
+      painter.drawText(QRect{0, y, kLabelWidth, kTrackRowHeight},
+                       Qt::AlignVCenter,
+                       QStringLiteral("%1 (%2)")
+                           .arg(map_.tracks.at(track).track_id)
+                           .arg(QString::fromStdString(
+                               map_.tracks.at(track).handler_type)));
+      PaintTrack(painter, track, y);
+      y += kTrackRowHeight + kRowGap;
+    }
+    PaintInterleaveDepth(painter, y);
+  }
+
+  void wheelEvent(QWheelEvent* event) override {
+    double const steps = event->angleDelta().y() / kWheelStepAngle;
+    if (steps == 0) {
+      return;
+    }
+    // Keep the byte under the cursor where it is.
+    double const anchor = GetOffsetAt(event->position().x());
+    auto const file_size = static_cast<double>(map_.file_size);
+    double const new_visible_bytes =
+        std::clamp(visible_bytes_ / std::pow(kZoomStep, steps),
+                   std::min(kMinVisibleBytes, file_size), file_size);
+    double const fraction =
+        (event->position().x() - kLabelWidth) / GetStripWidth();
+    visible_bytes_ = new_visible_bytes;
+    SetFirstVisibleByte(anchor - fraction * visible_bytes_);
+    event->accept();
+  }
+
+  void mousePressEvent(QMouseEvent* event) override {
+    drag_start_x_ = event->position().x();
+    drag_start_byte_ = first_visible_byte_;
+  }
+
+  void mouseMoveEvent(QMouseEvent* event) override {
+    if ((event->buttons() & Qt::LeftButton) != 0) {
+      double const moved = event->position().x() - drag_start_x_;
+      SetFirstVisibleByte(drag_start_byte_ -
+                          moved / GetStripWidth() * visible_bytes_);
+      return;
+    }
+    if (event->position().x() < kLabelWidth) {
+      QToolTip::hideText();
+      return;
+    }
+    QToolTip::showText(event->globalPosition().toPoint(),
+                       DescribeOffset(static_cast<uint64_t>(
+                           GetOffsetAt(event->position().x()))),
+                       this);
+  }
+
+  void mouseDoubleClickEvent(QMouseEvent* event) override {
+    Q_UNUSED(event);
+    visible_bytes_ = static_cast<double>(map_.file_size);
+    SetFirstVisibleByte(0);
+  }
+  // End QWidget overrides.
+
+ private:
+  [[nodiscard]] double GetStripWidth() const {
+    return width() - kLabelWidth;
+  }
+
+  [[nodiscard]] double GetOffsetAt(double x) const {
+    return first_visible_byte_ +
+           (x - kLabelWidth) / GetStripWidth() * visible_bytes_;
+  }
+
+  [[nodiscard]] double GetX(double offset) const {
+    return kLabelWidth +
+           (offset - first_visible_byte_) / visible_bytes_ * GetStripWidth();
+  }
+
+  void SetFirstVisibleByte(double first_visible_byte) {
+    first_visible_byte_ =
+        std::clamp(first_visible_byte, 0.0,
+                   static_cast<double>(map_.file_size) - visible_bytes_);
+    update();
+  }
+
+  // Returns the coarsest level whose bins are no larger than a pixel, or the
+  // finest level if a pixel is smaller than its bins.
+  [[nodiscard]] analysis::LayoutLevel const& GetLevel() const {
+    double const bytes_per_pixel = visible_bytes_ / GetStripWidth();
+    auto const level = std::find_if(
+        map_.levels.rbegin(), map_.levels.rend(),
+        [bytes_per_pixel](analysis::LayoutLevel const& candidate) {
+          return candidate.bin_size <= bytes_per_pixel;
+        });
+    return level != map_.levels.rend() ? *level : map_.levels.front();
+  }
+
+  // Returns the range of bins of `level` covering the pixel column at `x`.
+  [[nodiscard]] std::pair<size_t, size_t> GetBins(
+      analysis::LayoutLevel const& level, int x) const {
+    auto const begin = static_cast<uint64_t>(std::max(0.0, GetOffsetAt(x)));
+    auto const end =
+        static_cast<uint64_t>(std::max(0.0, GetOffsetAt(x + 1)));
+    uint64_t const last_byte = end > begin ? end - 1 : begin;
+    size_t const first =
+        std::min<size_t>(begin / level.bin_size, level.bin_count - 1);
+    size_t const last =
+        std::min<size_t>(last_byte / level.bin_size, level.bin_count - 1);
+    return {first, last + 1};
+  }
+
+  void PaintBoxes(QPainter& painter, int y) {
+    painter.setPen(palette().text().color());
+    painter.drawText(QRect{0, y, kLabelWidth, kBoxRowHeight},
+                     Qt::AlignVCenter, "Boxes");
+    QFontMetrics const metrics{font()};
+    for (analysis::LayoutBox const& box : map_.boxes) {
+      double const left = std::max<double>(kLabelWidth, GetX(box.offset));
+      double const right =
+          std::min<double>(width(), GetX(box.offset + box.size));
+      if (right <= left) {
+        continue;
+      }
+      QRectF const box_rect{left, static_cast<double>(y), right - left,
+                            static_cast<double>(kBoxRowHeight)};
+      painter.fillRect(box_rect, box.type == "moov"
+                                     ? palette().highlight()
+                                     : palette().alternateBase());
+      painter.drawRect(box_rect);
+      QString const type = QString::fromStdString(box.type);
+      if (metrics.horizontalAdvance(type) < right - left) {
+        painter.drawText(box_rect, Qt::AlignCenter, type);
+      }
+    }
+  }
+
+  void PaintTrack(QPainter& painter, size_t track, int y) {
+    QColor const color = GetTrackColor(track);
+    analysis::LayoutLevel const& level = GetLevel();
+    if (level.bin_size > visible_bytes_ / GetStripWidth()) {
+      // Zoomed in past the finest level, so draw the chunks themselves.
+      auto chunk = std::lower_bound(
+          map_.chunks.begin(), map_.chunks.end(), first_visible_byte_,
+          [](analysis::LayoutChunk const& candidate, double offset) {
+            return static_cast<double>(candidate.offset) < offset;
+          });
+      if (chunk != map_.chunks.begin()) {
+        --chunk;
+      }
+      double const end = first_visible_byte_ + visible_bytes_;
+      for (; chunk != map_.chunks.end() &&
+             static_cast<double>(chunk->offset) < end;
+           ++chunk) {
+        if (chunk->track != track) {
+          continue;
+        }
+        double const left = std::max<double>(kLabelWidth, GetX(chunk->offset));
+        double const right = GetX(chunk->offset + chunk->size);
+        painter.fillRect(QRectF{left, static_cast<double>(y),
+                                std::max(1.0, right - left),
+                                static_cast<double>(kTrackRowHeight)},
+                         color);
+      }
+      return;
+    }
+    // Each column is shaded by the share of its bytes that are the track's.
+    size_t const track_count = map_.tracks.size();
+    for (int x = kLabelWidth; x < width(); ++x) {
+      auto const [first, end] = GetBins(level, x);
+      uint64_t bytes = 0;
+      for (size_t bin = first; bin < end; ++bin) {
+        bytes += level.track_bytes.at(bin * track_count + track);
+      }
+      if (bytes == 0) {
+        continue;
+      }
+      double const share = std::min(
+          1.0, bytes / static_cast<double>((end - first) * level.bin_size));
+      QColor shaded = color;
+      shaded.setAlphaF(
+          static_cast<float>(kMinShade + (1 - kMinShade) * share));
+      painter.fillRect(x, y, 1, kTrackRowHeight, shaded);
+    }
+  }
+
+  void PaintInterleaveDepth(QPainter& painter, int y) {
+    painter.setPen(palette().text().color());
+    painter.drawText(QRect{0, y, kLabelWidth, kDepthRowHeight},
+                     Qt::AlignVCenter,
+                     QStringLiteral("Depth, %1 s")
+                         .arg(map_.max_interleave_depth, 0, 'f', 1));
+    if (map_.max_interleave_depth <= 0) {
+      return;
+    }
+    analysis::LayoutLevel const& level = GetLevel();
+    for (int x = kLabelWidth; x < width(); ++x) {
+      auto const [first, end] = GetBins(level, x);
+      float depth = 0;
+      for (size_t bin = first; bin < end; ++bin) {
+        depth = std::max(depth, level.interleave_depth.at(bin));
+      }
+      int const height = static_cast<int>(
+          depth / map_.max_interleave_depth * kDepthRowHeight);
+      painter.fillRect(x, y + kDepthRowHeight - height, 1, height,
+                       palette().text());
+    }
+  }
+
+  // Describes what's at `offset`: the box, and the chunk if there is one.
+  [[nodiscard]] QString DescribeOffset(uint64_t offset) const {
+    QString description = QStringLiteral("Offset %1").arg(offset);
+    for (analysis::LayoutBox const& box : map_.boxes) {
+      if (offset >= box.offset && offset < box.offset + box.size) {
+        description += QStringLiteral(", in %1 @ %2")
+                           .arg(QString::fromStdString(box.type))
+                           .arg(box.offset);
+      }
+    }
+    auto chunk = std::upper_bound(
+        map_.chunks.begin(), map_.chunks.end(), offset,
+        [](uint64_t value, analysis::LayoutChunk const& candidate) {
+          return value < candidate.offset;
+        });
+    if (chunk != map_.chunks.begin() &&
+        offset < std::prev(chunk)->offset + std::prev(chunk)->size) {
+      analysis::LayoutChunk const& found = *std::prev(chunk);
+      description +=
+          QStringLiteral("\nChunk of track %1 @ %2, %3 bytes, %4-%5 s")
+              .arg(map_.tracks.at(found.track).track_id)
+              .arg(found.offset)
+              .arg(found.size)
+              .arg(found.start_time, 0, 'f', 3)
+              .arg(found.start_time + found.duration, 0, 'f', 3);
+    }
+    return description;
+  }
+
+  analysis::LayoutMap const& map_;
+  double first_visible_byte_{0};
+  double visible_bytes_;
+  double drag_start_x_{0};
+  double drag_start_byte_{0};
+};
+
+LayoutMapDialog::LayoutMapDialog(QString const& file_name,
+                                 analysis::LayoutMap&& map,
+                                 QWidget* parent /* = nullptr */)
+    : QDialog{parent},
+      map_{std::move(map)},
+      view_{new LayoutMapView{map_, this}} {
+  setWindowTitle(QStringLiteral("Layout of %1").arg(file_name));
+  auto const moov = std::find_if(
+      map_.boxes.begin(), map_.boxes.end(),
+      [](analysis::LayoutBox const& box) { return box.type == "moov"; });
+  auto const mdat = std::find_if(
+      map_.boxes.begin(), map_.boxes.end(),
+      [](analysis::LayoutBox const& box) { return box.type == "mdat"; });
+  QString moov_position = "There's no moov.";
+  if (moov != map_.boxes.end()) {
+    moov_position = mdat != map_.boxes.end() && mdat->offset < moov->offset
+                        ? QStringLiteral("moov is at %1, after the media "
+                                         "data, so playback can't start "
+                                         "until the whole file is read.")
+                              .arg(moov->offset)
+                        : QStringLiteral("moov is at %1, before the media "
+                                         "data.")
+                              .arg(moov->offset);
+  }
+  double const startup_share =
+      map_.file_size > 0
+          ? 100.0 * static_cast<double>(map_.startup_bytes) /
+                static_cast<double>(map_.file_size)
+          : 0;
+  QLabel* summary = new QLabel{
+      QStringLiteral("%1 Tracks are interleaved at most %2 s deep (at "
+                     "offset %3). %4 bytes (%5%) must be read before the "
+                     "first %6 s of every track can play.\nScroll to zoom, "
+                     "drag to pan and double click to reset.")
+          .arg(moov_position)
+          .arg(map_.max_interleave_depth, 0, 'f', 3)
+          .arg(map_.max_interleave_depth_offset)
+          .arg(map_.startup_bytes)
+          .arg(startup_share, 0, 'f', 1)
+          .arg(analysis::kStartupSeconds),
+      this};
+  summary->setWordWrap(true);
+
+  QVBoxLayout* layout = new QVBoxLayout{this};
+  layout->addWidget(summary);
+  layout->addWidget(view_);
+  layout->addStretch();
+  resize(kDialogWidth, kDialogHeight);
+}
+
+}  // namespace mp4_manipulator
@@ -1,53 +1,177 @@
 #include "gui/main_window.h"
 
+#include <QCollator>
+#include <QDir>
 #include <QDragEnterEvent>
 #include <QDropEvent>
+#include <QElapsedTimer>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QInputDialog>
+#include <QLabel>
+#include <QLocale>
 #include <QMenu>
 #include <QMenuBar>
+#include <QMessageBox>
 #include <QMimeData>
+#include <QSettings>
+#include <QStatusBar>
+#include <QThread>
 #include <QTreeView>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
 
-#include "gui/atom_tree_view.h"
+#include "analysis/layout_map.h"
+#include "analysis/track_statistics.h"
+#include "extraction/track_extraction.h"
+#include "gui/atom_tab.h"
+#include "gui/layout_map_dialog.h"
+#include "gui/track_statistics_dialog.h"
+#include "network/http_range_byte_stream.h"
 #include "parsing/file_utils.h"
 
 namespace mp4_manipulator {
+namespace {
+constexpr char kMemoryBudgetSettingsKey[] = "memory_budget_mib";
+constexpr int kDefaultMemoryBudgetMib = 4096;
+constexpr uint64_t kBytesPerMib = 1024 * 1024;
+
+// Returns the settings used by the app. These match those created in main.
+QSettings GetSettings() {
+  return QSettings{QSettings::IniFormat, QSettings::UserScope, "",
+                   "mp4-manipulator"};
+}
+
+QString FormatBytes(uint64_t bytes) {
+  return QLocale{}.formattedDataSize(static_cast<qint64>(bytes));
+}
+}  // namespace
 
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent),
       file_menu_{menuBar()->addMenu("&File")},
+      settings_menu_{menuBar()->addMenu("S&ettings")},
       tabbed_widget_{new QTabWidget{this}},
+      memory_status_label_{new QLabel{this}},
       open_file_action_{new QAction{"&Open file", this}},
-      save_file_action_{new QAction{"&Save file as", this}} {
+      open_url_action_{new QAction{"Open &URL...", this}},
+      open_segment_set_action_{new QAction{"Open se&gment set...", this}},
+      save_file_action_{new QAction{"&Save file as", this}},
+      save_faststart_copy_action_{
+          new QAction{"Save &faststart copy as", this}},
+      save_fragmented_copy_action_{
+          new QAction{"Save f&ragmented copy as", this}},
+      compare_action_{new QAction{"&Compare with file...", this}},
+      verify_samples_action_{new QAction{"&Verify sample references", this}},
+      check_conformance_action_{new QAction{"C&heck conformance", this}},
+      track_statistics_action_{new QAction{"Track s&tatistics", this}},
+      layout_map_action_{new QAction{"&Layout map", this}},
+      extract_tracks_action_{new QAction{"E&xtract tracks...", this}},
+      memory_budget_action_{new QAction{"&Memory budget...", this}} {
   SetupMenuBar();
   SetupTabbedWidget();
+  SetupStatusBar();
   setAcceptDrops(true);  // Accept drag and drop to open files.
 }
 
+MainWindow::~MainWindow() {
+  // Remote files still being read hold their thread, which must finish
+  // before it's destroyed along with the window.
+  for (QThread* thread : findChildren<QThread*>()) {
+    thread->wait();
+  }
+}
+
 void MainWindow::RemoveTab(int tab_index) {
   assert(tabbed_widget_ != nullptr);
-  // These should always be AtomTreeViews, but it doesn't matter so don't bother
+  // These should always be AtomTabs, but it doesn't matter so don't bother
   // casting.
   QWidget* removed_widget = tabbed_widget_->widget(tab_index);
   tabbed_widget_->removeTab(tab_index);
   if (tabbed_widget_->count() == 0) {
     // Disable saving if no tabs exist.
     save_file_action_->setDisabled(true);
+    save_faststart_copy_action_->setDisabled(true);
+    save_fragmented_copy_action_->setDisabled(true);
+    compare_action_->setDisabled(true);
+    verify_samples_action_->setDisabled(true);
+    check_conformance_action_->setDisabled(true);
+    track_statistics_action_->setDisabled(true);
+    layout_map_action_->setDisabled(true);
+    extract_tracks_action_->setDisabled(true);
   }
   // When removing widgets, Qt doesn't handle deletion, so we manually delete.
   delete removed_widget;
+  UpdateMemoryStatus();
 }
 
 void MainWindow::SetupMenuBar() {
   file_menu_->addAction(open_file_action_);
   [[maybe_unused]] bool ok = connect(open_file_action_, &QAction::triggered,
                                      this, &MainWindow::OpenFileUsingDialog);
+  assert(ok);
+  file_menu_->addAction(open_url_action_);
+  ok = connect(open_url_action_, &QAction::triggered, this,
+               &MainWindow::OpenUrlUsingDialog);
+  assert(ok);
+  file_menu_->addAction(open_segment_set_action_);
+  ok = connect(open_segment_set_action_, &QAction::triggered, this,
+               &MainWindow::OpenSegmentSetUsingDialog);
+  assert(ok);
   // Disable the action until a file is opened.
   save_file_action_->setDisabled(true);
   file_menu_->addAction(save_file_action_);
   ok = connect(save_file_action_, &QAction::triggered, this,
                &MainWindow::SaveFile);
   assert(ok);
+  save_faststart_copy_action_->setDisabled(true);
+  file_menu_->addAction(save_faststart_copy_action_);
+  ok = connect(save_faststart_copy_action_, &QAction::triggered, this,
+               &MainWindow::SaveFaststartCopy);
+  assert(ok);
+  save_fragmented_copy_action_->setDisabled(true);
+  file_menu_->addAction(save_fragmented_copy_action_);
+  ok = connect(save_fragmented_copy_action_, &QAction::triggered, this,
+               &MainWindow::SaveFragmentedCopy);
+  assert(ok);
+  compare_action_->setDisabled(true);
+  file_menu_->addAction(compare_action_);
+  ok = connect(compare_action_, &QAction::triggered, this,
+               &MainWindow::CompareWithFileUsingDialog);
+  assert(ok);
+  verify_samples_action_->setDisabled(true);
+  file_menu_->addAction(verify_samples_action_);
+  ok = connect(verify_samples_action_, &QAction::triggered, this,
+               &MainWindow::VerifySampleReferences);
+  assert(ok);
+  check_conformance_action_->setDisabled(true);
+  file_menu_->addAction(check_conformance_action_);
+  ok = connect(check_conformance_action_, &QAction::triggered, this,
+               &MainWindow::CheckConformance);
+  assert(ok);
+  track_statistics_action_->setDisabled(true);
+  file_menu_->addAction(track_statistics_action_);
+  ok = connect(track_statistics_action_, &QAction::triggered, this,
+               &MainWindow::ShowTrackStatistics);
+  assert(ok);
+  layout_map_action_->setDisabled(true);
+  file_menu_->addAction(layout_map_action_);
+  ok = connect(layout_map_action_, &QAction::triggered, this,
+               &MainWindow::ShowLayoutMap);
+  assert(ok);
+  extract_tracks_action_->setDisabled(true);
+  file_menu_->addAction(extract_tracks_action_);
+  ok = connect(extract_tracks_action_, &QAction::triggered, this,
+               &MainWindow::ExtractTracksUsingDialog);
+  assert(ok);
+
+  settings_menu_->addAction(memory_budget_action_);
+  ok = connect(memory_budget_action_, &QAction::triggered, this,
+               &MainWindow::SetMemoryBudgetUsingDialog);
+  assert(ok);
 }
 
 void MainWindow::SetupTabbedWidget() {
@@ -58,14 +182,53 @@ void MainWindow::SetupTabbedWidget() {
       connect(tabbed_widget_, &QTabWidget::tabCloseRequested, this,
               &MainWindow::RemoveTab);
   assert(ok);
+  ok = connect(tabbed_widget_, &QTabWidget::currentChanged, this,
+               &MainWindow::OnCurrentTabChanged);
+  assert(ok);
+}
+
+void MainWindow::SetupStatusBar() {
+  statusBar()->addPermanentWidget(memory_status_label_);
+  UpdateMemoryStatus();
 }
 
 void MainWindow::SetupNewTab(QString const& file_name,
-                             std::unique_ptr<AtomHolder>&& atom_holder) {
-  AtomTreeView* atom_tree_view = new AtomTreeView(std::move(atom_holder));
+                             std::unique_ptr<AtomHolder>&& atom_holder,
+                             bool is_local_file /* = true */) {
+  AddTab(new AtomTab(file_name, std::move(atom_holder), is_local_file),
+         file_name);
+}
+
+void MainWindow::AddTab(AtomTab* atom_tab, QString const& title) {
+  [[maybe_unused]] bool ok =
+      connect(atom_tab, &AtomTab::MemoryUsageChanged, this,
+              &MainWindow::UpdateMemoryStatus);
+  assert(ok);
+  ok = connect(atom_tab, &AtomTab::StatusMessage, this,
+               [this](QString const& message) {
+                 statusBar()->showMessage(message);
+               });
+  assert(ok);
 
   save_file_action_->setEnabled(true);
-  tabbed_widget_->addTab(atom_tree_view, file_name);
+  save_faststart_copy_action_->setEnabled(true);
+  save_fragmented_copy_action_->setEnabled(true);
+  compare_action_->setEnabled(true);
+  verify_samples_action_->setEnabled(true);
+  check_conformance_action_->setEnabled(true);
+  track_statistics_action_->setEnabled(true);
+  layout_map_action_->setEnabled(true);
+  extract_tracks_action_->setEnabled(true);
+  int const tab_index = tabbed_widget_->addTab(atom_tab, title);
+  // Show the new tab, this also enforces the memory budget with the new tab
+  // counted.
+  if (tabbed_widget_->currentIndex() == tab_index) {
+    // Adding the first tab makes it current without us asking, so handle it
+    // explicitly.
+    OnCurrentTabChanged(tab_index);
+  } else {
+    tabbed_widget_->setCurrentIndex(tab_index);
+  }
 }
 
 void MainWindow::OpenFile(QString const& file_name) {
@@ -83,20 +246,468 @@ void MainWindow::OpenFile(QString const& file_name) {
   SetupNewTab(file_name, std::move(holder));
 }
 
+void MainWindow::OpenUrl(QUrl const& url) {
+  // Fetching runs an event loop, which on this thread would let the user act
+  // on the window mid-parse. Instead the file is opened and parsed on a
+  // worker thread, whose stream has its own network access manager, and the
+  // atoms are handed back once it finishes.
+  struct UrlRead {
+    std::optional<std::unique_ptr<AtomHolder>> atoms;
+    network::HttpRangeStats stats;
+    // Set if the file couldn't be opened.
+    std::optional<std::string> open_error;
+    std::string last_error;
+  };
+  auto url_read = std::make_shared<UrlRead>();
+  QThread* thread = QThread::create([url, url_read] {
+    Result<network::HttpRangeByteStream*, std::string> open_result =
+        network::HttpRangeByteStream::Open(url);
+    if (open_result.IsErr()) {
+      open_result.MarkErrorHandled();
+      url_read->open_error = std::move(open_result).GetErr();
+      return;
+    }
+    network::HttpRangeByteStream* stream = open_result.GetOk();
+    url_read->atoms = utility::ReadAtoms(stream);
+    url_read->stats = stream->GetStats();
+    url_read->last_error = stream->GetLastError();
+    stream->Release();
+  });
+  // Parented so the window waits for it before being destroyed.
+  thread->setParent(this);
+  // The thread finishes on itself, so this runs queued on the GUI thread.
+  [[maybe_unused]] bool ok = connect(
+      thread, &QThread::finished, this, [this, thread, url, url_read] {
+        thread->deleteLater();
+        QMessageBox message_box;
+        if (url_read->open_error.has_value()) {
+          message_box.setText(
+              QStringLiteral("Failed to open %1.").arg(url.toDisplayString()));
+          message_box.setDetailedText(
+              QString::fromStdString(url_read->open_error.value()));
+          message_box.exec();
+          return;
+        }
+        if (!url_read->atoms.has_value()) {
+          message_box.setText(
+              QStringLiteral("Failed to read %1.").arg(url.toDisplayString()));
+          message_box.setDetailedText(
+              QString::fromStdString(url_read->last_error));
+          message_box.exec();
+          return;
+        }
+        statusBar()->showMessage(
+            QStringLiteral("Fetched %1 in %2 requests")
+                .arg(FormatBytes(url_read->stats.bytes_fetched))
+                .arg(url_read->stats.request_count));
+        SetupNewTab(url.toDisplayString(), std::move(url_read->atoms.value()),
+                    /*is_local_file=*/false);
+      });
+  assert(ok);
+  statusBar()->showMessage(
+      QStringLiteral("Opening %1...").arg(url.toDisplayString()));
+  thread->start();
+}
+
 void MainWindow::OpenFileUsingDialog() {
   QString const file_name = QFileDialog::getOpenFileName(this);
   OpenFile(file_name);
 }
 
+void MainWindow::OpenUrlUsingDialog() {
+  QString const url_text = QInputDialog::getText(
+      this, "Open URL",
+      "URL of the file. The server must support range requests, only the "
+      "parts of the file that are parsed are fetched.");
+  if (url_text.trimmed().isEmpty()) {
+    return;
+  }
+  QUrl const url = QUrl::fromUserInput(url_text.trimmed());
+  if (url.scheme() != "http" && url.scheme() != "https") {
+    QMessageBox message_box;
+    message_box.setText("Only http and https URLs can be opened.");
+    message_box.exec();
+    return;
+  }
+  OpenUrl(url);
+}
+
+void MainWindow::OpenSegmentSetUsingDialog() {
+  QString const init_file_name = QFileDialog::getOpenFileName(
+      this, "Open initialization segment", QString{},
+      "Initialization segments (*.mp4 *.m4i *.cmfi *.m4v *.m4a);;"
+      "All files (*)");
+  if (init_file_name.isEmpty()) {
+    return;
+  }
+  QStringList segment_file_names = QFileDialog::getOpenFileNames(
+      this, "Open media segments", QFileInfo{init_file_name}.path(),
+      "Media segments (*.m4s *.cmfv *.cmfa *.mp4);;All files (*)");
+  segment_file_names.removeAll(init_file_name);
+  if (segment_file_names.isEmpty()) {
+    return;
+  }
+  // Packagers number segments, which should be in numeric order, e.g.
+  // segment_9.m4s before segment_10.m4s.
+  QCollator collator;
+  collator.setNumericMode(true);
+  std::sort(segment_file_names.begin(), segment_file_names.end(), collator);
+
+  std::vector<std::string> segment_file_name_strings;
+  segment_file_name_strings.reserve(segment_file_names.size());
+  for (QString const& file_name : segment_file_names) {
+    segment_file_name_strings.push_back(
+        QFile::encodeName(file_name).toStdString());
+  }
+  QElapsedTimer timer;
+  timer.start();
+  Result<std::unique_ptr<utility::SegmentSet>, std::string> open_result =
+      utility::SegmentSet::Open(
+          QFile::encodeName(init_file_name).toStdString(),
+          std::move(segment_file_name_strings));
+  if (open_result.IsErr()) {
+    open_result.MarkErrorHandled();
+    QMessageBox message_box;
+    message_box.setText("Opening the segment set failed.");
+    message_box.setDetailedText(
+        QString::fromStdString(std::move(open_result).GetErr()));
+    message_box.exec();
+    return;
+  }
+  statusBar()->showMessage(
+      QStringLiteral("Scanned %1 media segments in %2 ms")
+          .arg(segment_file_names.size())
+          .arg(timer.elapsed()));
+  AddTab(new AtomTab(init_file_name, std::move(open_result).GetOk()),
+         QStringLiteral("%1 + %2 segments")
+             .arg(QFileInfo{init_file_name}.fileName())
+             .arg(segment_file_names.size()));
+}
+
 void MainWindow::SaveFile() {
   assert(save_file_action_->isEnabled());
   assert(tabbed_widget_->count() > 0);
 
   QWidget* current_tab = tabbed_widget_->currentWidget();
-  AtomTreeView* current_tree_view = static_cast<AtomTreeView*>(current_tab);
+  AtomTab* current_atom_tab = static_cast<AtomTab*>(current_tab);
   // TODO(bryce): Need to show a clear error if we fail to save, to avoid
   // losing work.
-  current_tree_view->SaveAtoms();
+  current_atom_tab->SaveAtoms();
+}
+
+void MainWindow::SaveFaststartCopy() {
+  assert(save_faststart_copy_action_->isEnabled());
+  assert(tabbed_widget_->count() > 0);
+
+  AtomTab* current_atom_tab =
+      static_cast<AtomTab*>(tabbed_widget_->currentWidget());
+  current_atom_tab->SaveFaststartCopy();
+}
+
+void MainWindow::SaveFragmentedCopy() {
+  assert(save_fragmented_copy_action_->isEnabled());
+  assert(tabbed_widget_->count() > 0);
+
+  AtomTab* current_atom_tab =
+      static_cast<AtomTab*>(tabbed_widget_->currentWidget());
+  current_atom_tab->SaveFragmentedCopy();
+}
+
+void MainWindow::CompareWithFileUsingDialog() {
+  assert(compare_action_->isEnabled());
+  assert(tabbed_widget_->count() > 0);
+
+  QMessageBox message_box;
+  AtomTab* left_tab = static_cast<AtomTab*>(tabbed_widget_->currentWidget());
+  if (!left_tab->IsBackedByLocalFile()) {
+    message_box.setText(
+        "Only unmodified local files can be compared, as the comparison reads "
+        "the bytes of the atoms from the file.");
+    message_box.exec();
+    return;
+  }
+  QString const right_file_name = QFileDialog::getOpenFileName(
+      this, QStringLiteral("Compare %1 with").arg(left_tab->GetFileName()));
+  if (right_file_name.isEmpty()) {
+    return;
+  }
+  int const tab_count = tabbed_widget_->count();
+  OpenFile(right_file_name);
+  if (tabbed_widget_->count() == tab_count) {
+    message_box.setText(
+        QStringLiteral("Failed to read %1.").arg(right_file_name));
+    message_box.exec();
+    return;
+  }
+  AtomTab* right_tab = static_cast<AtomTab*>(tabbed_widget_->currentWidget());
+  // Opening the new tab may have unloaded the old one to save memory.
+  if (left_tab->IsEvicted() && !left_tab->Rehydrate()) {
+    return;
+  }
+
+  QByteArray const left_file_name = left_tab->GetFileName().toLocal8Bit();
+  QByteArray const right_file_name_bytes = right_file_name.toLocal8Bit();
+  Result<analysis::StructuralDiff, std::string> diff_result =
+      analysis::DiffFiles(
+          {left_file_name.constData(), *left_tab->GetAtomHolder()},
+          {right_file_name_bytes.constData(), *right_tab->GetAtomHolder()});
+  if (diff_result.IsErr()) {
+    diff_result.MarkErrorHandled();
+    message_box.setText("Comparing the files failed.");
+    message_box.setDetailedText(
+        QString::fromStdString(std::move(diff_result).GetErr()));
+    message_box.exec();
+    return;
+  }
+  analysis::StructuralDiff const& diff = diff_result.GetOk();
+  left_tab->ShowDifferences(diff, /*is_left=*/true);
+  right_tab->ShowDifferences(diff, /*is_left=*/false);
+  statusBar()->showMessage(
+      diff.differences.empty()
+          ? QStringLiteral("The files are the same (hashed %1)")
+                .arg(FormatBytes(diff.bytes_hashed))
+          : QStringLiteral("%1 differing atoms (hashed %2)")
+                .arg(diff.differences.size())
+                .arg(FormatBytes(diff.bytes_hashed)));
+}
+
+void MainWindow::VerifySampleReferences() {
+  assert(verify_samples_action_->isEnabled());
+  assert(tabbed_widget_->count() > 0);
+
+  AtomTab* current_atom_tab =
+      static_cast<AtomTab*>(tabbed_widget_->currentWidget());
+  current_atom_tab->VerifySampleReferences();
+}
+
+void MainWindow::CheckConformance() {
+  assert(check_conformance_action_->isEnabled());
+  assert(tabbed_widget_->count() > 0);
+
+  AtomTab* current_atom_tab =
+      static_cast<AtomTab*>(tabbed_widget_->currentWidget());
+  current_atom_tab->CheckConformance();
+}
+
+void MainWindow::ShowTrackStatistics() {
+  assert(track_statistics_action_->isEnabled());
+  assert(tabbed_widget_->count() > 0);
+
+  AtomTab* current_atom_tab =
+      static_cast<AtomTab*>(tabbed_widget_->currentWidget());
+  if (current_atom_tab->IsSegmentSet()) {
+    QMessageBox message_box;
+    message_box.setText(
+        "Track statistics can't be computed for a segment set, as its "
+        "samples are spread over the media segments.");
+    message_box.exec();
+    return;
+  }
+  QElapsedTimer timer;
+  timer.start();
+  std::vector<analysis::TrackStatistics> statistics =
+      analysis::ComputeTrackStatistics(*current_atom_tab->GetAtomHolder());
+  statusBar()->showMessage(
+      QStringLiteral("Computed the statistics of %1 tracks in %2 ms")
+          .arg(statistics.size())
+          .arg(timer.elapsed()));
+  // Not modal, so the statistics can be kept open while looking at the tree.
+  TrackStatisticsDialog* dialog = new TrackStatisticsDialog{
+      current_atom_tab->GetFileName(), std::move(statistics), this};
+  dialog->setAttribute(Qt::WA_DeleteOnClose);
+  dialog->show();
+}
+
+void MainWindow::ShowLayoutMap() {
+  assert(layout_map_action_->isEnabled());
+  assert(tabbed_widget_->count() > 0);
+
+  AtomTab* current_atom_tab =
+      static_cast<AtomTab*>(tabbed_widget_->currentWidget());
+  if (!current_atom_tab->IsBackedByLocalFile()) {
+    QMessageBox message_box;
+    message_box.setText(
+        "Only unmodified local files can be mapped, as the atoms' positions "
+        "must match the file.");
+    message_box.exec();
+    return;
+  }
+  Result<analysis::LayoutMap, std::string> map_result =
+      analysis::ComputeLayoutMap(*current_atom_tab->GetAtomHolder());
+  if (map_result.IsErr()) {
+    map_result.MarkErrorHandled();
+    QMessageBox message_box;
+    message_box.setText("Mapping the layout failed.");
+    message_box.setDetailedText(
+        QString::fromStdString(std::move(map_result).GetErr()));
+    message_box.exec();
+    return;
+  }
+  LayoutMapDialog* dialog = new LayoutMapDialog{
+      current_atom_tab->GetFileName(), std::move(map_result).GetOk(), this};
+  dialog->setAttribute(Qt::WA_DeleteOnClose);
+  dialog->show();
+}
+
+void MainWindow::ExtractTracksUsingDialog() {
+  assert(extract_tracks_action_->isEnabled());
+  assert(tabbed_widget_->count() > 0);
+
+  AtomTab* current_atom_tab =
+      static_cast<AtomTab*>(tabbed_widget_->currentWidget());
+  if (!current_atom_tab->IsBackedByLocalFile()) {
+    QMessageBox message_box;
+    message_box.setText(
+        "Only unmodified local files can be extracted, as the atoms' "
+        "positions must match the file.");
+    message_box.exec();
+    return;
+  }
+  QString const directory = QFileDialog::getExistingDirectory(
+      this, QStringLiteral("Extract the tracks of %1 to")
+                .arg(current_atom_tab->GetFileName()));
+  if (directory.isEmpty()) {
+    return;
+  }
+
+  // E.g. "out/video.mp4.track1.h264".
+  QString const output_prefix = QDir{directory}.filePath(
+      QFileInfo{current_atom_tab->GetFileName()}.fileName());
+  QElapsedTimer timer;
+  timer.start();
+  Result<std::vector<extraction::ExtractedTrack>, std::string> extract_result =
+      extraction::ExtractTracks(
+          QFile::encodeName(current_atom_tab->GetFileName()).constData(),
+          *current_atom_tab->GetAtomHolder(),
+          QFile::encodeName(output_prefix).toStdString());
+  if (extract_result.IsErr()) {
+    extract_result.MarkErrorHandled();
+    QMessageBox message_box;
+    message_box.setText("Extracting the tracks failed.");
+    message_box.setDetailedText(
+        QString::fromStdString(std::move(extract_result).GetErr()));
+    message_box.exec();
+    return;
+  }
+  std::vector<extraction::ExtractedTrack> const tracks =
+      std::move(extract_result).GetOk();
+  uint64_t bytes_written = 0;
+  QStringList problems;
+  for (extraction::ExtractedTrack const& track : tracks) {
+    bytes_written += track.bytes_written;
+    if (!track.error.empty()) {
+      problems.append(QStringLiteral("Track %1: %2")
+                          .arg(track.track_id)
+                          .arg(QString::fromStdString(track.error)));
+    }
+  }
+  statusBar()->showMessage(
+      QStringLiteral("Extracted %1 tracks (%2) in %3 ms")
+          .arg(tracks.size())
+          .arg(FormatBytes(bytes_written))
+          .arg(timer.elapsed()));
+  if (!problems.empty()) {
+    QMessageBox message_box;
+    message_box.setText(
+        "Some tracks couldn't be extracted completely, their files hold the "
+        "samples before the problem.");
+    message_box.setDetailedText(problems.join('\n'));
+    message_box.exec();
+  }
+}
+
+void MainWindow::OnCurrentTabChanged(int tab_index) {
+  if (tab_index < 0) {
+    UpdateMemoryStatus();
+    return;
+  }
+  AtomTab* atom_tab = static_cast<AtomTab*>(tabbed_widget_->widget(tab_index));
+  if (atom_tab->IsEvicted()) {
+    // Failure is reported by the tab itself.
+    atom_tab->Rehydrate();
+  }
+  atom_tab->MarkActivated(++activation_tick_);
+  EnforceMemoryBudget();
+  UpdateMemoryStatus();
+}
+
+void MainWindow::SetMemoryBudgetUsingDialog() {
+  bool ok = false;
+  int const budget_mib = QInputDialog::getInt(
+      this, "Memory budget",
+      "Memory budget for open files (MiB). Inactive, unmodified files are "
+      "unloaded when the budget is exceeded, and reloaded when shown.",
+      static_cast<int>(GetMemoryBudget() / kBytesPerMib), /*min=*/64,
+      /*max=*/std::numeric_limits<int>::max(), /*step=*/256, &ok);
+  if (!ok) {
+    return;
+  }
+  GetSettings().setValue(kMemoryBudgetSettingsKey, budget_mib);
+  EnforceMemoryBudget();
+  UpdateMemoryStatus();
+}
+
+uint64_t MainWindow::GetMemoryBudget() const {
+  int const budget_mib =
+      GetSettings()
+          .value(kMemoryBudgetSettingsKey, kDefaultMemoryBudgetMib)
+          .toInt();
+  return static_cast<uint64_t>(std::max(budget_mib, 1)) * kBytesPerMib;
+}
+
+void MainWindow::EnforceMemoryBudget() {
+  uint64_t const budget = GetMemoryBudget();
+  uint64_t total_usage = 0;
+  std::vector<AtomTab*> candidates;
+  for (int i = 0; i < tabbed_widget_->count(); ++i) {
+    AtomTab* atom_tab = static_cast<AtomTab*>(tabbed_widget_->widget(i));
+    total_usage += atom_tab->GetMemoryUsage();
+    if (i != tabbed_widget_->currentIndex() && atom_tab->CanEvict()) {
+      candidates.push_back(atom_tab);
+    }
+  }
+  if (total_usage <= budget) {
+    return;
+  }
+
+  // Evict the least recently used tabs first.
+  std::sort(candidates.begin(), candidates.end(),
+            [](AtomTab const* a, AtomTab const* b) {
+              return a->GetLastActivationTick() < b->GetLastActivationTick();
+            });
+  for (AtomTab* atom_tab : candidates) {
+    if (total_usage <= budget) {
+      break;
+    }
+    total_usage -= atom_tab->GetMemoryUsage();
+    atom_tab->Evict();
+  }
+}
+
+void MainWindow::UpdateMemoryStatus() {
+  uint64_t total_usage = 0;
+  for (int i = 0; i < tabbed_widget_->count(); ++i) {
+    AtomTab* atom_tab = static_cast<AtomTab*>(tabbed_widget_->widget(i));
+    total_usage += atom_tab->GetMemoryUsage();
+    QString const tool_tip =
+        atom_tab->IsEvicted()
+            ? QStringLiteral("%1\nUnloaded to save memory")
+                  .arg(tabbed_widget_->tabText(i))
+            : QStringLiteral("%1\nMemory: %2")
+                  .arg(tabbed_widget_->tabText(i),
+                       FormatBytes(atom_tab->GetMemoryUsage()));
+    tabbed_widget_->setTabToolTip(i, tool_tip);
+  }
+
+  QString status;
+  QWidget* current_tab = tabbed_widget_->currentWidget();
+  if (current_tab != nullptr) {
+    status = QStringLiteral("Tab: %1, ").arg(FormatBytes(
+        static_cast<AtomTab*>(current_tab)->GetMemoryUsage()));
+  }
+  status += QStringLiteral("All tabs: %1 of %2 budget")
+                .arg(FormatBytes(total_usage), FormatBytes(GetMemoryBudget()));
+  memory_status_label_->setText(status);
 }
 
 // Begin drag and drop handling.
@@ -110,6 +721,10 @@ void MainWindow::dragEnterEvent(QDragEnterEvent* event) {
 void MainWindow::dropEvent(QDropEvent* event) {
   QList<QUrl> url_list = event->mimeData()->urls();
   for (const QUrl& url : url_list) {
+    if (url.scheme() == "http" || url.scheme() == "https") {
+      OpenUrl(url);
+      continue;
+    }
     QString const file_name = url.toLocalFile();
     OpenFile(file_name);
   }
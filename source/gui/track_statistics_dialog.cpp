@@ -0,0 +1,162 @@
+#include "gui/track_statistics_dialog.h"
+
+#include <QHeaderView>
+#include <QPainter>
+#include <QStringList>
+#include <QTableWidget>
+#include <QVBoxLayout>
+#include <algorithm>
+
+namespace mp4_manipulator {
+namespace {
+constexpr double kBitsPerKilobit = 1000.0;
+constexpr int kChartHeight = 160;
+constexpr int kChartMargin = 4;
+constexpr int kDialogWidth = 960;
+constexpr int kDialogHeight = 480;
+
+QString FormatSeconds(double seconds) {
+  return QStringLiteral("%1 s").arg(seconds, 0, 'f', 3);
+}
+
+QString FormatBitrate(double bits_per_second) {
+  return QStringLiteral("%1 kbit/s")
+      .arg(bits_per_second / kBitsPerKilobit, 0, 'f', 1);
+}
+}  // namespace
+
+// Draws a bar per second of a track's bitrate over time, scaled to fit the
+// widget. Long tracks have several seconds per pixel, in which case each
+// column shows the highest of its seconds, so peaks aren't lost.
+class BitrateChart : public QWidget {
+ public:
+  explicit BitrateChart(QWidget* parent = nullptr) : QWidget{parent} {
+    setMinimumHeight(kChartHeight);
+  }
+
+  void SetBitrates(std::vector<double> const* bitrates) {
+    bitrates_ = bitrates;
+    update();
+  }
+
+ protected:
+  // QWidget overrides.
+  void paintEvent(QPaintEvent* event) override {
+    Q_UNUSED(event);
+    QPainter painter{this};
+    QRect const area = rect().adjusted(kChartMargin, kChartMargin,
+                                       -kChartMargin, -kChartMargin);
+    if (bitrates_ == nullptr || bitrates_->empty() || area.width() <= 0) {
+      painter.drawText(area, Qt::AlignCenter, "No samples");
+      return;
+    }
+    double const peak =
+        *std::max_element(bitrates_->begin(), bitrates_->end());
+    if (peak <= 0) {
+      return;
+    }
+    size_t const count = bitrates_->size();
+    auto const columns =
+        std::min<size_t>(count, static_cast<size_t>(area.width()));
+    double const column_width = static_cast<double>(area.width()) / columns;
+    for (size_t column = 0; column < columns; ++column) {
+      size_t const begin = column * count / columns;
+      size_t const end = std::max(begin + 1, (column + 1) * count / columns);
+      double const value = *std::max_element(bitrates_->begin() + begin,
+                                             bitrates_->begin() + end);
+      double const height = value / peak * area.height();
+      painter.fillRect(QRectF{area.left() + column * column_width,
+                              area.bottom() - height, column_width, height},
+                       palette().highlight());
+    }
+    painter.drawText(area, Qt::AlignLeft | Qt::AlignTop,
+                     QStringLiteral("Peak second: %1, %2 s shown")
+                         .arg(FormatBitrate(peak))
+                         .arg(count));
+  }
+  // End QWidget overrides.
+
+ private:
+  // Owned by the dialog.
+  std::vector<double> const* bitrates_{nullptr};
+};
+
+TrackStatisticsDialog::TrackStatisticsDialog(
+    QString const& file_name,
+    std::vector<analysis::TrackStatistics>&& statistics,
+    QWidget* parent /* = nullptr */)
+    : QDialog{parent},
+      statistics_{std::move(statistics)},
+      table_{new QTableWidget{this}},
+      chart_{new BitrateChart{this}} {
+  setWindowTitle(QStringLiteral("Track statistics of %1").arg(file_name));
+  QStringList const headers{"Track",
+                            "Handler",
+                            "Samples",
+                            "Bytes",
+                            "Duration",
+                            "Average bitrate",
+                            "Peak bitrate",
+                            "Peak at",
+                            "Keyframes",
+                            "Min keyframe interval",
+                            "Average keyframe interval",
+                            "Max keyframe interval",
+                            "Min composition offset",
+                            "Max composition offset",
+                            "Late samples"};
+  table_->setColumnCount(static_cast<int>(headers.size()));
+  table_->setHorizontalHeaderLabels(headers);
+  table_->setRowCount(static_cast<int>(statistics_.size()));
+  table_->setEditTriggers(QAbstractItemView::NoEditTriggers);
+  table_->setSelectionBehavior(QAbstractItemView::SelectRows);
+  table_->setSelectionMode(QAbstractItemView::SingleSelection);
+  table_->verticalHeader()->hide();
+  for (size_t i = 0; i < statistics_.size(); ++i) {
+    analysis::TrackStatistics const& track = statistics_.at(i);
+    QStringList const cells{
+        QString::number(track.track_id),
+        QString::fromStdString(track.handler_type),
+        QString::number(track.sample_count),
+        QString::number(track.total_bytes),
+        FormatSeconds(track.duration),
+        FormatBitrate(track.average_bitrate),
+        FormatBitrate(track.peak_bitrate),
+        FormatSeconds(track.peak_bitrate_time),
+        QString::number(track.keyframe_count),
+        FormatSeconds(track.min_keyframe_interval),
+        FormatSeconds(track.average_keyframe_interval),
+        FormatSeconds(track.max_keyframe_interval),
+        FormatSeconds(track.min_composition_offset),
+        FormatSeconds(track.max_composition_offset),
+        QString::number(track.late_sample_count)};
+    for (int column = 0; column < cells.size(); ++column) {
+      table_->setItem(static_cast<int>(i), column,
+                      new QTableWidgetItem{cells.at(column)});
+    }
+  }
+  table_->resizeColumnsToContents();
+
+  QVBoxLayout* layout = new QVBoxLayout{this};
+  layout->addWidget(table_);
+  layout->addWidget(chart_);
+
+  [[maybe_unused]] bool const ok =
+      connect(table_, &QTableWidget::currentCellChanged, this,
+              [this](int row) { ShowTrack(row); });
+  assert(ok);
+  if (!statistics_.empty()) {
+    table_->selectRow(0);
+  }
+  resize(kDialogWidth, kDialogHeight);
+}
+
+void TrackStatisticsDialog::ShowTrack(int row) {
+  if (row < 0 || static_cast<size_t>(row) >= statistics_.size()) {
+    chart_->SetBitrates(nullptr);
+    return;
+  }
+  chart_->SetBitrates(&statistics_.at(row).bitrate_over_time);
+}
+
+}  // namespace mp4_manipulator
@@ -0,0 +1,1159 @@
+#include "headless/command_line.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QUrl>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "analysis/atom_lookup.h"
+#include "analysis/conformance_checker.h"
+#include "analysis/structural_diff.h"
+#include "analysis/track_statistics.h"
+#include "batch/batch_processor.h"
+#include "crypto/cenc_decryption.h"
+#include "network/http_range_byte_stream.h"
+#include "parsing/concatenation.h"
+#include "parsing/field_patcher.h"
+#include "parsing/file_range_copy.h"
+#include "parsing/file_utils.h"
+#include "parsing/fragmenting.h"
+#include "parsing/resource_deleters.h"
+
+namespace mp4_manipulator::headless {
+namespace {
+constexpr int kExitSuccess = 0;
+constexpr int kExitFailures = 1;
+constexpr int kExitUsage = 2;
+
+constexpr char kBatchCommand[] = "batch";
+constexpr char kCheckCommand[] = "check";
+constexpr char kConcatCommand[] = "concat";
+constexpr char kDecryptCommand[] = "decrypt";
+constexpr char kDiffCommand[] = "diff";
+constexpr char kFragmentCommand[] = "fragment";
+constexpr char kInspectCommand[] = "inspect";
+constexpr char kPatchCommand[] = "patch";
+constexpr char kStatsCommand[] = "stats";
+
+// How often (in files) batch progress is reported.
+constexpr size_t kProgressInterval = 100;
+
+constexpr char kDefaultStripTypes[] = "udta,free,skip";
+constexpr char kDefaultNameFilters[] =
+    "*.mp4,*.m4a,*.m4v,*.m4s,*.mov,*.3gp,*.cmfv,*.cmfa,*.ismv";
+
+int UsageError(QCommandLineParser const& parser, QString const& message) {
+  std::cerr << message.toStdString() << "\n\n"
+            << parser.helpText().toStdString();
+  return kExitUsage;
+}
+
+int RunBatch(QStringList const& arguments) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Applies an operation to many files in parallel, and writes a manifest "
+      "with one JSON line of results per file.");
+  QCommandLineOption const help_option = parser.addHelpOption();
+  parser.addPositionalArgument(
+      "inputs", "Files, or directories to search recursively.", "[inputs...]");
+  QCommandLineOption const operation_option{
+      "operation", "One of strip, dump, validate, summary or extract.",
+      "operation"};
+  QCommandLineOption const types_option{
+      "types",
+      QStringLiteral("Comma separated four ccs to strip (default %1) or dump.")
+          .arg(kDefaultStripTypes),
+      "types"};
+  QCommandLineOption const output_directory_option{
+      "output-dir", "Where strip, dump and extract write files.",
+      "directory"};
+  QCommandLineOption const file_list_option{
+      "file-list", "A file listing input files, one per line.", "file"};
+  QCommandLineOption const manifest_option{
+      "manifest",
+      "Where to write the manifest. Defaults to manifest.jsonl in the output "
+      "directory, or the current directory if there isn't one.",
+      "file"};
+  QCommandLineOption const jobs_option{
+      QStringList{"j", "jobs"},
+      "How many files to process at once. Defaults to one per hardware "
+      "thread.",
+      "count"};
+  QCommandLineOption const name_filters_option{
+      "name-filters",
+      "Comma separated patterns of file names to process in input "
+      "directories.",
+      "patterns", kDefaultNameFilters};
+  parser.addOptions({operation_option, types_option, output_directory_option,
+                     file_list_option, manifest_option, jobs_option,
+                     name_filters_option});
+
+  if (!parser.parse(arguments)) {
+    return UsageError(parser, parser.errorText());
+  }
+  if (parser.isSet(help_option)) {
+    std::cout << parser.helpText().toStdString();
+    return kExitSuccess;
+  }
+
+  batch::Options options;
+  QString const operation = parser.value(operation_option);
+  if (operation == "strip") {
+    options.operation = batch::Operation::kStrip;
+  } else if (operation == "dump") {
+    options.operation = batch::Operation::kDump;
+  } else if (operation == "validate") {
+    options.operation = batch::Operation::kValidate;
+  } else if (operation == "summary") {
+    options.operation = batch::Operation::kSummary;
+  } else if (operation == "extract") {
+    options.operation = batch::Operation::kExtract;
+  } else {
+    return UsageError(parser, "--operation must be one of strip, dump, "
+                              "validate, summary or extract.");
+  }
+
+  bool const uses_types = options.operation == batch::Operation::kStrip ||
+                          options.operation == batch::Operation::kDump;
+  if (uses_types) {
+    QString types = parser.value(types_option);
+    if (types.isEmpty() && options.operation == batch::Operation::kStrip) {
+      types = kDefaultStripTypes;
+    }
+    Result<std::vector<AP4_Atom::Type>, std::string> types_result =
+        batch::ParseAtomTypes(types);
+    if (types_result.IsErr()) {
+      types_result.MarkErrorHandled();
+      return UsageError(parser, "--types: " + QString::fromStdString(
+                                                  types_result.GetErr()));
+    }
+    options.atom_types = std::move(types_result).GetOk();
+  }
+
+  bool const writes_files =
+      uses_types || options.operation == batch::Operation::kExtract;
+  if (writes_files) {
+    options.output_directory = parser.value(output_directory_option);
+    if (options.output_directory.isEmpty()) {
+      return UsageError(parser, "--output-dir is needed to " + operation + ".");
+    }
+  }
+
+  if (parser.isSet(jobs_option)) {
+    bool ok = false;
+    options.worker_count = parser.value(jobs_option).toULongLong(&ok);
+    if (!ok || options.worker_count == 0) {
+      return UsageError(parser, "--jobs must be a positive number.");
+    }
+  }
+
+  QString manifest_file_name = parser.value(manifest_option);
+  if (manifest_file_name.isEmpty()) {
+    manifest_file_name =
+        QDir{options.output_directory}.filePath("manifest.jsonl");
+  }
+
+  Result<std::vector<batch::Job>, std::string> jobs_result =
+      batch::CollectJobs(
+          parser.positionalArguments(), parser.value(file_list_option),
+          parser.value(name_filters_option).split(',', Qt::SkipEmptyParts));
+  if (jobs_result.IsErr()) {
+    jobs_result.MarkErrorHandled();
+    return UsageError(parser, QString::fromStdString(jobs_result.GetErr()));
+  }
+  std::vector<batch::Job> const jobs = std::move(jobs_result).GetOk();
+  if (jobs.empty()) {
+    return UsageError(parser, "No input files found.");
+  }
+  if (writes_files) {
+    QDir{}.mkpath(options.output_directory);
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  size_t const job_count = jobs.size();
+  std::vector<batch::JobResult> const results = batch::RunJobs(
+      jobs, options, [job_count](size_t finished_count) {
+        if (finished_count % kProgressInterval == 0 ||
+            finished_count == job_count) {
+          std::cerr << "\rProcessed " << finished_count << "/" << job_count
+                    << std::flush;
+        }
+      });
+  std::cerr << "\n";
+
+  Result<std::monostate, std::string> manifest_result =
+      batch::WriteManifest(manifest_file_name, jobs, results);
+  if (manifest_result.IsErr()) {
+    manifest_result.MarkErrorHandled();
+    std::cerr << manifest_result.GetErr() << "\n";
+    return kExitFailures;
+  }
+
+  size_t const failed_count = static_cast<size_t>(std::count_if(
+      results.begin(), results.end(),
+      [](batch::JobResult const& result) { return !result.succeeded; }));
+  std::cout << "Processed " << job_count << " files in "
+            << timer.elapsed() / 1000.0 << "s: "
+            << job_count - failed_count << " succeeded, " << failed_count
+            << " failed. Manifest written to "
+            << manifest_file_name.toStdString() << "\n";
+  return failed_count == 0 ? kExitSuccess : kExitFailures;
+}
+
+// Writes `atom` and its descendants to `output`, with a line per atom and
+// field, indented to show the tree.
+void PrintAtomTree(std::ostream& output, AtomOrDescriptorBase const& atom,
+                   int depth) {
+  std::string const indent(static_cast<size_t>(2 * depth), ' ');
+  output << indent << atom.GetName().toStdString();
+  std::optional<uint64_t> const position = atom.GetPositionInStream();
+  if (position.has_value()) {
+    output << " @ " << position.value();
+  }
+  output << ", " << atom.GetSize() << " bytes\n";
+  for (Field const& field : atom.GetFields()) {
+    output << indent << "  " << field.name.toStdString() << ": "
+           << field.data.toStdString() << "\n";
+  }
+  for (auto const& child : atom.GetChildDescriptors()) {
+    PrintAtomTree(output, *child, depth + 1);
+  }
+  for (auto const& child : atom.GetChildAtoms()) {
+    PrintAtomTree(output, *child, depth + 1);
+  }
+}
+
+// Reads the atoms of a file front to back, or of stdin if `input_name` is
+// "-".
+Result<std::unique_ptr<AtomHolder>, std::string> ReadAtomsFromFileOrStdin(
+    QString const& input_name, utility::StreamingReadOptions const& options) {
+  using ReadResult = Result<std::unique_ptr<AtomHolder>, std::string>;
+  FILE* input = nullptr;
+  if (input_name == "-") {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    input = stdin;
+  } else {
+    input = std::fopen(QFile::encodeName(input_name).constData(), "rb");
+    if (input == nullptr) {
+      return ReadResult::Err("Could not open " + input_name.toStdString() +
+                             ".");
+    }
+  }
+  ReadResult read_result = utility::ReadAtomsFromPipe(input, options);
+  if (input != stdin) {
+    std::fclose(input);
+  }
+  return read_result;
+}
+
+// Reads the atoms of a remote file with range requests, reporting how much
+// was fetched to stderr.
+Result<std::unique_ptr<AtomHolder>, std::string> ReadAtomsFromUrl(
+    QUrl const& url, InspectionDepth depth) {
+  using ReadResult = Result<std::unique_ptr<AtomHolder>, std::string>;
+  Result<network::HttpRangeByteStream*, std::string> open_result =
+      network::HttpRangeByteStream::Open(url);
+  if (open_result.IsErr()) {
+    open_result.MarkErrorHandled();
+    return ReadResult::Err(std::move(open_result).GetErr());
+  }
+  network::HttpRangeByteStream* stream = open_result.GetOk();
+  std::optional<std::unique_ptr<AtomHolder>> possible_atoms =
+      utility::ReadAtoms(stream, depth);
+  network::HttpRangeStats const stats = stream->GetStats();
+  std::string const last_error = stream->GetLastError();
+  stream->Release();
+  std::cerr << "Fetched " << stats.bytes_fetched << " bytes in "
+            << stats.request_count << " requests.\n";
+  if (!possible_atoms.has_value()) {
+    return ReadResult::Err("Failed to read " +
+                           url.toDisplayString().toStdString() + ". " +
+                           last_error);
+  }
+  return ReadResult::Ok(std::move(possible_atoms.value()));
+}
+
+int RunInspect(QStringList const& arguments) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Prints the atom tree of a file. The file is read front to back without "
+      "seeking, so it can be piped in, e.g. `curl -s URL | mp4-manipulator "
+      "inspect`. Media data is skipped rather than buffered. http(s) URLs are "
+      "read with range requests, fetching only the parts that are parsed.");
+  QCommandLineOption const help_option = parser.addHelpOption();
+  parser.addPositionalArgument(
+      "input", "The file or URL to read, or - for stdin.", "[input]");
+  QCommandLineOption const max_box_size_option{
+      "max-box-size",
+      "Boxes larger than this many MiB are skipped rather than parsed.",
+      "mib", "64"};
+  QCommandLineOption const full_option{
+      "full",
+      "Print every field, including the entries of sample tables, rather "
+      "than just the summary fields."};
+  parser.addOptions({max_box_size_option, full_option});
+
+  if (!parser.parse(arguments)) {
+    return UsageError(parser, parser.errorText());
+  }
+  if (parser.isSet(help_option)) {
+    std::cout << parser.helpText().toStdString();
+    return kExitSuccess;
+  }
+  QStringList const inputs = parser.positionalArguments();
+  if (inputs.size() > 1) {
+    return UsageError(parser, "Only one input can be inspected at a time.");
+  }
+  bool ok = false;
+  utility::StreamingReadOptions options;
+  options.max_buffered_box_size =
+      parser.value(max_box_size_option).toULongLong(&ok) * 1024 * 1024;
+  if (!ok || options.max_buffered_box_size == 0) {
+    return UsageError(parser, "--max-box-size must be a positive number.");
+  }
+  options.inspection_depth = parser.isSet(full_option)
+                                 ? InspectionDepth::kFull
+                                 : InspectionDepth::kSummary;
+
+  QString const input_name = inputs.isEmpty() ? "-" : inputs.front();
+  bool const is_url =
+      input_name.startsWith("http://") || input_name.startsWith("https://");
+  Result<std::unique_ptr<AtomHolder>, std::string> read_result =
+      is_url ? ReadAtomsFromUrl(QUrl{input_name}, options.inspection_depth)
+             : ReadAtomsFromFileOrStdin(input_name, options);
+  if (read_result.IsErr()) {
+    read_result.MarkErrorHandled();
+    std::cerr << read_result.GetErr() << "\n";
+    return kExitFailures;
+  }
+  std::unique_ptr<AtomHolder> const holder = std::move(read_result).GetOk();
+  for (auto const& atom : holder->GetTopLevelAtoms()) {
+    PrintAtomTree(std::cout, *atom, 0);
+  }
+  return kExitSuccess;
+}
+
+// Returns the path of `atom` from the top level, e.g. "moov/trak/tkhd".
+std::string GetAtomPath(AtomOrDescriptorBase const& atom) {
+  std::string path = atom.GetName().toStdString();
+  for (AtomOrDescriptorBase const* parent = atom.GetParent();
+       parent != nullptr; parent = parent->GetParent()) {
+    path = parent->GetName().toStdString() + "/" + path;
+  }
+  return path;
+}
+
+// Writes the position of `atom`, labelled with which file (`side`) it's in,
+// if `atom` is set and its position is known.
+void PrintPosition(std::ostream& output, char const* side,
+                   AtomOrDescriptorBase const* atom) {
+  if (atom == nullptr) {
+    return;
+  }
+  std::optional<uint64_t> const position = atom->GetPositionInStream();
+  if (position.has_value()) {
+    output << " " << side << " @ " << position.value();
+  }
+}
+
+int RunDiff(QStringList const& arguments) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Prints the atoms that differ between two files. Atoms are compared by "
+      "hashes of their bytes, so atoms that have moved aren't differences. "
+      "Changed atoms are marked ~ (or * if their own fields changed, rather "
+      "than just their children), removed atoms - and added atoms +. Exits "
+      "with 0 if the files are the same, and 1 if they differ.");
+  QCommandLineOption const help_option = parser.addHelpOption();
+  parser.addPositionalArgument("left", "The first file.", "left");
+  parser.addPositionalArgument("right", "The second file.", "right");
+
+  if (!parser.parse(arguments)) {
+    return UsageError(parser, parser.errorText());
+  }
+  if (parser.isSet(help_option)) {
+    std::cout << parser.helpText().toStdString();
+    return kExitSuccess;
+  }
+  QStringList const inputs = parser.positionalArguments();
+  if (inputs.size() != 2) {
+    return UsageError(parser, "Two files are needed to diff.");
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  QByteArray const left_name = QFile::encodeName(inputs.at(0));
+  QByteArray const right_name = QFile::encodeName(inputs.at(1));
+  std::optional<std::unique_ptr<AtomHolder>> left_atoms =
+      utility::ReadAtoms(left_name.constData());
+  std::optional<std::unique_ptr<AtomHolder>> right_atoms =
+      utility::ReadAtoms(right_name.constData());
+  if (!left_atoms.has_value() || !right_atoms.has_value()) {
+    // ReadAtoms reports which file couldn't be read.
+    return kExitFailures;
+  }
+  Result<analysis::StructuralDiff, std::string> diff_result =
+      analysis::DiffFiles({left_name.constData(), *left_atoms.value()},
+                          {right_name.constData(), *right_atoms.value()});
+  if (diff_result.IsErr()) {
+    diff_result.MarkErrorHandled();
+    std::cerr << diff_result.GetErr() << "\n";
+    return kExitFailures;
+  }
+  analysis::StructuralDiff const& diff = diff_result.GetOk();
+  for (analysis::Difference const& difference : diff.differences) {
+    switch (difference.kind) {
+      case analysis::DifferenceKind::kChanged:
+        std::cout << (difference.contents_changed ? "* " : "~ ")
+                  << GetAtomPath(*difference.left);
+        break;
+      case analysis::DifferenceKind::kRemoved:
+        std::cout << "- " << GetAtomPath(*difference.left);
+        break;
+      case analysis::DifferenceKind::kAdded:
+        std::cout << "+ " << GetAtomPath(*difference.right);
+        break;
+    }
+    PrintPosition(std::cout, "left", difference.left);
+    PrintPosition(std::cout, "right", difference.right);
+    std::cout << "\n";
+  }
+  std::cerr << diff.differences.size() << " differences, hashed "
+            << diff.bytes_hashed << " bytes in " << timer.elapsed() / 1000.0
+            << "s.\n";
+  return diff.differences.empty() ? kExitSuccess : kExitFailures;
+}
+
+int RunCheck(QStringList const& arguments) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Checks a file against ISO 14496-12 and CMAF rules: required boxes per "
+      "brand and container, box order, versions and flags, agreement of "
+      "tkhd, mdhd and mvhd durations, and sidx references. Prints one line "
+      "per issue. Exits with 0 if there are no errors (or, with --strict, "
+      "no warnings either), and 1 otherwise.");
+  QCommandLineOption const help_option = parser.addHelpOption();
+  parser.addPositionalArgument(
+      "input", "The file or URL to read, or - for stdin.", "[input]");
+  QCommandLineOption const strict_option{
+      "strict", "Exit with 1 if there are warnings, as well as errors."};
+  QCommandLineOption const jobs_option{
+      QStringList{"j", "jobs"},
+      "The number of threads to check on. Defaults to one per hardware "
+      "thread.",
+      "count"};
+  parser.addOptions({strict_option, jobs_option});
+
+  if (!parser.parse(arguments)) {
+    return UsageError(parser, parser.errorText());
+  }
+  if (parser.isSet(help_option)) {
+    std::cout << parser.helpText().toStdString();
+    return kExitSuccess;
+  }
+  QStringList const inputs = parser.positionalArguments();
+  if (inputs.size() > 1) {
+    return UsageError(parser, "Only one input can be checked at a time.");
+  }
+  size_t thread_count = 0;
+  if (parser.isSet(jobs_option)) {
+    bool ok = false;
+    thread_count = parser.value(jobs_option).toULongLong(&ok);
+    if (!ok || thread_count == 0) {
+      return UsageError(parser, "--jobs must be a positive number.");
+    }
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  QString const input_name = inputs.isEmpty() ? "-" : inputs.front();
+  bool const is_url =
+      input_name.startsWith("http://") || input_name.startsWith("https://");
+  Result<std::unique_ptr<AtomHolder>, std::string> read_result =
+      is_url ? ReadAtomsFromUrl(QUrl{input_name}, InspectionDepth::kSummary)
+             : ReadAtomsFromFileOrStdin(input_name, {});
+  if (read_result.IsErr()) {
+    read_result.MarkErrorHandled();
+    std::cerr << read_result.GetErr() << "\n";
+    return kExitFailures;
+  }
+  std::unique_ptr<AtomHolder> const holder = std::move(read_result).GetOk();
+  qint64 const read_ms = timer.restart();
+  analysis::ConformanceReport const report =
+      analysis::CheckConformance(*holder, thread_count);
+  qint64 const check_ms = timer.elapsed();
+
+  for (analysis::ConformanceIssue const& issue : report.issues) {
+    std::cout << (issue.severity == analysis::ConformanceSeverity::kError
+                      ? "error "
+                      : "warning ")
+              << GetAtomPath(*issue.atom);
+    std::optional<uint64_t> const position = issue.atom->GetPositionInStream();
+    if (position.has_value()) {
+      std::cout << " @ " << position.value();
+    }
+    std::cout << " (" << issue.rule << "): " << issue.description << "\n";
+  }
+  std::cerr << report.error_count << " errors and " << report.warning_count
+            << " warnings in " << report.checked_atom_count
+            << " checked atoms";
+  if (report.issues.size() < report.error_count + report.warning_count) {
+    std::cerr << " (first " << report.issues.size() << " listed)";
+  }
+  std::cerr << ". Read in " << read_ms / 1000.0 << "s, checked in "
+            << check_ms / 1000.0 << "s.\n";
+  bool const failed =
+      report.error_count > 0 ||
+      (parser.isSet(strict_option) && report.warning_count > 0);
+  return failed ? kExitFailures : kExitSuccess;
+}
+
+// Writes the statistics of a track as a few indented lines.
+void PrintTrackStatistics(std::ostream& output,
+                          analysis::TrackStatistics const& track,
+                          double window, bool print_bitrate_over_time) {
+  constexpr double kBitsPerKilobit = 1000.0;
+  output << "Track " << track.track_id << " (" << track.handler_type << "): "
+         << track.sample_count << " samples, " << track.total_bytes
+         << " bytes, " << track.duration << "s\n";
+  output << "  bitrate: average " << track.average_bitrate / kBitsPerKilobit
+         << " kbit/s, peak " << track.peak_bitrate / kBitsPerKilobit
+         << " kbit/s over " << window << "s at " << track.peak_bitrate_time
+         << "s\n";
+  output << "  keyframes: " << track.keyframe_count << ", interval min "
+         << track.min_keyframe_interval << "s, average "
+         << track.average_keyframe_interval << "s, max "
+         << track.max_keyframe_interval << "s\n";
+  output << "  composition offset: min " << track.min_composition_offset
+         << "s, max " << track.max_composition_offset << "s, "
+         << track.late_sample_count << " samples decoded after presentation\n";
+  if (print_bitrate_over_time) {
+    for (size_t second = 0; second < track.bitrate_over_time.size();
+         ++second) {
+      output << "  " << second << "s: "
+             << track.bitrate_over_time.at(second) / kBitsPerKilobit
+             << " kbit/s\n";
+    }
+  }
+}
+
+int RunStats(QStringList const& arguments) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Prints the bitrate, keyframe and timing statistics of each track of a "
+      "file. These are computed from the sample tables alone, so media data "
+      "is skipped rather than read, and the file can be piped in or given as "
+      "an http(s) URL.");
+  QCommandLineOption const help_option = parser.addHelpOption();
+  parser.addPositionalArgument(
+      "input", "The file or URL to read, or - for stdin.", "[input]");
+  QCommandLineOption const window_option{
+      "window", "The window for the peak bitrate, in seconds.", "seconds",
+      QString::number(analysis::kDefaultPeakBitrateWindow)};
+  QCommandLineOption const bitrate_over_time_option{
+      "bitrate-over-time", "Also print the bitrate of each second."};
+  parser.addOptions({window_option, bitrate_over_time_option});
+
+  if (!parser.parse(arguments)) {
+    return UsageError(parser, parser.errorText());
+  }
+  if (parser.isSet(help_option)) {
+    std::cout << parser.helpText().toStdString();
+    return kExitSuccess;
+  }
+  QStringList const inputs = parser.positionalArguments();
+  if (inputs.size() > 1) {
+    return UsageError(parser, "Only one input can be read at a time.");
+  }
+  bool ok = false;
+  double const window = parser.value(window_option).toDouble(&ok);
+  if (!ok || window <= 0) {
+    return UsageError(parser, "--window must be a positive number.");
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  QString const input_name = inputs.isEmpty() ? "-" : inputs.front();
+  bool const is_url =
+      input_name.startsWith("http://") || input_name.startsWith("https://");
+  Result<std::unique_ptr<AtomHolder>, std::string> read_result =
+      is_url ? ReadAtomsFromUrl(QUrl{input_name}, InspectionDepth::kSummary)
+             : ReadAtomsFromFileOrStdin(input_name, {});
+  if (read_result.IsErr()) {
+    read_result.MarkErrorHandled();
+    std::cerr << read_result.GetErr() << "\n";
+    return kExitFailures;
+  }
+  std::unique_ptr<AtomHolder> const holder = std::move(read_result).GetOk();
+  qint64 const read_ms = timer.restart();
+  std::vector<analysis::TrackStatistics> const statistics =
+      analysis::ComputeTrackStatistics(*holder, window);
+  qint64 const compute_ms = timer.elapsed();
+
+  std::cout << std::fixed << std::setprecision(3);
+  for (analysis::TrackStatistics const& track : statistics) {
+    PrintTrackStatistics(std::cout, track, window,
+                         parser.isSet(bitrate_over_time_option));
+  }
+  std::cerr << "Read in " << read_ms / 1000.0 << "s, computed statistics in "
+            << compute_ms / 1000.0 << "s.\n";
+  return kExitSuccess;
+}
+
+int RunDecrypt(QStringList const& arguments) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Writes a clear copy of a Common Encryption (cenc, cens, cbc1 or cbcs) "
+      "protected file. Samples are decrypted in batches on all cores, and "
+      "the copy keeps the layout of the input.");
+  QCommandLineOption const help_option = parser.addHelpOption();
+  parser.addPositionalArgument("input", "The protected file.", "input");
+  parser.addPositionalArgument("output", "Where to write the clear file.",
+                               "output");
+  QCommandLineOption const keys_option{
+      "keys",
+      "A file of keys, one per line as <key id>:<key> or <track id>:<key> "
+      "in hex.",
+      "file"};
+  QCommandLineOption const jobs_option{
+      QStringList{"j", "jobs"},
+      "How many threads decrypt. Defaults to one per hardware thread.",
+      "count"};
+  parser.addOptions({keys_option, jobs_option});
+
+  if (!parser.parse(arguments)) {
+    return UsageError(parser, parser.errorText());
+  }
+  if (parser.isSet(help_option)) {
+    std::cout << parser.helpText().toStdString();
+    return kExitSuccess;
+  }
+  QStringList const files = parser.positionalArguments();
+  if (files.size() != 2) {
+    return UsageError(parser, "An input and an output file are needed.");
+  }
+  if (!parser.isSet(keys_option)) {
+    return UsageError(parser, "--keys is needed to decrypt.");
+  }
+  size_t thread_count = 0;
+  if (parser.isSet(jobs_option)) {
+    bool ok = false;
+    thread_count = parser.value(jobs_option).toULongLong(&ok);
+    if (!ok || thread_count == 0) {
+      return UsageError(parser, "--jobs must be a positive number.");
+    }
+  }
+
+  Result<crypto::KeySet, std::string> keys_result = crypto::ReadKeyFile(
+      QFile::encodeName(parser.value(keys_option)).constData());
+  if (keys_result.IsErr()) {
+    keys_result.MarkErrorHandled();
+    return UsageError(parser, "--keys: " + QString::fromStdString(
+                                               keys_result.GetErr()));
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  QByteArray const input_name = QFile::encodeName(files.at(0));
+  QByteArray const output_name = QFile::encodeName(files.at(1));
+  Result<crypto::DecryptionSummary, std::string> decrypt_result =
+      crypto::DecryptFile(input_name.constData(), output_name.constData(),
+                          keys_result.GetOk(), thread_count);
+  if (decrypt_result.IsErr()) {
+    decrypt_result.MarkErrorHandled();
+    std::cerr << decrypt_result.GetErr() << "\n";
+    return kExitFailures;
+  }
+  crypto::DecryptionSummary const& summary = decrypt_result.GetOk();
+  std::cerr << "Decrypted " << summary.sample_count << " samples ("
+            << summary.bytes_decrypted << " bytes) of "
+            << summary.decrypted_track_ids.size() << " tracks in "
+            << timer.elapsed() / 1000.0 << "s.\n";
+  for (uint32_t const track_id : summary.skipped_track_ids) {
+    std::cerr << "Track " << track_id
+              << " was left encrypted, as there's no key for it.\n";
+  }
+  return summary.skipped_track_ids.empty() ? kExitSuccess : kExitFailures;
+}
+
+int RunFragment(QStringList const& arguments) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Writes a fragmented (CMAF style) copy of a progressive file, with "
+      "fragments starting on video keyframes. Fragments are built from the "
+      "sample tables and written one at a time, so memory use doesn't grow "
+      "with the length of the file.");
+  QCommandLineOption const help_option = parser.addHelpOption();
+  parser.addPositionalArgument("input", "The progressive file.", "input");
+  parser.addPositionalArgument(
+      "output", "Where to write the fragmented file.", "output");
+  QCommandLineOption const duration_option{
+      "fragment-duration",
+      "The shortest duration of a fragment, in seconds. Fragments run on to "
+      "the next keyframe.",
+      "seconds", QString::number(utility::kDefaultFragmentDuration)};
+  parser.addOption(duration_option);
+
+  if (!parser.parse(arguments)) {
+    return UsageError(parser, parser.errorText());
+  }
+  if (parser.isSet(help_option)) {
+    std::cout << parser.helpText().toStdString();
+    return kExitSuccess;
+  }
+  QStringList const files = parser.positionalArguments();
+  if (files.size() != 2) {
+    return UsageError(parser, "An input and an output file are needed.");
+  }
+  bool ok = false;
+  double const fragment_duration =
+      parser.value(duration_option).toDouble(&ok);
+  if (!ok || fragment_duration <= 0) {
+    return UsageError(parser,
+                      "--fragment-duration must be a positive number.");
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  QByteArray const input_name = QFile::encodeName(files.at(0));
+  QByteArray const output_name = QFile::encodeName(files.at(1));
+  Result<utility::FragmentingSummary, std::string> fragment_result =
+      utility::WriteFragmented(input_name.constData(),
+                               output_name.constData(), fragment_duration);
+  if (fragment_result.IsErr()) {
+    fragment_result.MarkErrorHandled();
+    std::cerr << fragment_result.GetErr() << "\n";
+    return kExitFailures;
+  }
+  utility::FragmentingSummary const& summary = fragment_result.GetOk();
+  std::cerr << "Wrote " << summary.sample_count << " samples in "
+            << summary.fragment_count << " fragments in "
+            << timer.elapsed() / 1000.0 << "s.\n";
+  return kExitSuccess;
+}
+
+int RunConcat(QStringList const& arguments) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Joins files with the same tracks into one, without re-encoding. The "
+      "sample tables of progressive files are merged, and the fragments of "
+      "fragmented files are appended. Media data is copied as is.");
+  QCommandLineOption const help_option = parser.addHelpOption();
+  parser.addPositionalArgument("inputs", "The files to join, in order.",
+                               "inputs...");
+  QCommandLineOption const output_option{
+      QStringList{"o", "output"}, "Where to write the joined file.", "file"};
+  parser.addOption(output_option);
+
+  if (!parser.parse(arguments)) {
+    return UsageError(parser, parser.errorText());
+  }
+  if (parser.isSet(help_option)) {
+    std::cout << parser.helpText().toStdString();
+    return kExitSuccess;
+  }
+  QStringList const files = parser.positionalArguments();
+  if (files.size() < 2) {
+    return UsageError(parser, "At least two input files are needed.");
+  }
+  if (!parser.isSet(output_option)) {
+    return UsageError(parser, "--output is needed.");
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  std::vector<std::string> input_names;
+  input_names.reserve(files.size());
+  for (QString const& file : files) {
+    input_names.push_back(QFile::encodeName(file).toStdString());
+  }
+  QByteArray const output_name =
+      QFile::encodeName(parser.value(output_option));
+  Result<utility::ConcatenationSummary, std::string> concat_result =
+      utility::ConcatenateFiles(input_names, output_name.constData());
+  if (concat_result.IsErr()) {
+    concat_result.MarkErrorHandled();
+    std::cerr << concat_result.GetErr() << "\n";
+    return kExitFailures;
+  }
+  utility::ConcatenationSummary const& summary = concat_result.GetOk();
+  std::cerr << "Joined " << files.size()
+            << (summary.is_fragmented ? " fragmented" : " progressive")
+            << " files, " << summary.sample_count << " samples and "
+            << summary.media_data_size << " bytes of media data, in "
+            << timer.elapsed() / 1000.0 << "s.\n";
+  return kExitSuccess;
+}
+
+// A field change for the patch command, applied to the file's moov once its
+// atoms are read.
+struct Patch {
+  std::string description;
+  std::function<Result<std::monostate, std::string>(
+      utility::FieldPatcher&, AtomOrDescriptorBase const& moov)>
+      apply;
+};
+
+// Returns the trak of `moov` whose tkhd has `track_id`, or nullptr.
+AtomOrDescriptorBase const* FindTrak(AtomOrDescriptorBase const& moov,
+                                     uint32_t track_id) {
+  for (auto const& child : moov.GetChildAtoms()) {
+    if (!analysis::HasType(*child, AP4_ATOM_TYPE_TRAK)) {
+      continue;
+    }
+    AP4_TkhdAtom* const tkhd =
+        analysis::FindDescendantAp4Atom<AP4_TkhdAtom>(*child);
+    if (tkhd != nullptr && tkhd->GetTrackId() == track_id) {
+      return child.get();
+    }
+  }
+  return nullptr;
+}
+
+// Makes a patch that applies `apply` to the first T in the trak of
+// `track_id`.
+template <typename T>
+Patch MakeTrackPatch(
+    std::string description, uint32_t track_id, char const* box_name,
+    std::function<Result<std::monostate, std::string>(
+        utility::FieldPatcher&, AtomOrDescriptorBase const&)>
+        apply) {
+  return Patch{
+      std::move(description),
+      [track_id, box_name, apply = std::move(apply)](
+          utility::FieldPatcher& patcher, AtomOrDescriptorBase const& moov) {
+        using PatchResult = Result<std::monostate, std::string>;
+        AtomOrDescriptorBase const* const trak = FindTrak(moov, track_id);
+        if (trak == nullptr) {
+          return PatchResult::Err("There's no track " +
+                                  std::to_string(track_id) + ".");
+        }
+        AtomOrDescriptorBase const* const box =
+            analysis::FindDescendant<T>(*trak);
+        if (box == nullptr) {
+          return PatchResult::Err("Track " + std::to_string(track_id) +
+                                  " has no " + box_name + ".");
+        }
+        return apply(patcher, *box);
+      }};
+}
+
+// Splits "<number>=<value>", as taken by the patch command's per track
+// options. Returns false if `argument` isn't of that form.
+bool ParseAssignment(QString const& argument, uint32_t* number,
+                     QString* value) {
+  qsizetype const separator = argument.indexOf('=');
+  if (separator < 0) {
+    return false;
+  }
+  bool ok = false;
+  *number = argument.left(separator).toUInt(&ok);
+  *value = argument.mid(separator + 1);
+  return ok;
+}
+
+int RunPatch(QStringList const& arguments) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Changes fixed size fields in place: track enabled flags, languages, "
+      "timescales and edit list entries. Only the bytes of the fields are "
+      "written, so a patch is instant however large the file. With --output "
+      "the file is copied first (as a reflink where the file system supports "
+      "it) and the copy is patched.");
+  QCommandLineOption const help_option = parser.addHelpOption();
+  parser.addPositionalArgument("file", "The file to patch.", "file");
+  QCommandLineOption const output_option{
+      QStringList{"o", "output"},
+      "Patch a copy written here rather than the file itself.", "file"};
+  QCommandLineOption const enable_option{
+      "enable-track", "Set the enabled flag of a track.", "track id"};
+  QCommandLineOption const disable_option{
+      "disable-track", "Clear the enabled flag of a track.", "track id"};
+  QCommandLineOption const language_option{
+      "language", "Set a track's language, e.g. 1=eng.", "track id=code"};
+  QCommandLineOption const media_timescale_option{
+      "media-timescale",
+      "Set the timescale of a track's media (mdhd), e.g. 1=90000. Durations "
+      "aren't converted, so this fixes a wrongly written timescale.",
+      "track id=timescale"};
+  QCommandLineOption const movie_timescale_option{
+      "movie-timescale", "Set the timescale of the movie (mvhd).",
+      "timescale"};
+  QCommandLineOption const edit_option{
+      "edit",
+      "Replace an entry (counting from 0) of a track's edit list, e.g. "
+      "1:0=90000,1024 or 1:0=90000,1024,1. The media time is -1 for an "
+      "empty edit and the rate defaults to 1.",
+      "track id:index=duration,media time[,rate]"};
+  parser.addOptions({output_option, enable_option, disable_option,
+                     language_option, media_timescale_option,
+                     movie_timescale_option, edit_option});
+
+  if (!parser.parse(arguments)) {
+    return UsageError(parser, parser.errorText());
+  }
+  if (parser.isSet(help_option)) {
+    std::cout << parser.helpText().toStdString();
+    return kExitSuccess;
+  }
+  QStringList const files = parser.positionalArguments();
+  if (files.size() != 1) {
+    return UsageError(parser, "One file to patch is needed.");
+  }
+
+  // Parse every patch before touching the file, so a bad argument leaves it
+  // as it was.
+  std::vector<Patch> patches;
+  for (bool const enabled : {true, false}) {
+    QCommandLineOption const& option =
+        enabled ? enable_option : disable_option;
+    for (QString const& value : parser.values(option)) {
+      bool ok = false;
+      uint32_t const track_id = value.toUInt(&ok);
+      if (!ok) {
+        return UsageError(parser, "--" + option.names().first() +
+                                      " takes a track id.");
+      }
+      patches.push_back(MakeTrackPatch<AP4_TkhdAtom>(
+          std::string{enabled ? "Enable" : "Disable"} + " track " +
+              std::to_string(track_id),
+          track_id, "tkhd",
+          [enabled](utility::FieldPatcher& patcher,
+                    AtomOrDescriptorBase const& tkhd) {
+            return patcher.SetTrackEnabled(tkhd, enabled);
+          }));
+    }
+  }
+  for (QString const& value : parser.values(language_option)) {
+    uint32_t track_id = 0;
+    QString language;
+    if (!ParseAssignment(value, &track_id, &language)) {
+      return UsageError(parser, "--language takes <track id>=<code>.");
+    }
+    std::string const code = language.toStdString();
+    patches.push_back(MakeTrackPatch<AP4_MdhdAtom>(
+        "Set the language of track " + std::to_string(track_id) + " to " +
+            code,
+        track_id, "mdhd",
+        [code](utility::FieldPatcher& patcher,
+               AtomOrDescriptorBase const& mdhd) {
+          return patcher.SetMediaLanguage(mdhd, code);
+        }));
+  }
+  for (QString const& value : parser.values(media_timescale_option)) {
+    uint32_t track_id = 0;
+    QString timescale_value;
+    bool timescale_ok = false;
+    bool const ok = ParseAssignment(value, &track_id, &timescale_value);
+    uint32_t const timescale = timescale_value.toUInt(&timescale_ok);
+    if (!ok || !timescale_ok || timescale == 0) {
+      return UsageError(parser,
+                        "--media-timescale takes <track id>=<timescale>, "
+                        "with a positive timescale.");
+    }
+    patches.push_back(MakeTrackPatch<AP4_MdhdAtom>(
+        "Set the media timescale of track " + std::to_string(track_id) +
+            " to " + std::to_string(timescale),
+        track_id, "mdhd",
+        [timescale](utility::FieldPatcher& patcher,
+                    AtomOrDescriptorBase const& mdhd) {
+          return patcher.SetMediaTimescale(mdhd, timescale);
+        }));
+  }
+  if (parser.isSet(movie_timescale_option)) {
+    bool ok = false;
+    uint32_t const timescale =
+        parser.value(movie_timescale_option).toUInt(&ok);
+    if (!ok || timescale == 0) {
+      return UsageError(parser,
+                        "--movie-timescale must be a positive number.");
+    }
+    patches.push_back(Patch{
+        "Set the movie timescale to " + std::to_string(timescale),
+        [timescale](utility::FieldPatcher& patcher,
+                    AtomOrDescriptorBase const& moov) {
+          AtomOrDescriptorBase const* const mvhd =
+              analysis::FindDescendant<AP4_MvhdAtom>(moov);
+          if (mvhd == nullptr) {
+            return Result<std::monostate, std::string>::Err(
+                "The file has no mvhd.");
+          }
+          return patcher.SetMovieTimescale(*mvhd, timescale);
+        }});
+  }
+  for (QString const& value : parser.values(edit_option)) {
+    QString const usage =
+        "--edit takes <track id>:<index>=<duration>,<media time>[,<rate>].";
+    qsizetype const colon = value.indexOf(':');
+    uint32_t index = 0;
+    QString entry_value;
+    if (colon < 0 ||
+        !ParseAssignment(value.mid(colon + 1), &index, &entry_value)) {
+      return UsageError(parser, usage);
+    }
+    bool ok = false;
+    uint32_t const track_id = value.left(colon).toUInt(&ok);
+    QStringList const parts = entry_value.split(',');
+    if (!ok || parts.size() < 2 || parts.size() > 3) {
+      return UsageError(parser, usage);
+    }
+    utility::EditListEntry entry{};
+    bool duration_ok = false;
+    bool time_ok = false;
+    bool rate_ok = true;
+    entry.segment_duration = parts.at(0).toULongLong(&duration_ok);
+    entry.media_time = parts.at(1).toLongLong(&time_ok);
+    if (parts.size() == 3) {
+      entry.media_rate =
+          static_cast<int32_t>(std::lround(parts.at(2).toDouble(&rate_ok) *
+                                           0x10000));
+    }
+    if (!duration_ok || !time_ok || !rate_ok) {
+      return UsageError(parser, usage);
+    }
+    patches.push_back(MakeTrackPatch<AP4_ElstAtom>(
+        "Set entry " + std::to_string(index) + " of the edit list of track " +
+            std::to_string(track_id),
+        track_id, "elst",
+        [index, entry](utility::FieldPatcher& patcher,
+                       AtomOrDescriptorBase const& elst) {
+          return patcher.SetEditListEntry(elst, index, entry);
+        }));
+  }
+  if (patches.empty()) {
+    return UsageError(parser, "Nothing to patch.");
+  }
+
+  QByteArray const input_name = QFile::encodeName(files.at(0));
+  QByteArray const target_name = parser.isSet(output_option)
+                                     ? QFile::encodeName(
+                                           parser.value(output_option))
+                                     : input_name;
+  if (parser.isSet(output_option)) {
+    Result<std::monostate, std::string> clone_result = utility::CloneFile(
+        input_name.constData(), target_name.constData());
+    if (clone_result.IsErr()) {
+      clone_result.MarkErrorHandled();
+      std::cerr << clone_result.GetErr() << "\n";
+      return kExitFailures;
+    }
+  }
+
+  // Only moov is used, so it's found from the top level box headers and
+  // parsed alone, and the summary depth skips the entries of its sample
+  // tables. However large the file, this reads little more than moov.
+  std::optional<std::unique_ptr<AtomHolder>> possible_moov;
+  {
+    AP4_ByteStream* stream = nullptr;
+    if (AP4_FAILED(AP4_FileByteStream::Create(
+            target_name.constData(), AP4_FileByteStream::STREAM_MODE_READ,
+            stream))) {
+      std::cerr << "Failed to read " << target_name.constData() << ".\n";
+      return kExitFailures;
+    }
+    utility::ByteStreamPointer const stream_owner{stream};
+    possible_moov = utility::ReadTopLevelAtom(*stream, AP4_ATOM_TYPE_MOOV);
+  }
+  if (!possible_moov.has_value() ||
+      possible_moov.value()->GetTopLevelAtoms().empty()) {
+    std::cerr << "Failed to read the moov of " << target_name.constData()
+              << ".\n";
+    return kExitFailures;
+  }
+  AtomOrDescriptorBase const* const moov =
+      possible_moov.value()->GetTopLevelAtoms().front().get();
+  Result<std::unique_ptr<utility::FieldPatcher>, std::string> open_result =
+      utility::FieldPatcher::Open(target_name.constData());
+  if (open_result.IsErr()) {
+    open_result.MarkErrorHandled();
+    std::cerr << open_result.GetErr() << "\n";
+    return kExitFailures;
+  }
+  utility::FieldPatcher& patcher = *open_result.GetOk();
+
+  size_t failed_count = 0;
+  for (Patch const& patch : patches) {
+    Result<std::monostate, std::string> patch_result =
+        patch.apply(patcher, *moov);
+    if (patch_result.IsErr()) {
+      patch_result.MarkErrorHandled();
+      std::cerr << patch.description << ": " << patch_result.GetErr()
+                << "\n";
+      ++failed_count;
+    }
+  }
+  std::cerr << "Applied " << patches.size() - failed_count << " of "
+            << patches.size() << " patches to " << target_name.constData()
+            << ".\n";
+  return failed_count == 0 ? kExitSuccess : kExitFailures;
+}
+}  // namespace
+
+bool IsHeadlessInvocation(int argc, char* argv[]) {
+  return argc > 1 && (std::strcmp(argv[1], kBatchCommand) == 0 ||
+                      std::strcmp(argv[1], kCheckCommand) == 0 ||
+                      std::strcmp(argv[1], kConcatCommand) == 0 ||
+                      std::strcmp(argv[1], kDecryptCommand) == 0 ||
+                      std::strcmp(argv[1], kDiffCommand) == 0 ||
+                      std::strcmp(argv[1], kFragmentCommand) == 0 ||
+                      std::strcmp(argv[1], kInspectCommand) == 0 ||
+                      std::strcmp(argv[1], kPatchCommand) == 0 ||
+                      std::strcmp(argv[1], kStatsCommand) == 0);
+}
+
+int RunHeadless(int argc, char* argv[]) {
+  assert(IsHeadlessInvocation(argc, argv));
+  QCoreApplication app{argc, argv};
+  QStringList arguments = app.arguments();
+  // Drop the command, so the parsers see the options as if they were the
+  // program's.
+  QString const command = arguments.takeAt(1);
+  if (command == kBatchCommand) {
+    return RunBatch(arguments);
+  }
+  if (command == kCheckCommand) {
+    return RunCheck(arguments);
+  }
+  if (command == kConcatCommand) {
+    return RunConcat(arguments);
+  }
+  if (command == kDecryptCommand) {
+    return RunDecrypt(arguments);
+  }
+  if (command == kDiffCommand) {
+    return RunDiff(arguments);
+  }
+  if (command == kFragmentCommand) {
+    return RunFragment(arguments);
+  }
+  if (command == kInspectCommand) {
+    return RunInspect(arguments);
+  }
+  if (command == kPatchCommand) {
+    return RunPatch(arguments);
+  }
+  if (command == kStatsCommand) {
+    return RunStats(arguments);
+  }
+  return kExitUsage;
+}
+
+}  // namespace mp4_manipulator::headless
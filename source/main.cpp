@@ -1,12 +1,29 @@
 #include <QApplication>
 #include <QSettings>
+#include <iostream>
 // Could try and move these later, but import order seems to matter for some
 // reason
 
 #include "gui/main_window.h"
+#include "headless/command_line.h"
 #include "parsing/file_utils.h"
+#include "profiling/allocation_profiler.h"
+
+namespace {
+void MaybeWriteAllocationReport() {
+  if (mp4_manipulator::profiling::IsAllocationProfilingEnabled()) {
+    mp4_manipulator::profiling::WriteAllocationReport(std::cerr);
+  }
+}
+}  // namespace
 
 int main(int argc, char* argv[]) {
+  if (mp4_manipulator::headless::IsHeadlessInvocation(argc, argv)) {
+    int const exit_code = mp4_manipulator::headless::RunHeadless(argc, argv);
+    MaybeWriteAllocationReport();
+    return exit_code;
+  }
+
   // TODO(bryce): save and load window dimensions. See
   // https://doc.qt.io/qt-6/restoring-geometry.html
   QSettings settings(QSettings::IniFormat, QSettings::UserScope, "",
@@ -18,5 +35,7 @@ int main(int argc, char* argv[]) {
   mp4_manipulator::MainWindow main_window;
   main_window.show();
 
-  return app.exec();
+  int const exit_code = app.exec();
+  MaybeWriteAllocationReport();
+  return exit_code;
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include "network/block_cache.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace mp4_manipulator::network {
+
+BlockCache::BlockCache(size_t capacity, size_t shard_count /* = 8 */)
+    : shard_capacity_{std::max<size_t>(1, capacity / shard_count)},
+      shards_(std::max<size_t>(1, shard_count)) {}
+
+BlockCache::Block BlockCache::Find(uint64_t index) {
+  Shard& shard = GetShard(index);
+  std::lock_guard<std::mutex> lock{shard.mutex};
+  auto it = shard.entries.find(index);
+  if (it == shard.entries.end()) {
+    return nullptr;
+  }
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  return it->second->second;
+}
+
+void BlockCache::Insert(uint64_t index, Block block) {
+  assert(block != nullptr);
+  Shard& shard = GetShard(index);
+  std::lock_guard<std::mutex> lock{shard.mutex};
+  auto it = shard.entries.find(index);
+  if (it != shard.entries.end()) {
+    it->second->second = std::move(block);
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return;
+  }
+  if (shard.lru.size() >= shard_capacity_) {
+    shard.entries.erase(shard.lru.back().first);
+    shard.lru.pop_back();
+  }
+  shard.lru.emplace_front(index, std::move(block));
+  shard.entries.emplace(index, shard.lru.begin());
+}
+
+BlockCache::Shard& BlockCache::GetShard(uint64_t index) {
+  // Consecutive blocks go to different shards, so a sequential read doesn't
+  // evict its own recent blocks from one shard.
+  return shards_.at(static_cast<size_t>(index % shards_.size()));
+}
+
+}  // namespace mp4_manipulator::network
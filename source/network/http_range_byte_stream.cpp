@@ -0,0 +1,260 @@
+#include "network/http_range_byte_stream.h"
+
+#include <QEventLoop>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QThread>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <optional>
+
+namespace mp4_manipulator::network {
+namespace {
+// HTTP status for a successful range request.
+constexpr int kPartialContentStatus = 206;
+
+// Parses the size of the whole file from a Content-Range header, e.g.
+// "bytes 0-65535/1234567". Returns std::nullopt if the size is missing or
+// unknown ("*").
+std::optional<uint64_t> ParseContentRangeSize(QByteArray const& header) {
+  qsizetype const slash = header.lastIndexOf('/');
+  if (slash < 0) {
+    return std::nullopt;
+  }
+  bool ok = false;
+  uint64_t const size = header.mid(slash + 1).trimmed().toULongLong(&ok);
+  if (!ok) {
+    return std::nullopt;
+  }
+  return size;
+}
+}  // namespace
+
+Result<HttpRangeByteStream*, std::string> HttpRangeByteStream::Open(
+    QUrl const& url, HttpRangeOptions const& options /* = {} */) {
+  using OpenResult = Result<HttpRangeByteStream*, std::string>;
+  assert(options.block_size > 0);
+  auto* stream = new HttpRangeByteStream{url, options};
+  // Fetching the first block tells us the size of the file, and it's always
+  // needed as it holds the first box header.
+  Result<std::vector<BlockCache::Block>, std::string> fetch_result =
+      stream->FetchBlocks(0, 1);
+  if (fetch_result.IsErr()) {
+    fetch_result.MarkErrorHandled();
+    stream->Release();
+    return OpenResult::Err(std::move(fetch_result).GetErr());
+  }
+  return OpenResult::Ok(stream);
+}
+
+HttpRangeByteStream::HttpRangeByteStream(QUrl url,
+                                         HttpRangeOptions const& options)
+    : url_{std::move(url)},
+      options_{options},
+      cache_{std::max<size_t>(1, options.cache_size / options.block_size)} {}
+
+HttpRangeByteStream::~HttpRangeByteStream() = default;
+
+AP4_Result HttpRangeByteStream::ReadPartial(void* buffer,
+                                            AP4_Size bytes_to_read,
+                                            AP4_Size& bytes_read) {
+  bytes_read = 0;
+  if (bytes_to_read == 0) {
+    return AP4_SUCCESS;
+  }
+  if (position_ >= size_) {
+    return AP4_ERROR_EOS;
+  }
+  bytes_to_read = static_cast<AP4_Size>(
+      std::min<uint64_t>(bytes_to_read, size_ - position_));
+
+  uint64_t const block_size = options_.block_size;
+  uint64_t const block_count = (size_ + block_size - 1) / block_size;
+  uint64_t const first_block = position_ / block_size;
+  uint64_t const last_block = (position_ + bytes_to_read - 1) / block_size;
+  // Walking the headers of a large box (e.g. moov) reads forward in small
+  // steps. Read further ahead the longer that goes on, so the walk takes a
+  // handful of requests rather than one per block.
+  bool const is_sequential =
+      first_block == last_read_block_ || first_block == last_read_block_ + 1;
+  uint64_t const max_read_ahead_blocks =
+      std::max<uint64_t>(1, options_.max_read_ahead / block_size);
+
+  auto* output = static_cast<uint8_t*>(buffer);
+  uint64_t block_index = first_block;
+  while (bytes_read < bytes_to_read) {
+    BlockCache::Block block = cache_.Find(block_index);
+    if (block == nullptr) {
+      if (is_sequential) {
+        read_ahead_blocks_ =
+            std::min(max_read_ahead_blocks,
+                     std::max<uint64_t>(1, read_ahead_blocks_ * 2));
+      } else {
+        read_ahead_blocks_ = 0;
+      }
+      // Coalesce the missing blocks of this read, and any read ahead, into
+      // one request.
+      uint64_t run_end = block_index + 1;
+      while (run_end <= last_block && cache_.Find(run_end) == nullptr) {
+        ++run_end;
+      }
+      if (run_end > last_block) {
+        uint64_t const read_ahead_end =
+            std::min(block_count, run_end + read_ahead_blocks_);
+        while (run_end < read_ahead_end && cache_.Find(run_end) == nullptr) {
+          ++run_end;
+        }
+      }
+      Result<std::vector<BlockCache::Block>, std::string> fetch_result =
+          FetchBlocks(block_index, run_end - block_index);
+      if (fetch_result.IsErr()) {
+        fetch_result.MarkErrorHandled();
+        last_error_ = std::move(fetch_result).GetErr();
+        if (bytes_read > 0) {
+          break;
+        }
+        return AP4_ERROR_READ_FAILED;
+      }
+      block = fetch_result.GetOk().front();
+    }
+    uint64_t const offset_in_block =
+        position_ + bytes_read - block_index * block_size;
+    if (offset_in_block >= block->size()) {
+      last_error_ = "Block " + std::to_string(block_index) + " is truncated.";
+      return bytes_read > 0 ? AP4_SUCCESS : AP4_ERROR_READ_FAILED;
+    }
+    size_t const copy_size = static_cast<size_t>(std::min<uint64_t>(
+        block->size() - offset_in_block, bytes_to_read - bytes_read));
+    std::memcpy(output + bytes_read, block->data() + offset_in_block,
+                copy_size);
+    bytes_read += static_cast<AP4_Size>(copy_size);
+    ++block_index;
+  }
+  position_ += bytes_read;
+  last_read_block_ = block_index - 1;
+  return AP4_SUCCESS;
+}
+
+AP4_Result HttpRangeByteStream::WritePartial(void const* /*buffer*/,
+                                             AP4_Size /*bytes_to_write*/,
+                                             AP4_Size& bytes_written) {
+  bytes_written = 0;
+  return AP4_ERROR_NOT_SUPPORTED;
+}
+
+AP4_Result HttpRangeByteStream::Seek(AP4_Position position) {
+  if (position > size_) {
+    return AP4_ERROR_OUT_OF_RANGE;
+  }
+  position_ = position;
+  return AP4_SUCCESS;
+}
+
+AP4_Result HttpRangeByteStream::Tell(AP4_Position& position) {
+  position = position_;
+  return AP4_SUCCESS;
+}
+
+AP4_Result HttpRangeByteStream::GetSize(AP4_LargeSize& size) {
+  size = size_;
+  return AP4_SUCCESS;
+}
+
+void HttpRangeByteStream::AddReference() { ++reference_count_; }
+
+void HttpRangeByteStream::Release() {
+  if (--reference_count_ == 0) {
+    delete this;
+  }
+}
+
+HttpRangeStats HttpRangeByteStream::GetStats() const { return stats_; }
+
+std::string const& HttpRangeByteStream::GetLastError() const {
+  return last_error_;
+}
+
+QNetworkAccessManager& HttpRangeByteStream::GetNetworkAccessManager() {
+  // A QObject can only be used from its own thread.
+  if (network_access_manager_ == nullptr ||
+      network_access_manager_->thread() != QThread::currentThread()) {
+    network_access_manager_ = std::make_unique<QNetworkAccessManager>();
+  }
+  return *network_access_manager_;
+}
+
+Result<std::vector<BlockCache::Block>, std::string>
+HttpRangeByteStream::FetchBlocks(uint64_t first_block, uint64_t block_count) {
+  using FetchResult = Result<std::vector<BlockCache::Block>, std::string>;
+  assert(block_count > 0);
+  uint64_t const block_size = options_.block_size;
+  uint64_t const start = first_block * block_size;
+  uint64_t end = start + block_count * block_size;
+  if (size_ != 0) {
+    end = std::min(end, size_);
+  }
+
+  QNetworkRequest request{url_};
+  request.setRawHeader("Range", QByteArrayLiteral("bytes=") +
+                                    QByteArray::number(start) + '-' +
+                                    QByteArray::number(end - 1));
+  // Ranges are of the stored bytes, so don't let the server compress them.
+  request.setRawHeader("Accept-Encoding", "identity");
+  request.setTransferTimeout(options_.timeout_ms);
+  std::unique_ptr<QNetworkReply> reply{GetNetworkAccessManager().get(request)};
+  QEventLoop loop;
+  [[maybe_unused]] bool ok = QObject::connect(
+      reply.get(), &QNetworkReply::finished, &loop, &QEventLoop::quit);
+  assert(ok);
+  // Clicks and key presses wait until the fetch is done, so they can't act
+  // on (e.g. close) whatever is reading the stream.
+  loop.exec(QEventLoop::ExcludeUserInputEvents);
+
+  ++stats_.request_count;
+  if (reply->error() != QNetworkReply::NoError) {
+    return FetchResult::Err("Failed to fetch " +
+                            url_.toDisplayString().toStdString() + ": " +
+                            reply->errorString().toStdString());
+  }
+  int const status =
+      reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (status != kPartialContentStatus) {
+    return FetchResult::Err(
+        "The server doesn't support range requests (status " +
+        std::to_string(status) + ").");
+  }
+  std::optional<uint64_t> const size =
+      ParseContentRangeSize(reply->rawHeader("Content-Range"));
+  if (!size.has_value()) {
+    return FetchResult::Err("The server didn't give the size of the file.");
+  }
+  if (size_ == 0) {
+    size_ = size.value();
+    end = std::min(end, size_);
+  } else if (size_ != size.value()) {
+    return FetchResult::Err("The file changed size while being read.");
+  }
+
+  QByteArray const data = reply->readAll();
+  stats_.bytes_fetched += static_cast<uint64_t>(data.size());
+  if (static_cast<uint64_t>(data.size()) != end - start) {
+    return FetchResult::Err("The server returned " +
+                            std::to_string(data.size()) + " bytes for a " +
+                            std::to_string(end - start) + " byte range.");
+  }
+
+  std::vector<BlockCache::Block> blocks;
+  auto const* bytes = reinterpret_cast<uint8_t const*>(data.constData());
+  for (uint64_t offset = 0; offset < end - start; offset += block_size) {
+    uint64_t const length = std::min(block_size, end - start - offset);
+    auto block = std::make_shared<std::vector<uint8_t> const>(
+        bytes + offset, bytes + offset + length);
+    cache_.Insert(first_block + blocks.size(), block);
+    blocks.push_back(std::move(block));
+  }
+  return FetchResult::Ok(std::move(blocks));
+}
+
+}  // namespace mp4_manipulator::network
@@ -0,0 +1,453 @@
+#include "parallel/batched_file_reader.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "parallel/work_stealing_pool.h"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define MP4_MANIPULATOR_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cstring>
+#endif
+
+namespace mp4_manipulator::parallel {
+namespace {
+// Reads up to `length` bytes at `offset`, stopping early only at the end of
+// the file. Returns the number of bytes read, or -1 with errno set.
+int64_t ReadAt(int file_descriptor, uint8_t* buffer, uint32_t length,
+               uint64_t offset) {
+  uint32_t total = 0;
+  while (total < length) {
+#if defined(_WIN32)
+    // Passing an offset makes the read positional, so reads of the same file
+    // from different threads don't race on the file pointer.
+    HANDLE const handle =
+        reinterpret_cast<HANDLE>(_get_osfhandle(file_descriptor));
+    OVERLAPPED overlapped{};
+    uint64_t const position = offset + total;
+    overlapped.Offset = static_cast<DWORD>(position);
+    overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+    DWORD read_count = 0;
+    if (!ReadFile(handle, buffer + total, length - total, &read_count,
+                  &overlapped)) {
+      if (GetLastError() == ERROR_HANDLE_EOF) {
+        break;
+      }
+      errno = EIO;
+      return -1;
+    }
+#else
+    ssize_t const read_count =
+        pread(file_descriptor, buffer + total, length - total,
+              static_cast<off_t>(offset + total));
+    if (read_count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+#endif
+    if (read_count == 0) {
+      break;
+    }
+    total += static_cast<uint32_t>(read_count);
+  }
+  return total;
+}
+
+// Reads on a pool of threads, each blocking in pread. Used where io_uring
+// isn't available.
+class PreadFileReader : public BatchedFileReader {
+ public:
+  explicit PreadFileReader(size_t thread_count) : pool_{thread_count} {}
+
+  void Submit(ReadRequest const& request) override {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      ++in_flight_count_;
+    }
+    pool_.Submit([this, request](size_t /*worker_index*/) {
+      ReadCompletion completion;
+      completion.id = request.id;
+      completion.data.resize(request.length);
+      int64_t const read_count =
+          ReadAt(request.file_descriptor, completion.data.data(),
+                 request.length, request.offset);
+      if (read_count < 0) {
+        completion.error = errno;
+        completion.data.clear();
+      } else {
+        completion.data.resize(static_cast<size_t>(read_count));
+      }
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        completed_.push_back(std::move(completion));
+        --in_flight_count_;
+      }
+      completion_available_.notify_one();
+    });
+  }
+
+  std::vector<ReadCompletion> WaitForCompletions() override {
+    std::unique_lock<std::mutex> lock{mutex_};
+    completion_available_.wait(lock, [this] {
+      return !completed_.empty() || in_flight_count_ == 0;
+    });
+    return std::exchange(completed_, {});
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable completion_available_;
+  std::vector<ReadCompletion> completed_;
+  size_t in_flight_count_{0};
+  // Declared last so it's destroyed (waiting for its tasks) before the
+  // members its tasks use.
+  WorkStealingPool pool_;
+};
+
+#if defined(MP4_MANIPULATOR_HAS_IO_URING)
+// The most entries io_uring accepts for a ring.
+constexpr uint32_t kMaxRingEntries = 32768;
+
+// Reads with io_uring, using the raw system calls so there's no dependency on
+// liburing. Each call to WaitForCompletions submits every queued read that
+// fits in the ring and waits for completions in a single io_uring_enter.
+class IoUringFileReader : public BatchedFileReader {
+ public:
+  // Returns nullptr if io_uring can't be set up.
+  static std::unique_ptr<IoUringFileReader> Create(uint32_t queue_depth);
+
+  ~IoUringFileReader() override;
+
+  IoUringFileReader(IoUringFileReader const&) = delete;
+  IoUringFileReader& operator=(IoUringFileReader const&) = delete;
+
+  void Submit(ReadRequest const& request) override {
+    waiting_.push_back(request);
+  }
+
+  std::vector<ReadCompletion> WaitForCompletions() override;
+
+ private:
+  // A read handed to the kernel. Its buffer and iovec must stay put until
+  // the read completes.
+  struct Slot {
+    uint64_t id{0};
+    int file_descriptor{-1};
+    uint64_t offset{0};
+    std::vector<uint8_t> data;
+    // How much of `data` has been read. Reads that come back short are
+    // resubmitted for the rest.
+    size_t bytes_read{0};
+    iovec io_vector{};
+  };
+
+  IoUringFileReader() = default;
+
+  [[nodiscard]] bool HasReadsInFlight() const {
+    return free_slots_.size() < slots_.size();
+  }
+  // Fills the next submission queue entry with the rest of `slot_index`'s
+  // read.
+  void QueueSlot(uint32_t slot_index);
+  // Moves waiting reads into free slots, and queues them.
+  void QueueWaitingReads();
+  // Fails the queued reads the kernel hasn't taken yet, after io_uring_enter
+  // fails with `error`.
+  void FailUnsubmittedReads(int error,
+                            std::vector<ReadCompletion>& completions);
+  void ReapCompletions(std::vector<ReadCompletion>& completions);
+
+  int ring_fd_{-1};
+  void* sq_ring_{MAP_FAILED};
+  size_t sq_ring_size_{0};
+  void* cq_ring_{MAP_FAILED};
+  size_t cq_ring_size_{0};
+  io_uring_sqe* sqes_{static_cast<io_uring_sqe*>(MAP_FAILED)};
+  size_t sqes_size_{0};
+
+  // Pointers into the mapped rings.
+  unsigned* sq_head_{nullptr};
+  unsigned* sq_tail_{nullptr};
+  unsigned* sq_mask_{nullptr};
+  unsigned* sq_array_{nullptr};
+  unsigned* cq_head_{nullptr};
+  unsigned* cq_tail_{nullptr};
+  unsigned* cq_mask_{nullptr};
+  io_uring_cqe* cqes_{nullptr};
+
+  // One slot per submission queue entry, so the completion queue (twice the
+  // size) can't overflow.
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> free_slots_;
+  // Reads waiting for a free slot.
+  std::deque<ReadRequest> waiting_;
+  // Queued entries not yet passed to io_uring_enter.
+  uint32_t unsubmitted_count_{0};
+};
+
+std::unique_ptr<IoUringFileReader> IoUringFileReader::Create(
+    uint32_t queue_depth) {
+  io_uring_params params{};
+  int const ring_fd = static_cast<int>(syscall(
+      __NR_io_uring_setup, std::clamp(queue_depth, 1u, kMaxRingEntries),
+      &params));
+  if (ring_fd < 0) {
+    return nullptr;
+  }
+  std::unique_ptr<IoUringFileReader> reader{new IoUringFileReader{}};
+  reader->ring_fd_ = ring_fd;
+
+  reader->sq_ring_size_ =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  reader->cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool const is_single_mapping =
+      (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (is_single_mapping) {
+    reader->sq_ring_size_ =
+        std::max(reader->sq_ring_size_, reader->cq_ring_size_);
+    reader->cq_ring_size_ = reader->sq_ring_size_;
+  }
+  reader->sq_ring_ =
+      mmap(nullptr, reader->sq_ring_size_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (reader->sq_ring_ == MAP_FAILED) {
+    return nullptr;
+  }
+  if (is_single_mapping) {
+    reader->cq_ring_ = reader->sq_ring_;
+  } else {
+    reader->cq_ring_ =
+        mmap(nullptr, reader->cq_ring_size_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (reader->cq_ring_ == MAP_FAILED) {
+      return nullptr;
+    }
+  }
+  reader->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  reader->sqes_ = static_cast<io_uring_sqe*>(
+      mmap(nullptr, reader->sqes_size_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+  if (reader->sqes_ == MAP_FAILED) {
+    return nullptr;
+  }
+
+  auto* const sq_ring = static_cast<uint8_t*>(reader->sq_ring_);
+  reader->sq_head_ = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.head);
+  reader->sq_tail_ = reinterpret_cast<unsigned*>(sq_ring + params.sq_off.tail);
+  reader->sq_mask_ =
+      reinterpret_cast<unsigned*>(sq_ring + params.sq_off.ring_mask);
+  reader->sq_array_ =
+      reinterpret_cast<unsigned*>(sq_ring + params.sq_off.array);
+  auto* const cq_ring = static_cast<uint8_t*>(reader->cq_ring_);
+  reader->cq_head_ = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.head);
+  reader->cq_tail_ = reinterpret_cast<unsigned*>(cq_ring + params.cq_off.tail);
+  reader->cq_mask_ =
+      reinterpret_cast<unsigned*>(cq_ring + params.cq_off.ring_mask);
+  reader->cqes_ =
+      reinterpret_cast<io_uring_cqe*>(cq_ring + params.cq_off.cqes);
+
+  reader->slots_.resize(params.sq_entries);
+  for (uint32_t i = params.sq_entries; i > 0; --i) {
+    reader->free_slots_.push_back(i - 1);
+  }
+  return reader;
+}
+
+IoUringFileReader::~IoUringFileReader() {
+  // The kernel writes into the slots' buffers, so they have to outlive every
+  // read that's been submitted.
+  waiting_.clear();
+  while (HasReadsInFlight()) {
+    WaitForCompletions();
+  }
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+std::vector<ReadCompletion> IoUringFileReader::WaitForCompletions() {
+  std::vector<ReadCompletion> completions;
+  // Short reads are resubmitted rather than completed, so keep going until
+  // something actually completes.
+  while (completions.empty()) {
+    QueueWaitingReads();
+    if (!HasReadsInFlight()) {
+      break;
+    }
+    int const submitted_count = static_cast<int>(
+        syscall(__NR_io_uring_enter, ring_fd_, unsubmitted_count_,
+                /*min_complete=*/1, IORING_ENTER_GETEVENTS, nullptr, 0));
+    if (submitted_count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // EAGAIN and EBUSY mean the kernel is short of resources, or the
+      // completion queue needs reaping, so reap and try again. Anything
+      // else means the queued entries can't be submitted.
+      if (errno != EAGAIN && errno != EBUSY) {
+        FailUnsubmittedReads(errno, completions);
+      }
+    } else {
+      unsubmitted_count_ -= static_cast<uint32_t>(submitted_count);
+    }
+    ReapCompletions(completions);
+  }
+  return completions;
+}
+
+void IoUringFileReader::QueueSlot(uint32_t slot_index) {
+  Slot& slot = slots_.at(slot_index);
+  unsigned const tail = *sq_tail_;
+  unsigned const index = tail & *sq_mask_;
+  slot.io_vector.iov_base = slot.data.data() + slot.bytes_read;
+  slot.io_vector.iov_len = slot.data.size() - slot.bytes_read;
+  io_uring_sqe& sqe = sqes_[index];
+  std::memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = IORING_OP_READV;
+  sqe.fd = slot.file_descriptor;
+  sqe.off = slot.offset + slot.bytes_read;
+  sqe.addr = reinterpret_cast<uint64_t>(&slot.io_vector);
+  sqe.len = 1;
+  sqe.user_data = slot_index;
+  sq_array_[index] = index;
+  // Publish the entry to the kernel.
+  std::atomic_ref<unsigned>{*sq_tail_}.store(tail + 1,
+                                             std::memory_order_release);
+  ++unsubmitted_count_;
+}
+
+void IoUringFileReader::QueueWaitingReads() {
+  while (!waiting_.empty() && !free_slots_.empty()) {
+    ReadRequest const& request = waiting_.front();
+    uint32_t const slot_index = free_slots_.back();
+    free_slots_.pop_back();
+    Slot& slot = slots_.at(slot_index);
+    slot.id = request.id;
+    slot.file_descriptor = request.file_descriptor;
+    slot.offset = request.offset;
+    slot.data.resize(request.length);
+    slot.bytes_read = 0;
+    QueueSlot(slot_index);
+    waiting_.pop_front();
+  }
+}
+
+void IoUringFileReader::FailUnsubmittedReads(
+    int error, std::vector<ReadCompletion>& completions) {
+  // Entries between the kernel's head and our tail haven't been taken, so
+  // they can be withdrawn by moving the tail back.
+  unsigned const head =
+      std::atomic_ref<unsigned>{*sq_head_}.load(std::memory_order_acquire);
+  unsigned const tail = *sq_tail_;
+  for (unsigned i = head; i != tail; ++i) {
+    auto const slot_index = static_cast<uint32_t>(
+        sqes_[sq_array_[i & *sq_mask_]].user_data);
+    ReadCompletion completion;
+    completion.id = slots_.at(slot_index).id;
+    completion.error = error;
+    completions.push_back(std::move(completion));
+    slots_.at(slot_index).data = {};
+    free_slots_.push_back(slot_index);
+  }
+  std::atomic_ref<unsigned>{*sq_tail_}.store(head, std::memory_order_release);
+  unsubmitted_count_ = 0;
+}
+
+void IoUringFileReader::ReapCompletions(
+    std::vector<ReadCompletion>& completions) {
+  unsigned head = *cq_head_;
+  unsigned const tail =
+      std::atomic_ref<unsigned>{*cq_tail_}.load(std::memory_order_acquire);
+  for (; head != tail; ++head) {
+    io_uring_cqe const& cqe = cqes_[head & *cq_mask_];
+    auto const slot_index = static_cast<uint32_t>(cqe.user_data);
+    Slot& slot = slots_.at(slot_index);
+    if (cqe.res > 0) {
+      slot.bytes_read += static_cast<size_t>(cqe.res);
+      if (slot.bytes_read < slot.data.size()) {
+        // Not at the end of the file yet, read the rest.
+        QueueSlot(slot_index);
+        continue;
+      }
+    }
+    ReadCompletion completion;
+    completion.id = slot.id;
+    if (cqe.res < 0) {
+      completion.error = -cqe.res;
+    } else {
+      slot.data.resize(slot.bytes_read);
+      completion.data = std::move(slot.data);
+    }
+    slot.data = {};
+    completions.push_back(std::move(completion));
+    free_slots_.push_back(slot_index);
+  }
+  std::atomic_ref<unsigned>{*cq_head_}.store(head, std::memory_order_release);
+}
+#endif  // MP4_MANIPULATOR_HAS_IO_URING
+}  // namespace
+
+std::unique_ptr<BatchedFileReader> CreateBatchedFileReader(
+    uint32_t queue_depth, size_t thread_count /* = 0 */) {
+#if defined(MP4_MANIPULATOR_HAS_IO_URING)
+  std::unique_ptr<IoUringFileReader> io_uring_reader =
+      IoUringFileReader::Create(queue_depth);
+  if (io_uring_reader != nullptr) {
+    return io_uring_reader;
+  }
+#else
+  (void)queue_depth;
+#endif
+  return std::make_unique<PreadFileReader>(thread_count);
+}
+
+int OpenFileForReading(char const* file_name) {
+#if defined(_WIN32)
+  return _open(file_name, _O_RDONLY | _O_BINARY);
+#else
+  return open(file_name, O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+void CloseFile(int file_descriptor) {
+#if defined(_WIN32)
+  _close(file_descriptor);
+#else
+  close(file_descriptor);
+#endif
+}
+
+}  // namespace mp4_manipulator::parallel
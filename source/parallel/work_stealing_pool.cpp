@@ -0,0 +1,137 @@
+#include "parallel/work_stealing_pool.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace mp4_manipulator::parallel {
+namespace {
+// The pool and worker index of the current thread, if it's a worker. Used to
+// queue tasks submitted from within tasks on the submitting worker.
+thread_local WorkStealingPool const* current_pool = nullptr;
+thread_local size_t current_worker_index = 0;
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(size_t worker_count /* = 0 */) {
+  if (worker_count == 0) {
+    worker_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  queues_.reserve(worker_count);
+  for (size_t i = 0; i < worker_count; ++i) {
+    queues_.push_back(std::make_unique<WorkerQueue>());
+  }
+  workers_.reserve(worker_count);
+  for (size_t i = 0; i < worker_count; ++i) {
+    workers_.emplace_back(&WorkStealingPool::RunWorker, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  Wait();
+  {
+    std::lock_guard<std::mutex> lock{state_mutex_};
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void WorkStealingPool::Submit(Task task) {
+  size_t const queue_index =
+      current_pool == this
+          ? current_worker_index
+          : next_queue_.fetch_add(1, std::memory_order_relaxed) %
+                queues_.size();
+  {
+    // Count the task as unfinished before it's visible in a queue, so a
+    // worker that takes it straight away can't finish it before it's counted.
+    std::lock_guard<std::mutex> lock{state_mutex_};
+    ++unfinished_count_;
+  }
+  {
+    WorkerQueue& queue = *queues_.at(queue_index);
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    queue.tasks.push_back(std::move(task));
+  }
+  {
+    // But only count it as queued once it's in a queue, so a worker that
+    // claims it is sure to find it.
+    std::lock_guard<std::mutex> lock{state_mutex_};
+    ++queued_count_;
+  }
+  work_available_.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+  assert(current_pool != this);
+  std::unique_lock<std::mutex> lock{state_mutex_};
+  all_finished_.wait(lock, [this] { return unfinished_count_ == 0; });
+}
+
+size_t WorkStealingPool::GetWorkerCount() const { return workers_.size(); }
+
+void WorkStealingPool::RunWorker(size_t worker_index) {
+  current_pool = this;
+  current_worker_index = worker_index;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{state_mutex_};
+      work_available_.wait(
+          lock, [this] { return queued_count_ > 0 || stopping_; });
+      if (queued_count_ == 0) {
+        // Only stop once all the work is done.
+        return;
+      }
+      // Claim a task, so other workers keep sleeping unless there are more.
+      --queued_count_;
+    }
+
+    // There's a task in a queue for every claim, but other workers taking
+    // and submitting tasks while we look through the queues can make us miss
+    // ours, in which case look again.
+    Task task = TakeTask(worker_index);
+    while (!task) {
+      std::this_thread::yield();
+      task = TakeTask(worker_index);
+    }
+    task(worker_index);
+    bool is_last = false;
+    {
+      std::lock_guard<std::mutex> lock{state_mutex_};
+      is_last = --unfinished_count_ == 0;
+    }
+    if (is_last) {
+      all_finished_.notify_all();
+    }
+  }
+}
+
+WorkStealingPool::Task WorkStealingPool::TakeTask(size_t worker_index) {
+  {
+    // Newest first from our own queue, as its data is most likely to still
+    // be in cache.
+    WorkerQueue& own_queue = *queues_.at(worker_index);
+    std::lock_guard<std::mutex> lock{own_queue.mutex};
+    if (!own_queue.tasks.empty()) {
+      Task task = std::move(own_queue.tasks.back());
+      own_queue.tasks.pop_back();
+      return task;
+    }
+  }
+  // Oldest first from other queues, which keeps us away from the end the
+  // owner is working on.
+  for (size_t offset = 1; offset < queues_.size(); ++offset) {
+    WorkerQueue& victim_queue =
+        *queues_.at((worker_index + offset) % queues_.size());
+    std::lock_guard<std::mutex> lock{victim_queue.mutex};
+    if (!victim_queue.tasks.empty()) {
+      Task task = std::move(victim_queue.tasks.front());
+      victim_queue.tasks.pop_front();
+      return task;
+    }
+  }
+  return {};
+}
+
+}  // namespace mp4_manipulator::parallel
@@ -32,6 +32,14 @@ void AtomOrDescriptorBase::AddField(QString&& name, QString&& data) {
   field.data = std::move(data);
 }
 
+void AtomOrDescriptorBase::SetFields(std::vector<Field>&& fields) {
+  fields_ = std::move(fields);
+}
+
+std::vector<Field> AtomOrDescriptorBase::TakeFields() {
+  return std::move(fields_);
+}
+
 AtomOrDescriptorBase* AtomOrDescriptorBase::GetParent() const {
   return parent_;
 }
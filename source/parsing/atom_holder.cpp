@@ -1,114 +1,201 @@
 #include "parsing/atom_holder.h"
 
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+#include "parsing/atom_inspector.h"
 #include "parsing/atom_path_utils.h"
+#include "parsing/editing_processor.h"
 #include "parsing/file_utils.h"
+#include "parsing/skipped_atom.h"
+#include "parsing/unparsed_atom.h"
+#include "profiling/allocation_profiler.h"
 
 namespace mp4_manipulator {
-namespace {
-// Base class for commands for the processor.
-class Command {
- public:
-  virtual Result<std::monostate, std::string> Do(AP4_AtomParent& top_level) = 0;
-  Command() = default;
-  Command(Command const&) = default;
-  Command& operator=(Command const&) = default;
-  Command(Command&&) = default;
-  Command& operator=(Command&&) = default;
-  virtual ~Command() = default;
-};
-
-class RemoveCommand : public Command {
- public:
-  RemoveCommand(Ap4CompatiblePath path_to_remove)
-      : path_to_remove_(std::move(path_to_remove)) {}
-  Result<std::monostate, std::string> Do(AP4_AtomParent& top_level) override {
-    std::optional<AP4_Atom*> possible_atom =
-        GetAp4AtomFromPath(path_to_remove_, top_level);
-    if (!possible_atom.has_value()) {
-      return Result<std::monostate, std::string>::Err("Atom not found!");
-    }
-    AP4_Atom* atom = possible_atom.value();
-    atom->Detach();
-
-    return Result<std::monostate, std::string>::Ok();
-  }
-
- private:
-  Ap4CompatiblePath path_to_remove_;
-};
-
-// Based on AP4_EditingProcessor from Mp4Edit.cpp in the Ap4 lib.
-class EditingProcessor : public AP4_Processor {
- public:
-  EditingProcessor() = default;
-  EditingProcessor(EditingProcessor const&) = delete;
-  EditingProcessor& operator=(EditingProcessor const&) = delete;
-  EditingProcessor(EditingProcessor&& other) noexcept
-      : commands_(std::move(other.commands_)) {}
-  EditingProcessor& operator=(EditingProcessor&& other) noexcept {
-    if (this == &other) {
-      return *this;
+
+AtomHolder::AtomHolder(
+    std::vector<std::unique_ptr<AtomOrDescriptorBase>>&& top_level_atoms,
+    std::vector<std::unique_ptr<AP4_Atom>>&& top_level_ap4_atoms,
+    std::unique_ptr<AtomSearchIndex>&& search_index /* = nullptr */)
+    : top_level_atoms_(std::move(top_level_atoms)),
+      top_level_ap4_atoms_(std::move(top_level_ap4_atoms)),
+      search_index_(std::move(search_index)) {
+  MatchAtoms();
+}
+
+std::vector<std::unique_ptr<AtomOrDescriptorBase>>&
+AtomHolder::GetTopLevelAtoms() {
+  return top_level_atoms_;
+}
+
+AtomSearchIndex const* AtomHolder::GetSearchIndex() const {
+  return search_index_.get();
+}
+
+void AtomHolder::AppendAtoms(std::unique_ptr<AtomHolder>&& appended_atoms) {
+  assert(appended_atoms != nullptr);
+  std::move(appended_atoms->top_level_atoms_.begin(),
+            appended_atoms->top_level_atoms_.end(),
+            std::back_inserter(top_level_atoms_));
+  std::move(appended_atoms->top_level_ap4_atoms_.begin(),
+            appended_atoms->top_level_ap4_atoms_.end(),
+            std::back_inserter(top_level_ap4_atoms_));
+  if (appended_atoms->search_index_ != nullptr) {
+    if (search_index_ == nullptr) {
+      search_index_ = std::move(appended_atoms->search_index_);
+    } else {
+      search_index_->Append(std::move(*appended_atoms->search_index_));
     }
-    this->commands_ = std::move(other.commands_);
-    return *this;
-  }
-  // EditingProcessor(EditingProcessor&& other) = default;
-  ~EditingProcessor() override = default;
-
-  AP4_Result Initialize(AP4_AtomParent& top_level, AP4_ByteStream& stream,
-                        ProgressListener* listener) override;
-  void AddCommand(std::unique_ptr<Command> command);
-
-  std::optional<std::string> GetInitializationError() const;
-
- private:
-  std::vector<std::unique_ptr<Command>> commands_;
-
-  // If `Initialize()` failed, this will contain the error.
-  std::optional<std::string> initialization_error_;
-};
-
-AP4_Result EditingProcessor::Initialize(AP4_AtomParent& top_level,
-                                        AP4_ByteStream& stream,
-                                        ProgressListener* listener) {
-  AP4_Result ap4_result = AP4_SUCCESS;
-  for (std::unique_ptr<Command>& command : commands_) {
-    // TODO(bryce): logging on failure.
-    Result<std::monostate, std::string> result = command->Do(top_level);
-    if (result.IsErr()) {
-      result.MarkErrorHandled();
-      initialization_error_ = std::move(result).GetErr();
-      ap4_result = AP4_FAILURE;
+  }
+  appended_atoms.reset();
+}
+
+size_t AtomHolder::GetTrailingUnparsedAtomCount() const {
+  auto const last_parsed_atom = std::find_if(
+      top_level_atoms_.rbegin(), top_level_atoms_.rend(),
+      [](std::unique_ptr<AtomOrDescriptorBase> const& atom) {
+        return !IsUnparsedAtom(*atom);
+      });
+  return static_cast<size_t>(
+      std::distance(top_level_atoms_.rbegin(), last_parsed_atom));
+}
+
+void AtomHolder::RemoveTrailingUnparsedAtoms() {
+  size_t const removed_count = GetTrailingUnparsedAtomCount();
+  if (removed_count == 0) {
+    return;
+  }
+  auto const first_removed = top_level_atoms_.end() - removed_count;
+  if (search_index_ != nullptr) {
+    search_index_->RemoveNodesFrom(first_removed->get());
+  }
+  top_level_atoms_.erase(first_removed, top_level_atoms_.end());
+  // Each inspected top level atom has an ap4 atom in the same order, so the
+  // unparsed ap4 atoms are also at the end.
+  while (!top_level_ap4_atoms_.empty() &&
+         top_level_ap4_atoms_.back()->GetType() == UnparsedAtom::kType) {
+    top_level_ap4_atoms_.pop_back();
+  }
+}
+
+bool AtomHolder::InspectDeeply(AtomOrDescriptorBase& atom) {
+  AP4_Atom* ap4_atom = atom.GetAp4Atom();
+  if (ap4_atom == nullptr ||
+      AP4_DYNAMIC_CAST(AP4_ContainerAtom, ap4_atom) != nullptr) {
+    return false;
+  }
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kInspect, "AtomHolder::InspectDeeply");
+  AtomInspector inspector{InspectionDepth::kFull};
+  ap4_atom->Inspect(inspector);
+  std::vector<std::unique_ptr<AtomOrDescriptorBase>> inspected_atoms =
+      inspector.TakeAtoms();
+  if (inspected_atoms.size() != 1) {
+    return false;
+  }
+  // Deeper inspection only adds fields, so the same number means the same
+  // fields. Child descriptors are left alone, they don't vary with depth.
+  std::vector<Field> fields = inspected_atoms.front()->TakeFields();
+  if (fields.size() == atom.GetFields().size()) {
+    return false;
+  }
+  atom.SetFields(std::move(fields));
+  if (search_index_ != nullptr) {
+    // The index ignores fields it already has for the atom.
+    for (Field const& field : atom.GetFields()) {
+      search_index_->AddField(&atom, field.name, field.data);
     }
   }
-  return ap4_result;
+  return true;
 }
 
-void EditingProcessor::AddCommand(std::unique_ptr<Command> command) {
-  commands_.push_back(std::move(command));
+namespace {
+// Returns the estimated heap usage of `atom_or_descriptor` and its children.
+size_t EstimateInspectedMemoryUsage(
+    AtomOrDescriptorBase const& atom_or_descriptor) {
+  size_t usage = sizeof(Atom) + sizeof(std::unique_ptr<AtomOrDescriptorBase>);
+  usage += static_cast<size_t>(atom_or_descriptor.GetName().capacity()) *
+           sizeof(QChar);
+  for (Field const& field : atom_or_descriptor.GetFields()) {
+    usage += sizeof(Field);
+    qsizetype const capacity = field.name.capacity() + field.data.capacity();
+    usage += static_cast<size_t>(capacity) * sizeof(QChar);
+  }
+  for (auto const& child : atom_or_descriptor.GetChildAtoms()) {
+    usage += EstimateInspectedMemoryUsage(*child);
+  }
+  for (auto const& child : atom_or_descriptor.GetChildDescriptors()) {
+    usage += EstimateInspectedMemoryUsage(*child);
+  }
+  return usage;
 }
 
-// TODO(bryce): use this to do error reporting to the UI.
-std::optional<std::string> EditingProcessor::GetInitializationError() const {
-  return initialization_error_;
+// Returns the estimated heap usage of `ap4_atom` and its children. AP4 atoms
+// hold their parsed payloads (tables, etc.), which take roughly the payload's
+// size in memory. The exception is large unknown atoms (e.g. mdat), which
+// reference their source stream rather than copying the payload.
+size_t EstimateAp4MemoryUsage(AP4_Atom& ap4_atom) {
+  // Covers the atom object itself plus list node overhead.
+  constexpr size_t kAp4AtomOverhead = 128;
+  // AP4_UnknownAtom keeps payloads up to this size in memory, see
+  // AP4_UNKNOWN_ATOM_MAX_LOCAL_PAYLOAD_SIZE.
+  constexpr AP4_UI64 kMaxLocalUnknownPayload = 4096;
+  if (ap4_atom.GetType() == UnparsedAtom::kType ||
+      AP4_DYNAMIC_CAST(SkippedAtom, &ap4_atom) != nullptr) {
+    // Unparsed atoms reference their source stream, and skipped atoms have
+    // no payload.
+    return kAp4AtomOverhead;
+  }
+  AP4_ContainerAtom* container =
+      AP4_DYNAMIC_CAST(AP4_ContainerAtom, &ap4_atom);
+  if (container != nullptr) {
+    size_t usage = kAp4AtomOverhead;
+    for (AP4_List<AP4_Atom>::Item* item = container->GetChildren().FirstItem();
+         item != nullptr; item = item->GetNext()) {
+      usage += EstimateAp4MemoryUsage(*item->GetData());
+    }
+    return usage;
+  }
+  if (AP4_DYNAMIC_CAST(AP4_UnknownAtom, &ap4_atom) != nullptr &&
+      ap4_atom.GetSize() > kMaxLocalUnknownPayload) {
+    return kAp4AtomOverhead;
+  }
+  return kAp4AtomOverhead + static_cast<size_t>(ap4_atom.GetSize());
 }
 }  // namespace
 
-AtomHolder::AtomHolder(
-    std::vector<std::unique_ptr<AtomOrDescriptorBase>>&& top_level_atoms,
-    std::vector<std::unique_ptr<AP4_Atom>>&& top_level_ap4_atoms)
-    : top_level_atoms_(std::move(top_level_atoms)),
-      top_level_ap4_atoms_(std::move(top_level_ap4_atoms)) {
-  MatchAtoms();
+bool AtomHolder::HasUnparsedAtoms() const {
+  return std::any_of(top_level_ap4_atoms_.begin(), top_level_ap4_atoms_.end(),
+                     [](std::unique_ptr<AP4_Atom> const& ap4_atom) {
+                       return ap4_atom->GetType() == UnparsedAtom::kType;
+                     });
 }
 
-std::vector<std::unique_ptr<AtomOrDescriptorBase>>&
-AtomHolder::GetTopLevelAtoms() {
-  return top_level_atoms_;
+bool AtomHolder::HasSkippedAtoms() const {
+  return std::any_of(top_level_ap4_atoms_.begin(), top_level_ap4_atoms_.end(),
+                     [](std::unique_ptr<AP4_Atom> const& ap4_atom) {
+                       return AP4_DYNAMIC_CAST(SkippedAtom, ap4_atom.get()) !=
+                              nullptr;
+                     });
+}
+
+size_t AtomHolder::EstimateMemoryUsage() const {
+  size_t usage = sizeof(AtomHolder);
+  for (auto const& atom : top_level_atoms_) {
+    usage += EstimateInspectedMemoryUsage(*atom);
+  }
+  for (auto const& ap4_atom : top_level_ap4_atoms_) {
+    usage += EstimateAp4MemoryUsage(*ap4_atom);
+  }
+  if (search_index_ != nullptr) {
+    usage += search_index_->EstimateMemoryUsage();
+  }
+  return usage;
 }
 
 Result<std::monostate, std::string> AtomHolder::RemoveAtom(
     Atom* atom_to_remove) {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kEdit, "AtomHolder::RemoveAtom");
   AP4_List<AP4_Atom> top_level;
   for (std::unique_ptr<AP4_Atom>& ap4_atom : top_level_ap4_atoms_) {
     top_level.Add(ap4_atom.get());
@@ -117,17 +204,43 @@ Result<std::monostate, std::string> AtomHolder::RemoveAtom(
   Ap4CompatiblePath path = GetAp4Path(atom_to_remove->GetAp4Atom(), top_level);
 
   EditingProcessor processor;
-  // TODO(bryce): error handle this.
   processor.AddCommand(std::make_unique<RemoveCommand>(path));
+  return ApplyEdits(processor);
+}
 
-  // TODO(bryce): error handle this.
-  ProcessAp4Atoms(processor);
-
+Result<std::monostate, std::string> AtomHolder::ApplyEdits(
+    EditingProcessor& processor) {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kEdit, "AtomHolder::ApplyEdits");
+  if (HasUnparsedAtoms()) {
+    // Editing reparses the atoms, which would stop at the unparsed bytes and
+    // drop everything after them.
+    return Result<std::monostate, std::string>::Err(
+        "Files with unparsed (damaged) ranges can't be edited, as editing "
+        "would drop everything after the first damaged range.");
+  }
+  if (HasSkippedAtoms()) {
+    return Result<std::monostate, std::string>::Err(
+        "Atoms whose payloads were skipped while streaming can't be edited.");
+  }
+  bool const processed = ProcessAp4Atoms(processor);
+  std::optional<std::string> error = processor.GetInitializationError();
+  if (error.has_value()) {
+    return Result<std::monostate, std::string>::Err(std::move(error.value()));
+  }
+  if (!processed) {
+    return Result<std::monostate, std::string>::Err(
+        "Failed to parse the atoms after editing.");
+  }
   return Result<std::monostate, std::string>::Ok();
 }
 
 Result<std::monostate, std::string> AtomHolder::SaveAtoms(
     char const* file_name) {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kSave, "AtomHolder::SaveAtoms");
+  if (HasSkippedAtoms()) {
+    return Result<std::monostate, std::string>::Err(
+        "Atoms whose payloads were skipped while streaming can't be saved.");
+  }
   // Create AP4 byte stream from top level atoms.
   AP4_AtomParent dummy_root;
 
@@ -165,6 +278,11 @@ void RecursiveMatchAtoms(AtomOrDescriptorBase* atom, AP4_Atom* ap4_atom) {
     return;
   }
   atom->SetAp4Atom(ap4_atom);
+  if (ap4_atom->GetType() == UnparsedAtom::kType) {
+    // Unparsed atoms are named for the UI rather than by a four cc, and have
+    // no children.
+    return;
+  }
   // Ensure type matching invariant holds.
   assert(atom->GetName().toStdString().length() == 4);
 
@@ -204,6 +322,7 @@ void RecursiveMatchAtoms(AtomOrDescriptorBase* atom, AP4_Atom* ap4_atom) {
 }  // namespace
 
 void AtomHolder::MatchAtoms() {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kMatch, "AtomHolder::MatchAtoms");
   assert(top_level_atoms_.size() == top_level_ap4_atoms_.size());
   for (size_t i = 0; i < top_level_atoms_.size(); ++i) {
     RecursiveMatchAtoms(top_level_atoms_.at(i).get(),
@@ -212,6 +331,7 @@ void AtomHolder::MatchAtoms() {
 }
 
 bool AtomHolder::ProcessAp4Atoms(AP4_Processor& processor) {
+  MP4_MANIPULATOR_ALLOCATION_SITE("AtomHolder::ProcessAp4Atoms");
   // TODO(bryce): better estimate the size of this.
   AP4_MemoryByteStream* current_atom_input_stream =
       new AP4_MemoryByteStream{AP4_Size{}};
@@ -227,11 +347,26 @@ bool AtomHolder::ProcessAp4Atoms(AP4_Processor& processor) {
   dummy_root.GetChildren().Apply(
       AP4_AtomListWriter(*current_atom_input_stream));
 
+  // Remove the atoms from our dummy root, otherwise it will delete them when
+  // it goes out of scope and we'll double free. We'll let top_level_ap4_atoms_
+  // take care of deleting them.
+  [[maybe_unused]] AP4_Result result = dummy_root.GetChildren().Clear();
+  assert(AP4_SUCCEEDED(result));
+  assert(dummy_root.GetChildren().ItemCount() == 0);
+
   // Seek the input stream to the start so it's ready to be read.
   current_atom_input_stream->Seek(0);
 
   // Write atoms to an AP4_MemoryByteStream with the processor (AP4_AtomParent).
-  processor.Process(*current_atom_input_stream, *current_atom_output_stream);
+  // The processor works on its own parse of the input stream, so on failure
+  // our atoms are untouched.
+  AP4_Result const process_result = processor.Process(
+      *current_atom_input_stream, *current_atom_output_stream);
+  current_atom_input_stream->Release();
+  if (AP4_FAILED(process_result)) {
+    current_atom_output_stream->Release();
+    return false;
+  }
 
   // Seek the output stream to the start so it's ready to be parsed.
   current_atom_output_stream->Seek(0);
@@ -239,6 +374,7 @@ bool AtomHolder::ProcessAp4Atoms(AP4_Processor& processor) {
   // Parse the atoms with mp4 manipulator.
   std::optional<std::unique_ptr<AtomHolder>> possible_new_holder =
       utility::ReadAtoms(current_atom_output_stream);
+  current_atom_output_stream->Release();
   if (!possible_new_holder.has_value()) {
     return false;
   }
@@ -246,19 +382,10 @@ bool AtomHolder::ProcessAp4Atoms(AP4_Processor& processor) {
   std::unique_ptr<AtomHolder> new_atom_holder{
       std::move(possible_new_holder.value())};
 
-  // Remove the atoms from our dummy root, otherwise it will delete them when
-  // it goes out of scope and we'll double free. We'll let top_level_ap4_atoms_
-  // take care of deleting them.
-  [[maybe_unused]] AP4_Result result = dummy_root.GetChildren().Clear();
-  assert(AP4_SUCCEEDED(result));
-  assert(dummy_root.GetChildren().ItemCount() == 0);
-
   // Move the atoms out of the new holder into this holder.
   this->top_level_atoms_ = std::move(new_atom_holder->top_level_atoms_);
   this->top_level_ap4_atoms_ = std::move(new_atom_holder->top_level_ap4_atoms_);
-
-  current_atom_input_stream->Release();
-  current_atom_output_stream->Release();
+  this->search_index_ = std::move(new_atom_holder->search_index_);
 
   return true;
 }
@@ -2,17 +2,25 @@
 
 #include <QTextStream>
 
+#include "profiling/allocation_profiler.h"
+
 namespace mp4_manipulator {
-AtomInspector::AtomInspector() {
-  // We want maximum verbosity.
-  SetVerbosity(2);
+AtomInspector::AtomInspector(
+    InspectionDepth depth /* = InspectionDepth::kSummary */) {
+  // AP4 emits the entries of tables at verbosity 1 (small tables) and 2 (all
+  // tables), so 0 leaves just the headers and summary fields.
+  SetVerbosity(depth == InspectionDepth::kFull ? 2 : 0);
 }
 
 void AtomInspector::StartAtom(char const* name, AP4_UI08 version,
                               AP4_UI32 flags, AP4_Size header_size,
                               AP4_UI64 size) {
+  MP4_MANIPULATOR_ALLOCATION_SITE("AtomInspector::StartAtom");
   std::unique_ptr<AtomOrDescriptorBase> new_atom =
       std::make_unique<Atom>(name, header_size, size);
+  if (search_index_ != nullptr) {
+    search_index_->AddNode(new_atom.get());
+  }
   if (current_atom_or_descriptor_ == nullptr) {
     // We're starting a top level atom.
     current_atom_or_descriptor_ = new_atom.get();
@@ -32,8 +40,12 @@ void AtomInspector::EndAtom() {
 
 void AtomInspector::StartDescriptor(const char* name, AP4_Size header_size,
                                     AP4_UI64 size) {
+  MP4_MANIPULATOR_ALLOCATION_SITE("AtomInspector::StartDescriptor");
   std::unique_ptr<AtomOrDescriptorBase> new_descriptor =
       std::make_unique<Descriptor>(name, header_size, size);
+  if (search_index_ != nullptr) {
+    search_index_->AddNode(new_descriptor.get());
+  }
   if (current_atom_or_descriptor_ == nullptr) {
     // The descriptor is at the top level. This shouldn't happen, but
     // gracefully handle in case we're given weird input.
@@ -54,6 +66,7 @@ void AtomInspector::EndDescriptor() {
 
 void AtomInspector::AddField(char const* name, AP4_UI64 value,
                              FormatHint hint /* = HINT_NONE */) {
+  MP4_MANIPULATOR_ALLOCATION_SITE("AtomInspector::AddField(integer)");
   assert(current_atom_or_descriptor_ != nullptr);
   // Use AP4 formatting to conform to lib expectations + use hints.
   char str[32];
@@ -62,25 +75,31 @@ void AtomInspector::AddField(char const* name, AP4_UI64 value,
   QString value_string{};
   QTextStream(&value_string) << str;
   current_atom_or_descriptor_->AddField(QString(name), std::move(value_string));
+  IndexLastField();
 }
 
 void AtomInspector::AddFieldF(char const* name, float value,
                               FormatHint hint /* = HINT_NONE */) {
+  MP4_MANIPULATOR_ALLOCATION_SITE("AtomInspector::AddFieldF");
   assert(current_atom_or_descriptor_ != nullptr);
   QString value_string{};
   QTextStream(&value_string) << value;
   current_atom_or_descriptor_->AddField(QString(name), std::move(value_string));
+  IndexLastField();
 }
 
 void AtomInspector::AddField(char const* name, char const* value,
                              FormatHint hint /* = HINT_NONE */) {
+  MP4_MANIPULATOR_ALLOCATION_SITE("AtomInspector::AddField(string)");
   assert(current_atom_or_descriptor_ != nullptr);
   current_atom_or_descriptor_->AddField(QString(name), QString(value));
+  IndexLastField();
 }
 
 void AtomInspector::AddField(char const* name, unsigned char const* bytes,
                              AP4_Size byte_count,
                              FormatHint hint /* = HINT_NONE */) {
+  MP4_MANIPULATOR_ALLOCATION_SITE("AtomInspector::AddField(bytes)");
   assert(current_atom_or_descriptor_ != nullptr);
   QString value_string{};
   QTextStream stream(&value_string);
@@ -93,12 +112,25 @@ void AtomInspector::AddField(char const* name, unsigned char const* bytes,
   }
   stream << "]";
   current_atom_or_descriptor_->AddField(QString(name), std::move(value_string));
+  IndexLastField();
 }
 
 std::vector<std::unique_ptr<AtomOrDescriptorBase>> AtomInspector::TakeAtoms() {
   return std::move(top_level_atoms_);
 }
 
+void AtomInspector::SetSearchIndex(AtomSearchIndex* search_index) {
+  search_index_ = search_index;
+}
+
+void AtomInspector::IndexLastField() {
+  if (search_index_ == nullptr) {
+    return;
+  }
+  Field const& field = current_atom_or_descriptor_->GetFields().back();
+  search_index_->AddField(current_atom_or_descriptor_, field.name, field.data);
+}
+
 AtomOrDescriptorBase* AtomInspector::GetPreviousSibling() {
   AtomOrDescriptorBase* parent = current_atom_or_descriptor_->GetParent();
   if (parent == nullptr) {
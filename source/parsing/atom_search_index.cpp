@@ -0,0 +1,291 @@
+#include "parsing/atom_search_index.h"
+
+#include <algorithm>
+#include <cassert>
+#include <initializer_list>
+#include <iterator>
+
+namespace mp4_manipulator {
+namespace {
+// Prefixes for the different kinds of keys in the index.
+QString const kTypePrefix = QStringLiteral("t:");
+QString const kNamePrefix = QStringLiteral("n:");
+QString const kValuePrefix = QStringLiteral("v:");
+QString const kWordPrefix = QStringLiteral("w:");
+QString const kFieldPrefix = QStringLiteral("f:");
+
+// Limits how many words of a single value are indexed, so long strings don't
+// bloat the index.
+constexpr int kMaxWordsPerValue = 16;
+
+// Byte arrays are formatted by the inspector as "[0a 1b ...]". Strip the
+// formatting so they can be searched for as a plain hex string.
+QString NormalizeValue(QString const& value) {
+  QString normalized = value.trimmed().toLower();
+  if (normalized.startsWith('[') && normalized.endsWith(']')) {
+    normalized.remove('[').remove(']').remove(' ');
+  }
+  return normalized;
+}
+
+// As NormalizeValue, but also handles the ways users tend to write values
+// that aren't how the inspector formats them.
+QString NormalizeQueryValue(QString const& value) {
+  QString normalized = value.trimmed().toLower();
+  normalized.remove('[').remove(']').remove(' ');
+  // Allow uuids, such as DRM system ids, to be written with dashes. Only do
+  // this for long values so negative numbers are left alone.
+  QString without_dashes = normalized;
+  without_dashes.remove('-');
+  bool const is_hex = std::all_of(
+      without_dashes.cbegin(), without_dashes.cend(), [](QChar c) {
+        char16_t const code = c.unicode();
+        return (code >= u'0' && code <= u'9') || (code >= u'a' && code <= u'f');
+      });
+  if (is_hex && without_dashes.size() >= 16) {
+    return without_dashes;
+  }
+  return normalized;
+}
+
+// Returns the sorted union of two sorted lists.
+std::vector<uint32_t> Union(std::vector<uint32_t> const& a,
+                            std::vector<uint32_t> const& b) {
+  std::vector<uint32_t> result;
+  result.reserve(a.size() + b.size());
+  std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                 std::back_inserter(result));
+  return result;
+}
+
+// Returns the sorted intersection of two sorted lists. Galloping via binary
+// search means this is fast when one of the lists is much smaller.
+std::vector<uint32_t> Intersect(std::vector<uint32_t> const& smaller,
+                                std::vector<uint32_t> const& larger) {
+  std::vector<uint32_t> result;
+  auto search_start = larger.begin();
+  for (uint32_t id : smaller) {
+    search_start = std::lower_bound(search_start, larger.end(), id);
+    if (search_start == larger.end()) {
+      break;
+    }
+    if (*search_start == id) {
+      result.push_back(id);
+    }
+  }
+  return result;
+}
+}  // namespace
+
+void AtomSearchIndex::AddNode(AtomOrDescriptorBase* node) {
+  GetOrAddNodeId(node);
+}
+
+void AtomSearchIndex::AddField(AtomOrDescriptorBase* node, QString const& name,
+                               QString const& value) {
+  NodeId const id = GetOrAddNodeId(node);
+  QString const lower_name = name.toLower();
+  QString const normalized_value = NormalizeValue(value);
+  AddPosting(kNamePrefix + lower_name, id);
+  AddPosting(kValuePrefix + normalized_value, id);
+  AddPosting(kFieldPrefix + lower_name + '=' + normalized_value, id);
+
+  // Index the individual words of values such as handler names or brands.
+  qsizetype const value_size = normalized_value.size();
+  int word_count = 0;
+  qsizetype word_start = -1;
+  for (qsizetype i = 0; i <= value_size && word_count < kMaxWordsPerValue;
+       ++i) {
+    bool const is_word_char =
+        i < value_size && normalized_value.at(i).isLetterOrNumber();
+    if (is_word_char && word_start < 0) {
+      word_start = i;
+    } else if (!is_word_char && word_start >= 0) {
+      if (word_start != 0 || i != value_size) {
+        // Only index words that aren't the whole value, as the whole value is
+        // already indexed above.
+        QString const word = normalized_value.mid(word_start, i - word_start);
+        AddPosting(kWordPrefix + word, id);
+      }
+      word_start = -1;
+      ++word_count;
+    }
+  }
+}
+
+void AtomSearchIndex::Append(AtomSearchIndex&& other) {
+  NodeId const offset = static_cast<NodeId>(nodes_.size());
+  for (AtomOrDescriptorBase* node : other.nodes_) {
+    node_ids_.insert({node, static_cast<NodeId>(nodes_.size())});
+    nodes_.push_back(node);
+  }
+  // Every id in `other` maps to an id larger than any of ours, so appending
+  // keeps the posting lists sorted.
+  for (auto it = other.postings_.cbegin(); it != other.postings_.cend(); ++it) {
+    PostingList& postings = postings_[it.key()];
+    postings.reserve(postings.size() + it.value().size());
+    for (NodeId id : it.value()) {
+      postings.push_back(id + offset);
+    }
+  }
+  other.nodes_.clear();
+  other.node_ids_.clear();
+  other.postings_.clear();
+}
+
+void AtomSearchIndex::RemoveNodesFrom(AtomOrDescriptorBase* node) {
+  auto const it = node_ids_.find(node);
+  if (it == node_ids_.end()) {
+    return;
+  }
+  NodeId const first_removed_id = it->second;
+  for (size_t id = first_removed_id; id < nodes_.size(); ++id) {
+    node_ids_.erase(nodes_.at(id));
+  }
+  nodes_.resize(first_removed_id);
+  // Posting lists are sorted, so the removed ids are at their ends.
+  for (auto postings_it = postings_.begin(); postings_it != postings_.end();) {
+    PostingList& postings = postings_it.value();
+    while (!postings.empty() && postings.back() >= first_removed_id) {
+      postings.pop_back();
+    }
+    if (postings.empty()) {
+      postings_it = postings_.erase(postings_it);
+    } else {
+      ++postings_it;
+    }
+  }
+}
+
+std::vector<AtomOrDescriptorBase*> AtomSearchIndex::Search(
+    QString const& query) const {
+  QStringList const terms = query.simplified().split(' ', Qt::SkipEmptyParts);
+  if (terms.isEmpty()) {
+    return {};
+  }
+
+  std::vector<PostingList> term_matches;
+  term_matches.reserve(terms.size());
+  for (QString const& term : terms) {
+    term_matches.push_back(MatchTerm(term));
+    if (term_matches.back().empty()) {
+      // All terms have to match, so we're done.
+      return {};
+    }
+  }
+
+  // Intersect starting with the most selective terms to keep intermediate
+  // results small.
+  std::sort(term_matches.begin(), term_matches.end(),
+            [](PostingList const& a, PostingList const& b) {
+              return a.size() < b.size();
+            });
+  PostingList matching_ids = std::move(term_matches.front());
+  for (size_t i = 1; i < term_matches.size() && !matching_ids.empty(); ++i) {
+    matching_ids = Intersect(matching_ids, term_matches.at(i));
+  }
+
+  std::vector<AtomOrDescriptorBase*> results;
+  results.reserve(matching_ids.size());
+  for (NodeId id : matching_ids) {
+    results.push_back(nodes_.at(id));
+  }
+  return results;
+}
+
+size_t AtomSearchIndex::GetNodeCount() const { return nodes_.size(); }
+
+size_t AtomSearchIndex::EstimateMemoryUsage() const {
+  // Rough per entry overheads for the hash containers' nodes and buckets.
+  constexpr size_t kHashEntryOverhead = 32;
+  size_t usage = nodes_.capacity() * sizeof(AtomOrDescriptorBase*);
+  size_t const node_id_entry_size =
+      sizeof(AtomOrDescriptorBase*) + sizeof(NodeId) + kHashEntryOverhead;
+  usage += node_ids_.size() * node_id_entry_size;
+  for (auto it = postings_.cbegin(); it != postings_.cend(); ++it) {
+    usage += kHashEntryOverhead + sizeof(QString) + sizeof(PostingList);
+    usage += static_cast<size_t>(it.key().capacity()) * sizeof(QChar);
+    usage += it.value().capacity() * sizeof(NodeId);
+  }
+  return usage;
+}
+
+AtomSearchIndex::NodeId AtomSearchIndex::GetOrAddNodeId(
+    AtomOrDescriptorBase* node) {
+  assert(node != nullptr);
+  // Fields are almost always added to the most recently added node, so check
+  // that before doing a map lookup.
+  if (!nodes_.empty() && nodes_.back() == node) {
+    return static_cast<NodeId>(nodes_.size() - 1);
+  }
+  auto [it, inserted] =
+      node_ids_.insert({node, static_cast<NodeId>(nodes_.size())});
+  if (inserted) {
+    nodes_.push_back(node);
+    AddPosting(kTypePrefix + node->GetName().toLower(), it->second);
+  }
+  return it->second;
+}
+
+void AtomSearchIndex::AddPosting(QString const& key, NodeId id) {
+  PostingList& postings = postings_[key];
+  if (postings.empty() || postings.back() < id) {
+    // The common case, ids are handed out in increasing order.
+    postings.push_back(id);
+    return;
+  }
+  // A node was revisited (e.g. it was re-inspected), keep the list sorted and
+  // free of duplicates.
+  auto it = std::lower_bound(postings.begin(), postings.end(), id);
+  if (it == postings.end() || *it != id) {
+    postings.insert(it, id);
+  }
+}
+
+AtomSearchIndex::PostingList const* AtomSearchIndex::FindPostings(
+    QString const& key) const {
+  auto it = postings_.constFind(key);
+  if (it == postings_.cend()) {
+    return nullptr;
+  }
+  return &it.value();
+}
+
+AtomSearchIndex::PostingList AtomSearchIndex::MatchTerm(
+    QString const& term) const {
+  // Gathers the union of the postings for `keys`.
+  auto match_any = [this](std::initializer_list<QString> keys) {
+    PostingList result;
+    for (QString const& key : keys) {
+      PostingList const* postings = FindPostings(key);
+      if (postings != nullptr) {
+        result = result.empty() ? *postings : Union(result, *postings);
+      }
+    }
+    return result;
+  };
+
+  qsizetype const equals_index = term.indexOf('=');
+  if (equals_index > 0) {
+    QString const name = term.left(equals_index).toLower();
+    QString const value = NormalizeQueryValue(term.mid(equals_index + 1));
+    return match_any({kFieldPrefix + name + '=' + value});
+  }
+
+  QString const lower_term = term.toLower();
+  if (lower_term.startsWith(QStringLiteral("type:"))) {
+    return match_any({kTypePrefix + lower_term.mid(5)});
+  }
+  if (lower_term.startsWith(QStringLiteral("name:"))) {
+    return match_any({kNamePrefix + lower_term.mid(5)});
+  }
+  if (lower_term.startsWith(QStringLiteral("value:"))) {
+    QString const value = NormalizeQueryValue(lower_term.mid(6));
+    return match_any({kValuePrefix + value, kWordPrefix + value});
+  }
+  QString const value = NormalizeQueryValue(lower_term);
+  return match_any({kTypePrefix + lower_term, kNamePrefix + lower_term,
+                    kValuePrefix + value, kWordPrefix + value});
+}
+
+}  // namespace mp4_manipulator
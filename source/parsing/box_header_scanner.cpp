@@ -0,0 +1,131 @@
+#include "parsing/box_header_scanner.h"
+
+namespace mp4_manipulator::utility {
+namespace {
+// Size of a box header with a 32 bit size: the size and the four cc.
+constexpr uint32_t kCompactHeaderSize = 8;
+// Size of a box header with a 64 bit size, which follows the four cc.
+constexpr uint32_t kLargeHeaderSize = 16;
+}  // namespace
+
+Result<std::vector<BoxHeader>, std::string> ScanTopLevelBoxHeaders(
+    AP4_ByteStream& stream, uint64_t start_offset /* = 0 */,
+    TruncatedBoxHandling truncated_box_handling /* = kError */) {
+  using ScanResult = Result<std::vector<BoxHeader>, std::string>;
+  AP4_LargeSize stream_size = 0;
+  if (AP4_FAILED(stream.GetSize(stream_size))) {
+    return ScanResult::Err("Could not get the size of the stream.");
+  }
+  bool const stop_at_truncated_box =
+      truncated_box_handling == TruncatedBoxHandling::kStop;
+
+  std::vector<BoxHeader> headers;
+  uint64_t offset = start_offset;
+  while (offset < stream_size) {
+    if (stream_size - offset < kCompactHeaderSize) {
+      if (stop_at_truncated_box) {
+        break;
+      }
+      return ScanResult::Err("Trailing bytes at " + std::to_string(offset) +
+                             " are too short to be a box.");
+    }
+    AP4_UI32 size_32 = 0;
+    AP4_UI32 type = 0;
+    if (AP4_FAILED(stream.Seek(offset)) ||
+        AP4_FAILED(stream.ReadUI32(size_32)) ||
+        AP4_FAILED(stream.ReadUI32(type))) {
+      return ScanResult::Err("Failed to read box header at " +
+                             std::to_string(offset) + ".");
+    }
+
+    BoxHeader header{type, offset, kCompactHeaderSize, size_32};
+    if (size_32 == 0) {
+      if (stop_at_truncated_box) {
+        break;
+      }
+      // The box extends to the end of the stream.
+      header.size = stream_size - offset;
+    } else if (size_32 == 1) {
+      if (stream_size - offset < kLargeHeaderSize && stop_at_truncated_box) {
+        break;
+      }
+      AP4_UI64 size_64 = 0;
+      if (stream_size - offset < kLargeHeaderSize ||
+          AP4_FAILED(stream.ReadUI64(size_64))) {
+        return ScanResult::Err("Failed to read 64 bit box size at " +
+                               std::to_string(offset) + ".");
+      }
+      header.header_size = kLargeHeaderSize;
+      header.size = size_64;
+    }
+
+    if (header.size < header.header_size) {
+      return ScanResult::Err("Box " + FourCcToString(type) + " at " +
+                             std::to_string(offset) + " has invalid size " +
+                             std::to_string(header.size) + ".");
+    }
+    if (header.size > stream_size - offset) {
+      if (stop_at_truncated_box) {
+        break;
+      }
+      return ScanResult::Err("Box " + FourCcToString(type) + " at " +
+                             std::to_string(offset) +
+                             " extends past the end of the file.");
+    }
+    headers.push_back(header);
+    offset += header.size;
+  }
+  return ScanResult::Ok(std::move(headers));
+}
+
+Result<std::optional<BoxHeader>, std::string> ParseBoxHeader(
+    uint8_t const* data, size_t size, uint64_t offset, uint64_t stream_size) {
+  using ParseResult = Result<std::optional<BoxHeader>, std::string>;
+  if (offset > stream_size || stream_size - offset < kCompactHeaderSize) {
+    return ParseResult::Err("Trailing bytes at " + std::to_string(offset) +
+                            " are too short to be a box.");
+  }
+  if (size < kCompactHeaderSize) {
+    return ParseResult::Ok(std::nullopt);
+  }
+  uint32_t const size_32 = AP4_BytesToUInt32BE(data);
+  AP4_Atom::Type const type = AP4_BytesToUInt32BE(data + 4);
+  BoxHeader header{type, offset, kCompactHeaderSize, size_32};
+  if (size_32 == 0) {
+    // The box extends to the end of the stream.
+    header.size = stream_size - offset;
+  } else if (size_32 == 1) {
+    if (stream_size - offset < kLargeHeaderSize) {
+      return ParseResult::Err("Failed to read 64 bit box size at " +
+                              std::to_string(offset) + ".");
+    }
+    if (size < kLargeHeaderSize) {
+      return ParseResult::Ok(std::nullopt);
+    }
+    header.header_size = kLargeHeaderSize;
+    header.size = AP4_BytesToUInt64BE(data + 8);
+  }
+
+  if (header.size < header.header_size) {
+    return ParseResult::Err("Box " + FourCcToString(type) + " at " +
+                            std::to_string(offset) + " has invalid size " +
+                            std::to_string(header.size) + ".");
+  }
+  if (header.size > stream_size - offset) {
+    return ParseResult::Err("Box " + FourCcToString(type) + " at " +
+                            std::to_string(offset) +
+                            " extends past the end of the file.");
+  }
+  return ParseResult::Ok(header);
+}
+
+std::string FourCcToString(AP4_Atom::Type type) {
+  std::string four_cc(4, ' ');
+  for (int i = 0; i < 4; ++i) {
+    char const c = static_cast<char>((type >> (24 - 8 * i)) & 0xff);
+    four_cc[i] = (c >= 0x20 && c < 0x7f) ? c : '.';
+  }
+  return four_cc;
+}
+
+}  // namespace mp4_manipulator::utility
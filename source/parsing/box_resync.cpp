@@ -0,0 +1,182 @@
+#include "parsing/box_resync.h"
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MP4_MANIPULATOR_BOX_RESYNC_SSE2
+#endif
+
+namespace mp4_manipulator::utility {
+namespace {
+constexpr uint64_t kHeaderSize = 8;
+constexpr uint64_t kLargeHeaderSize = 16;
+// Offset of the four cc within a box header.
+constexpr size_t kTypeOffset = 4;
+// How much of the stream is read at a time.
+constexpr size_t kChunkSize = 4 * 1024 * 1024;
+// Bytes are checked in blocks, producing a mask with a bit per byte.
+constexpr size_t kBlockSize = 64;
+// A four cc spans 4 bytes, so the last 3 positions of a block are checked as
+// part of the next block.
+constexpr size_t kBlockStride = kBlockSize - 3;
+
+// Box types expected at the top level of a file. These are all lowercase
+// letters, which the scan relies on to quickly reject most positions.
+constexpr AP4_Atom::Type kTopLevelTypes[] = {
+    AP4_ATOM_TYPE('f', 't', 'y', 'p'), AP4_ATOM_TYPE('s', 't', 'y', 'p'),
+    AP4_ATOM_TYPE('m', 'o', 'o', 'v'), AP4_ATOM_TYPE('m', 'o', 'o', 'f'),
+    AP4_ATOM_TYPE('m', 'd', 'a', 't'), AP4_ATOM_TYPE('m', 'f', 'r', 'a'),
+    AP4_ATOM_TYPE('f', 'r', 'e', 'e'), AP4_ATOM_TYPE('s', 'k', 'i', 'p'),
+    AP4_ATOM_TYPE('w', 'i', 'd', 'e'), AP4_ATOM_TYPE('s', 'i', 'd', 'x'),
+    AP4_ATOM_TYPE('s', 's', 'i', 'x'), AP4_ATOM_TYPE('e', 'm', 's', 'g'),
+    AP4_ATOM_TYPE('p', 'r', 'f', 't'), AP4_ATOM_TYPE('p', 'd', 'i', 'n'),
+    AP4_ATOM_TYPE('u', 'u', 'i', 'd'), AP4_ATOM_TYPE('m', 'e', 't', 'a'),
+};
+
+bool IsTopLevelType(AP4_Atom::Type type) {
+  return std::find(std::begin(kTopLevelTypes), std::end(kTopLevelTypes),
+                   type) != std::end(kTopLevelTypes);
+}
+
+// Returns a mask with bit i set if `bytes[i]` is a lowercase ascii letter,
+// for the `kBlockSize` bytes starting at `bytes`.
+uint64_t LowercaseMask(uint8_t const* bytes) {
+  uint64_t mask = 0;
+#ifdef MP4_MANIPULATOR_BOX_RESYNC_SSE2
+  __m128i const below = _mm_set1_epi8('a' - 1);
+  __m128i const above = _mm_set1_epi8('z' + 1);
+  for (size_t i = 0; i < kBlockSize; i += 16) {
+    __m128i const block =
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(bytes + i));
+    // The comparisons are signed, so bytes >= 0x80 fail the first one.
+    __m128i const is_lowercase = _mm_and_si128(_mm_cmpgt_epi8(block, below),
+                                               _mm_cmplt_epi8(block, above));
+    mask |= uint64_t{static_cast<uint32_t>(_mm_movemask_epi8(is_lowercase))}
+            << i;
+  }
+#else
+  for (size_t i = 0; i < kBlockSize; ++i) {
+    mask |= uint64_t{bytes[i] >= 'a' && bytes[i] <= 'z'} << i;
+  }
+#endif
+  return mask;
+}
+
+// Reads the header at `offset`. Returns the size of the box if the header
+// looks like a top level box that fits before `end_offset`.
+std::optional<uint64_t> ReadPlausibleBoxSize(AP4_ByteStream& stream,
+                                             uint64_t offset,
+                                             uint64_t end_offset) {
+  uint64_t const available = end_offset - offset;
+  AP4_UI32 size_32 = 0;
+  AP4_UI32 type = 0;
+  if (available < kHeaderSize || AP4_FAILED(stream.Seek(offset)) ||
+      AP4_FAILED(stream.ReadUI32(size_32)) ||
+      AP4_FAILED(stream.ReadUI32(type)) || !IsTopLevelType(type)) {
+    return std::nullopt;
+  }
+  if (size_32 == 0) {
+    // Only media data is commonly written with a size of 0, which means it
+    // extends to the end of the file.
+    if (type != AP4_ATOM_TYPE('m', 'd', 'a', 't')) {
+      return std::nullopt;
+    }
+    return available;
+  }
+  uint64_t size = size_32;
+  uint64_t header_size = kHeaderSize;
+  if (size_32 == 1) {
+    AP4_UI64 size_64 = 0;
+    if (available < kLargeHeaderSize || AP4_FAILED(stream.ReadUI64(size_64))) {
+      return std::nullopt;
+    }
+    size = size_64;
+    header_size = kLargeHeaderSize;
+  }
+  if (size < header_size || size > available) {
+    return std::nullopt;
+  }
+  return size;
+}
+
+// Returns true if a plausible top level box starts at `offset`, and it's
+// followed by another plausible box type (or the end of the range).
+bool IsPlausibleBoxAt(AP4_ByteStream& stream, uint64_t offset,
+                      uint64_t end_offset) {
+  std::optional<uint64_t> const size =
+      ReadPlausibleBoxSize(stream, offset, end_offset);
+  if (!size.has_value()) {
+    return false;
+  }
+  uint64_t const next_offset = offset + size.value();
+  if (end_offset - next_offset < kHeaderSize) {
+    // The box ends at (or within a few bytes of) the end.
+    return true;
+  }
+  // The following box may be truncated or damaged itself, so only its type
+  // is checked.
+  AP4_UI32 next_type = 0;
+  return AP4_SUCCEEDED(stream.Seek(next_offset + kTypeOffset)) &&
+         AP4_SUCCEEDED(stream.ReadUI32(next_type)) && IsTopLevelType(next_type);
+}
+}  // namespace
+
+std::optional<uint64_t> FindNextPlausibleBox(AP4_ByteStream& stream,
+                                             uint64_t start_offset,
+                                             uint64_t end_offset) {
+  std::vector<uint8_t> chunk;
+  uint64_t chunk_offset = start_offset;
+  while (chunk_offset < end_offset &&
+         end_offset - chunk_offset >= kHeaderSize) {
+    size_t const chunk_size = static_cast<size_t>(
+        std::min<uint64_t>(kChunkSize, end_offset - chunk_offset));
+    chunk.resize(chunk_size);
+    if (AP4_FAILED(stream.Seek(chunk_offset)) ||
+        AP4_FAILED(stream.Read(chunk.data(), chunk_size))) {
+      return std::nullopt;
+    }
+
+    // Checks the box whose four cc starts at `type_start` in the chunk.
+    auto check_position = [&](size_t type_start) {
+      uint64_t const box_offset = chunk_offset + type_start - kTypeOffset;
+      return IsTopLevelType(AP4_BytesToUInt32BE(&chunk.at(type_start))) &&
+             IsPlausibleBoxAt(stream, box_offset, end_offset);
+    };
+
+    // Four ccs start `kTypeOffset` into a box, and need 4 bytes.
+    size_t const last_type_start = chunk_size - 4;
+    size_t type_start = kTypeOffset;
+    for (; type_start + kBlockSize <= chunk_size; type_start += kBlockStride) {
+      uint64_t const mask = LowercaseMask(&chunk.at(type_start));
+      // Positions that start 4 lowercase letters.
+      uint64_t candidates = mask & (mask >> 1) & (mask >> 2) & (mask >> 3);
+      candidates &= (uint64_t{1} << kBlockStride) - 1;
+      while (candidates != 0) {
+        size_t const bit = static_cast<size_t>(std::countr_zero(candidates));
+        candidates &= candidates - 1;
+        if (check_position(type_start + bit)) {
+          return chunk_offset + type_start + bit - kTypeOffset;
+        }
+      }
+    }
+    // Check what's left at the end of the chunk one position at a time.
+    for (; type_start <= last_type_start; ++type_start) {
+      if (check_position(type_start)) {
+        return chunk_offset + type_start - kTypeOffset;
+      }
+    }
+
+    if (end_offset - chunk_offset == chunk_size) {
+      break;
+    }
+    // Overlap the chunks, so headers that span chunks are checked.
+    chunk_offset += chunk_size - (kHeaderSize - 1);
+  }
+  return std::nullopt;
+}
+
+}  // namespace mp4_manipulator::utility
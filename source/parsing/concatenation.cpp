@@ -0,0 +1,1054 @@
+#include "parsing/concatenation.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+
+#include "Ap4.h"
+#include "parsing/box_header_scanner.h"
+#include "parsing/file_range_copy.h"
+#include "parsing/resource_deleters.h"
+#include "profiling/allocation_profiler.h"
+
+namespace mp4_manipulator::utility {
+namespace {
+using ConcatenationResult = Result<ConcatenationSummary, std::string>;
+
+constexpr AP4_Atom::Type kSsixType = AP4_ATOM_TYPE('s', 's', 'i', 'x');
+
+
+// Returns the serialized bytes of `atom`, or an empty vector on failure.
+std::vector<uint8_t> SerializeAtom(AP4_Atom& atom) {
+  ByteStreamPointer bytes{
+      new AP4_MemoryByteStream{static_cast<AP4_Size>(atom.GetSize())}};
+  AP4_MemoryByteStream& memory_bytes =
+      static_cast<AP4_MemoryByteStream&>(*bytes);
+  if (AP4_FAILED(atom.Write(memory_bytes)) ||
+      memory_bytes.GetDataSize() != atom.GetSize()) {
+    return {};
+  }
+  return {memory_bytes.GetData(),
+          memory_bytes.GetData() + memory_bytes.GetDataSize()};
+}
+
+Result<std::monostate, std::string> WriteAtom(AP4_Atom& atom,
+                                              std::FILE* output) {
+  std::vector<uint8_t> const bytes = SerializeAtom(atom);
+  if (bytes.empty()) {
+    return Result<std::monostate, std::string>::Err(
+        "Failed to serialize a box.");
+  }
+  if (std::fwrite(bytes.data(), 1, bytes.size(), output) != bytes.size()) {
+    return Result<std::monostate, std::string>::Err("Failed to write a box.");
+  }
+  return Result<std::monostate, std::string>::Ok();
+}
+
+// Copies the mdat `header` of `input` to `output`. The header keeps its size
+// (so offsets into the payload are unchanged), but always gets an explicit
+// box size, as a size of 0 would swallow the boxes after it in the output.
+Result<std::monostate, std::string> CopyMdat(BoxHeader const& header,
+                                             std::FILE* input,
+                                             std::FILE* output) {
+  AP4_UI08 bytes[16];
+  if (header.header_size == 16) {
+    AP4_BytesFromUInt32BE(&bytes[0], 1);
+    AP4_BytesFromUInt64BE(&bytes[8], header.size);
+  } else if (header.size <= std::numeric_limits<AP4_UI32>::max()) {
+    AP4_BytesFromUInt32BE(&bytes[0], static_cast<AP4_UI32>(header.size));
+  } else {
+    return Result<std::monostate, std::string>::Err(
+        "An mdat that runs to the end of its file is too big for its 32-bit "
+        "size field.");
+  }
+  AP4_BytesFromUInt32BE(&bytes[4], AP4_ATOM_TYPE_MDAT);
+  if (std::fwrite(bytes, 1, header.header_size, output) !=
+      header.header_size) {
+    return Result<std::monostate, std::string>::Err(
+        "Failed to write an mdat header.");
+  }
+  return CopyFileRange(input, header.offset + header.header_size,
+                       header.size - header.header_size, output);
+}
+
+// The defaults of a track's trex, which its fragments fall back on.
+struct TrackDefaults {
+  uint32_t sample_description_index;
+  uint32_t sample_duration;
+  uint32_t sample_size;
+  uint32_t sample_flags;
+
+  bool operator==(TrackDefaults const&) const = default;
+};
+
+struct TrackInfo {
+  AP4_ContainerAtom* trak;
+  uint32_t track_id;
+  uint32_t timescale;
+  // The serialized stsd, compared to check the files are compatible.
+  std::vector<uint8_t> sample_descriptions;
+  // Set if moov has a trex for the track, i.e. the file is fragmented.
+  std::optional<TrackDefaults> defaults;
+};
+
+// A file to concatenate, with its moov parsed.
+struct Input {
+  std::string file_name;
+  std::vector<BoxHeader> headers;
+  std::unique_ptr<AP4_ContainerAtom> moov;
+  AP4_MvhdAtom* mvhd{nullptr};
+  std::vector<TrackInfo> tracks;
+  bool is_fragmented{false};
+};
+
+// Returns the defaults of each track with a trex in `moov`, by track id.
+std::map<uint32_t, TrackDefaults> GetTrackDefaults(AP4_ContainerAtom& moov) {
+  std::map<uint32_t, TrackDefaults> defaults;
+  AP4_ContainerAtom* const mvex =
+      AP4_DYNAMIC_CAST(AP4_ContainerAtom, moov.GetChild(AP4_ATOM_TYPE_MVEX));
+  if (mvex == nullptr) {
+    return defaults;
+  }
+  for (AP4_List<AP4_Atom>::Item* item = mvex->GetChildren().FirstItem();
+       item != nullptr; item = item->GetNext()) {
+    if (AP4_TrexAtom* const trex =
+            AP4_DYNAMIC_CAST(AP4_TrexAtom, item->GetData())) {
+      defaults[trex->GetTrackId()] = TrackDefaults{
+          trex->GetDefaultSampleDescriptionIndex(),
+          trex->GetDefaultSampleDuration(), trex->GetDefaultSampleSize(),
+          trex->GetDefaultSampleFlags()};
+    }
+  }
+  return defaults;
+}
+
+Result<std::vector<TrackInfo>, std::string> GetTrackInfos(
+    AP4_ContainerAtom& moov) {
+  std::map<uint32_t, TrackDefaults> const defaults = GetTrackDefaults(moov);
+  std::vector<TrackInfo> tracks;
+  for (AP4_List<AP4_Atom>::Item* item = moov.GetChildren().FirstItem();
+       item != nullptr; item = item->GetNext()) {
+    if (item->GetData()->GetType() != AP4_ATOM_TYPE_TRAK) {
+      continue;
+    }
+    AP4_ContainerAtom* const trak =
+        AP4_DYNAMIC_CAST(AP4_ContainerAtom, item->GetData());
+    AP4_TkhdAtom* const tkhd =
+        trak != nullptr
+            ? AP4_DYNAMIC_CAST(AP4_TkhdAtom, trak->FindChild("tkhd"))
+            : nullptr;
+    AP4_MdhdAtom* const mdhd =
+        trak != nullptr
+            ? AP4_DYNAMIC_CAST(AP4_MdhdAtom, trak->FindChild("mdia/mdhd"))
+            : nullptr;
+    AP4_Atom* const stsd =
+        trak != nullptr ? trak->FindChild("mdia/minf/stbl/stsd") : nullptr;
+    if (tkhd == nullptr || mdhd == nullptr || stsd == nullptr) {
+      return Result<std::vector<TrackInfo>, std::string>::Err(
+          "A track is missing its tkhd, mdhd or sample descriptions.");
+    }
+    tracks.push_back(TrackInfo{trak, tkhd->GetTrackId(), mdhd->GetTimeScale(),
+                               SerializeAtom(*stsd), std::nullopt});
+    auto const track_defaults = defaults.find(tracks.back().track_id);
+    if (track_defaults != defaults.end()) {
+      tracks.back().defaults = track_defaults->second;
+    }
+  }
+  return Result<std::vector<TrackInfo>, std::string>::Ok(std::move(tracks));
+}
+
+Result<Input, std::string> ReadInput(std::string const& file_name) {
+  AP4_ByteStream* raw_stream = nullptr;
+  if (AP4_FAILED(AP4_FileByteStream::Create(
+          file_name.c_str(), AP4_FileByteStream::STREAM_MODE_READ,
+          raw_stream))) {
+    return Result<Input, std::string>::Err("Could not open " + file_name +
+                                           ".");
+  }
+  ByteStreamPointer stream{raw_stream};
+  Result<std::vector<BoxHeader>, std::string> scan_result =
+      ScanTopLevelBoxHeaders(*stream);
+  if (scan_result.IsErr()) {
+    scan_result.MarkErrorHandled();
+    return Result<Input, std::string>::Err(file_name + ": " +
+                                           std::move(scan_result).GetErr());
+  }
+  Input input;
+  input.file_name = file_name;
+  input.headers = std::move(scan_result).GetOk();
+  std::optional<uint64_t> moov_offset;
+  for (BoxHeader const& header : input.headers) {
+    if (header.type == AP4_ATOM_TYPE_MOOF) {
+      input.is_fragmented = true;
+    } else if (header.type == AP4_ATOM_TYPE_MOOV) {
+      if (moov_offset.has_value()) {
+        return Result<Input, std::string>::Err(
+            file_name + ": the file has more than one moov.");
+      }
+      moov_offset = header.offset;
+    }
+  }
+  if (!moov_offset.has_value()) {
+    return Result<Input, std::string>::Err(file_name +
+                                           ": the file has no moov.");
+  }
+
+  AP4_Atom* moov_atom = nullptr;
+  AP4_AtomFactory atom_factory;
+  if (AP4_FAILED(stream->Seek(moov_offset.value())) ||
+      AP4_FAILED(atom_factory.CreateAtomFromStream(*stream, moov_atom))) {
+    return Result<Input, std::string>::Err(file_name +
+                                           ": failed to parse moov.");
+  }
+  input.moov.reset(AP4_DYNAMIC_CAST(AP4_ContainerAtom, moov_atom));
+  if (input.moov == nullptr) {
+    delete moov_atom;
+    return Result<Input, std::string>::Err(file_name +
+                                           ": failed to parse moov.");
+  }
+  input.mvhd = AP4_DYNAMIC_CAST(AP4_MvhdAtom,
+                                input.moov->GetChild(AP4_ATOM_TYPE_MVHD));
+  if (input.mvhd == nullptr || input.mvhd->GetTimeScale() == 0) {
+    return Result<Input, std::string>::Err(
+        file_name + ": moov has no mvhd, or a timescale of 0.");
+  }
+  Result<std::vector<TrackInfo>, std::string> tracks_result =
+      GetTrackInfos(*input.moov);
+  if (tracks_result.IsErr()) {
+    tracks_result.MarkErrorHandled();
+    return Result<Input, std::string>::Err(file_name + ": " +
+                                           std::move(tracks_result).GetErr());
+  }
+  input.tracks = std::move(tracks_result).GetOk();
+  return Result<Input, std::string>::Ok(std::move(input));
+}
+
+// Checks that `input` has the same tracks as `first`, so its samples can be
+// appended to them.
+Result<std::monostate, std::string> CheckCompatible(Input const& first,
+                                                    Input const& input) {
+  if (input.is_fragmented != first.is_fragmented) {
+    return Result<std::monostate, std::string>::Err(
+        input.file_name + ": fragmented and progressive files can't be "
+                          "concatenated together.");
+  }
+  if (input.tracks.size() != first.tracks.size()) {
+    return Result<std::monostate, std::string>::Err(
+        input.file_name + " has " + std::to_string(input.tracks.size()) +
+        " tracks, but " + first.file_name + " has " +
+        std::to_string(first.tracks.size()) + ".");
+  }
+  for (size_t i = 0; i < input.tracks.size(); ++i) {
+    TrackInfo const& track = input.tracks.at(i);
+    TrackInfo const& first_track = first.tracks.at(i);
+    if (track.track_id != first_track.track_id ||
+        track.timescale != first_track.timescale) {
+      return Result<std::monostate, std::string>::Err(
+          input.file_name + ": track " + std::to_string(i + 1) +
+          " has a different id or timescale to the same track of " +
+          first.file_name + ".");
+    }
+    if (track.sample_descriptions.empty() ||
+        track.sample_descriptions != first_track.sample_descriptions) {
+      return Result<std::monostate, std::string>::Err(
+          input.file_name + ": track " + std::to_string(track.track_id) +
+          " has different sample descriptions to the same track of " +
+          first.file_name + ", so the files can't be joined losslessly.");
+    }
+    // Only the first moov is kept, so its trex defaults apply to every
+    // file's fragments. The moofs are copied at their size, so the defaults
+    // can't be written into their tfhds instead.
+    if (track.defaults != first_track.defaults) {
+      return Result<std::monostate, std::string>::Err(
+          input.file_name + ": track " + std::to_string(track.track_id) +
+          " has different default sample description, duration, size or "
+          "flags (trex) to the same track of " + first.file_name + ".");
+    }
+  }
+  return Result<std::monostate, std::string>::Ok();
+}
+
+// Copies the ftyp of `input`, if it has one, to `output`.
+Result<std::monostate, std::string> CopyFtyp(Input const& input,
+                                             std::FILE* input_file,
+                                             std::FILE* output) {
+  for (BoxHeader const& header : input.headers) {
+    if (header.type == AP4_ATOM_TYPE_FTYP) {
+      return CopyFileRange(input_file, header.offset, header.size, output);
+    }
+  }
+  return Result<std::monostate, std::string>::Ok();
+}
+
+// Where an input's mdat is placed in the output, relative to the start of
+// the output's media data.
+struct PlacedMdat {
+  BoxHeader header;
+  uint64_t output_offset;
+};
+
+// The sample tables of a track, merged from all the inputs. Chunk offsets
+// are relative to the start of the output's media data until it's known
+// where that is.
+struct MergedTables {
+  std::vector<AP4_SttsTableEntry> stts;
+  std::vector<AP4_CttsTableEntry> ctts;
+  bool has_ctts{false};
+  // 1 if an input's ctts has signed (version 1) offsets.
+  AP4_UI08 ctts_version{0};
+  std::vector<AP4_UI32> sample_sizes;
+  // Sample numbers of the sync samples, only written if an input has stss.
+  std::vector<AP4_UI32> sync_samples;
+  bool has_stss{false};
+  // Chunk count, samples per chunk and sample description index, as taken
+  // by AP4_StscAtom::AddEntry.
+  std::vector<std::array<AP4_UI32, 3>> stsc;
+  std::vector<uint64_t> chunk_offsets;
+  uint64_t media_duration{0};
+};
+
+// Appends the samples of `track`, from `input`, to `tables`. `mdats` are
+// where the input's mdats are placed in the output.
+Result<std::monostate, std::string> AppendTrackTables(
+    Input const& input, TrackInfo const& track,
+    std::vector<PlacedMdat> const& mdats, MergedTables& tables) {
+  std::string const prefix = input.file_name + ": track " +
+                             std::to_string(track.track_id) + ": ";
+  auto const error = [&](std::string const& message) {
+    return Result<std::monostate, std::string>::Err(prefix + message);
+  };
+  AP4_ContainerAtom* const stbl = AP4_DYNAMIC_CAST(
+      AP4_ContainerAtom, track.trak->FindChild("mdia/minf/stbl"));
+  if (stbl == nullptr) {
+    return error("the track has no sample table.");
+  }
+  if (stbl->GetChild(AP4_ATOM_TYPE_SAIZ) != nullptr ||
+      stbl->GetChild(AP4_ATOM_TYPE_SAIO) != nullptr ||
+      stbl->GetChild(AP4_ATOM_TYPE_SENC) != nullptr) {
+    return error("encrypted tracks can't be concatenated.");
+  }
+  auto* const stts =
+      AP4_DYNAMIC_CAST(AP4_SttsAtom, stbl->GetChild(AP4_ATOM_TYPE_STTS));
+  auto* const ctts =
+      AP4_DYNAMIC_CAST(AP4_CttsAtom, stbl->GetChild(AP4_ATOM_TYPE_CTTS));
+  auto* const stsc =
+      AP4_DYNAMIC_CAST(AP4_StscAtom, stbl->GetChild(AP4_ATOM_TYPE_STSC));
+  auto* const stss =
+      AP4_DYNAMIC_CAST(AP4_StssAtom, stbl->GetChild(AP4_ATOM_TYPE_STSS));
+  auto* const stsz =
+      AP4_DYNAMIC_CAST(AP4_StszAtom, stbl->GetChild(AP4_ATOM_TYPE_STSZ));
+  auto* const stz2 =
+      AP4_DYNAMIC_CAST(AP4_Stz2Atom, stbl->GetChild(AP4_ATOM_TYPE_STZ2));
+  auto* const stco =
+      AP4_DYNAMIC_CAST(AP4_StcoAtom, stbl->GetChild(AP4_ATOM_TYPE_STCO));
+  auto* const co64 =
+      AP4_DYNAMIC_CAST(AP4_Co64Atom, stbl->GetChild(AP4_ATOM_TYPE_CO64));
+  if (stts == nullptr || stsc == nullptr ||
+      (stsz == nullptr && stz2 == nullptr) ||
+      (stco == nullptr && co64 == nullptr)) {
+    return error(
+        "the sample table is missing its decoding times (stts), sample to "
+        "chunk (stsc), sample sizes (stsz or stz2) or chunk offsets (stco or "
+        "co64).");
+  }
+
+  uint32_t const sample_count =
+      stsz != nullptr ? stsz->GetSampleCount() : stz2->GetSampleCount();
+  auto const sample_base = static_cast<uint32_t>(tables.sample_sizes.size());
+  tables.sample_sizes.reserve(tables.sample_sizes.size() + sample_count);
+  for (AP4_Ordinal sample = 1; sample <= sample_count; ++sample) {
+    AP4_Size size = 0;
+    if (stsz != nullptr) {
+      stsz->GetSampleSize(sample, size);
+    } else {
+      stz2->GetSampleSize(sample, size);
+    }
+    tables.sample_sizes.push_back(size);
+  }
+
+  uint64_t stts_samples = 0;
+  AP4_Array<AP4_SttsTableEntry>& stts_entries = stts->GetEntries();
+  for (AP4_Ordinal i = 0; i < stts_entries.ItemCount(); ++i) {
+    AP4_SttsTableEntry const& entry = stts_entries[i];
+    stts_samples += entry.m_SampleCount;
+    tables.media_duration +=
+        static_cast<uint64_t>(entry.m_SampleCount) * entry.m_SampleDuration;
+    // Runs of the same duration usually continue across files.
+    if (!tables.stts.empty() &&
+        tables.stts.back().m_SampleDuration == entry.m_SampleDuration) {
+      tables.stts.back().m_SampleCount += entry.m_SampleCount;
+    } else if (entry.m_SampleCount > 0) {
+      tables.stts.push_back(entry);
+    }
+  }
+  if (stts_samples != sample_count) {
+    return error("stts has " + std::to_string(stts_samples) +
+                 " samples, but the sample size table has " +
+                 std::to_string(sample_count) + ".");
+  }
+
+  // Files without ctts have no composition offsets, which is the same as
+  // offsets of 0, so a track only needs ctts if one of its files has it.
+  if (ctts != nullptr) {
+    tables.has_ctts = true;
+    tables.ctts_version = std::max(tables.ctts_version, ctts->GetVersion());
+    AP4_Array<AP4_CttsTableEntry>& ctts_entries = ctts->GetEntries();
+    for (AP4_Ordinal i = 0; i < ctts_entries.ItemCount(); ++i) {
+      tables.ctts.push_back(ctts_entries[i]);
+    }
+  } else if (sample_count > 0) {
+    tables.ctts.push_back(AP4_CttsTableEntry{sample_count, 0});
+  }
+
+  // Likewise, without stss every sample is a sync sample.
+  if (stss != nullptr) {
+    tables.has_stss = true;
+    AP4_Array<AP4_UI32> const& stss_entries = stss->GetEntries();
+    for (AP4_Ordinal i = 0; i < stss_entries.ItemCount(); ++i) {
+      tables.sync_samples.push_back(sample_base + stss_entries[i]);
+    }
+  } else {
+    for (uint32_t sample = 1; sample <= sample_count; ++sample) {
+      tables.sync_samples.push_back(sample_base + sample);
+    }
+  }
+
+  uint32_t const chunk_count =
+      stco != nullptr ? stco->GetChunkCount() : co64->GetEntryCount();
+  AP4_Array<AP4_StscTableEntry>& stsc_entries = stsc->GetEntries();
+  uint64_t mapped_samples = 0;
+  for (AP4_Ordinal i = 0; i < stsc_entries.ItemCount(); ++i) {
+    uint32_t const first_chunk = stsc_entries[i].m_FirstChunk;
+    uint32_t const end_chunk = i + 1 < stsc_entries.ItemCount()
+                                   ? stsc_entries[i + 1].m_FirstChunk
+                                   : chunk_count + 1;
+    if ((i == 0 && first_chunk != 1) || first_chunk >= end_chunk ||
+        end_chunk > chunk_count + 1) {
+      return error("stsc entry " + std::to_string(i + 1) +
+                   " refers to chunks that stco or co64 don't have, or "
+                   "aren't in order.");
+    }
+    tables.stsc.push_back({end_chunk - first_chunk,
+                           stsc_entries[i].m_SamplesPerChunk,
+                           stsc_entries[i].m_SampleDescriptionIndex});
+    mapped_samples += static_cast<uint64_t>(end_chunk - first_chunk) *
+                      stsc_entries[i].m_SamplesPerChunk;
+  }
+  if (mapped_samples != sample_count) {
+    return error("stsc maps " + std::to_string(mapped_samples) +
+                 " samples, but the sample size table has " +
+                 std::to_string(sample_count) + ".");
+  }
+
+  tables.chunk_offsets.reserve(tables.chunk_offsets.size() + chunk_count);
+  for (AP4_Ordinal chunk = 1; chunk <= chunk_count; ++chunk) {
+    uint64_t offset = 0;
+    if (stco != nullptr) {
+      AP4_UI32 offset_32 = 0;
+      stco->GetChunkOffset(chunk, offset_32);
+      offset = offset_32;
+    } else {
+      AP4_UI64 offset_64 = 0;
+      co64->GetChunkOffset(chunk, offset_64);
+      offset = offset_64;
+    }
+    auto const mdat = std::find_if(
+        mdats.begin(), mdats.end(), [offset](PlacedMdat const& placed) {
+          return offset >= placed.header.offset + placed.header.header_size &&
+                 offset < placed.header.offset + placed.header.size;
+        });
+    if (mdat == mdats.end()) {
+      return error("chunk offset " + std::to_string(offset) +
+                   " does not point into an mdat.");
+    }
+    tables.chunk_offsets.push_back(mdat->output_offset +
+                                   (offset - mdat->header.offset));
+  }
+  return Result<std::monostate, std::string>::Ok();
+}
+
+// Replaces the sample tables in `stbl` with `tables`. Chunk offsets are
+// written as they are, relative to the start of the media data, and are
+// returned as `chunk_offset_table` to be updated once the layout is known.
+void ReplaceSampleTables(AP4_ContainerAtom& stbl, MergedTables const& tables,
+                         bool use_co64, AP4_Atom*& chunk_offset_table) {
+  std::vector<AP4_Atom*> replaced_atoms;
+  for (AP4_List<AP4_Atom>::Item* item = stbl.GetChildren().FirstItem();
+       item != nullptr; item = item->GetNext()) {
+    AP4_Atom::Type const type = item->GetData()->GetType();
+    if (type != AP4_ATOM_TYPE_STSD && type != AP4_ATOM_TYPE_SGPD) {
+      replaced_atoms.push_back(item->GetData());
+    }
+  }
+  for (AP4_Atom* atom : replaced_atoms) {
+    stbl.RemoveChild(atom);
+    delete atom;
+  }
+
+  AP4_SttsAtom* const stts = new AP4_SttsAtom();
+  for (AP4_SttsTableEntry const& entry : tables.stts) {
+    stts->AddEntry(entry.m_SampleCount, entry.m_SampleDuration);
+  }
+  stbl.AddChild(stts);
+  if (tables.has_ctts) {
+    AP4_CttsAtom* const ctts = new AP4_CttsAtom();
+    ctts->SetVersion(tables.ctts_version);
+    for (AP4_CttsTableEntry const& entry : tables.ctts) {
+      ctts->AddEntry(entry.m_SampleCount, entry.m_SampleOffset);
+    }
+    stbl.AddChild(ctts);
+  }
+  if (tables.has_stss) {
+    AP4_StssAtom* const stss = new AP4_StssAtom();
+    for (AP4_UI32 const sample : tables.sync_samples) {
+      stss->AddEntry(sample);
+    }
+    stbl.AddChild(stss);
+  }
+  AP4_StscAtom* const stsc = new AP4_StscAtom();
+  for (std::array<AP4_UI32, 3> const& entry : tables.stsc) {
+    stsc->AddEntry(entry[0], entry[1], entry[2]);
+  }
+  stbl.AddChild(stsc);
+  AP4_StszAtom* const stsz = new AP4_StszAtom();
+  for (AP4_UI32 const size : tables.sample_sizes) {
+    stsz->AddEntry(size);
+  }
+  stbl.AddChild(stsz);
+
+  if (use_co64) {
+    std::vector<AP4_UI64> offsets{tables.chunk_offsets.begin(),
+                                  tables.chunk_offsets.end()};
+    chunk_offset_table =
+        new AP4_Co64Atom(offsets.data(), static_cast<AP4_UI32>(offsets.size()));
+  } else {
+    std::vector<AP4_UI32> offsets{tables.chunk_offsets.begin(),
+                                  tables.chunk_offsets.end()};
+    chunk_offset_table =
+        new AP4_StcoAtom(offsets.data(), static_cast<AP4_UI32>(offsets.size()));
+  }
+  stbl.AddChild(chunk_offset_table);
+}
+
+// Adds `media_data_offset` to the chunk offsets of `tables`, which are the
+// merged tables of the track whose chunk offset table is `atom`.
+void RebaseChunkOffsets(AP4_Atom& atom, MergedTables const& tables,
+                        uint64_t media_data_offset) {
+  if (AP4_StcoAtom* const stco = AP4_DYNAMIC_CAST(AP4_StcoAtom, &atom)) {
+    for (size_t i = 0; i < tables.chunk_offsets.size(); ++i) {
+      stco->SetChunkOffset(static_cast<AP4_Ordinal>(i + 1),
+                           static_cast<AP4_UI32>(tables.chunk_offsets.at(i) +
+                                                 media_data_offset));
+    }
+    return;
+  }
+  AP4_Co64Atom* const co64 = AP4_DYNAMIC_CAST(AP4_Co64Atom, &atom);
+  assert(co64 != nullptr);
+  for (size_t i = 0; i < tables.chunk_offsets.size(); ++i) {
+    co64->SetChunkOffset(static_cast<AP4_Ordinal>(i + 1),
+                         tables.chunk_offsets.at(i) + media_data_offset);
+  }
+}
+
+ConcatenationResult ConcatenateProgressive(std::vector<Input>& inputs,
+                                           char const* output_file_name) {
+  // Each input's mdats are placed one after another, in the order of the
+  // inputs, after the output's ftyp and moov.
+  std::vector<std::vector<PlacedMdat>> placed_mdats(inputs.size());
+  uint64_t media_data_size = 0;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    for (BoxHeader const& header : inputs.at(i).headers) {
+      if (header.type == AP4_ATOM_TYPE_MDAT) {
+        placed_mdats.at(i).push_back(PlacedMdat{header, media_data_size});
+        media_data_size += header.size;
+      }
+    }
+  }
+
+  Input& first = inputs.front();
+  std::vector<MergedTables> merged_tables(first.tracks.size());
+  std::vector<uint64_t> track_durations(first.tracks.size());
+  uint64_t movie_duration = 0;
+  uint64_t sample_count = 0;
+  uint32_t const movie_timescale = first.mvhd->GetTimeScale();
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    Input& input = inputs.at(i);
+    uint32_t const input_timescale = input.mvhd->GetTimeScale();
+    movie_duration += AP4_ConvertTime(input.mvhd->GetDuration(),
+                                      input_timescale, movie_timescale);
+    for (size_t t = 0; t < input.tracks.size(); ++t) {
+      Result<std::monostate, std::string> result = AppendTrackTables(
+          input, input.tracks.at(t), placed_mdats.at(i), merged_tables.at(t));
+      if (result.IsErr()) {
+        result.MarkErrorHandled();
+        return ConcatenationResult::Err(std::move(result).GetErr());
+      }
+      AP4_TkhdAtom* const tkhd = AP4_DYNAMIC_CAST(
+          AP4_TkhdAtom, input.tracks.at(t).trak->FindChild("tkhd"));
+      track_durations.at(t) += AP4_ConvertTime(
+          tkhd->GetDuration(), input_timescale, movie_timescale);
+    }
+    // Only the first moov is kept, the others can be freed as we go.
+    if (i > 0) {
+      input.tracks.clear();
+      input.moov.reset();
+    }
+  }
+
+  // All chunk offset tables are stco if the whole output fits in 32 bits,
+  // assuming they're all co64, and co64 otherwise.
+  uint64_t output_size_bound = first.moov->GetSize() + media_data_size;
+  for (BoxHeader const& header : first.headers) {
+    if (header.type == AP4_ATOM_TYPE_FTYP) {
+      output_size_bound += header.size;
+    }
+  }
+  for (MergedTables const& tables : merged_tables) {
+    output_size_bound += 16 + 8 * tables.chunk_offsets.size() +
+                         4 * tables.sample_sizes.size() +
+                         8 * (tables.stts.size() + tables.ctts.size()) +
+                         4 * tables.sync_samples.size() +
+                         12 * tables.stsc.size();
+  }
+  bool const use_co64 =
+      output_size_bound > std::numeric_limits<AP4_UI32>::max();
+
+  std::vector<AP4_Atom*> chunk_offset_tables(first.tracks.size());
+  for (size_t t = 0; t < first.tracks.size(); ++t) {
+    TrackInfo const& track = first.tracks.at(t);
+    AP4_ContainerAtom* const stbl = AP4_DYNAMIC_CAST(
+        AP4_ContainerAtom, track.trak->FindChild("mdia/minf/stbl"));
+    ReplaceSampleTables(*stbl, merged_tables.at(t), use_co64,
+                        chunk_offset_tables.at(t));
+    sample_count += merged_tables.at(t).sample_sizes.size();
+    AP4_DYNAMIC_CAST(AP4_MdhdAtom, track.trak->FindChild("mdia/mdhd"))
+        ->SetDuration(merged_tables.at(t).media_duration);
+    AP4_DYNAMIC_CAST(AP4_TkhdAtom, track.trak->FindChild("tkhd"))
+        ->SetDuration(track_durations.at(t));
+    // The edit list describes the first file's presentation only.
+    if (AP4_Atom* const edts = track.trak->GetChild(AP4_ATOM_TYPE_EDTS)) {
+      track.trak->RemoveChild(edts);
+      delete edts;
+    }
+  }
+  first.mvhd->SetDuration(movie_duration);
+
+  FilePointer first_file{std::fopen(first.file_name.c_str(), "rb")};
+  if (first_file == nullptr) {
+    return ConcatenationResult::Err("Could not open " + first.file_name +
+                                    ".");
+  }
+  FilePointer output{std::fopen(output_file_name, "wb")};
+  if (output == nullptr) {
+    return ConcatenationResult::Err(std::string{"Could not open "} +
+                                    output_file_name + " for writing.");
+  }
+  Result<std::monostate, std::string> result =
+      CopyFtyp(first, first_file.get(), output.get());
+  first_file.reset();
+  if (result.IsOk()) {
+    int64_t const ftyp_size = TellFile(output.get());
+    if (ftyp_size < 0) {
+      result = Result<std::monostate, std::string>::Err(
+          "Failed to find the output position.");
+    } else {
+      uint64_t const media_data_offset =
+          static_cast<uint64_t>(ftyp_size) + first.moov->GetSize();
+      for (size_t t = 0; t < first.tracks.size(); ++t) {
+        RebaseChunkOffsets(*chunk_offset_tables.at(t), merged_tables.at(t),
+                           media_data_offset);
+      }
+      result = WriteAtom(*first.moov, output.get());
+    }
+  }
+  for (size_t i = 0; i < inputs.size() && result.IsOk(); ++i) {
+    FilePointer input_file{std::fopen(inputs.at(i).file_name.c_str(), "rb")};
+    if (input_file == nullptr) {
+      result = Result<std::monostate, std::string>::Err(
+          "Could not open " + inputs.at(i).file_name + ".");
+      break;
+    }
+    for (PlacedMdat const& placed : placed_mdats.at(i)) {
+      result = CopyMdat(placed.header, input_file.get(), output.get());
+      if (result.IsErr()) {
+        break;
+      }
+    }
+  }
+
+  bool const closed = std::fclose(output.release()) == 0;
+  if (result.IsErr() || !closed) {
+    std::remove(output_file_name);
+    if (result.IsErr()) {
+      result.MarkErrorHandled();
+      return ConcatenationResult::Err(std::move(result).GetErr());
+    }
+    return ConcatenationResult::Err(std::string{"Failed to finish writing "} +
+                                    output_file_name + ".");
+  }
+  return ConcatenationResult::Ok(
+      ConcatenationSummary{false, sample_count, media_data_size});
+}
+
+// The timeline of a track across the fragmented inputs.
+struct FragmentedTrack {
+  uint32_t timescale{0};
+  // Where the track's fragments so far end, in its timescale.
+  uint64_t end_time{0};
+  // What's added to the decode times of the current input's fragments, in
+  // the track's timescale. Every track of an input is shifted by the same
+  // time, see ShiftInput.
+  int64_t shift{0};
+  // The default sample duration from the trex, which CheckCompatible makes
+  // the same for every input.
+  uint32_t default_duration{0};
+};
+
+// Parses the moof `header` of `input_stream`. Returns nullptr on failure.
+std::unique_ptr<AP4_ContainerAtom> ParseMoof(AP4_ByteStream& input_stream,
+                                             BoxHeader const& header) {
+  AP4_Atom* moof_atom = nullptr;
+  AP4_AtomFactory atom_factory;
+  if (AP4_FAILED(input_stream.Seek(header.offset)) ||
+      AP4_FAILED(atom_factory.CreateAtomFromStream(input_stream, moof_atom))) {
+    return nullptr;
+  }
+  std::unique_ptr<AP4_ContainerAtom> moof{
+      AP4_DYNAMIC_CAST(AP4_ContainerAtom, moof_atom)};
+  if (moof == nullptr) {
+    delete moof_atom;
+  }
+  return moof;
+}
+
+// Sets the shift of each of `tracks` so the fragments of `input` follow on
+// from those written so far. The input is moved as a whole: its earliest
+// decode time, over all its tracks, is placed at the latest end of the
+// tracks so far, so tracks that start later than others in the input still
+// do in the output. Times are compared in `timescale`, then converted to
+// each track's own.
+Result<std::monostate, std::string> ShiftInput(
+    Input const& input, AP4_ByteStream& input_stream, uint32_t timescale,
+    std::map<uint32_t, FragmentedTrack>& tracks) {
+  // A track's decode times only increase, so its first traf holds its
+  // earliest, and only the moofs up to the first traf of every track need
+  // to be read.
+  std::optional<uint64_t> earliest_time;
+  std::map<uint32_t, bool> seen_tracks;
+  for (BoxHeader const& header : input.headers) {
+    if (seen_tracks.size() == tracks.size()) {
+      break;
+    }
+    if (header.type != AP4_ATOM_TYPE_MOOF) {
+      continue;
+    }
+    std::unique_ptr<AP4_ContainerAtom> const moof =
+        ParseMoof(input_stream, header);
+    if (moof == nullptr) {
+      return Result<std::monostate, std::string>::Err(
+          input.file_name + ": failed to parse a moof.");
+    }
+    for (AP4_List<AP4_Atom>::Item* item = moof->GetChildren().FirstItem();
+         item != nullptr; item = item->GetNext()) {
+      AP4_ContainerAtom* const traf =
+          AP4_DYNAMIC_CAST(AP4_ContainerAtom, item->GetData());
+      if (traf == nullptr || traf->GetType() != AP4_ATOM_TYPE_TRAF) {
+        continue;
+      }
+      AP4_TfhdAtom* const tfhd =
+          AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
+      AP4_TfdtAtom* const tfdt =
+          AP4_DYNAMIC_CAST(AP4_TfdtAtom, traf->GetChild(AP4_ATOM_TYPE_TFDT));
+      // RewriteMoof reports trafs without these.
+      if (tfhd == nullptr || tfdt == nullptr) {
+        continue;
+      }
+      auto const track = tracks.find(tfhd->GetTrackId());
+      if (track == tracks.end() || seen_tracks[track->first]) {
+        continue;
+      }
+      seen_tracks[track->first] = true;
+      uint64_t const time =
+          AP4_ConvertTime(tfdt->GetBaseMediaDecodeTime(),
+                          track->second.timescale, timescale);
+      earliest_time = std::min(earliest_time.value_or(time), time);
+    }
+  }
+  if (!earliest_time.has_value()) {
+    return Result<std::monostate, std::string>::Ok();
+  }
+
+  uint64_t end_time = 0;
+  for (auto const& [track_id, track] : tracks) {
+    end_time = std::max(
+        end_time, AP4_ConvertTime(track.end_time, track.timescale, timescale));
+  }
+  bool const is_forwards = end_time >= earliest_time.value();
+  uint64_t const distance = is_forwards ? end_time - earliest_time.value()
+                                        : earliest_time.value() - end_time;
+  for (auto& [track_id, track] : tracks) {
+    auto const track_distance = static_cast<int64_t>(
+        AP4_ConvertTime(distance, timescale, track.timescale));
+    track.shift = is_forwards ? track_distance : -track_distance;
+  }
+  return Result<std::monostate, std::string>::Ok();
+}
+
+// Rewrites the moof at `moof_offset` in `input_stream` for the output, where
+// it will be at `output_offset`: renumbers it and shifts its decode times,
+// then writes it to `output`.
+Result<std::monostate, std::string> RewriteMoof(
+    Input const& input, AP4_ByteStream& input_stream, BoxHeader const& header,
+    uint64_t output_offset, uint32_t sequence_number,
+    std::map<uint32_t, FragmentedTrack>& tracks, uint64_t& sample_count,
+    std::FILE* output) {
+  std::string const prefix = input.file_name + ": ";
+  std::unique_ptr<AP4_ContainerAtom> const moof =
+      ParseMoof(input_stream, header);
+  if (moof == nullptr) {
+    return Result<std::monostate, std::string>::Err(prefix +
+                                                    "failed to parse a moof.");
+  }
+  if (AP4_MfhdAtom* const mfhd =
+          AP4_DYNAMIC_CAST(AP4_MfhdAtom, moof->GetChild(AP4_ATOM_TYPE_MFHD))) {
+    mfhd->SetSequenceNumber(sequence_number);
+  }
+
+  for (AP4_List<AP4_Atom>::Item* item = moof->GetChildren().FirstItem();
+       item != nullptr; item = item->GetNext()) {
+    AP4_ContainerAtom* const traf =
+        AP4_DYNAMIC_CAST(AP4_ContainerAtom, item->GetData());
+    if (traf == nullptr || traf->GetType() != AP4_ATOM_TYPE_TRAF) {
+      continue;
+    }
+    AP4_TfhdAtom* const tfhd =
+        AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
+    AP4_TfdtAtom* const tfdt =
+        AP4_DYNAMIC_CAST(AP4_TfdtAtom, traf->GetChild(AP4_ATOM_TYPE_TFDT));
+    if (tfhd == nullptr || tfdt == nullptr) {
+      return Result<std::monostate, std::string>::Err(
+          prefix + "a traf has no tfhd or tfdt, so its decode times can't "
+                   "be shifted.");
+    }
+    auto const track_it = tracks.find(tfhd->GetTrackId());
+    if (track_it == tracks.end()) {
+      return Result<std::monostate, std::string>::Err(
+          prefix + "a traf refers to track " +
+          std::to_string(tfhd->GetTrackId()) + ", which moov doesn't have.");
+    }
+    FragmentedTrack& track = track_it->second;
+    if ((tfhd->GetFlags() & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) != 0) {
+      // Absolute offsets move with the moof, as the data after it is
+      // copied as is.
+      tfhd->SetBaseDataOffset(tfhd->GetBaseDataOffset() + output_offset -
+                              header.offset);
+    }
+
+    uint64_t const decode_time = tfdt->GetBaseMediaDecodeTime();
+    if (track.shift < 0 &&
+        decode_time < static_cast<uint64_t>(-track.shift)) {
+      return Result<std::monostate, std::string>::Err(
+          prefix + "a shifted decode time would be negative.");
+    }
+    uint64_t const shifted_time =
+        decode_time + static_cast<uint64_t>(track.shift);
+    if (tfdt->GetVersion() == 0 &&
+        shifted_time > std::numeric_limits<AP4_UI32>::max()) {
+      return Result<std::monostate, std::string>::Err(
+          prefix + "a shifted decode time doesn't fit in its version 0 tfdt.");
+    }
+    tfdt->SetBaseMediaDecodeTime(shifted_time);
+
+    uint32_t const default_duration =
+        (tfhd->GetFlags() & AP4_TFHD_FLAG_DEFAULT_SAMPLE_DURATION_PRESENT) != 0
+            ? tfhd->GetDefaultSampleDuration()
+            : track.default_duration;
+    uint64_t duration = 0;
+    for (AP4_List<AP4_Atom>::Item* child = traf->GetChildren().FirstItem();
+         child != nullptr; child = child->GetNext()) {
+      AP4_TrunAtom* const trun =
+          AP4_DYNAMIC_CAST(AP4_TrunAtom, child->GetData());
+      if (trun == nullptr) {
+        continue;
+      }
+      bool const has_durations =
+          (trun->GetFlags() & AP4_TRUN_FLAG_SAMPLE_DURATION_PRESENT) != 0;
+      AP4_Array<AP4_TrunAtom::Entry> const& entries = trun->GetEntries();
+      for (AP4_Ordinal i = 0; i < entries.ItemCount(); ++i) {
+        duration +=
+            has_durations ? entries[i].sample_duration : default_duration;
+      }
+      sample_count += entries.ItemCount();
+    }
+    track.end_time = std::max(track.end_time, shifted_time + duration);
+  }
+
+  if (moof->GetSize() != header.size) {
+    return Result<std::monostate, std::string>::Err(
+        prefix + "a moof changed size when rewritten, which would break its "
+                 "data offsets.");
+  }
+  return WriteAtom(*moof, output);
+}
+
+ConcatenationResult ConcatenateFragmented(std::vector<Input>& inputs,
+                                          char const* output_file_name) {
+  Input& first = inputs.front();
+  std::map<uint32_t, FragmentedTrack> tracks;
+  // Inputs are shifted in the finest of the track timescales, so the shift
+  // is exact for that track and within a tick of it for the others.
+  uint32_t shift_timescale = 1;
+  for (TrackInfo const& track : first.tracks) {
+    FragmentedTrack& fragmented_track = tracks[track.track_id];
+    fragmented_track.timescale = track.timescale;
+    fragmented_track.default_duration =
+        track.defaults.has_value() ? track.defaults->sample_duration : 0;
+    shift_timescale = std::max(shift_timescale, track.timescale);
+  }
+  // mehd gives the duration of the first file's fragments only, and is
+  // optional, so it's removed rather than updated.
+  if (AP4_ContainerAtom* const mvex = AP4_DYNAMIC_CAST(
+          AP4_ContainerAtom, first.moov->GetChild(AP4_ATOM_TYPE_MVEX))) {
+    if (AP4_Atom* const mehd = mvex->GetChild(AP4_ATOM_TYPE_MEHD)) {
+      mvex->RemoveChild(mehd);
+      delete mehd;
+    }
+  }
+
+  FilePointer output{std::fopen(output_file_name, "wb")};
+  if (output == nullptr) {
+    return ConcatenationResult::Err(std::string{"Could not open "} +
+                                    output_file_name + " for writing.");
+  }
+  Result<std::monostate, std::string> result =
+      Result<std::monostate, std::string>::Ok();
+  ConcatenationSummary summary{true, 0, 0};
+  uint32_t sequence_number = 1;
+  for (size_t i = 0; i < inputs.size() && result.IsOk(); ++i) {
+    Input& input = inputs.at(i);
+    FilePointer input_file{std::fopen(input.file_name.c_str(), "rb")};
+    AP4_ByteStream* raw_stream = nullptr;
+    if (input_file == nullptr ||
+        AP4_FAILED(AP4_FileByteStream::Create(
+            input.file_name.c_str(), AP4_FileByteStream::STREAM_MODE_READ,
+            raw_stream))) {
+      result = Result<std::monostate, std::string>::Err(
+          "Could not open " + input.file_name + ".");
+      break;
+    }
+    ByteStreamPointer input_stream{raw_stream};
+    for (TrackInfo const& track : input.tracks) {
+      AP4_Atom* const stsz = track.trak->FindChild("mdia/minf/stbl/stsz");
+      if (stsz != nullptr &&
+          AP4_DYNAMIC_CAST(AP4_StszAtom, stsz)->GetSampleCount() > 0) {
+        result = Result<std::monostate, std::string>::Err(
+            input.file_name + ": track " + std::to_string(track.track_id) +
+            " has samples in moov as well as in fragments, which isn't "
+            "supported.");
+        break;
+      }
+    }
+    if (result.IsOk() && i == 0) {
+      result = CopyFtyp(first, input_file.get(), output.get());
+      if (result.IsOk()) {
+        result = WriteAtom(*first.moov, output.get());
+      }
+    }
+    // The first input keeps its decode times.
+    if (result.IsOk() && i > 0) {
+      result = ShiftInput(input, *input_stream, shift_timescale, tracks);
+    }
+
+    // Everything from the first moof on is copied, other than the indexes,
+    // which would no longer be right.
+    bool found_moof = false;
+    for (BoxHeader const& header : input.headers) {
+      if (result.IsErr()) {
+        break;
+      }
+      found_moof |= header.type == AP4_ATOM_TYPE_MOOF;
+      if (!found_moof || header.type == AP4_ATOM_TYPE_SIDX ||
+          header.type == kSsixType ||
+          header.type == AP4_ATOM_TYPE_MFRA) {
+        continue;
+      }
+      if (header.type == AP4_ATOM_TYPE_MOOF) {
+        int64_t const output_offset = TellFile(output.get());
+        if (output_offset < 0) {
+          result = Result<std::monostate, std::string>::Err(
+              "Failed to find the output position.");
+          break;
+        }
+        result = RewriteMoof(input, *input_stream, header,
+                             static_cast<uint64_t>(output_offset),
+                             sequence_number++, tracks, summary.sample_count,
+                             output.get());
+      } else if (header.type == AP4_ATOM_TYPE_MDAT) {
+        result = CopyMdat(header, input_file.get(), output.get());
+        summary.media_data_size += header.size;
+      } else {
+        result = CopyFileRange(input_file.get(), header.offset, header.size,
+                               output.get());
+      }
+    }
+    // Only the first moov is kept, the others can be freed as we go.
+    if (i > 0) {
+      input.tracks.clear();
+      input.moov.reset();
+    }
+  }
+
+  bool const closed = std::fclose(output.release()) == 0;
+  if (result.IsErr() || !closed) {
+    std::remove(output_file_name);
+    if (result.IsErr()) {
+      result.MarkErrorHandled();
+      return ConcatenationResult::Err(std::move(result).GetErr());
+    }
+    return ConcatenationResult::Err(std::string{"Failed to finish writing "} +
+                                    output_file_name + ".");
+  }
+  return ConcatenationResult::Ok(summary);
+}
+}  // namespace
+
+Result<ConcatenationSummary, std::string> ConcatenateFiles(
+    std::vector<std::string> const& input_file_names,
+    char const* output_file_name) {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kSave, "utility::ConcatenateFiles");
+  if (input_file_names.size() < 2) {
+    return ConcatenationResult::Err("At least two files are needed.");
+  }
+  std::vector<Input> inputs;
+  inputs.reserve(input_file_names.size());
+  for (std::string const& file_name : input_file_names) {
+    std::error_code error_code;
+    if (std::filesystem::equivalent(file_name, output_file_name,
+                                    error_code)) {
+      return ConcatenationResult::Err(
+          "The output file must be different to the input files.");
+    }
+    Result<Input, std::string> input_result = ReadInput(file_name);
+    if (input_result.IsErr()) {
+      input_result.MarkErrorHandled();
+      return ConcatenationResult::Err(std::move(input_result).GetErr());
+    }
+    inputs.push_back(std::move(input_result).GetOk());
+    Result<std::monostate, std::string> compatible_result =
+        CheckCompatible(inputs.front(), inputs.back());
+    if (compatible_result.IsErr()) {
+      compatible_result.MarkErrorHandled();
+      return ConcatenationResult::Err(std::move(compatible_result).GetErr());
+    }
+  }
+  return inputs.front().is_fragmented
+             ? ConcatenateFragmented(inputs, output_file_name)
+             : ConcatenateProgressive(inputs, output_file_name);
+}
+
+}  // namespace mp4_manipulator::utility
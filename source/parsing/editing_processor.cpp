@@ -0,0 +1,76 @@
+#include "parsing/editing_processor.h"
+
+#include <algorithm>
+
+namespace mp4_manipulator {
+
+Result<std::monostate, std::string> RemoveCommand::Do(
+    AP4_AtomParent& top_level) {
+  std::optional<AP4_Atom*> possible_atom =
+      GetAp4AtomFromPath(path_to_remove_, top_level);
+  if (!possible_atom.has_value()) {
+    return Result<std::monostate, std::string>::Err("Atom not found!");
+  }
+  AP4_Atom* atom = possible_atom.value();
+  atom->Detach();
+
+  return Result<std::monostate, std::string>::Ok();
+}
+
+Result<std::monostate, std::string> RemoveAtomsOfTypesCommand::Do(
+    AP4_AtomParent& top_level) {
+  removed_count_ = 0;
+  RemoveFrom(top_level);
+  return Result<std::monostate, std::string>::Ok();
+}
+
+size_t RemoveAtomsOfTypesCommand::GetRemovedCount() const {
+  return removed_count_;
+}
+
+void RemoveAtomsOfTypesCommand::RemoveFrom(AP4_AtomParent& parent) {
+  AP4_List<AP4_Atom>::Item* item = parent.GetChildren().FirstItem();
+  while (item != nullptr) {
+    AP4_Atom* atom = item->GetData();
+    // Grab the next item first, as detaching removes the current one.
+    item = item->GetNext();
+    if (std::find(types_to_remove_.begin(), types_to_remove_.end(),
+                  atom->GetType()) != types_to_remove_.end()) {
+      atom->Detach();
+      delete atom;
+      ++removed_count_;
+      continue;
+    }
+    AP4_ContainerAtom* container = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
+    if (container != nullptr) {
+      RemoveFrom(*container);
+    }
+  }
+}
+
+AP4_Result EditingProcessor::Initialize(AP4_AtomParent& top_level,
+                                        AP4_ByteStream& stream,
+                                        ProgressListener* listener) {
+  AP4_Result ap4_result = AP4_SUCCESS;
+  for (std::unique_ptr<Command>& command : commands_) {
+    // TODO(bryce): logging on failure.
+    Result<std::monostate, std::string> result = command->Do(top_level);
+    if (result.IsErr()) {
+      result.MarkErrorHandled();
+      initialization_error_ = std::move(result).GetErr();
+      ap4_result = AP4_FAILURE;
+    }
+  }
+  return ap4_result;
+}
+
+void EditingProcessor::AddCommand(std::unique_ptr<Command> command) {
+  commands_.push_back(std::move(command));
+}
+
+// TODO(bryce): use this to do error reporting to the UI.
+std::optional<std::string> EditingProcessor::GetInitializationError() const {
+  return initialization_error_;
+}
+
+}  // namespace mp4_manipulator
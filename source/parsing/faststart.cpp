@@ -0,0 +1,372 @@
+#include "parsing/faststart.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "Ap4.h"
+#include "parsing/box_header_scanner.h"
+#include "parsing/file_range_copy.h"
+#include "parsing/resource_deleters.h"
+#include "profiling/allocation_profiler.h"
+
+namespace mp4_manipulator::utility {
+namespace {
+using FaststartResult = Result<FaststartOutcome, std::string>;
+
+// A chunk offset box (`stco` or `co64`) in `moov`, along with the offsets it
+// had in the input file.
+struct ChunkOffsetTable {
+  AP4_Atom* atom;
+  std::vector<uint64_t> input_offsets;
+};
+
+// Collects the chunk offset tables in `container` and its descendants.
+// Returns an error if a box with offsets we can't update is found.
+Result<std::monostate, std::string> CollectChunkOffsetTables(
+    AP4_ContainerAtom& container, std::vector<ChunkOffsetTable>& tables) {
+  for (AP4_List<AP4_Atom>::Item* item = container.GetChildren().FirstItem();
+       item != nullptr; item = item->GetNext()) {
+    AP4_Atom* atom = item->GetData();
+    if (atom->GetType() == AP4_ATOM_TYPE_STCO) {
+      AP4_StcoAtom* stco = AP4_DYNAMIC_CAST(AP4_StcoAtom, atom);
+      assert(stco != nullptr);
+      ChunkOffsetTable table{atom, {}};
+      table.input_offsets.reserve(stco->GetChunkCount());
+      for (AP4_Ordinal chunk = 1; chunk <= stco->GetChunkCount(); ++chunk) {
+        AP4_UI32 offset = 0;
+        stco->GetChunkOffset(chunk, offset);
+        table.input_offsets.push_back(offset);
+      }
+      tables.push_back(std::move(table));
+    } else if (atom->GetType() == AP4_ATOM_TYPE_CO64) {
+      AP4_Co64Atom* co64 = AP4_DYNAMIC_CAST(AP4_Co64Atom, atom);
+      assert(co64 != nullptr);
+      ChunkOffsetTable table{atom, {}};
+      table.input_offsets.reserve(co64->GetEntryCount());
+      for (AP4_Ordinal chunk = 1; chunk <= co64->GetEntryCount(); ++chunk) {
+        AP4_UI64 offset = 0;
+        co64->GetChunkOffset(chunk, offset);
+        table.input_offsets.push_back(offset);
+      }
+      tables.push_back(std::move(table));
+    } else if (atom->GetType() == AP4_ATOM_TYPE_SAIO) {
+      return Result<std::monostate, std::string>::Err(
+          "The file contains saio boxes, whose offsets can't be updated.");
+    }
+
+    AP4_ContainerAtom* child_container =
+        AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
+    if (child_container != nullptr) {
+      Result<std::monostate, std::string> result =
+          CollectChunkOffsetTables(*child_container, tables);
+      if (result.IsErr()) {
+        return result;
+      }
+    }
+  }
+  return Result<std::monostate, std::string>::Ok();
+}
+
+// Replaces the `stco` in `table` with an equivalent `co64`.
+void UpgradeToCo64(ChunkOffsetTable& table) {
+  assert(table.atom->GetType() == AP4_ATOM_TYPE_STCO);
+  AP4_AtomParent* parent = table.atom->GetParent();
+  assert(parent != nullptr);
+  int position = 0;
+  for (AP4_List<AP4_Atom>::Item* item = parent->GetChildren().FirstItem();
+       item != nullptr && item->GetData() != table.atom;
+       item = item->GetNext()) {
+    ++position;
+  }
+
+  std::vector<AP4_UI64> offsets{table.input_offsets.begin(),
+                                table.input_offsets.end()};
+  AP4_Co64Atom* co64 =
+      new AP4_Co64Atom(offsets.data(), static_cast<AP4_UI32>(offsets.size()));
+  // Removing and adding children updates the sizes of the ancestors.
+  parent->RemoveChild(table.atom);
+  delete table.atom;
+  parent->AddChild(co64, position);
+  table.atom = co64;
+}
+
+// Maps offsets in the input file to offsets in the output file.
+class OffsetMap {
+ public:
+  // `output_offsets` holds the output offset of each box in `headers`.
+  OffsetMap(std::vector<BoxHeader> const& headers,
+            std::vector<uint64_t> output_offsets, size_t moov_index)
+      : headers_{headers},
+        output_offsets_{std::move(output_offsets)},
+        moov_index_{moov_index} {}
+
+  // Returns the output offset of `input_offset`, or nullopt if it isn't
+  // within a box that's copied as is.
+  [[nodiscard]] std::optional<uint64_t> Map(uint64_t input_offset) const {
+    auto const after = std::upper_bound(
+        headers_.begin(), headers_.end(), input_offset,
+        [](uint64_t offset, BoxHeader const& header) {
+          return offset < header.offset;
+        });
+    if (after == headers_.begin()) {
+      return std::nullopt;
+    }
+    size_t const index = static_cast<size_t>(after - headers_.begin()) - 1;
+    BoxHeader const& header = headers_.at(index);
+    if (index == moov_index_ || input_offset - header.offset >= header.size) {
+      return std::nullopt;
+    }
+    return output_offsets_.at(index) + (input_offset - header.offset);
+  }
+
+ private:
+  std::vector<BoxHeader> const& headers_;
+  std::vector<uint64_t> output_offsets_;
+  size_t moov_index_;
+};
+
+// Returns the output offset of each box in `headers` when they're written in
+// `output_order`, given the size `moov` will have in the output.
+std::vector<uint64_t> ComputeOutputOffsets(
+    std::vector<BoxHeader> const& headers,
+    std::vector<size_t> const& output_order, size_t moov_index,
+    uint64_t moov_size) {
+  std::vector<uint64_t> output_offsets(headers.size());
+  uint64_t offset = 0;
+  for (size_t const index : output_order) {
+    output_offsets.at(index) = offset;
+    offset += index == moov_index ? moov_size : headers.at(index).size;
+  }
+  return output_offsets;
+}
+
+// Updates the chunk offsets in `tables` for the output layout. Any `stco`
+// whose offsets no longer fit in 32 bits is upgraded to a `co64`, which grows
+// `moov` and so moves everything after it, so we repeat until no more upgrades
+// are needed. This terminates as each pass either upgrades a table or is the
+// last.
+Result<std::monostate, std::string> UpdateChunkOffsets(
+    std::vector<BoxHeader> const& headers,
+    std::vector<size_t> const& output_order, size_t moov_index,
+    AP4_ContainerAtom& moov, std::vector<ChunkOffsetTable>& tables) {
+  while (true) {
+    OffsetMap const offset_map{
+        headers,
+        ComputeOutputOffsets(headers, output_order, moov_index,
+                             moov.GetSize()),
+        moov_index};
+    bool upgraded = false;
+    for (ChunkOffsetTable& table : tables) {
+      std::vector<uint64_t> output_offsets;
+      output_offsets.reserve(table.input_offsets.size());
+      for (uint64_t const input_offset : table.input_offsets) {
+        std::optional<uint64_t> const output_offset =
+            offset_map.Map(input_offset);
+        if (!output_offset.has_value()) {
+          return Result<std::monostate, std::string>::Err(
+              "Chunk offset " + std::to_string(input_offset) +
+              " does not point into media data.");
+        }
+        output_offsets.push_back(output_offset.value());
+      }
+
+      if (table.atom->GetType() == AP4_ATOM_TYPE_STCO) {
+        bool const fits_in_32_bits =
+            output_offsets.empty() ||
+            *std::max_element(output_offsets.begin(), output_offsets.end()) <=
+                std::numeric_limits<AP4_UI32>::max();
+        if (!fits_in_32_bits) {
+          UpgradeToCo64(table);
+          upgraded = true;
+          continue;
+        }
+        AP4_StcoAtom* stco = AP4_DYNAMIC_CAST(AP4_StcoAtom, table.atom);
+        for (size_t i = 0; i < output_offsets.size(); ++i) {
+          stco->SetChunkOffset(static_cast<AP4_Ordinal>(i + 1),
+                               static_cast<AP4_UI32>(output_offsets.at(i)));
+        }
+      } else {
+        AP4_Co64Atom* co64 = AP4_DYNAMIC_CAST(AP4_Co64Atom, table.atom);
+        for (size_t i = 0; i < output_offsets.size(); ++i) {
+          co64->SetChunkOffset(static_cast<AP4_Ordinal>(i + 1),
+                               output_offsets.at(i));
+        }
+      }
+    }
+    if (!upgraded) {
+      return Result<std::monostate, std::string>::Ok();
+    }
+  }
+}
+
+// Writes the boxes in `output_order` to `output`. All boxes other than `moov`
+// are copied from `input`.
+Result<std::monostate, std::string> WriteBoxes(
+    std::vector<BoxHeader> const& headers,
+    std::vector<size_t> const& output_order, std::optional<size_t> moov_index,
+    AP4_Atom* moov, std::FILE* input, std::FILE* output) {
+  for (size_t const index : output_order) {
+    if (moov != nullptr && index == moov_index) {
+      std::unique_ptr<AP4_MemoryByteStream, ByteStreamReleaser> moov_bytes{
+          new AP4_MemoryByteStream{static_cast<AP4_Size>(moov->GetSize())}};
+      if (AP4_FAILED(moov->Write(*moov_bytes)) ||
+          moov_bytes->GetDataSize() != moov->GetSize()) {
+        return Result<std::monostate, std::string>::Err(
+            "Failed to serialize moov.");
+      }
+      if (std::fwrite(moov_bytes->GetData(), 1, moov_bytes->GetDataSize(),
+                      output) != moov_bytes->GetDataSize()) {
+        return Result<std::monostate, std::string>::Err(
+            "Failed to write moov.");
+      }
+      continue;
+    }
+    BoxHeader const& header = headers.at(index);
+    Result<std::monostate, std::string> result =
+        CopyFileRange(input, header.offset, header.size, output);
+    if (result.IsErr()) {
+      return result;
+    }
+  }
+  return Result<std::monostate, std::string>::Ok();
+}
+}  // namespace
+
+Result<FaststartOutcome, std::string> WriteFaststart(
+    char const* input_file_name, char const* output_file_name) {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kSave, "utility::WriteFaststart");
+  std::error_code error_code;
+  if (std::filesystem::equivalent(input_file_name, output_file_name,
+                                  error_code)) {
+    return FaststartResult::Err(
+        "The output file must be different to the input file.");
+  }
+
+  AP4_ByteStream* raw_input_stream = nullptr;
+  if (AP4_FAILED(AP4_FileByteStream::Create(
+          input_file_name, AP4_FileByteStream::STREAM_MODE_READ,
+          raw_input_stream))) {
+    return FaststartResult::Err(std::string{"Could not open "} +
+                                input_file_name + ".");
+  }
+  ByteStreamPointer input_stream{raw_input_stream};
+
+  Result<std::vector<BoxHeader>, std::string> scan_result =
+      ScanTopLevelBoxHeaders(*input_stream);
+  if (scan_result.IsErr()) {
+    scan_result.MarkErrorHandled();
+    return FaststartResult::Err(std::move(scan_result).GetErr());
+  }
+  std::vector<BoxHeader> const headers = std::move(scan_result).GetOk();
+
+  std::optional<size_t> moov_index;
+  std::optional<size_t> first_mdat_index;
+  for (size_t i = 0; i < headers.size(); ++i) {
+    switch (headers.at(i).type) {
+      case AP4_ATOM_TYPE_MOOV:
+        if (moov_index.has_value()) {
+          return FaststartResult::Err("The file has more than one moov.");
+        }
+        moov_index = i;
+        break;
+      case AP4_ATOM_TYPE_MDAT:
+        if (!first_mdat_index.has_value()) {
+          first_mdat_index = i;
+        }
+        break;
+      case AP4_ATOM_TYPE_MOOF:
+        return FaststartResult::Err(
+            "Fragmented files are not supported, their moov can be loaded "
+            "without the media data already.");
+      default:
+        break;
+    }
+  }
+  if (!moov_index.has_value()) {
+    return FaststartResult::Err("The file has no moov.");
+  }
+
+  bool const is_already_faststart =
+      !first_mdat_index.has_value() ||
+      moov_index.value() < first_mdat_index.value();
+  // Everything keeps its order, other than moov, which goes in front of the
+  // first mdat.
+  std::vector<size_t> output_order;
+  output_order.reserve(headers.size());
+  for (size_t i = 0; i < headers.size(); ++i) {
+    if (!is_already_faststart && i == first_mdat_index) {
+      output_order.push_back(moov_index.value());
+    }
+    if (is_already_faststart || i != moov_index) {
+      output_order.push_back(i);
+    }
+  }
+
+  // Only moov is parsed, everything else is copied as is.
+  std::unique_ptr<AP4_ContainerAtom> moov;
+  std::vector<ChunkOffsetTable> chunk_offset_tables;
+  if (!is_already_faststart) {
+    AP4_Atom* moov_atom = nullptr;
+    AP4_AtomFactory atom_factory;
+    if (AP4_FAILED(input_stream->Seek(headers.at(moov_index.value()).offset)) ||
+        AP4_FAILED(atom_factory.CreateAtomFromStream(*input_stream,
+                                                     moov_atom))) {
+      return FaststartResult::Err("Failed to parse moov.");
+    }
+    moov.reset(AP4_DYNAMIC_CAST(AP4_ContainerAtom, moov_atom));
+    if (moov == nullptr) {
+      delete moov_atom;
+      return FaststartResult::Err("Failed to parse moov.");
+    }
+
+    Result<std::monostate, std::string> result =
+        CollectChunkOffsetTables(*moov, chunk_offset_tables);
+    if (result.IsOk()) {
+      result = UpdateChunkOffsets(headers, output_order, moov_index.value(),
+                                  *moov, chunk_offset_tables);
+    }
+    if (result.IsErr()) {
+      result.MarkErrorHandled();
+      return FaststartResult::Err(std::move(result).GetErr());
+    }
+  }
+  // The AP4 stream isn't needed for copying, release it so it doesn't hold
+  // any buffers while we copy.
+  input_stream.reset();
+
+  FilePointer input{std::fopen(input_file_name, "rb")};
+  if (input == nullptr) {
+    return FaststartResult::Err(std::string{"Could not open "} +
+                                input_file_name + ".");
+  }
+  FilePointer output{std::fopen(output_file_name, "wb")};
+  if (output == nullptr) {
+    return FaststartResult::Err(std::string{"Could not open "} +
+                                output_file_name + " for writing.");
+  }
+
+  Result<std::monostate, std::string> write_result =
+      WriteBoxes(headers, output_order, moov_index, moov.get(), input.get(),
+                 output.get());
+  bool const closed = std::fclose(output.release()) == 0;
+  if (write_result.IsErr() || !closed) {
+    std::remove(output_file_name);
+    if (write_result.IsErr()) {
+      write_result.MarkErrorHandled();
+      return FaststartResult::Err(std::move(write_result).GetErr());
+    }
+    return FaststartResult::Err(std::string{"Failed to finish writing "} +
+                                output_file_name + ".");
+  }
+
+  return FaststartResult::Ok(is_already_faststart
+                                 ? FaststartOutcome::kAlreadyFaststart
+                                 : FaststartOutcome::kRelocated);
+}
+
+}  // namespace mp4_manipulator::utility
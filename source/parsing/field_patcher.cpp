@@ -0,0 +1,253 @@
+#include "parsing/field_patcher.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "parsing/box_header_scanner.h"
+
+namespace mp4_manipulator::utility {
+namespace {
+using PatchResult = Result<std::monostate, std::string>;
+
+// The enabled bit of tkhd's flags.
+constexpr uint8_t kTrackEnabledFlag = 0x01;
+}  // namespace
+
+Result<std::unique_ptr<FieldPatcher>, std::string> FieldPatcher::Open(
+    char const* file_name) {
+#if defined(_WIN32)
+  int const descriptor = _open(file_name, _O_RDWR | _O_BINARY);
+#else
+  int const descriptor = open(file_name, O_RDWR);
+#endif
+  if (descriptor < 0) {
+    return Result<std::unique_ptr<FieldPatcher>, std::string>::Err(
+        std::string{"Could not open "} + file_name + " for patching.");
+  }
+  return Result<std::unique_ptr<FieldPatcher>, std::string>::Ok(
+      std::unique_ptr<FieldPatcher>{new FieldPatcher{descriptor}});
+}
+
+FieldPatcher::~FieldPatcher() {
+#if defined(_WIN32)
+  _close(descriptor_);
+#else
+  close(descriptor_);
+#endif
+}
+
+PatchResult FieldPatcher::SetTrackEnabled(AtomOrDescriptorBase const& tkhd,
+                                          bool enabled) {
+  Result<FullBoxHeader, std::string> header_result =
+      ReadFullBoxHeader(tkhd, AP4_ATOM_TYPE_TKHD);
+  if (header_result.IsErr()) {
+    header_result.MarkErrorHandled();
+    return PatchResult::Err(std::move(header_result).GetErr());
+  }
+  FullBoxHeader const& header = header_result.GetOk();
+  // The flags are the 3 bytes before the fields, the enabled bit is in the
+  // last of them.
+  uint64_t const flags_offset = header.fields_offset - 1;
+  uint8_t flags = 0;
+  if (!ReadAt(header.position + flags_offset, &flags, 1)) {
+    return PatchResult::Err("Failed to read tkhd's flags.");
+  }
+  flags = enabled ? (flags | kTrackEnabledFlag) : (flags & ~kTrackEnabledFlag);
+  return WriteWithinBox(header, flags_offset, &flags, 1);
+}
+
+PatchResult FieldPatcher::SetMediaLanguage(AtomOrDescriptorBase const& mdhd,
+                                           std::string const& language) {
+  if (language.size() != 3 ||
+      std::any_of(language.begin(), language.end(),
+                  [](char c) { return c < 'a' || c > 'z'; })) {
+    return PatchResult::Err(
+        "Languages are three lower case letters, e.g. \"eng\".");
+  }
+  Result<FullBoxHeader, std::string> header_result =
+      ReadFullBoxHeader(mdhd, AP4_ATOM_TYPE_MDHD);
+  if (header_result.IsErr()) {
+    header_result.MarkErrorHandled();
+    return PatchResult::Err(std::move(header_result).GetErr());
+  }
+  FullBoxHeader const& header = header_result.GetOk();
+  // After the creation and modification times, timescale and duration, which
+  // are 64-bit in version 1, other than the timescale.
+  uint64_t const language_offset =
+      header.fields_offset + (header.version == 1 ? 28 : 16);
+  // Each letter is stored in 5 bits, as its offset from 0x60.
+  uint16_t const packed =
+      static_cast<uint16_t>(((language[0] - 0x60) << 10) |
+                            ((language[1] - 0x60) << 5) | (language[2] - 0x60));
+  uint8_t const bytes[2] = {static_cast<uint8_t>(packed >> 8),
+                            static_cast<uint8_t>(packed & 0xff)};
+  return WriteWithinBox(header, language_offset, bytes, sizeof(bytes));
+}
+
+PatchResult FieldPatcher::SetMediaTimescale(AtomOrDescriptorBase const& mdhd,
+                                            uint32_t timescale) {
+  return SetTimescale(mdhd, AP4_ATOM_TYPE_MDHD, timescale);
+}
+
+PatchResult FieldPatcher::SetMovieTimescale(AtomOrDescriptorBase const& mvhd,
+                                            uint32_t timescale) {
+  return SetTimescale(mvhd, AP4_ATOM_TYPE_MVHD, timescale);
+}
+
+PatchResult FieldPatcher::SetTimescale(AtomOrDescriptorBase const& box,
+                                       AP4_Atom::Type type,
+                                       uint32_t timescale) {
+  if (timescale == 0) {
+    return PatchResult::Err("Timescales must be positive.");
+  }
+  Result<FullBoxHeader, std::string> header_result =
+      ReadFullBoxHeader(box, type);
+  if (header_result.IsErr()) {
+    header_result.MarkErrorHandled();
+    return PatchResult::Err(std::move(header_result).GetErr());
+  }
+  FullBoxHeader const& header = header_result.GetOk();
+  // mvhd and mdhd both start with the creation and modification times, which
+  // are 64-bit in version 1, then the timescale.
+  uint64_t const timescale_offset =
+      header.fields_offset + (header.version == 1 ? 16 : 8);
+  uint8_t bytes[4];
+  AP4_BytesFromUInt32BE(bytes, timescale);
+  return WriteWithinBox(header, timescale_offset, bytes, sizeof(bytes));
+}
+
+PatchResult FieldPatcher::SetEditListEntry(AtomOrDescriptorBase const& elst,
+                                           uint32_t index,
+                                           EditListEntry const& entry) {
+  Result<FullBoxHeader, std::string> header_result =
+      ReadFullBoxHeader(elst, AP4_ATOM_TYPE_ELST);
+  if (header_result.IsErr()) {
+    header_result.MarkErrorHandled();
+    return PatchResult::Err(std::move(header_result).GetErr());
+  }
+  FullBoxHeader const& header = header_result.GetOk();
+  uint8_t count_bytes[4];
+  if (!ReadAt(header.position + header.fields_offset, count_bytes,
+              sizeof(count_bytes))) {
+    return PatchResult::Err("Failed to read elst's entry count.");
+  }
+  uint32_t const entry_count = AP4_BytesToUInt32BE(count_bytes);
+  if (index >= entry_count) {
+    return PatchResult::Err("elst has " + std::to_string(entry_count) +
+                            " entries, so has no entry " +
+                            std::to_string(index) + ".");
+  }
+
+  bool const is_version_1 = header.version == 1;
+  size_t const entry_size = is_version_1 ? 20 : 12;
+  uint8_t bytes[20];
+  size_t time_size = 8;
+  if (is_version_1) {
+    AP4_BytesFromUInt64BE(&bytes[0], entry.segment_duration);
+    AP4_BytesFromUInt64BE(&bytes[8],
+                          static_cast<uint64_t>(entry.media_time));
+  } else {
+    if (entry.segment_duration > std::numeric_limits<uint32_t>::max() ||
+        entry.media_time < std::numeric_limits<int32_t>::min() ||
+        entry.media_time > std::numeric_limits<int32_t>::max()) {
+      return PatchResult::Err(
+          "The entry's times don't fit in a version 0 elst, which would have "
+          "to grow to hold them.");
+    }
+    time_size = 4;
+    AP4_BytesFromUInt32BE(&bytes[0],
+                          static_cast<uint32_t>(entry.segment_duration));
+    AP4_BytesFromUInt32BE(
+        &bytes[4],
+        static_cast<uint32_t>(static_cast<int32_t>(entry.media_time)));
+  }
+  AP4_BytesFromUInt32BE(&bytes[2 * time_size],
+                        static_cast<uint32_t>(entry.media_rate));
+  uint64_t const entry_offset =
+      header.fields_offset + sizeof(count_bytes) + index * entry_size;
+  return WriteWithinBox(header, entry_offset, bytes, entry_size);
+}
+
+Result<FieldPatcher::FullBoxHeader, std::string>
+FieldPatcher::ReadFullBoxHeader(AtomOrDescriptorBase const& box,
+                                AP4_Atom::Type type) {
+  using HeaderResult = Result<FullBoxHeader, std::string>;
+  std::string const type_name = FourCcToString(type);
+  std::optional<uint64_t> const position = box.GetPositionInStream();
+  if (!position.has_value()) {
+    return HeaderResult::Err("The position of " + type_name +
+                             " in the file isn't known.");
+  }
+  // Size and type, an optional 64-bit size, then version and flags.
+  uint8_t bytes[20];
+  if (!ReadAt(position.value(), bytes, 12)) {
+    return HeaderResult::Err("Failed to read the header of " + type_name +
+                             ".");
+  }
+  uint64_t size = AP4_BytesToUInt32BE(&bytes[0]);
+  uint32_t header_size = 8;
+  if (size == 1) {
+    if (!ReadAt(position.value(), bytes, sizeof(bytes))) {
+      return HeaderResult::Err("Failed to read the header of " + type_name +
+                               ".");
+    }
+    size = AP4_BytesToUInt64BE(&bytes[8]);
+    header_size = 16;
+  }
+  if (AP4_BytesToUInt32BE(&bytes[4]) != type || size != box.GetSize()) {
+    return HeaderResult::Err(
+        "The file doesn't have the " + type_name + " box the atom says it "
+        "has at offset " + std::to_string(position.value()) +
+        ", it may have been changed since it was read.");
+  }
+  return HeaderResult::Ok(FullBoxHeader{position.value(), size,
+                                        header_size + 4,
+                                        bytes[header_size]});
+}
+
+PatchResult FieldPatcher::WriteWithinBox(FullBoxHeader const& header,
+                                         uint64_t offset, uint8_t const* data,
+                                         size_t size) {
+  // The box keeps its size, so the write must lie within it.
+  if (offset + size > header.size) {
+    return PatchResult::Err("The field lies past the end of its box.");
+  }
+  if (!WriteAt(header.position + offset, data, size)) {
+    return PatchResult::Err("Failed to write the field.");
+  }
+  return PatchResult::Ok();
+}
+
+bool FieldPatcher::ReadAt(uint64_t offset, uint8_t* data, size_t size) {
+#if defined(_WIN32)
+  return _lseeki64(descriptor_, static_cast<__int64>(offset), SEEK_SET) >= 0 &&
+         _read(descriptor_, data, static_cast<unsigned int>(size)) ==
+             static_cast<int>(size);
+#else
+  return pread(descriptor_, data, size, static_cast<off_t>(offset)) ==
+         static_cast<ssize_t>(size);
+#endif
+}
+
+bool FieldPatcher::WriteAt(uint64_t offset, uint8_t const* data,
+                           size_t size) {
+#if defined(_WIN32)
+  return _lseeki64(descriptor_, static_cast<__int64>(offset), SEEK_SET) >= 0 &&
+         _write(descriptor_, data, static_cast<unsigned int>(size)) ==
+             static_cast<int>(size);
+#else
+  return pwrite(descriptor_, data, size, static_cast<off_t>(offset)) ==
+         static_cast<ssize_t>(size);
+#endif
+}
+
+}  // namespace mp4_manipulator::utility
@@ -0,0 +1,174 @@
+#include "parsing/file_range_copy.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#include "parsing/resource_deleters.h"
+
+namespace mp4_manipulator::utility {
+namespace {
+// Size of the buffer used when the kernel can't do the copy.
+constexpr size_t kCopyBufferSize = 1 << 20;
+
+#if defined(__linux__)
+// The most we ask the kernel to copy in one call. Large enough that the call
+// overhead is negligible, and below the limits some kernels place on a single
+// call.
+constexpr uint64_t kMaxKernelCopySize = 1 << 30;
+
+// Copies as much of the range as possible with `copy_file_range`. Advances
+// `input_offset` and decreases `length` by the amount copied. Leaves the rest
+// of the range to be copied by the caller if the kernel can't copy between the
+// files (e.g. they're on different file systems on older kernels).
+Result<std::monostate, std::string> KernelCopyFileRange(std::FILE* input,
+                                                        uint64_t& input_offset,
+                                                        uint64_t& length,
+                                                        std::FILE* output) {
+  using CopyResult = Result<std::monostate, std::string>;
+  // The kernel writes to the file directly, so anything still buffered in
+  // `output` has to go first.
+  if (std::fflush(output) != 0) {
+    return CopyResult::Err("Failed to flush output file.");
+  }
+  int64_t const output_position = TellFile(output);
+  if (output_position < 0) {
+    return CopyResult::Err("Failed to get output file position.");
+  }
+  loff_t in_offset = static_cast<loff_t>(input_offset);
+  loff_t out_offset = static_cast<loff_t>(output_position);
+  while (length > 0) {
+    ssize_t const copied = copy_file_range(
+        fileno(input), &in_offset, fileno(output), &out_offset,
+        static_cast<size_t>(std::min(length, kMaxKernelCopySize)), 0);
+    if (copied < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+          errno == EOPNOTSUPP) {
+        // Fall back to a buffered copy for the rest of the range.
+        break;
+      }
+      return CopyResult::Err("copy_file_range failed with errno " +
+                             std::to_string(errno) + ".");
+    }
+    if (copied == 0) {
+      return CopyResult::Err("Input file ended before the end of the range.");
+    }
+    length -= static_cast<uint64_t>(copied);
+  }
+  input_offset = static_cast<uint64_t>(in_offset);
+  // The offsets passed to copy_file_range don't move the file position, so
+  // move it past what was copied.
+  if (!SeekFile(output, static_cast<uint64_t>(out_offset))) {
+    return CopyResult::Err("Failed to seek output file.");
+  }
+  return CopyResult::Ok();
+}
+#endif
+}  // namespace
+
+Result<std::monostate, std::string> CopyFileRange(std::FILE* input,
+                                                  uint64_t input_offset,
+                                                  uint64_t length,
+                                                  std::FILE* output) {
+  using CopyResult = Result<std::monostate, std::string>;
+#if defined(__linux__)
+  CopyResult kernel_result =
+      KernelCopyFileRange(input, input_offset, length, output);
+  if (kernel_result.IsErr() || length == 0) {
+    return kernel_result;
+  }
+#endif
+
+  if (!SeekFile(input, input_offset)) {
+    return CopyResult::Err("Failed to seek input file.");
+  }
+  std::vector<char> buffer(
+      static_cast<size_t>(std::min<uint64_t>(length, kCopyBufferSize)));
+  while (length > 0) {
+    size_t const chunk_size =
+        static_cast<size_t>(std::min<uint64_t>(length, buffer.size()));
+    if (std::fread(buffer.data(), 1, chunk_size, input) != chunk_size) {
+      return CopyResult::Err("Input file ended before the end of the range.");
+    }
+    if (std::fwrite(buffer.data(), 1, chunk_size, output) != chunk_size) {
+      return CopyResult::Err("Failed to write to output file.");
+    }
+    length -= chunk_size;
+  }
+  return CopyResult::Ok();
+}
+
+Result<std::monostate, std::string> CloneFile(char const* input_file_name,
+                                              char const* output_file_name) {
+  using CloneResult = Result<std::monostate, std::string>;
+  // Opening the output would truncate the input.
+  std::error_code error_code;
+  if (std::filesystem::equivalent(input_file_name, output_file_name,
+                                  error_code)) {
+    return CloneResult::Err("The copy must be a different file.");
+  }
+  FilePointer input{std::fopen(input_file_name, "rb")};
+  if (input == nullptr) {
+    return CloneResult::Err(std::string{"Could not open "} + input_file_name +
+                            ".");
+  }
+  FilePointer output{std::fopen(output_file_name, "wb")};
+  if (output == nullptr) {
+    return CloneResult::Err(std::string{"Could not open "} +
+                            output_file_name + " for writing.");
+  }
+#if defined(FICLONE)
+  if (ioctl(fileno(output.get()), FICLONE, fileno(input.get())) == 0) {
+    return CloneResult::Ok();
+  }
+#endif
+
+  if (std::fseek(input.get(), 0, SEEK_END) != 0) {
+    return CloneResult::Err("Failed to seek input file.");
+  }
+  int64_t const size = TellFile(input.get());
+  if (size < 0) {
+    return CloneResult::Err("Failed to get input file size.");
+  }
+  CloneResult result = CopyFileRange(input.get(), 0,
+                                     static_cast<uint64_t>(size), output.get());
+  bool const closed = std::fclose(output.release()) == 0;
+  if (result.IsErr() || !closed) {
+    std::remove(output_file_name);
+    if (result.IsErr()) {
+      return result;
+    }
+    return CloneResult::Err(std::string{"Failed to finish writing "} +
+                            output_file_name + ".");
+  }
+  return CloneResult::Ok();
+}
+
+bool SeekFile(std::FILE* file, uint64_t offset) {
+#if defined(_WIN32)
+  return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+  return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+int64_t TellFile(std::FILE* file) {
+#if defined(_WIN32)
+  return _ftelli64(file);
+#else
+  return ftello(file);
+#endif
+}
+
+}  // namespace mp4_manipulator::utility
@@ -1,10 +1,22 @@
 #include "parsing/file_utils.h"
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <thread>
 
 #include "Ap4.h"
+#include "parallel/work_stealing_pool.h"
 #include "parsing/atom_inspector.h"
+#include "parsing/box_header_scanner.h"
+#include "parsing/box_resync.h"
 #include "parsing/position_aware_atom_factory.h"
+#include "parsing/skipped_atom.h"
+#include "parsing/unparsed_atom.h"
+#include "profiling/allocation_profiler.h"
 
 namespace mp4_manipulator::utility {
 namespace {
@@ -37,22 +49,61 @@ void RecursiveSetAtomPositions(
 void SetAtomPositions(
     AtomHolder& atom_holder,
     std::unordered_map<AP4_Atom*, uint64_t> const& atom_to_position_map) {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kMatch, "utility::SetAtomPositions");
   for (auto& child_atom : atom_holder.GetTopLevelAtoms()) {
     RecursiveSetAtomPositions(child_atom.get(), atom_to_position_map);
   }
 }
-}  // namespace
 
-std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(AP4_ByteStream* input) {
-  std::unique_ptr<AtomInspector> inspector = std::make_unique<AtomInspector>();
+// Top level boxes that are cheap to parse regardless of size, as AP4 doesn't
+// load their payloads.
+bool IsCheapToParse(AP4_Atom::Type type) {
+  return type == AP4_ATOM_TYPE_MDAT || type == AP4_ATOM_TYPE_FREE ||
+         type == AP4_ATOM_TYPE_SKIP;
+}
+
+// A byte range of consecutive top level boxes.
+struct Range {
+  uint64_t offset;
+  uint64_t size;
+};
+
+// The atoms parsed from a range of top level boxes.
+struct ParsedRange {
+  std::vector<std::unique_ptr<AtomOrDescriptorBase>> inspected_atoms;
+  std::vector<std::unique_ptr<AP4_Atom>> ap4_atoms;
+  std::unordered_map<AP4_Atom*, uint64_t> atom_to_position_map;
+  std::unique_ptr<AtomSearchIndex> search_index;
+  // True if parsing stopped before the end of the range.
+  bool stopped_early{false};
+};
+
+// Parses and inspects (to `depth`) the top level atoms in the next
+// `bytes_to_parse` bytes of `input`, or until parsing fails.
+ParsedRange ParseRange(AP4_ByteStream& input, AP4_LargeSize bytes_to_parse,
+                       InspectionDepth depth) {
+  ParsedRange parsed_range;
+  std::unique_ptr<AtomInspector> inspector =
+      std::make_unique<AtomInspector>(depth);
+  // Index the atoms as they're inspected, so they can be searched without
+  // walking the tree.
+  parsed_range.search_index = std::make_unique<AtomSearchIndex>();
+  inspector->SetSearchIndex(parsed_range.search_index.get());
   // Grab top level atoms, store and inspect them.
   AP4_Atom* atom;
   PositionAwareAtomFactory atom_factory;
   // We want virtual functions to be used, so grab a ptr.
   AP4_AtomFactory* atom_factory_ptr =
       static_cast<AP4_AtomFactory*>(&atom_factory);
-  std::vector<std::unique_ptr<AP4_Atom>> top_level_ap4_atoms;
-  while (atom_factory_ptr->CreateAtomFromStream(*input, atom) == AP4_SUCCESS) {
+  while (bytes_to_parse > 0) {
+    {
+      MP4_MANIPULATOR_ALLOCATION_PHASE(
+          kParse, "PositionAwareAtomFactory::CreateAtomFromStream");
+      if (atom_factory_ptr->CreateAtomFromStream(input, bytes_to_parse,
+                                                 atom) != AP4_SUCCESS) {
+        break;
+      }
+    }
     // This AP4_Position code if from the mp4 dump source. There it's suggested
     // that inspect could change the stream position so that this is needed.
     // It's not clear that it is... The code is kept in case uncommenting it
@@ -61,26 +112,292 @@ std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(AP4_ByteStream* input) {
     // input->Tell(position);
 
     // inspect the atom
-    atom->Inspect(*inspector);
+    {
+      MP4_MANIPULATOR_ALLOCATION_PHASE(kInspect, "AP4_Atom::Inspect");
+      atom->Inspect(*inspector);
+    }
 
     // restore the previous stream position
     // input->Seek(position);
 
-    top_level_ap4_atoms.emplace_back(std::unique_ptr<AP4_Atom>(atom));
+    parsed_range.ap4_atoms.emplace_back(std::unique_ptr<AP4_Atom>(atom));
   }
+  // Streams of unknown size report a huge size, which we'll never reach, so
+  // only a failure part way through a known size counts as stopping early.
+  parsed_range.stopped_early =
+      bytes_to_parse > 0 &&
+      bytes_to_parse != std::numeric_limits<AP4_LargeSize>::max();
 
-  std::unique_ptr<AtomHolder> holder = std::make_unique<AtomHolder>(
-      std::move(inspector->TakeAtoms()), std::move(top_level_ap4_atoms));
+  parsed_range.inspected_atoms = inspector->TakeAtoms();
+  parsed_range.atom_to_position_map = atom_factory.TakeAtomToPositionMap();
+  return parsed_range;
+}
+
+// Moves the atoms of `next_range`, which directly follows `range` in the
+// stream, onto the end of `range`.
+void AppendParsedRange(ParsedRange& range, ParsedRange&& next_range) {
+  std::move(next_range.inspected_atoms.begin(),
+            next_range.inspected_atoms.end(),
+            std::back_inserter(range.inspected_atoms));
+  std::move(next_range.ap4_atoms.begin(), next_range.ap4_atoms.end(),
+            std::back_inserter(range.ap4_atoms));
+  range.atom_to_position_map.merge(next_range.atom_to_position_map);
+  range.search_index->Append(std::move(*next_range.search_index));
+  range.stopped_early = next_range.stopped_early;
+}
+
+// Returns the number of bytes covered by the atoms in `parsed_range`.
+uint64_t GetParsedSize(ParsedRange const& parsed_range) {
+  uint64_t size = 0;
+  for (std::unique_ptr<AP4_Atom> const& atom : parsed_range.ap4_atoms) {
+    size += atom->GetSize();
+  }
+  return size;
+}
+
+// Inspects `atom`, which wasn't created by parsing (e.g. an UnparsedAtom),
+// and adds it to the end of `parsed_range` at `offset`.
+void AppendSyntheticAtom(ParsedRange& parsed_range,
+                         std::unique_ptr<AP4_Atom>&& atom, uint64_t offset) {
+  AtomInspector inspector;
+  inspector.SetSearchIndex(parsed_range.search_index.get());
+  atom->Inspect(inspector);
+  std::vector<std::unique_ptr<AtomOrDescriptorBase>> inspected_atoms =
+      inspector.TakeAtoms();
+  assert(inspected_atoms.size() == 1);
+  parsed_range.inspected_atoms.push_back(std::move(inspected_atoms.front()));
+  parsed_range.atom_to_position_map[atom.get()] = offset;
+  parsed_range.ap4_atoms.push_back(std::move(atom));
+}
+
+// Adds an UnparsedAtom covering `size` bytes of `input` from `offset` to the
+// end of `parsed_range`.
+void AppendUnparsedAtom(ParsedRange& parsed_range, AP4_ByteStream& input,
+                        uint64_t offset, uint64_t size,
+                        std::string const& reason) {
+  AppendSyntheticAtom(
+      parsed_range,
+      std::make_unique<UnparsedAtom>(input, offset, size, reason), offset);
+}
 
-  std::unordered_map<AP4_Atom*, uint64_t> const atom_to_position_map =
-      atom_factory.TakeAtomToPositionMap();
+// Parses `size` bytes of `input` from `offset` like ParseRange, but if a box
+// can't be parsed (e.g. its size is corrupt, or it's truncated) searches
+// forward for the next plausible box and carries on parsing from there. The
+// skipped bytes are represented by UnparsedAtoms, so the result always covers
+// the whole range, and a damaged box doesn't hide the rest of the file.
+ParsedRange ParseRangeRecovering(AP4_ByteStream& input, uint64_t offset,
+                                 uint64_t size, InspectionDepth depth) {
+  uint64_t const end_offset = offset + size;
+  ParsedRange parsed_range;
+  if (AP4_SUCCEEDED(input.Seek(offset))) {
+    parsed_range = ParseRange(input, size, depth);
+  } else {
+    parsed_range.search_index = std::make_unique<AtomSearchIndex>();
+    parsed_range.stopped_early = true;
+  }
+  uint64_t parsed_end_offset = offset + GetParsedSize(parsed_range);
+  while (parsed_range.stopped_early && parsed_end_offset < end_offset) {
+    uint64_t const failed_offset = parsed_end_offset;
+    std::optional<uint64_t> resume_offset;
+    {
+      MP4_MANIPULATOR_ALLOCATION_PHASE(kParse, "utility::FindNextPlausibleBox");
+      resume_offset =
+          FindNextPlausibleBox(input, failed_offset + 1, end_offset);
+    }
+    uint64_t const unparsed_end_offset = resume_offset.value_or(end_offset);
+    AppendUnparsedAtom(
+        parsed_range, input, failed_offset,
+        unparsed_end_offset - failed_offset,
+        resume_offset.has_value()
+            ? "The box here could not be parsed, skipped to the next "
+              "plausible box."
+            : "The box here could not be parsed, and no plausible boxes "
+              "follow it. The file may be truncated.");
+    parsed_range.stopped_early = false;
+    if (!resume_offset.has_value() ||
+        AP4_FAILED(input.Seek(resume_offset.value()))) {
+      break;
+    }
+    ParsedRange resumed_range =
+        ParseRange(input, end_offset - resume_offset.value(), depth);
+    parsed_end_offset = resume_offset.value() + GetParsedSize(resumed_range);
+    AppendParsedRange(parsed_range, std::move(resumed_range));
+  }
+  return parsed_range;
+}
 
-  SetAtomPositions(*holder, atom_to_position_map);
+// Joins consecutive parsed ranges into a holder. Ranges come from
+// ParseRangeRecovering, which covers the whole of its range and holds any
+// bytes it couldn't parse as UnparsedAtoms, so every range is joined and a
+// damaged box doesn't hide the ranges after it. Only a plain ParseRange, used
+// for a stream of unknown size, which is a single range, stops early and
+// leaves the rest of the stream out of the holder.
+std::unique_ptr<AtomHolder> MakeAtomHolder(
+    std::vector<ParsedRange>&& parsed_ranges) {
+  assert(!parsed_ranges.empty());
+  ParsedRange& first_range = parsed_ranges.front();
+  for (size_t i = 1; i < parsed_ranges.size() && !first_range.stopped_early;
+       ++i) {
+    AppendParsedRange(first_range, std::move(parsed_ranges.at(i)));
+  }
 
+  std::unique_ptr<AtomHolder> holder = std::make_unique<AtomHolder>(
+      std::move(first_range.inspected_atoms),
+      std::move(first_range.ap4_atoms), std::move(first_range.search_index));
+  SetAtomPositions(*holder, first_range.atom_to_position_map);
   return holder;
 }
 
-std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(char const* file_name) {
+// Splits the top level boxes of `input` into a few ranges per thread, balanced
+// by how much parsing each range needs. Returns no ranges if the file is too
+// small to be worth parsing in parallel, and nullopt if the top level boxes
+// can't be scanned, e.g. because the file is corrupt.
+std::optional<std::vector<Range>> PartitionTopLevelBoxes(
+    AP4_ByteStream& input, size_t thread_count) {
+  // More ranges than threads lets threads that finish early steal work from
+  // those that got expensive ranges.
+  constexpr size_t kRangesPerThread = 4;
+  // Even cheap boxes take some work, so they aren't weighted as free.
+  constexpr uint64_t kMinimumBoxWeight = 4096;
+  // Below this, starting threads costs more than parsing in parallel saves.
+  constexpr uint64_t kMinimumParallelWeight = 4 * 1024 * 1024;
+
+  Result<std::vector<BoxHeader>, std::string> scan_result =
+      ScanTopLevelBoxHeaders(input);
+  if (scan_result.IsErr()) {
+    scan_result.MarkErrorHandled();
+    return std::nullopt;
+  }
+  std::vector<BoxHeader> const headers = std::move(scan_result).GetOk();
+
+  auto const weight = [](BoxHeader const& header) {
+    return IsCheapToParse(header.type)
+               ? kMinimumBoxWeight
+               : std::max(header.size, kMinimumBoxWeight);
+  };
+  uint64_t total_weight = 0;
+  for (BoxHeader const& header : headers) {
+    total_weight += weight(header);
+  }
+  if (total_weight < kMinimumParallelWeight) {
+    return std::vector<Range>{};
+  }
+  size_t const range_count =
+      std::min(headers.size(), thread_count * kRangesPerThread);
+  uint64_t const weight_per_range =
+      range_count == 0 ? 0 : total_weight / range_count;
+
+  std::vector<Range> ranges;
+  uint64_t range_weight = 0;
+  for (BoxHeader const& header : headers) {
+    if (ranges.empty() || range_weight >= weight_per_range) {
+      ranges.push_back({header.offset, 0});
+      range_weight = 0;
+    }
+    ranges.back().size += header.size;
+    range_weight += weight(header);
+  }
+  return ranges;
+}
+
+// Parses `ranges` of `file_name` in parallel, each with its own inspector and
+// search index, then stitches the results together in order.
+std::optional<std::unique_ptr<AtomHolder>> ReadRangesInParallel(
+    char const* file_name, std::vector<Range> const& ranges,
+    size_t thread_count, InspectionDepth depth) {
+  parallel::WorkStealingPool pool{std::min(thread_count, ranges.size())};
+  // Each worker reads through its own stream, so workers never contend on a
+  // stream's position. Atoms that reference their stream (e.g. mdat) keep
+  // their worker's stream alive after we release ours.
+  std::vector<AP4_ByteStream*> worker_streams(pool.GetWorkerCount(), nullptr);
+  std::vector<ParsedRange> parsed_ranges(ranges.size());
+  std::atomic<bool> open_failed{false};
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    pool.Submit([&, i](size_t worker_index) {
+      AP4_ByteStream*& stream = worker_streams.at(worker_index);
+      if (stream == nullptr &&
+          AP4_FAILED(AP4_FileByteStream::Create(
+              file_name, AP4_FileByteStream::STREAM_MODE_READ, stream))) {
+        stream = nullptr;
+        open_failed = true;
+        return;
+      }
+      Range const& range = ranges.at(i);
+      parsed_ranges.at(i) =
+          ParseRangeRecovering(*stream, range.offset, range.size, depth);
+    });
+  }
+  pool.Wait();
+
+  for (AP4_ByteStream* stream : worker_streams) {
+    if (stream != nullptr) {
+      stream->Release();
+    }
+  }
+  if (open_failed) {
+    fprintf(stderr, "ERROR: cannot open input file %s\n", file_name);
+    return std::nullopt;
+  }
+  return MakeAtomHolder(std::move(parsed_ranges));
+}
+
+// Reads up to `size` bytes from `input`, stopping early only at the end of
+// the stream or on an error. Returns the number of bytes read.
+size_t ReadFully(FILE* input, void* buffer, size_t size) {
+  size_t total_read = 0;
+  while (total_read < size) {
+    size_t const read = fread(static_cast<uint8_t*>(buffer) + total_read, 1,
+                              size - total_read, input);
+    if (read == 0) {
+      break;
+    }
+    total_read += read;
+  }
+  return total_read;
+}
+
+// Reads and discards up to `size` bytes from `input`. Returns the number of
+// bytes skipped, which is less than `size` at the end of the stream.
+uint64_t SkipBytes(FILE* input, uint64_t size) {
+  constexpr size_t kSkipBufferSize = 1024 * 1024;
+  std::vector<uint8_t> buffer(
+      static_cast<size_t>(std::min<uint64_t>(size, kSkipBufferSize)));
+  uint64_t skipped = 0;
+  while (skipped < size) {
+    size_t const to_read =
+        static_cast<size_t>(std::min<uint64_t>(size - skipped, buffer.size()));
+    size_t const read = ReadFully(input, buffer.data(), to_read);
+    skipped += read;
+    if (read < to_read) {
+      break;
+    }
+  }
+  return skipped;
+}
+}  // namespace
+
+std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(
+    AP4_ByteStream* input,
+    InspectionDepth depth /* = InspectionDepth::kSummary */) {
+  AP4_LargeSize stream_size = 0;
+  AP4_Position position = 0;
+  std::vector<ParsedRange> parsed_ranges;
+  if (AP4_SUCCEEDED(input->GetSize(stream_size)) && stream_size != 0 &&
+      AP4_SUCCEEDED(input->Tell(position)) && position <= stream_size) {
+    parsed_ranges.push_back(ParseRangeRecovering(
+        *input, position, stream_size - position, depth));
+  } else {
+    // Without a known size there's no end to search for boxes up to, so
+    // parse until parsing fails.
+    parsed_ranges.push_back(ParseRange(
+        *input, std::numeric_limits<AP4_LargeSize>::max(), depth));
+  }
+  return MakeAtomHolder(std::move(parsed_ranges));
+}
+
+std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(
+    char const* file_name, size_t thread_count /* = 0 */,
+    InspectionDepth depth /* = InspectionDepth::kSummary */) {
   // We don't bother using a file approach, because the atoms are not in the
   // same order as if the boxes are streamed. An example of how to use AP4's
   // file API is shown below, but again, we don't want to do this.
@@ -97,26 +414,220 @@ std::optional<std::unique_ptr<AtomHolder>> ReadAtoms(char const* file_name) {
     return std::nullopt;
   }
 
-  // TODO(bryce): error handle this with a Result.
-  std::optional<std::unique_ptr<AtomHolder>> holder = ReadAtoms(input);
+  if (thread_count == 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::optional<std::vector<Range>> ranges;
+  if (thread_count > 1) {
+    ranges = PartitionTopLevelBoxes(*input, thread_count);
+  }
+  if (!ranges.has_value() || ranges->size() < 2) {
+    // Not worth (or not possible) parsing in parallel, e.g. the file is
+    // corrupt, so parse it in one go.
+    input->Seek(0);
+    // TODO(bryce): error handle this with a Result.
+    std::optional<std::unique_ptr<AtomHolder>> holder =
+        ReadAtoms(input, depth);
+    input->Release();
+    return holder;
+  }
+  // Each worker opens its own stream, the scanning stream isn't needed.
   input->Release();
-  return holder;
+  return ReadRangesInParallel(file_name, ranges.value(), thread_count,
+                              depth);
+}
+
+std::optional<std::unique_ptr<AtomHolder>> ReadAppendedAtoms(
+    AP4_ByteStream& input, uint64_t offset, uint64_t& end_offset) {
+  end_offset = offset;
+  Result<std::vector<BoxHeader>, std::string> scan_result =
+      ScanTopLevelBoxHeaders(input, offset, TruncatedBoxHandling::kStop);
+  if (scan_result.IsErr()) {
+    scan_result.MarkErrorHandled();
+    return std::nullopt;
+  }
+  std::vector<BoxHeader> const headers = std::move(scan_result).GetOk();
+  uint64_t bytes_to_parse = 0;
+  for (BoxHeader const& header : headers) {
+    bytes_to_parse += header.size;
+  }
+
+  std::vector<ParsedRange> parsed_ranges;
+  if (bytes_to_parse > 0 && AP4_SUCCEEDED(input.Seek(offset))) {
+    parsed_ranges.push_back(
+        ParseRange(input, bytes_to_parse, InspectionDepth::kSummary));
+  } else {
+    parsed_ranges.emplace_back();
+    parsed_ranges.back().search_index = std::make_unique<AtomSearchIndex>();
+  }
+  // Only advance past the atoms that were parsed, so a failed parse isn't
+  // skipped over.
+  for (std::unique_ptr<AP4_Atom> const& atom : parsed_ranges.back().ap4_atoms) {
+    end_offset += atom->GetSize();
+  }
+  return MakeAtomHolder(std::move(parsed_ranges));
 }
 
-void DumpAtom(char const* output_file_name, AP4_Atom& atom) {
+std::optional<std::unique_ptr<AtomHolder>> ReadTopLevelAtom(
+    AP4_ByteStream& input, AP4_Atom::Type type,
+    InspectionDepth depth /* = InspectionDepth::kSummary */) {
+  // A box cut off by the end of the file, e.g. an mdat still being written,
+  // doesn't matter as long as the wanted box is before it.
+  Result<std::vector<BoxHeader>, std::string> scan_result =
+      ScanTopLevelBoxHeaders(input, 0, TruncatedBoxHandling::kStop);
+  if (scan_result.IsErr()) {
+    scan_result.MarkErrorHandled();
+    return std::nullopt;
+  }
+  std::vector<BoxHeader> const& headers = scan_result.GetOk();
+  auto const header =
+      std::find_if(headers.begin(), headers.end(),
+                   [type](BoxHeader const& box) { return box.type == type; });
+  if (header == headers.end() || AP4_FAILED(input.Seek(header->offset))) {
+    return std::nullopt;
+  }
+  std::vector<ParsedRange> parsed_ranges;
+  parsed_ranges.push_back(ParseRange(input, header->size, depth));
+  if (parsed_ranges.back().ap4_atoms.empty()) {
+    return std::nullopt;
+  }
+  return MakeAtomHolder(std::move(parsed_ranges));
+}
+
+Result<std::unique_ptr<AtomHolder>, std::string> ReadAtomsFromPipe(
+    FILE* input, StreamingReadOptions const& options) {
+  using ReadResult = Result<std::unique_ptr<AtomHolder>, std::string>;
+  constexpr size_t kCompactHeaderSize = 8;
+  constexpr size_t kLargeHeaderSize = 16;
+  // Boxes are parsed from an AP4_MemoryByteStream, whose size is 32 bit.
+  uint64_t const max_buffered_box_size = std::min<uint64_t>(
+      options.max_buffered_box_size, std::numeric_limits<AP4_Size>::max());
+
+  ParsedRange parsed_range;
+  parsed_range.search_index = std::make_unique<AtomSearchIndex>();
+  std::vector<uint8_t> box;
+  uint64_t offset = 0;
+  while (true) {
+    uint8_t header[kLargeHeaderSize];
+    size_t const header_read = ReadFully(input, header, kCompactHeaderSize);
+    if (ferror(input)) {
+      return ReadResult::Err("Failed to read from the stream.");
+    }
+    if (header_read == 0) {
+      break;
+    }
+    if (header_read < kCompactHeaderSize) {
+      return ReadResult::Err("The stream ends within a box header at " +
+                             std::to_string(offset) + ".");
+    }
+    uint32_t const size_32 = AP4_BytesToUInt32BE(header);
+    AP4_Atom::Type const type = AP4_BytesToUInt32BE(header + 4);
+    size_t header_size = kCompactHeaderSize;
+    uint64_t size = size_32;
+    // A size of 0 means the box extends to the end of the stream, which we
+    // don't know yet.
+    bool const extends_to_end = size_32 == 0;
+    if (size_32 == 1) {
+      if (ReadFully(input, header + kCompactHeaderSize, kCompactHeaderSize) <
+          kCompactHeaderSize) {
+        return ReadResult::Err("The stream ends within a box header at " +
+                               std::to_string(offset) + ".");
+      }
+      header_size = kLargeHeaderSize;
+      size = AP4_BytesToUInt64BE(header + 8);
+    }
+    if (!extends_to_end && size < header_size) {
+      return ReadResult::Err("Box " + FourCcToString(type) + " at " +
+                             std::to_string(offset) + " has invalid size " +
+                             std::to_string(size) + ".");
+    }
+
+    if (extends_to_end || IsCheapToParse(type) ||
+        size > max_buffered_box_size) {
+      uint64_t const payload_size =
+          extends_to_end ? std::numeric_limits<uint64_t>::max()
+                         : size - header_size;
+      uint64_t const skipped = SkipBytes(input, payload_size);
+      if (ferror(input)) {
+        return ReadResult::Err("Failed to read from the stream.");
+      }
+      std::string note = options.skipped_note;
+      if (extends_to_end) {
+        size = header_size + skipped;
+      } else if (skipped < payload_size) {
+        note = "Truncated, the stream ended after " +
+               std::to_string(header_size + skipped) + " bytes.";
+      }
+      AppendSyntheticAtom(parsed_range,
+                          std::make_unique<SkippedAtom>(
+                              type, size, header_size == kLargeHeaderSize,
+                              std::move(note)),
+                          offset);
+      if (extends_to_end || skipped < payload_size) {
+        break;
+      }
+      offset += size;
+      continue;
+    }
+
+    box.resize(static_cast<size_t>(size));
+    std::copy(header, header + header_size, box.begin());
+    size_t const payload_size = box.size() - header_size;
+    size_t const payload_read =
+        ReadFully(input, box.data() + header_size, payload_size);
+    if (ferror(input)) {
+      return ReadResult::Err("Failed to read from the stream.");
+    }
+    if (payload_read < payload_size) {
+      AppendSyntheticAtom(
+          parsed_range,
+          std::make_unique<SkippedAtom>(
+              type, size, header_size == kLargeHeaderSize,
+              "Truncated, the stream ended after " +
+                  std::to_string(header_size + payload_read) + " bytes."),
+          offset);
+      break;
+    }
+
+    AP4_MemoryByteStream* box_stream = new AP4_MemoryByteStream{
+        box.data(), static_cast<AP4_Size>(box.size())};
+    ParsedRange box_range =
+        ParseRange(*box_stream, box.size(), options.inspection_depth);
+    box_stream->Release();
+    if (box_range.ap4_atoms.size() != 1 || box_range.stopped_early) {
+      return ReadResult::Err("Failed to parse box " + FourCcToString(type) +
+                             " at " + std::to_string(offset) + ".");
+    }
+    // Positions are relative to the box's own stream.
+    for (auto& [atom, position] : box_range.atom_to_position_map) {
+      position += offset;
+    }
+    AppendParsedRange(parsed_range, std::move(box_range));
+    offset += size;
+  }
+
+  std::vector<ParsedRange> parsed_ranges;
+  parsed_ranges.push_back(std::move(parsed_range));
+  return ReadResult::Ok(MakeAtomHolder(std::move(parsed_ranges)));
+}
+
+Result<std::monostate, std::string> DumpAtom(char const* output_file_name,
+                                             AP4_Atom& atom) {
+  using DumpResult = Result<std::monostate, std::string>;
   AP4_ByteStream* output = nullptr;
   AP4_Result result = AP4_FileByteStream::Create(
       output_file_name, AP4_FileByteStream::STREAM_MODE_WRITE, output);
   if (AP4_FAILED(result)) {
-    // fprintf(stderr, "ERROR: cannot open output file (%s)\n",
-    // output_filename);
-    // TODO(bryce): error handling
-    return;
+    return DumpResult::Err(std::string{"Failed to open "} + output_file_name +
+                           ".");
   }
 
-  atom.Write(*output);
-
-  // cleanup
+  result = atom.Write(*output);
   output->Release();
+  if (AP4_FAILED(result)) {
+    return DumpResult::Err(std::string{"Failed to write "} +
+                           output_file_name + ".");
+  }
+  return DumpResult::Ok();
 }
 }  // namespace mp4_manipulator::utility
@@ -0,0 +1,687 @@
+#include "parsing/fragmenting.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "Ap4.h"
+#include "parsing/box_header_scanner.h"
+#include "parsing/file_range_copy.h"
+#include "parsing/resource_deleters.h"
+#include "profiling/allocation_profiler.h"
+
+namespace mp4_manipulator::utility {
+namespace {
+using FragmentingResult = Result<FragmentingSummary, std::string>;
+
+// Sample flags (ISO/IEC 14496-12 8.8.3.1) for sync samples, which don't
+// depend on other samples, and for other samples, which do and are marked as
+// non sync.
+constexpr uint32_t kSyncSampleFlags = 0x02000000;
+constexpr uint32_t kNonSyncSampleFlags = 0x01010000;
+
+// A sample of a progressive track, as found by SampleCursor.
+struct Sample {
+  uint64_t offset;
+  uint64_t dts;
+  uint32_t size;
+  uint32_t duration;
+  int32_t composition_offset;
+  bool is_sync;
+};
+
+// Walks the sample tables of a track in decode order, one sample at a time.
+// The tables are read where they are rather than being expanded, so this
+// takes constant memory and time per sample however long the track is.
+class SampleCursor {
+ public:
+  // Returns an error if `tables` is missing a required table, or its tables
+  // disagree on the number of samples. `tables` must outlive the cursor.
+  static Result<SampleCursor, std::string> Create(AP4_ContainerAtom& tables,
+                                                  uint32_t track_id);
+
+  // Returns true once all samples have been visited.
+  [[nodiscard]] bool IsDone() const { return sample_ > sample_count_; }
+
+  // Returns the current sample. Must not be called once IsDone.
+  [[nodiscard]] Sample const& Get() const {
+    assert(!IsDone());
+    return current_;
+  }
+
+  // Moves to the next sample.
+  void Advance();
+
+ private:
+  SampleCursor() = default;
+
+  [[nodiscard]] uint64_t GetChunkOffset(AP4_Ordinal chunk) const;
+  [[nodiscard]] uint32_t GetSampleSize(AP4_Ordinal sample) const;
+  // Fills in `current_` for `sample_`.
+  void Load();
+
+  AP4_StcoAtom* stco_{nullptr};
+  AP4_Co64Atom* co64_{nullptr};
+  AP4_StszAtom* stsz_{nullptr};
+  AP4_Stz2Atom* stz2_{nullptr};
+  AP4_Array<AP4_StscTableEntry>* stsc_entries_{nullptr};
+  AP4_Array<AP4_SttsTableEntry>* stts_entries_{nullptr};
+  // Optional, without ctts there are no composition offsets, and without
+  // stss every sample is a sync sample.
+  AP4_Array<AP4_CttsTableEntry>* ctts_entries_{nullptr};
+  AP4_Array<AP4_UI32> const* stss_entries_{nullptr};
+  uint32_t sample_count_{0};
+
+  // 1-based number of the current sample.
+  uint32_t sample_{1};
+  AP4_Ordinal chunk_{1};
+  AP4_Ordinal stsc_index_{0};
+  uint32_t sample_in_chunk_{0};
+  uint64_t offset_{0};
+  AP4_Ordinal stts_index_{0};
+  uint32_t stts_used_{0};
+  uint64_t dts_{0};
+  AP4_Ordinal ctts_index_{0};
+  uint32_t ctts_used_{0};
+  AP4_Ordinal stss_index_{0};
+  Sample current_{};
+};
+
+Result<SampleCursor, std::string> SampleCursor::Create(
+    AP4_ContainerAtom& tables, uint32_t track_id) {
+  std::string const track = "Track " + std::to_string(track_id) + ": ";
+  SampleCursor cursor;
+  cursor.stco_ =
+      AP4_DYNAMIC_CAST(AP4_StcoAtom, tables.GetChild(AP4_ATOM_TYPE_STCO));
+  cursor.co64_ =
+      AP4_DYNAMIC_CAST(AP4_Co64Atom, tables.GetChild(AP4_ATOM_TYPE_CO64));
+  cursor.stsz_ =
+      AP4_DYNAMIC_CAST(AP4_StszAtom, tables.GetChild(AP4_ATOM_TYPE_STSZ));
+  cursor.stz2_ =
+      AP4_DYNAMIC_CAST(AP4_Stz2Atom, tables.GetChild(AP4_ATOM_TYPE_STZ2));
+  AP4_StscAtom* const stsc =
+      AP4_DYNAMIC_CAST(AP4_StscAtom, tables.GetChild(AP4_ATOM_TYPE_STSC));
+  AP4_SttsAtom* const stts =
+      AP4_DYNAMIC_CAST(AP4_SttsAtom, tables.GetChild(AP4_ATOM_TYPE_STTS));
+  if ((cursor.stco_ == nullptr && cursor.co64_ == nullptr) ||
+      (cursor.stsz_ == nullptr && cursor.stz2_ == nullptr) ||
+      stsc == nullptr || stts == nullptr) {
+    return Result<SampleCursor, std::string>::Err(
+        track +
+        "the sample table is missing its chunk offsets (stco or co64), "
+        "sample to chunk (stsc), sample sizes (stsz or stz2) or decoding "
+        "times (stts).");
+  }
+  cursor.stsc_entries_ = &stsc->GetEntries();
+  cursor.stts_entries_ = &stts->GetEntries();
+  if (AP4_CttsAtom* const ctts = AP4_DYNAMIC_CAST(
+          AP4_CttsAtom, tables.GetChild(AP4_ATOM_TYPE_CTTS));
+      ctts != nullptr) {
+    cursor.ctts_entries_ = &ctts->GetEntries();
+  }
+  if (AP4_StssAtom* const stss = AP4_DYNAMIC_CAST(
+          AP4_StssAtom, tables.GetChild(AP4_ATOM_TYPE_STSS));
+      stss != nullptr) {
+    cursor.stss_entries_ = &stss->GetEntries();
+  }
+  cursor.sample_count_ = cursor.stsz_ != nullptr
+                             ? cursor.stsz_->GetSampleCount()
+                             : cursor.stz2_->GetSampleCount();
+  if (cursor.sample_count_ == 0) {
+    return Result<SampleCursor, std::string>::Ok(std::move(cursor));
+  }
+
+  // Check the tables agree up front, so walking them can't fail.
+  uint32_t const chunk_count = cursor.stco_ != nullptr
+                                   ? cursor.stco_->GetChunkCount()
+                                   : cursor.co64_->GetEntryCount();
+  AP4_Array<AP4_StscTableEntry> const& stsc_entries = *cursor.stsc_entries_;
+  uint64_t mapped_samples = 0;
+  for (AP4_Ordinal i = 0; i < stsc_entries.ItemCount(); ++i) {
+    uint32_t const first_chunk = stsc_entries[i].m_FirstChunk;
+    uint32_t const end_chunk = i + 1 < stsc_entries.ItemCount()
+                                   ? stsc_entries[i + 1].m_FirstChunk
+                                   : chunk_count + 1;
+    if ((i == 0 && first_chunk != 1) || first_chunk >= end_chunk ||
+        end_chunk > chunk_count + 1 ||
+        stsc_entries[i].m_SamplesPerChunk == 0) {
+      return Result<SampleCursor, std::string>::Err(
+          track + "stsc entry " + std::to_string(i + 1) +
+          " refers to chunks that stco or co64 don't have, aren't in order, "
+          "or has no samples.");
+    }
+    mapped_samples += static_cast<uint64_t>(end_chunk - first_chunk) *
+                      stsc_entries[i].m_SamplesPerChunk;
+  }
+  if (mapped_samples != cursor.sample_count_) {
+    return Result<SampleCursor, std::string>::Err(
+        track + "stsc maps " + std::to_string(mapped_samples) +
+        " samples, but the sample size table has " +
+        std::to_string(cursor.sample_count_) + ".");
+  }
+  auto const count_samples = [](auto const& entries) {
+    uint64_t count = 0;
+    for (AP4_Ordinal i = 0; i < entries.ItemCount(); ++i) {
+      count += entries[i].m_SampleCount;
+    }
+    return count;
+  };
+  if (count_samples(*cursor.stts_entries_) < cursor.sample_count_ ||
+      (cursor.ctts_entries_ != nullptr &&
+       count_samples(*cursor.ctts_entries_) < cursor.sample_count_)) {
+    return Result<SampleCursor, std::string>::Err(
+        track + "stts or ctts has fewer samples than the sample size table.");
+  }
+
+  cursor.offset_ = cursor.GetChunkOffset(1);
+  cursor.Load();
+  return Result<SampleCursor, std::string>::Ok(std::move(cursor));
+}
+
+void SampleCursor::Advance() {
+  assert(!IsDone());
+  offset_ += current_.size;
+  dts_ += current_.duration;
+  ++stts_used_;
+  ++ctts_used_;
+  ++sample_;
+  if (IsDone()) {
+    return;
+  }
+  ++sample_in_chunk_;
+  AP4_Array<AP4_StscTableEntry> const& stsc_entries = *stsc_entries_;
+  if (sample_in_chunk_ == stsc_entries[stsc_index_].m_SamplesPerChunk) {
+    sample_in_chunk_ = 0;
+    ++chunk_;
+    if (stsc_index_ + 1 < stsc_entries.ItemCount() &&
+        chunk_ == stsc_entries[stsc_index_ + 1].m_FirstChunk) {
+      ++stsc_index_;
+    }
+    offset_ = GetChunkOffset(chunk_);
+  }
+  Load();
+}
+
+uint64_t SampleCursor::GetChunkOffset(AP4_Ordinal chunk) const {
+  if (stco_ != nullptr) {
+    AP4_UI32 offset = 0;
+    stco_->GetChunkOffset(chunk, offset);
+    return offset;
+  }
+  AP4_UI64 offset = 0;
+  co64_->GetChunkOffset(chunk, offset);
+  return offset;
+}
+
+uint32_t SampleCursor::GetSampleSize(AP4_Ordinal sample) const {
+  AP4_Size size = 0;
+  if (stsz_ != nullptr) {
+    stsz_->GetSampleSize(sample, size);
+  } else {
+    stz2_->GetSampleSize(sample, size);
+  }
+  return size;
+}
+
+void SampleCursor::Load() {
+  AP4_Array<AP4_SttsTableEntry> const& stts_entries = *stts_entries_;
+  while (stts_used_ == stts_entries[stts_index_].m_SampleCount) {
+    ++stts_index_;
+    stts_used_ = 0;
+  }
+  int32_t composition_offset = 0;
+  if (ctts_entries_ != nullptr) {
+    AP4_Array<AP4_CttsTableEntry> const& ctts_entries = *ctts_entries_;
+    while (ctts_used_ == ctts_entries[ctts_index_].m_SampleCount) {
+      ++ctts_index_;
+      ctts_used_ = 0;
+    }
+    // Version 1 ctts offsets are signed. Version 0 offsets are unsigned, but
+    // fit in 31 bits in practice, so both are read as signed.
+    composition_offset =
+        static_cast<int32_t>(ctts_entries[ctts_index_].m_SampleOffset);
+  }
+  bool is_sync = true;
+  if (stss_entries_ != nullptr) {
+    AP4_Array<AP4_UI32> const& stss_entries = *stss_entries_;
+    while (stss_index_ < stss_entries.ItemCount() &&
+           stss_entries[stss_index_] < sample_) {
+      ++stss_index_;
+    }
+    is_sync = stss_index_ < stss_entries.ItemCount() &&
+              stss_entries[stss_index_] == sample_;
+  }
+  current_ = Sample{offset_,
+                    dts_,
+                    GetSampleSize(sample_),
+                    stts_entries[stts_index_].m_SampleDuration,
+                    composition_offset,
+                    is_sync};
+}
+
+// A track of the input, whose sample tables have been moved out of its stbl
+// so the output moov has empty ones.
+struct Track {
+  uint32_t track_id;
+  uint32_t timescale;
+  bool is_video;
+  // Holds the original tables, which `cursor` reads.
+  std::unique_ptr<AP4_ContainerAtom> sample_tables;
+  std::optional<SampleCursor> cursor;
+  // The samples of the fragment being built. Reused for each fragment.
+  std::vector<Sample> fragment_samples;
+};
+
+// Boxes of stbl that describe samples, rather than how to decode them, and so
+// are moved out of moov.
+bool IsSampleTable(AP4_Atom::Type type) {
+  return type != AP4_ATOM_TYPE_STSD && type != AP4_ATOM_TYPE_SGPD;
+}
+
+// Takes the sample tables out of `trak`'s stbl, leaving it with its sample
+// descriptions and empty tables, as a fragmented file's moov has.
+Result<Track, std::string> PrepareTrack(AP4_ContainerAtom& trak) {
+  AP4_TkhdAtom* const tkhd =
+      AP4_DYNAMIC_CAST(AP4_TkhdAtom, trak.FindChild("tkhd"));
+  AP4_MdhdAtom* const mdhd =
+      AP4_DYNAMIC_CAST(AP4_MdhdAtom, trak.FindChild("mdia/mdhd"));
+  AP4_HdlrAtom* const hdlr =
+      AP4_DYNAMIC_CAST(AP4_HdlrAtom, trak.FindChild("mdia/hdlr"));
+  AP4_ContainerAtom* const stbl =
+      AP4_DYNAMIC_CAST(AP4_ContainerAtom, trak.FindChild("mdia/minf/stbl"));
+  AP4_StsdAtom* const stsd =
+      AP4_DYNAMIC_CAST(AP4_StsdAtom, trak.FindChild("mdia/minf/stbl/stsd"));
+  if (tkhd == nullptr || mdhd == nullptr || hdlr == nullptr ||
+      stbl == nullptr || stsd == nullptr || mdhd->GetTimeScale() == 0) {
+    return Result<Track, std::string>::Err(
+        "A track is missing its tkhd, mdhd, hdlr or sample table, or has a "
+        "timescale of 0.");
+  }
+  std::string const track =
+      "Track " + std::to_string(tkhd->GetTrackId()) + ": ";
+  if (stsd->GetSampleDescriptionCount() != 1) {
+    return Result<Track, std::string>::Err(
+        track + "tracks with more than one sample description can't be "
+                "fragmented.");
+  }
+
+  std::vector<AP4_Atom*> moved_atoms;
+  for (AP4_List<AP4_Atom>::Item* item = stbl->GetChildren().FirstItem();
+       item != nullptr; item = item->GetNext()) {
+    AP4_Atom::Type const type = item->GetData()->GetType();
+    if (type == AP4_ATOM_TYPE_SAIZ || type == AP4_ATOM_TYPE_SAIO ||
+        type == AP4_ATOM_TYPE_SENC) {
+      return Result<Track, std::string>::Err(
+          track + "encrypted tracks can't be fragmented, as their sample "
+                  "auxiliary information would be lost.");
+    }
+    if (IsSampleTable(type)) {
+      moved_atoms.push_back(item->GetData());
+    }
+  }
+  auto sample_tables = std::make_unique<AP4_ContainerAtom>(AP4_ATOM_TYPE_STBL);
+  for (AP4_Atom* atom : moved_atoms) {
+    stbl->RemoveChild(atom);
+    sample_tables->AddChild(atom);
+  }
+  stbl->AddChild(new AP4_SttsAtom());
+  stbl->AddChild(new AP4_StscAtom());
+  stbl->AddChild(new AP4_StszAtom());
+  stbl->AddChild(new AP4_StcoAtom(nullptr, 0));
+
+  Result<SampleCursor, std::string> cursor_result =
+      SampleCursor::Create(*sample_tables, tkhd->GetTrackId());
+  if (cursor_result.IsErr()) {
+    cursor_result.MarkErrorHandled();
+    return Result<Track, std::string>::Err(
+        std::move(cursor_result).GetErr());
+  }
+  return Result<Track, std::string>::Ok(
+      Track{tkhd->GetTrackId(), mdhd->GetTimeScale(),
+            hdlr->GetHandlerType() == AP4_HANDLER_TYPE_VIDE,
+            std::move(sample_tables), std::move(cursor_result).GetOk(), {}});
+}
+
+// Serializes `atom` to `output`.
+Result<std::monostate, std::string> WriteAtom(AP4_Atom& atom,
+                                              std::FILE* output) {
+  std::unique_ptr<AP4_MemoryByteStream, ByteStreamReleaser> bytes{
+      new AP4_MemoryByteStream{static_cast<AP4_Size>(atom.GetSize())}};
+  if (AP4_FAILED(atom.Write(*bytes)) ||
+      bytes->GetDataSize() != atom.GetSize()) {
+    return Result<std::monostate, std::string>::Err(
+        "Failed to serialize a box.");
+  }
+  if (std::fwrite(bytes->GetData(), 1, bytes->GetDataSize(), output) !=
+      bytes->GetDataSize()) {
+    return Result<std::monostate, std::string>::Err("Failed to write a box.");
+  }
+  return Result<std::monostate, std::string>::Ok();
+}
+
+// Writes a moof and mdat holding `track`'s fragment samples. The samples'
+// data is copied from `input` a run of contiguous samples at a time.
+Result<std::monostate, std::string> WriteFragment(Track const& track,
+                                                  uint32_t sequence_number,
+                                                  std::FILE* input,
+                                                  std::FILE* output) {
+  std::vector<Sample> const& samples = track.fragment_samples;
+  assert(!samples.empty());
+  uint64_t payload_size = 0;
+  bool has_composition_offsets = false;
+  bool has_negative_composition_offsets = false;
+  AP4_Array<AP4_TrunAtom::Entry> entries;
+  entries.SetItemCount(static_cast<AP4_Cardinal>(samples.size()));
+  for (size_t i = 0; i < samples.size(); ++i) {
+    Sample const& sample = samples.at(i);
+    payload_size += sample.size;
+    has_composition_offsets |= sample.composition_offset != 0;
+    has_negative_composition_offsets |= sample.composition_offset < 0;
+    AP4_TrunAtom::Entry& entry = entries[static_cast<AP4_Ordinal>(i)];
+    entry.sample_duration = sample.duration;
+    entry.sample_size = sample.size;
+    entry.sample_flags =
+        sample.is_sync ? kSyncSampleFlags : kNonSyncSampleFlags;
+    entry.sample_composition_time_offset =
+        static_cast<AP4_UI32>(sample.composition_offset);
+  }
+
+  uint32_t trun_flags = AP4_TRUN_FLAG_DATA_OFFSET_PRESENT |
+                        AP4_TRUN_FLAG_SAMPLE_DURATION_PRESENT |
+                        AP4_TRUN_FLAG_SAMPLE_SIZE_PRESENT |
+                        AP4_TRUN_FLAG_SAMPLE_FLAGS_PRESENT;
+  if (has_composition_offsets) {
+    trun_flags |= AP4_TRUN_FLAG_SAMPLE_COMPOSITION_TIME_OFFSET_PRESENT;
+  }
+  AP4_TrunAtom* const trun = new AP4_TrunAtom(trun_flags, 0, 0);
+  // Version 1 truns have signed composition offsets.
+  trun->SetVersion(has_negative_composition_offsets ? 1 : 0);
+  trun->SetEntries(entries);
+  AP4_ContainerAtom* const traf = new AP4_ContainerAtom(AP4_ATOM_TYPE_TRAF);
+  traf->AddChild(new AP4_TfhdAtom(AP4_TFHD_FLAG_DEFAULT_BASE_IS_MOOF,
+                                  track.track_id, 0, 0, 0, 0, 0));
+  traf->AddChild(new AP4_TfdtAtom(1, samples.front().dts));
+  traf->AddChild(trun);
+  AP4_ContainerAtom moof{AP4_ATOM_TYPE_MOOF};
+  moof.AddChild(new AP4_MfhdAtom(sequence_number));
+  moof.AddChild(traf);
+
+  bool const needs_large_size =
+      payload_size + 8 > std::numeric_limits<uint32_t>::max();
+  uint64_t const mdat_header_size = needs_large_size ? 16 : 8;
+  // The data offset is from the start of moof, so the samples start straight
+  // after the mdat header.
+  trun->SetDataOffset(
+      static_cast<AP4_SI32>(moof.GetSize() + mdat_header_size));
+  Result<std::monostate, std::string> result = WriteAtom(moof, output);
+  if (result.IsErr()) {
+    return result;
+  }
+
+  AP4_UI08 mdat_header[16];
+  uint64_t const mdat_size = payload_size + mdat_header_size;
+  // A size of 1 means the size follows the type, as a 64-bit value.
+  AP4_BytesFromUInt32BE(
+      &mdat_header[0],
+      needs_large_size ? 1 : static_cast<AP4_UI32>(mdat_size));
+  AP4_BytesFromUInt32BE(&mdat_header[4], AP4_ATOM_TYPE_MDAT);
+  if (needs_large_size) {
+    AP4_BytesFromUInt64BE(&mdat_header[8], mdat_size);
+  }
+  if (std::fwrite(mdat_header, 1, mdat_header_size, output) !=
+      mdat_header_size) {
+    return Result<std::monostate, std::string>::Err(
+        "Failed to write an mdat header.");
+  }
+
+  // Samples are usually stored one after another in chunks, so most
+  // fragments are copied with a handful of range copies.
+  uint64_t run_offset = samples.front().offset;
+  uint64_t run_size = 0;
+  for (Sample const& sample : samples) {
+    if (sample.offset != run_offset + run_size) {
+      result = CopyFileRange(input, run_offset, run_size, output);
+      if (result.IsErr()) {
+        return result;
+      }
+      run_offset = sample.offset;
+      run_size = 0;
+    }
+    run_size += sample.size;
+  }
+  return CopyFileRange(input, run_offset, run_size, output);
+}
+
+// Writes the fragments of `tracks`. Each fragment period ends at the first
+// sync sample of the primary track at least `fragment_duration` seconds after
+// its start, and takes the samples of each track that start before then.
+Result<std::monostate, std::string> WriteFragments(
+    std::vector<Track>& tracks, size_t primary_index,
+    double fragment_duration, std::FILE* input, std::FILE* output,
+    FragmentingSummary& summary) {
+  uint32_t sequence_number = 1;
+  auto const get_time = [](Track const& track, uint64_t dts) {
+    return static_cast<double>(dts) / track.timescale;
+  };
+  while (true) {
+    for (Track& track : tracks) {
+      track.fragment_samples.clear();
+    }
+    Track& primary = tracks.at(primary_index);
+    SampleCursor& primary_cursor = primary.cursor.value();
+    double period_end = 0;
+    if (!primary_cursor.IsDone()) {
+      uint64_t const start_dts = primary_cursor.Get().dts;
+      auto const target_duration = static_cast<uint64_t>(
+          fragment_duration * primary.timescale);
+      while (!primary_cursor.IsDone()) {
+        Sample const& sample = primary_cursor.Get();
+        if (!primary.fragment_samples.empty() && sample.is_sync &&
+            sample.dts - start_dts >= target_duration) {
+          period_end = get_time(primary, sample.dts);
+          break;
+        }
+        primary.fragment_samples.push_back(sample);
+        primary_cursor.Advance();
+      }
+      if (primary_cursor.IsDone()) {
+        Sample const& last = primary.fragment_samples.back();
+        period_end = get_time(primary, last.dts + last.duration);
+      }
+    } else {
+      // The primary track has ended, so the others are fragmented on their
+      // own, into periods of the target duration.
+      double period_start = std::numeric_limits<double>::infinity();
+      for (Track const& track : tracks) {
+        if (!track.cursor->IsDone()) {
+          period_start =
+              std::min(period_start, get_time(track, track.cursor->Get().dts));
+        }
+      }
+      if (period_start == std::numeric_limits<double>::infinity()) {
+        return Result<std::monostate, std::string>::Ok();
+      }
+      period_end = period_start + fragment_duration;
+    }
+
+    for (size_t i = 0; i < tracks.size(); ++i) {
+      Track& track = tracks.at(i);
+      SampleCursor& cursor = track.cursor.value();
+      if (i != primary_index) {
+        while (!cursor.IsDone() &&
+               get_time(track, cursor.Get().dts) < period_end) {
+          track.fragment_samples.push_back(cursor.Get());
+          cursor.Advance();
+        }
+      }
+      if (track.fragment_samples.empty()) {
+        continue;
+      }
+      Result<std::monostate, std::string> result =
+          WriteFragment(track, sequence_number++, input, output);
+      if (result.IsErr()) {
+        return result;
+      }
+      ++summary.fragment_count;
+      summary.sample_count += track.fragment_samples.size();
+    }
+  }
+}
+}  // namespace
+
+Result<FragmentingSummary, std::string> WriteFragmented(
+    char const* input_file_name, char const* output_file_name,
+    double fragment_duration) {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kSave, "utility::WriteFragmented");
+  if (!(fragment_duration > 0)) {
+    return FragmentingResult::Err("The fragment duration must be positive.");
+  }
+  std::error_code error_code;
+  if (std::filesystem::equivalent(input_file_name, output_file_name,
+                                  error_code)) {
+    return FragmentingResult::Err(
+        "The output file must be different to the input file.");
+  }
+
+  AP4_ByteStream* raw_input_stream = nullptr;
+  if (AP4_FAILED(AP4_FileByteStream::Create(
+          input_file_name, AP4_FileByteStream::STREAM_MODE_READ,
+          raw_input_stream))) {
+    return FragmentingResult::Err(std::string{"Could not open "} +
+                                  input_file_name + ".");
+  }
+  ByteStreamPointer input_stream{raw_input_stream};
+
+  Result<std::vector<BoxHeader>, std::string> scan_result =
+      ScanTopLevelBoxHeaders(*input_stream);
+  if (scan_result.IsErr()) {
+    scan_result.MarkErrorHandled();
+    return FragmentingResult::Err(std::move(scan_result).GetErr());
+  }
+  std::optional<uint64_t> moov_offset;
+  for (BoxHeader const& header : scan_result.GetOk()) {
+    if (header.type == AP4_ATOM_TYPE_MOOF) {
+      return FragmentingResult::Err("The file is already fragmented.");
+    }
+    if (header.type == AP4_ATOM_TYPE_MOOV) {
+      if (moov_offset.has_value()) {
+        return FragmentingResult::Err("The file has more than one moov.");
+      }
+      moov_offset = header.offset;
+    }
+  }
+  if (!moov_offset.has_value()) {
+    return FragmentingResult::Err("The file has no moov.");
+  }
+
+  // Only moov is parsed, the media data is copied from the file by range.
+  AP4_Atom* moov_atom = nullptr;
+  AP4_AtomFactory atom_factory;
+  if (AP4_FAILED(input_stream->Seek(moov_offset.value())) ||
+      AP4_FAILED(atom_factory.CreateAtomFromStream(*input_stream,
+                                                   moov_atom))) {
+    return FragmentingResult::Err("Failed to parse moov.");
+  }
+  std::unique_ptr<AP4_ContainerAtom> moov{
+      AP4_DYNAMIC_CAST(AP4_ContainerAtom, moov_atom)};
+  if (moov == nullptr) {
+    delete moov_atom;
+    return FragmentingResult::Err("Failed to parse moov.");
+  }
+  input_stream.reset();
+  AP4_MvhdAtom* const mvhd =
+      AP4_DYNAMIC_CAST(AP4_MvhdAtom, moov->GetChild(AP4_ATOM_TYPE_MVHD));
+  if (mvhd == nullptr) {
+    return FragmentingResult::Err("moov has no mvhd.");
+  }
+  if (moov->GetChild(AP4_ATOM_TYPE_MVEX) != nullptr) {
+    return FragmentingResult::Err(
+        "moov already has an mvex, the file is already fragmented.");
+  }
+
+  std::vector<Track> tracks;
+  std::vector<AP4_ContainerAtom*> traks;
+  for (AP4_List<AP4_Atom>::Item* item = moov->GetChildren().FirstItem();
+       item != nullptr; item = item->GetNext()) {
+    if (item->GetData()->GetType() == AP4_ATOM_TYPE_TRAK) {
+      traks.push_back(AP4_DYNAMIC_CAST(AP4_ContainerAtom, item->GetData()));
+    }
+  }
+  if (traks.empty()) {
+    return FragmentingResult::Err("The file has no tracks.");
+  }
+  AP4_ContainerAtom* const mvex = new AP4_ContainerAtom(AP4_ATOM_TYPE_MVEX);
+  mvex->AddChild(new AP4_MehdAtom(mvhd->GetDuration()));
+  for (AP4_ContainerAtom* trak : traks) {
+    if (trak == nullptr) {
+      delete mvex;
+      return FragmentingResult::Err("Failed to parse a trak.");
+    }
+    Result<Track, std::string> track_result = PrepareTrack(*trak);
+    if (track_result.IsErr()) {
+      delete mvex;
+      track_result.MarkErrorHandled();
+      return FragmentingResult::Err(std::move(track_result).GetErr());
+    }
+    tracks.push_back(std::move(track_result).GetOk());
+    // The sample description and sample flags are given for every sample by
+    // the truns, so the defaults don't matter.
+    mvex->AddChild(new AP4_TrexAtom(tracks.back().track_id, 1, 0, 0, 0));
+  }
+  moov->AddChild(mvex);
+
+  size_t primary_index = 0;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    if (tracks.at(i).is_video) {
+      primary_index = i;
+      break;
+    }
+  }
+
+  FilePointer input{std::fopen(input_file_name, "rb")};
+  if (input == nullptr) {
+    return FragmentingResult::Err(std::string{"Could not open "} +
+                                  input_file_name + ".");
+  }
+  FilePointer output{std::fopen(output_file_name, "wb")};
+  if (output == nullptr) {
+    return FragmentingResult::Err(std::string{"Could not open "} +
+                                  output_file_name + " for writing.");
+  }
+
+  std::vector<AP4_UI32> compatible_brands{AP4_FTYP_BRAND_ISO6};
+  // A CMAF track file holds a single track, so the output is only one with
+  // a single track.
+  if (tracks.size() == 1) {
+    compatible_brands.push_back(AP4_ATOM_TYPE('c', 'm', 'f', 'c'));
+  }
+  AP4_FtypAtom ftyp{AP4_FTYP_BRAND_ISO6, 0, compatible_brands.data(),
+                    static_cast<AP4_Cardinal>(compatible_brands.size())};
+  FragmentingSummary summary;
+  Result<std::monostate, std::string> write_result =
+      WriteAtom(ftyp, output.get());
+  if (write_result.IsOk()) {
+    write_result = WriteAtom(*moov, output.get());
+  }
+  if (write_result.IsOk()) {
+    write_result = WriteFragments(tracks, primary_index, fragment_duration,
+                                  input.get(), output.get(), summary);
+  }
+  bool const closed = std::fclose(output.release()) == 0;
+  if (write_result.IsErr() || !closed) {
+    std::remove(output_file_name);
+    if (write_result.IsErr()) {
+      write_result.MarkErrorHandled();
+      return FragmentingResult::Err(std::move(write_result).GetErr());
+    }
+    return FragmentingResult::Err(std::string{"Failed to finish writing "} +
+                                  output_file_name + ".");
+  }
+  return FragmentingResult::Ok(summary);
+}
+
+}  // namespace mp4_manipulator::utility
@@ -0,0 +1,241 @@
+#include "parsing/segment_set.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+#include <utility>
+
+#include "parallel/work_stealing_pool.h"
+#include "parsing/box_header_scanner.h"
+#include "parsing/file_utils.h"
+#include "parsing/resource_deleters.h"
+#include "profiling/allocation_profiler.h"
+
+namespace mp4_manipulator::utility {
+namespace {
+using OpenResult = Result<std::unique_ptr<SegmentSet>, std::string>;
+
+// Returns the types of `headers` in the order they first appear, with counts
+// for repeated types, e.g. "styp sidx moof x4 mdat x4".
+std::string DescribeLayout(std::vector<BoxHeader> const& headers) {
+  std::vector<std::pair<AP4_Atom::Type, size_t>> type_counts;
+  for (BoxHeader const& header : headers) {
+    auto it = std::find_if(
+        type_counts.begin(), type_counts.end(),
+        [&header](auto const& type_count) {
+          return type_count.first == header.type;
+        });
+    if (it == type_counts.end()) {
+      type_counts.emplace_back(header.type, 1);
+    } else {
+      ++it->second;
+    }
+  }
+  std::string layout;
+  for (auto const& [type, count] : type_counts) {
+    if (!layout.empty()) {
+      layout += ' ';
+    }
+    layout += FourCcToString(type);
+    if (count > 1) {
+      layout += " x" + std::to_string(count);
+    }
+  }
+  return layout;
+}
+
+// Fills in the size and layout of `summary` from the box headers of
+// `file_name`.
+void ScanSegment(std::string const& file_name, SegmentSummary& summary) {
+  AP4_ByteStream* stream = nullptr;
+  if (AP4_FAILED(AP4_FileByteStream::Create(
+          file_name.c_str(), AP4_FileByteStream::STREAM_MODE_READ, stream))) {
+    summary.error = "Could not open " + file_name + ".";
+    return;
+  }
+  AP4_LargeSize size = 0;
+  stream->GetSize(size);
+  summary.size = size;
+  Result<std::vector<BoxHeader>, std::string> scan_result =
+      ScanTopLevelBoxHeaders(*stream);
+  stream->Release();
+  if (scan_result.IsErr()) {
+    scan_result.MarkErrorHandled();
+    summary.error = std::move(scan_result).GetErr();
+    return;
+  }
+  summary.layout = DescribeLayout(scan_result.GetOk());
+}
+
+// Fills in the parsed members of `summary` from the moof boxes of `atoms`.
+void SummarizeFragments(AtomHolder& atoms, SegmentSummary& summary) {
+  for (auto const& atom : atoms.GetTopLevelAtoms()) {
+    AP4_ContainerAtom* const moof =
+        AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom->GetAp4Atom());
+    if (moof == nullptr || moof->GetType() != AP4_ATOM_TYPE_MOOF) {
+      continue;
+    }
+    AP4_MfhdAtom* const mfhd =
+        AP4_DYNAMIC_CAST(AP4_MfhdAtom, moof->GetChild(AP4_ATOM_TYPE_MFHD));
+    if (mfhd != nullptr && !summary.sequence_number.has_value()) {
+      summary.sequence_number = mfhd->GetSequenceNumber();
+    }
+    for (AP4_List<AP4_Atom>::Item* item = moof->GetChildren().FirstItem();
+         item != nullptr; item = item->GetNext()) {
+      AP4_ContainerAtom* const traf =
+          AP4_DYNAMIC_CAST(AP4_ContainerAtom, item->GetData());
+      if (traf == nullptr || traf->GetType() != AP4_ATOM_TYPE_TRAF) {
+        continue;
+      }
+      AP4_TfdtAtom* const tfdt =
+          AP4_DYNAMIC_CAST(AP4_TfdtAtom, traf->GetChild(AP4_ATOM_TYPE_TFDT));
+      if (tfdt != nullptr && !summary.base_decode_time.has_value()) {
+        summary.base_decode_time = tfdt->GetBaseMediaDecodeTime();
+      }
+      for (AP4_List<AP4_Atom>::Item* traf_item =
+               traf->GetChildren().FirstItem();
+           traf_item != nullptr; traf_item = traf_item->GetNext()) {
+        if (AP4_TrunAtom* const trun =
+                AP4_DYNAMIC_CAST(AP4_TrunAtom, traf_item->GetData())) {
+          summary.sample_count += trun->GetEntries().ItemCount();
+        }
+      }
+    }
+  }
+}
+}  // namespace
+
+OpenResult SegmentSet::Open(std::string init_file_name,
+                            std::vector<std::string> segment_file_names,
+                            size_t thread_count /* = 0 */) {
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kParse, "SegmentSet::Open");
+  // The init segment is only a moov, so there's nothing to gain from
+  // parsing it in parallel.
+  std::optional<std::unique_ptr<AtomHolder>> init_atoms =
+      ReadAtoms(init_file_name.c_str(), 1);
+  if (!init_atoms.has_value()) {
+    return OpenResult::Err("Failed to read the initialization segment " +
+                           init_file_name + ".");
+  }
+  std::error_code error_code;
+  uint64_t const init_size =
+      std::filesystem::file_size(init_file_name, error_code);
+
+  std::vector<Segment> segments(segment_file_names.size());
+  for (size_t i = 0; i < segments.size(); ++i) {
+    segments.at(i).file_name = std::move(segment_file_names.at(i));
+  }
+  {
+    // Each scan is a few small reads, so on a cold cache or a network file
+    // system the time is mostly latency, which the workers overlap.
+    parallel::WorkStealingPool pool{thread_count};
+    for (Segment& segment : segments) {
+      pool.Submit([&segment](size_t /* worker_index */) {
+        ScanSegment(segment.file_name, segment.summary);
+      });
+    }
+  }
+  return OpenResult::Ok(std::unique_ptr<SegmentSet>{new SegmentSet{
+      std::move(init_file_name), error_code ? 0 : init_size,
+      std::move(init_atoms.value()), std::move(segments), thread_count}});
+}
+
+SegmentSet::SegmentSet(std::string init_file_name, uint64_t init_size,
+                       std::unique_ptr<AtomHolder> init_atoms,
+                       std::vector<Segment> segments, size_t thread_count)
+    : init_file_name_{std::move(init_file_name)},
+      init_size_{init_size},
+      init_atoms_{std::move(init_atoms)},
+      segments_{std::move(segments)},
+      thread_count_{thread_count} {}
+
+std::string const& SegmentSet::GetInitFileName() const {
+  return init_file_name_;
+}
+
+uint64_t SegmentSet::GetInitSize() const { return init_size_; }
+
+AtomHolder& SegmentSet::GetInitAtoms() const { return *init_atoms_; }
+
+size_t SegmentSet::GetSegmentCount() const { return segments_.size(); }
+
+std::string const& SegmentSet::GetSegmentFileName(size_t index) const {
+  return segments_.at(index).file_name;
+}
+
+SegmentSummary const& SegmentSet::GetSegmentSummary(size_t index) const {
+  return segments_.at(index).summary;
+}
+
+AtomHolder* SegmentSet::GetSegmentAtoms(size_t index) const {
+  return segments_.at(index).atoms.get();
+}
+
+void SegmentSet::ParseSegments(std::vector<size_t> const& indices) {
+  std::vector<Segment*> unparsed_segments;
+  for (size_t const index : indices) {
+    Segment& segment = segments_.at(index);
+    if (!segment.summary.is_parsed) {
+      // Marked here rather than by the worker, so an index given twice is
+      // only parsed once.
+      segment.summary.is_parsed = true;
+      unparsed_segments.push_back(&segment);
+    }
+  }
+  if (unparsed_segments.empty()) {
+    return;
+  }
+  MP4_MANIPULATOR_ALLOCATION_PHASE(kParse, "SegmentSet::ParseSegments");
+  size_t const thread_count =
+      thread_count_ == 0 ? std::max(1u, std::thread::hardware_concurrency())
+                         : thread_count_;
+  {
+    // Segments are small, so there's no point starting more workers than
+    // there are segments to parse.
+    parallel::WorkStealingPool pool{
+        std::min(thread_count, unparsed_segments.size())};
+    for (Segment* segment : unparsed_segments) {
+      pool.Submit([segment](size_t /* worker_index */) {
+        // Read the segment front to back, as from a pipe, so media data is
+        // skipped rather than kept by a stream that holds the file open.
+        // Atoms read with ReadAtoms keep one open file per segment, which
+        // runs out of file descriptors after about a thousand segments.
+        // Segments are parsed in parallel with each other, so each is
+        // parsed on one thread.
+        FilePointer input{std::fopen(segment->file_name.c_str(), "rb")};
+        if (input == nullptr) {
+          segment->summary.error = "Could not open " + segment->file_name + ".";
+          return;
+        }
+        StreamingReadOptions options;
+        options.skipped_note =
+            "Media data isn't read for segments, see the hex view.";
+        Result<std::unique_ptr<AtomHolder>, std::string> read_result =
+            ReadAtomsFromPipe(input.get(), options);
+        if (read_result.IsErr()) {
+          read_result.MarkErrorHandled();
+          segment->summary.error = "Failed to parse " + segment->file_name +
+                                   ": " + std::move(read_result).GetErr();
+          return;
+        }
+        segment->atoms = std::move(read_result).GetOk();
+        SummarizeFragments(*segment->atoms, segment->summary);
+      });
+    }
+  }
+}
+
+size_t SegmentSet::EstimateMemoryUsage() const {
+  size_t usage = init_atoms_->EstimateMemoryUsage() +
+                 segments_.capacity() * sizeof(Segment);
+  for (Segment const& segment : segments_) {
+    usage += segment.file_name.capacity() + segment.summary.layout.capacity();
+    if (segment.atoms != nullptr) {
+      usage += segment.atoms->EstimateMemoryUsage();
+    }
+  }
+  return usage;
+}
+
+}  // namespace mp4_manipulator::utility
@@ -0,0 +1,28 @@
+#include "parsing/skipped_atom.h"
+
+#include <utility>
+
+namespace mp4_manipulator {
+
+AP4_DEFINE_DYNAMIC_CAST_ANCHOR(SkippedAtom)
+
+SkippedAtom::SkippedAtom(AP4_Atom::Type type, uint64_t size,
+                         bool has_large_size, std::string note)
+    : AP4_Atom{type, AP4_UI64{size}, has_large_size},
+      has_large_size_{has_large_size},
+      note_{std::move(note)} {}
+
+AP4_Result SkippedAtom::WriteFields(AP4_ByteStream& /* stream */) {
+  return AP4_ERROR_NOT_SUPPORTED;
+}
+
+AP4_Result SkippedAtom::InspectFields(AP4_AtomInspector& inspector) {
+  inspector.AddField("payload", note_.c_str());
+  return AP4_SUCCESS;
+}
+
+AP4_Atom* SkippedAtom::Clone() {
+  return new SkippedAtom{GetType(), GetSize(), has_large_size_, note_};
+}
+
+}  // namespace mp4_manipulator
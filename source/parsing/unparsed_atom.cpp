@@ -0,0 +1,58 @@
+#include "parsing/unparsed_atom.h"
+
+#include <utility>
+
+namespace mp4_manipulator {
+
+UnparsedAtom::UnparsedAtom(AP4_ByteStream& source, uint64_t offset,
+                           uint64_t size, std::string reason)
+    : AP4_Atom{kType, AP4_UI64{size}, false},
+      source_{&source},
+      source_offset_{offset},
+      reason_{std::move(reason)} {
+  source_->AddReference();
+}
+
+UnparsedAtom::~UnparsedAtom() { source_->Release(); }
+
+AP4_Result UnparsedAtom::WriteHeader(AP4_ByteStream& /* stream */) {
+  // Any header is part of the unparsed bytes.
+  return AP4_SUCCESS;
+}
+
+AP4_Result UnparsedAtom::WriteFields(AP4_ByteStream& stream) {
+  AP4_Position position = 0;
+  AP4_Result result = source_->Tell(position);
+  if (AP4_FAILED(result)) {
+    return result;
+  }
+  result = source_->Seek(source_offset_);
+  if (AP4_FAILED(result)) {
+    return result;
+  }
+  result = source_->CopyTo(stream, GetSize());
+  // Put the source back, in case it's also being read elsewhere.
+  source_->Seek(position);
+  return result;
+}
+
+AP4_Result UnparsedAtom::Inspect(AP4_AtomInspector& inspector) {
+  // There's no header, the whole range is unparsed.
+  inspector.StartAtom("unparsed", 0, 0, 0, GetSize());
+  inspector.AddField("reason", reason_.c_str());
+  inspector.EndAtom();
+  return AP4_SUCCESS;
+}
+
+AP4_Atom* UnparsedAtom::Clone() {
+  return new UnparsedAtom{*source_, source_offset_, GetSize(), reason_};
+}
+
+uint64_t UnparsedAtom::GetSourceOffset() const { return source_offset_; }
+
+bool IsUnparsedAtom(AtomOrDescriptorBase const& atom) {
+  return atom.GetAp4Atom() != nullptr &&
+         atom.GetAp4Atom()->GetType() == UnparsedAtom::kType;
+}
+
+}  // namespace mp4_manipulator
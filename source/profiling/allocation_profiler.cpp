@@ -0,0 +1,367 @@
+#include "profiling/allocation_profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace mp4_manipulator::profiling {
+namespace {
+constexpr size_t kPhaseCount = static_cast<size_t>(AllocationPhase::kCount);
+// Fixed so recording never has to allocate. If we ever have more sites than
+// this, the overflow is still counted in the phase totals.
+constexpr size_t kSiteSlotCount = 512;
+// Used as the site for allocations made without an active site tag.
+constexpr char kUntaggedSite[] = "(untagged)";
+
+struct Counters {
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> bytes{0};
+};
+
+// A slot in an open addressed table keyed by site pointer.
+struct SiteSlot {
+  std::atomic<char const*> site{nullptr};
+  Counters per_phase[kPhaseCount];
+};
+
+// All of these are constant initialized, so they're usable by allocations
+// made before main or during static initialization.
+Counters phase_counters[kPhaseCount];
+SiteSlot site_slots[kSiteSlotCount];
+std::atomic<uint64_t> site_table_overflow{0};
+
+thread_local AllocationPhase current_phase = AllocationPhase::kUntagged;
+thread_local char const* current_site = nullptr;
+
+void AddToCounters(Counters& counters, size_t size) {
+  counters.allocations.fetch_add(1, std::memory_order_relaxed);
+  counters.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+[[maybe_unused]] void RecordAllocation(size_t size) {
+  size_t const phase_index = static_cast<size_t>(current_phase);
+  AddToCounters(phase_counters[phase_index], size);
+
+  char const* site = current_site != nullptr ? current_site : kUntaggedSite;
+  size_t const start =
+      (reinterpret_cast<uintptr_t>(site) >> 3) % kSiteSlotCount;
+  for (size_t probe = 0; probe < kSiteSlotCount; ++probe) {
+    SiteSlot& slot = site_slots[(start + probe) % kSiteSlotCount];
+    char const* slot_site = slot.site.load(std::memory_order_acquire);
+    if (slot_site == nullptr) {
+      // Try to claim the slot. If another thread beats us `slot_site` is
+      // updated to whatever they stored.
+      if (slot.site.compare_exchange_strong(slot_site, site,
+                                            std::memory_order_acq_rel)) {
+        slot_site = site;
+      }
+    }
+    if (slot_site == site) {
+      AddToCounters(slot.per_phase[phase_index], size);
+      return;
+    }
+  }
+  site_table_overflow.fetch_add(1, std::memory_order_relaxed);
+}
+}  // namespace
+
+char const* GetAllocationPhaseName(AllocationPhase phase) {
+  switch (phase) {
+    case AllocationPhase::kUntagged:
+      return "untagged";
+    case AllocationPhase::kParse:
+      return "parse";
+    case AllocationPhase::kInspect:
+      return "inspect";
+    case AllocationPhase::kMatch:
+      return "match";
+    case AllocationPhase::kModelBuild:
+      return "model build";
+    case AllocationPhase::kEdit:
+      return "edit";
+    case AllocationPhase::kSave:
+      return "save";
+    case AllocationPhase::kCount:
+      break;
+  }
+  assert(false);
+  return "unknown";
+}
+
+bool IsAllocationProfilingEnabled() {
+#if defined(MP4_MANIPULATOR_ALLOCATION_PROFILING)
+  return true;
+#else
+  return false;
+#endif
+}
+
+ScopedAllocationPhase::ScopedAllocationPhase(AllocationPhase phase,
+                                             char const* site)
+    : previous_phase_{current_phase}, previous_site_{current_site} {
+  assert(phase != AllocationPhase::kCount);
+  current_phase = phase;
+  current_site = site;
+}
+
+ScopedAllocationPhase::~ScopedAllocationPhase() {
+  current_phase = previous_phase_;
+  current_site = previous_site_;
+}
+
+ScopedAllocationSite::ScopedAllocationSite(char const* site)
+    : previous_site_{current_site} {
+  current_site = site;
+}
+
+ScopedAllocationSite::~ScopedAllocationSite() { current_site = previous_site_; }
+
+void WriteAllocationReport(std::ostream& stream, size_t max_sites /* = 20 */) {
+  if (!IsAllocationProfilingEnabled()) {
+    stream << "Allocation profiling is not enabled in this build. Configure "
+              "with -D MP4_MANIPULATOR_ALLOCATION_PROFILING=ON.\n";
+    return;
+  }
+
+  struct SiteTotal {
+    char const* site;
+    AllocationPhase phase;
+    uint64_t allocations;
+    uint64_t bytes;
+  };
+
+  // Snapshot everything before doing any work that may allocate, so the
+  // report doesn't measure itself.
+  uint64_t phase_allocations[kPhaseCount];
+  uint64_t phase_bytes[kPhaseCount];
+  for (size_t i = 0; i < kPhaseCount; ++i) {
+    phase_allocations[i] =
+        phase_counters[i].allocations.load(std::memory_order_relaxed);
+    phase_bytes[i] = phase_counters[i].bytes.load(std::memory_order_relaxed);
+  }
+  std::vector<SiteTotal> site_totals;
+  site_totals.reserve(kSiteSlotCount);
+  for (SiteSlot& slot : site_slots) {
+    char const* site = slot.site.load(std::memory_order_acquire);
+    if (site == nullptr) {
+      continue;
+    }
+    for (size_t i = 0; i < kPhaseCount; ++i) {
+      uint64_t const allocations =
+          slot.per_phase[i].allocations.load(std::memory_order_relaxed);
+      if (allocations == 0) {
+        continue;
+      }
+      site_totals.push_back(
+          {site, static_cast<AllocationPhase>(i), allocations,
+           slot.per_phase[i].bytes.load(std::memory_order_relaxed)});
+    }
+  }
+
+  stream << "Allocations by phase:\n";
+  stream << std::left << std::setw(14) << "phase" << std::right
+         << std::setw(16) << "allocations" << std::setw(18) << "bytes"
+         << "\n";
+  for (size_t i = 0; i < kPhaseCount; ++i) {
+    stream << std::left << std::setw(14)
+           << GetAllocationPhaseName(static_cast<AllocationPhase>(i))
+           << std::right << std::setw(16) << phase_allocations[i]
+           << std::setw(18) << phase_bytes[i] << "\n";
+  }
+
+  std::sort(site_totals.begin(), site_totals.end(),
+            [](SiteTotal const& a, SiteTotal const& b) {
+              return a.bytes > b.bytes;
+            });
+  size_t const site_count = std::min(max_sites, site_totals.size());
+  stream << "\nTop " << site_count << " allocation sites by bytes:\n";
+  stream << std::left << std::setw(14) << "phase" << std::right
+         << std::setw(16) << "allocations" << std::setw(18) << "bytes"
+         << "  site\n";
+  for (size_t i = 0; i < site_count; ++i) {
+    SiteTotal const& total = site_totals.at(i);
+    stream << std::left << std::setw(14) << GetAllocationPhaseName(total.phase)
+           << std::right << std::setw(16) << total.allocations
+           << std::setw(18) << total.bytes << "  " << total.site << "\n";
+  }
+
+  uint64_t const overflow = site_table_overflow.load(std::memory_order_relaxed);
+  if (overflow != 0) {
+    stream << overflow
+           << " allocations could not be attributed to a site (site table "
+              "full), they are still included in the phase totals.\n";
+  }
+}
+
+}  // namespace mp4_manipulator::profiling
+
+#if defined(MP4_MANIPULATOR_ALLOCATION_PROFILING)
+#if defined(__GLIBC__)
+// On glibc we interpose the malloc family rather than the C++ allocation
+// functions. This also catches Qt containers (e.g. QString), which allocate
+// via malloc rather than operator new. The default operator new calls malloc,
+// and the aligned operator new (for over-aligned types) calls aligned_alloc,
+// so C++ allocations are counted too.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* pointer);
+
+void* malloc(size_t size) __THROW {
+  mp4_manipulator::profiling::RecordAllocation(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) __THROW {
+  mp4_manipulator::profiling::RecordAllocation(count * size);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) __THROW {
+  mp4_manipulator::profiling::RecordAllocation(size);
+  return __libc_realloc(pointer, size);
+}
+
+void* memalign(size_t alignment, size_t size) __THROW {
+  mp4_manipulator::profiling::RecordAllocation(size);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) __THROW {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size) __THROW {
+  if (alignment % sizeof(void*) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  void* const allocation = memalign(alignment, size);
+  if (allocation == nullptr) {
+    return ENOMEM;
+  }
+  *pointer = allocation;
+  return 0;
+}
+
+void free(void* pointer) __THROW { __libc_free(pointer); }
+}  // extern "C"
+#else
+// Elsewhere we can only portably replace the C++ allocation functions. Note
+// that this misses allocations made directly via malloc, such as those made
+// by Qt containers.
+void* operator new(size_t size) {
+  mp4_manipulator::profiling::RecordAllocation(size);
+  void* pointer = std::malloc(size == 0 ? 1 : size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc{};
+  }
+  return pointer;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept {
+  mp4_manipulator::profiling::RecordAllocation(size);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, std::nothrow_t const& tag) noexcept {
+  return operator new(size, tag);
+}
+
+// The aligned forms are used for over-aligned types. Their memory has to be
+// freed by the matching aligned delete, which on Windows isn't std::free.
+void* operator new(size_t size, std::align_val_t alignment,
+                   std::nothrow_t const&) noexcept {
+  mp4_manipulator::profiling::RecordAllocation(size);
+  auto const alignment_value = static_cast<size_t>(alignment);
+  // aligned_alloc needs the size to be a multiple of the alignment, which
+  // is a power of two.
+  size_t const aligned_size = (std::max<size_t>(size, 1) + alignment_value -
+                               1) & ~(alignment_value - 1);
+#if defined(_WIN32)
+  return _aligned_malloc(aligned_size, alignment_value);
+#else
+  return std::aligned_alloc(alignment_value, aligned_size);
+#endif
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  void* pointer = operator new(size, alignment, std::nothrow);
+  if (pointer == nullptr) {
+    throw std::bad_alloc{};
+  }
+  return pointer;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment,
+                     std::nothrow_t const& tag) noexcept {
+  return operator new(size, alignment, tag);
+}
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+
+void operator delete(void* pointer, std::nothrow_t const&) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::nothrow_t const&) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+#if defined(_WIN32)
+  _aligned_free(pointer);
+#else
+  std::free(pointer);
+#endif
+}
+
+void operator delete[](void* pointer, std::align_val_t alignment) noexcept {
+  operator delete(pointer, alignment);
+}
+
+void operator delete(void* pointer, size_t,
+                     std::align_val_t alignment) noexcept {
+  operator delete(pointer, alignment);
+}
+
+void operator delete[](void* pointer, size_t,
+                       std::align_val_t alignment) noexcept {
+  operator delete(pointer, alignment);
+}
+
+void operator delete(void* pointer, std::align_val_t alignment,
+                     std::nothrow_t const&) noexcept {
+  operator delete(pointer, alignment);
+}
+
+void operator delete[](void* pointer, std::align_val_t alignment,
+                       std::nothrow_t const&) noexcept {
+  operator delete(pointer, alignment);
+}
+#endif  // defined(__GLIBC__)
+#endif  // defined(MP4_MANIPULATOR_ALLOCATION_PROFILING)
@@ -0,0 +1,226 @@
+#include <QByteArray>
+#include <QHash>
+#include <QHostAddress>
+#include <QObject>
+#include <QRegularExpression>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTest>
+#include <QUrl>
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "network/http_range_byte_stream.h"
+
+namespace mp4_manipulator::network {
+namespace {
+// A stand-in for a server that supports range requests. Requests are answered
+// on the thread running the test, so they're served by the event loop the
+// stream runs while it waits for a reply.
+class RangeServer : public QObject {
+  Q_OBJECT
+ public:
+  enum class Mode {
+    // Answer with 206 and the requested bytes.
+    kPartialContent,
+    // Ignore the range and answer with 200 and the whole file, as servers
+    // without range support do.
+    kFullContent,
+    // Answer with 206, but send half of the requested bytes.
+    kShortRead,
+  };
+
+  explicit RangeServer(QByteArray data) : data_{std::move(data)} {
+    [[maybe_unused]] bool ok = connect(&server_, &QTcpServer::newConnection,
+                                       this, &RangeServer::OnNewConnection);
+    assert(ok);
+    ok = server_.listen(QHostAddress::LocalHost);
+    assert(ok);
+  }
+
+  [[nodiscard]] QUrl GetUrl() const {
+    return QUrl{QStringLiteral("http://127.0.0.1:%1/video.mp4")
+                    .arg(server_.serverPort())};
+  }
+
+  void SetMode(Mode mode) { mode_ = mode; }
+
+  // The Range header of each request, e.g. "bytes=0-15", in order.
+  [[nodiscard]] std::vector<QByteArray> const& GetRanges() const {
+    return ranges_;
+  }
+
+ private slots:
+  void OnNewConnection() {
+    while (QTcpSocket* socket = server_.nextPendingConnection()) {
+      [[maybe_unused]] bool ok =
+          connect(socket, &QTcpSocket::readyRead, this,
+                  [this, socket] { OnReadyRead(socket); });
+      assert(ok);
+      ok = connect(socket, &QTcpSocket::disconnected, socket,
+                   &QObject::deleteLater);
+      assert(ok);
+    }
+  }
+
+ private:
+  void OnReadyRead(QTcpSocket* socket) {
+    QByteArray& request = requests_[socket];
+    request += socket->readAll();
+    if (!request.contains("\r\n\r\n")) {
+      return;
+    }
+    static QRegularExpression const kRangePattern{
+        QStringLiteral("\\r\\nrange: *bytes=(\\d+)-(\\d+)"),
+        QRegularExpression::CaseInsensitiveOption};
+    QRegularExpressionMatch const match =
+        kRangePattern.match(QString::fromLatin1(request));
+    requests_.remove(socket);
+    QByteArray response;
+    if (!match.hasMatch() || mode_ == Mode::kFullContent) {
+      response = "HTTP/1.1 200 OK\r\nContent-Length: " +
+                 QByteArray::number(data_.size()) + "\r\n";
+      response += "Connection: close\r\n\r\n" + data_;
+    } else {
+      qsizetype const start = match.captured(1).toLongLong();
+      qsizetype const end =
+          std::min<qsizetype>(match.captured(2).toLongLong(), data_.size() - 1);
+      ranges_.push_back("bytes=" + match.captured(1).toLatin1() + '-' +
+                        match.captured(2).toLatin1());
+      QByteArray body = data_.mid(start, end - start + 1);
+      if (mode_ == Mode::kShortRead) {
+        body.truncate(body.size() / 2);
+      }
+      response = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " +
+                 QByteArray::number(start) + '-' + QByteArray::number(end) +
+                 '/' + QByteArray::number(data_.size()) +
+                 "\r\nContent-Length: " + QByteArray::number(body.size()) +
+                 "\r\nConnection: close\r\n\r\n" + body;
+    }
+    socket->write(response);
+    socket->disconnectFromHost();
+  }
+
+  QTcpServer server_;
+  QByteArray data_;
+  Mode mode_{Mode::kPartialContent};
+  QHash<QTcpSocket*, QByteArray> requests_;
+  std::vector<QByteArray> ranges_;
+};
+
+// Returns `size` bytes that differ from block to block, so reading the wrong
+// block is caught.
+QByteArray MakeData(qsizetype size) {
+  QByteArray data;
+  data.reserve(size);
+  for (qsizetype i = 0; i < size; ++i) {
+    data.append(static_cast<char>(i % 251));
+  }
+  return data;
+}
+
+HttpRangeOptions MakeOptions() {
+  HttpRangeOptions options;
+  options.block_size = 16;
+  options.cache_size = 64 * 16;
+  options.max_read_ahead = 4 * 16;
+  options.timeout_ms = 5000;
+  return options;
+}
+}  // namespace
+
+class HttpRangeByteStreamTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void OpenFetchesFirstBlockAndSize() {
+    RangeServer server{MakeData(256)};
+    Result<HttpRangeByteStream*, std::string> open_result =
+        HttpRangeByteStream::Open(server.GetUrl(), MakeOptions());
+    QVERIFY(open_result.IsOk());
+    HttpRangeByteStream* stream = open_result.GetOk();
+    AP4_LargeSize size = 0;
+    QCOMPARE(stream->GetSize(size), AP4_SUCCESS);
+    QCOMPARE(size, AP4_LargeSize{256});
+    QCOMPARE(server.GetRanges().size(), size_t{1});
+    QCOMPARE(server.GetRanges().front(), QByteArray{"bytes=0-15"});
+    stream->Release();
+  }
+
+  void CoalescesMissingBlocksIntoOneRequest() {
+    QByteArray const data = MakeData(256);
+    RangeServer server{data};
+    Result<HttpRangeByteStream*, std::string> open_result =
+        HttpRangeByteStream::Open(server.GetUrl(), MakeOptions());
+    QVERIFY(open_result.IsOk());
+    HttpRangeByteStream* stream = open_result.GetOk();
+    // Not sequential with the first block, so nothing is read ahead.
+    QCOMPARE(stream->Seek(64), AP4_SUCCESS);
+    char buffer[48];
+    AP4_Size bytes_read = 0;
+    QCOMPARE(stream->ReadPartial(buffer, sizeof(buffer), bytes_read),
+             AP4_SUCCESS);
+    QCOMPARE(bytes_read, AP4_Size{sizeof(buffer)});
+    QCOMPARE(QByteArray(buffer, sizeof(buffer)), data.mid(64, 48));
+    QCOMPARE(server.GetRanges().size(), size_t{2});
+    QCOMPARE(server.GetRanges().back(), QByteArray{"bytes=64-111"});
+    QCOMPARE(stream->GetStats().request_count, uint64_t{2});
+    stream->Release();
+  }
+
+  void ReadsAheadOfSequentialReads() {
+    QByteArray const data = MakeData(256);
+    RangeServer server{data};
+    Result<HttpRangeByteStream*, std::string> open_result =
+        HttpRangeByteStream::Open(server.GetUrl(), MakeOptions());
+    QVERIFY(open_result.IsOk());
+    HttpRangeByteStream* stream = open_result.GetOk();
+    char buffer[16];
+    AP4_Size bytes_read = 0;
+    // Block 0 is cached by Open, block 1 is fetched along with one block of
+    // read ahead, so reading blocks 0 to 2 takes one more request.
+    for (int block = 0; block < 3; ++block) {
+      QCOMPARE(stream->ReadPartial(buffer, sizeof(buffer), bytes_read),
+               AP4_SUCCESS);
+      QCOMPARE(QByteArray(buffer, bytes_read), data.mid(block * 16, 16));
+    }
+    QCOMPARE(server.GetRanges().size(), size_t{2});
+    QCOMPARE(server.GetRanges().back(), QByteArray{"bytes=16-47"});
+    stream->Release();
+  }
+
+  void RejectsServersWithoutRangeSupport() {
+    RangeServer server{MakeData(256)};
+    server.SetMode(RangeServer::Mode::kFullContent);
+    Result<HttpRangeByteStream*, std::string> open_result =
+        HttpRangeByteStream::Open(server.GetUrl(), MakeOptions());
+    QVERIFY(open_result.IsErr());
+    open_result.MarkErrorHandled();
+    QVERIFY(QString::fromStdString(open_result.GetErr())
+                .contains(QStringLiteral("range requests")));
+  }
+
+  void FailsReadsOnShortResponses() {
+    RangeServer server{MakeData(256)};
+    Result<HttpRangeByteStream*, std::string> open_result =
+        HttpRangeByteStream::Open(server.GetUrl(), MakeOptions());
+    QVERIFY(open_result.IsOk());
+    HttpRangeByteStream* stream = open_result.GetOk();
+    server.SetMode(RangeServer::Mode::kShortRead);
+    QCOMPARE(stream->Seek(128), AP4_SUCCESS);
+    char buffer[32];
+    AP4_Size bytes_read = 0;
+    QCOMPARE(stream->ReadPartial(buffer, sizeof(buffer), bytes_read),
+             AP4_ERROR_READ_FAILED);
+    QCOMPARE(bytes_read, AP4_Size{0});
+    QVERIFY(!stream->GetLastError().empty());
+    stream->Release();
+  }
+};
+
+}  // namespace mp4_manipulator::network
+
+QTEST_GUILESS_MAIN(mp4_manipulator::network::HttpRangeByteStreamTest)
+#include "http_range_byte_stream_test.moc"
@@ -0,0 +1,76 @@
+#ifndef MP4_MANIPULATOR_TESTS_BOX_WRITER_H_
+#define MP4_MANIPULATOR_TESTS_BOX_WRITER_H_
+
+#include <QFile>
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mp4_manipulator::utility {
+// Builds boxes byte by byte, so test files don't depend on the parser being
+// tested.
+class BoxWriter {
+ public:
+  void U8(uint8_t value) { bytes_.push_back(value); }
+  void U16(uint16_t value) {
+    U8(static_cast<uint8_t>(value >> 8));
+    U8(static_cast<uint8_t>(value));
+  }
+  void U32(uint32_t value) {
+    U16(static_cast<uint16_t>(value >> 16));
+    U16(static_cast<uint16_t>(value));
+  }
+  void U64(uint64_t value) {
+    U32(static_cast<uint32_t>(value >> 32));
+    U32(static_cast<uint32_t>(value));
+  }
+  void Type(char const (&type)[5]) {
+    for (int i = 0; i < 4; ++i) {
+      U8(static_cast<uint8_t>(type[i]));
+    }
+  }
+  void Zeros(size_t count) { bytes_.insert(bytes_.end(), count, 0); }
+  void Append(std::vector<uint8_t> const& bytes) {
+    bytes_.insert(bytes_.end(), bytes.begin(), bytes.end());
+  }
+
+  // Wraps the bytes written so far in a box of `type`.
+  [[nodiscard]] std::vector<uint8_t> Box(char const (&type)[5]) const {
+    BoxWriter box;
+    box.U32(static_cast<uint32_t>(bytes_.size() + 8));
+    box.Type(type);
+    box.Append(bytes_);
+    return box.bytes_;
+  }
+
+  // Likewise for a full box.
+  [[nodiscard]] std::vector<uint8_t> FullBox(char const (&type)[5],
+                                             uint8_t version,
+                                             uint32_t flags) const {
+    BoxWriter box;
+    box.U32(static_cast<uint32_t>(version) << 24 | flags);
+    box.Append(bytes_);
+    return box.Box(type);
+  }
+
+  [[nodiscard]] std::vector<uint8_t> const& GetBytes() const {
+    return bytes_;
+  }
+
+  // Writes the bytes written so far to `file_name`, replacing it.
+  [[nodiscard]] bool WriteToFile(QString const& file_name) const {
+    QFile output{file_name};
+    return output.open(QIODevice::WriteOnly) &&
+           output.write(reinterpret_cast<char const*>(bytes_.data()),
+                        static_cast<qint64>(bytes_.size())) ==
+               static_cast<qint64>(bytes_.size());
+  }
+
+ private:
+  std::vector<uint8_t> bytes_;
+};
+
+}  // namespace mp4_manipulator::utility
+
+#endif  // MP4_MANIPULATOR_TESTS_BOX_WRITER_H_
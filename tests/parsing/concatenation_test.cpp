@@ -0,0 +1,231 @@
+#include <QFile>
+#include <QObject>
+#include <QTemporaryDir>
+#include <QTest>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "box_writer.h"
+#include "parsing/concatenation.h"
+
+namespace mp4_manipulator::utility {
+namespace {
+void WriteMatrix(BoxWriter& writer) {
+  for (uint32_t const value :
+       {0x10000u, 0u, 0u, 0u, 0x10000u, 0u, 0u, 0u, 0x40000000u}) {
+    writer.U32(value);
+  }
+}
+
+struct TestTrack {
+  uint32_t track_id;
+  uint32_t timescale;
+  uint32_t sample_duration;
+  // The decode time of the track's first sample.
+  uint64_t start_time;
+};
+
+std::vector<uint8_t> MakeTrak(TestTrack const& track) {
+  BoxWriter tkhd;
+  tkhd.Zeros(8);
+  tkhd.U32(track.track_id);
+  tkhd.Zeros(4 + 4 + 8 + 2 + 2 + 2 + 2);
+  WriteMatrix(tkhd);
+  tkhd.Zeros(8);
+
+  BoxWriter mdhd;
+  mdhd.Zeros(8);
+  mdhd.U32(track.timescale);
+  mdhd.U32(0);
+  // "und"
+  mdhd.U16(0x55c4);
+  mdhd.U16(0);
+  BoxWriter hdlr;
+  hdlr.U32(0);
+  hdlr.Type("vide");
+  hdlr.Zeros(12 + 1);
+
+  BoxWriter stsd;
+  stsd.U32(0);
+  BoxWriter empty_table;
+  empty_table.U32(0);
+  BoxWriter stsz;
+  stsz.U32(0);
+  stsz.U32(0);
+  BoxWriter stbl;
+  stbl.Append(stsd.FullBox("stsd", 0, 0));
+  stbl.Append(empty_table.FullBox("stts", 0, 0));
+  stbl.Append(empty_table.FullBox("stsc", 0, 0));
+  stbl.Append(stsz.FullBox("stsz", 0, 0));
+  stbl.Append(empty_table.FullBox("stco", 0, 0));
+  BoxWriter minf;
+  minf.Append(stbl.Box("stbl"));
+
+  BoxWriter mdia;
+  mdia.Append(mdhd.FullBox("mdhd", 0, 0));
+  mdia.Append(hdlr.FullBox("hdlr", 0, 0));
+  mdia.Append(minf.Box("minf"));
+  BoxWriter trak;
+  trak.Append(tkhd.FullBox("tkhd", 0, 3));
+  trak.Append(mdia.Box("mdia"));
+  return trak.Box("trak");
+}
+
+// Writes a fragmented file to `file_name` with `fragment_count` fragments,
+// each holding one 4 byte sample of every track in `tracks`.
+bool WriteFragmentedFile(QString const& file_name,
+                         std::vector<TestTrack> const& tracks,
+                         uint32_t fragment_count) {
+  BoxWriter file;
+  BoxWriter ftyp;
+  ftyp.Type("isom");
+  ftyp.U32(0);
+  ftyp.Type("isom");
+  ftyp.Type("iso6");
+  file.Append(ftyp.Box("ftyp"));
+
+  BoxWriter mvhd;
+  mvhd.Zeros(8);
+  mvhd.U32(1000);
+  mvhd.U32(0);
+  mvhd.U32(0x10000);
+  mvhd.U16(0x100);
+  mvhd.Zeros(2 + 8);
+  WriteMatrix(mvhd);
+  mvhd.Zeros(24);
+  mvhd.U32(static_cast<uint32_t>(tracks.size() + 1));
+  BoxWriter mvex;
+  BoxWriter moov;
+  moov.Append(mvhd.FullBox("mvhd", 0, 0));
+  for (TestTrack const& track : tracks) {
+    moov.Append(MakeTrak(track));
+    BoxWriter trex;
+    trex.U32(track.track_id);
+    trex.U32(1);
+    trex.U32(track.sample_duration);
+    trex.U32(4);
+    trex.U32(0);
+    mvex.Append(trex.FullBox("trex", 0, 0));
+  }
+  moov.Append(mvex.Box("mvex"));
+  file.Append(moov.Box("moov"));
+
+  for (uint32_t fragment = 0; fragment < fragment_count; ++fragment) {
+    // The moof's size doesn't depend on the data offsets, so build it once
+    // to find its size, then again with the right offsets.
+    std::vector<uint8_t> moof;
+    for (int pass = 0; pass < 2; ++pass) {
+      BoxWriter mfhd;
+      mfhd.U32(fragment + 1);
+      BoxWriter moof_writer;
+      moof_writer.Append(mfhd.FullBox("mfhd", 0, 0));
+      for (size_t i = 0; i < tracks.size(); ++i) {
+        TestTrack const& track = tracks.at(i);
+        BoxWriter tfhd;
+        tfhd.U32(track.track_id);
+        BoxWriter tfdt;
+        tfdt.U64(track.start_time +
+                 uint64_t{fragment} * track.sample_duration);
+        BoxWriter trun;
+        trun.U32(1);
+        trun.U32(static_cast<uint32_t>(moof.size() + 8 + 4 * i));
+        trun.U32(track.sample_duration);
+        trun.U32(4);
+        BoxWriter traf;
+        // default-base-is-moof
+        traf.Append(tfhd.FullBox("tfhd", 0, 0x020000));
+        traf.Append(tfdt.FullBox("tfdt", 1, 0));
+        // Data offset, sample duration and sample size present.
+        traf.Append(trun.FullBox("trun", 0, 0x000301));
+        moof_writer.Append(traf.Box("traf"));
+      }
+      moof = moof_writer.Box("moof");
+    }
+    file.Append(moof);
+    BoxWriter mdat;
+    mdat.Zeros(4 * tracks.size());
+    file.Append(mdat.Box("mdat"));
+  }
+  return file.WriteToFile(file_name);
+}
+
+uint32_t ReadU32(QByteArray const& data, qsizetype offset) {
+  auto const* bytes = reinterpret_cast<uint8_t const*>(data.constData());
+  return static_cast<uint32_t>(bytes[offset]) << 24 |
+         static_cast<uint32_t>(bytes[offset + 1]) << 16 |
+         static_cast<uint32_t>(bytes[offset + 2]) << 8 | bytes[offset + 3];
+}
+
+// Returns the (track id, tfdt) of each traf of `data`, a file written by
+// WriteFragmentedFile or concatenated from them, in file order.
+std::vector<std::pair<uint32_t, uint64_t>> ReadDecodeTimes(
+    QByteArray const& data) {
+  std::vector<std::pair<uint32_t, uint64_t>> times;
+  for (qsizetype offset = 0; offset + 8 <= data.size();
+       offset += ReadU32(data, offset)) {
+    if (data.mid(offset + 4, 4) != "moof") {
+      continue;
+    }
+    qsizetype const moof_end = offset + ReadU32(data, offset);
+    for (qsizetype child = offset + 8; child < moof_end;
+         child += ReadU32(data, child)) {
+      if (data.mid(child + 4, 4) != "traf") {
+        continue;
+      }
+      // tfhd comes first, then tfdt, as WriteFragmentedFile writes them.
+      qsizetype const tfhd = child + 8;
+      qsizetype const tfdt = tfhd + ReadU32(data, tfhd);
+      uint64_t const decode_time =
+          uint64_t{ReadU32(data, tfdt + 12)} << 32 | ReadU32(data, tfdt + 16);
+      times.emplace_back(ReadU32(data, tfhd + 12), decode_time);
+    }
+  }
+  return times;
+}
+}  // namespace
+
+class ConcatenationTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void KeepsTheOffsetsBetweenTracks() {
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    QString const first_name = directory.filePath("first.mp4");
+    QString const second_name = directory.filePath("second.mp4");
+    QString const output_name = directory.filePath("joined.mp4");
+    // Audio starts 0.1s after video in both files, and the second file's
+    // timeline starts at 10s.
+    QVERIFY(WriteFragmentedFile(
+        first_name, {{1, 90000, 3000, 0}, {2, 48000, 1600, 4800}}, 3));
+    QVERIFY(WriteFragmentedFile(
+        second_name, {{1, 90000, 3000, 900000}, {2, 48000, 1600, 484800}},
+        3));
+
+    Result<ConcatenationSummary, std::string> result = ConcatenateFiles(
+        {first_name.toStdString(), second_name.toStdString()},
+        output_name.toLocal8Bit().constData());
+    if (result.IsErr()) {
+      result.MarkErrorHandled();
+      QFAIL(result.GetErr().c_str());
+    }
+    QVERIFY(result.GetOk().is_fragmented);
+
+    QFile output{output_name};
+    QVERIFY(output.open(QIODevice::ReadOnly));
+    // The first file is unchanged. The first file's audio ends last, at
+    // 0.2s, so the second file's video starts there, and its audio 0.1s
+    // later.
+    std::vector<std::pair<uint32_t, uint64_t>> const expected{
+        {1, 0},     {2, 4800},  {1, 3000},  {2, 6400},  {1, 6000},
+        {2, 8000},  {1, 18000}, {2, 14400}, {1, 21000}, {2, 16000},
+        {1, 24000}, {2, 17600}};
+    QVERIFY(ReadDecodeTimes(output.readAll()) == expected);
+  }
+};
+
+}  // namespace mp4_manipulator::utility
+
+QTEST_GUILESS_MAIN(mp4_manipulator::utility::ConcatenationTest)
+#include "concatenation_test.moc"
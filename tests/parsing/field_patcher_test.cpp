@@ -0,0 +1,250 @@
+#include <QFile>
+#include <QObject>
+#include <QTemporaryDir>
+#include <QTest>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "box_writer.h"
+#include "parsing/atom.h"
+#include "parsing/field_patcher.h"
+
+namespace mp4_manipulator::utility {
+namespace {
+using PatchResult = Result<std::monostate, std::string>;
+
+// Returns the error of `result`, or an empty string if it's ok.
+std::string TakeError(PatchResult result) {
+  if (result.IsOk()) {
+    return {};
+  }
+  result.MarkErrorHandled();
+  return std::move(result).GetErr();
+}
+
+// A file of full boxes written one after another, with atoms standing in for
+// the parsed ones the patcher is given.
+class TestFile {
+ public:
+  // Appends `box` to the file, returning an atom with its position and size.
+  Atom& AddBox(char const* name, std::vector<uint8_t> const& box) {
+    auto atom = std::make_unique<Atom>(name, 8, box.size());
+    atom->SetPositionInStream(file_.GetBytes().size());
+    file_.Append(box);
+    atoms_.push_back(std::move(atom));
+    return *atoms_.back();
+  }
+
+  [[nodiscard]] QByteArray GetBytes() const {
+    std::vector<uint8_t> const& bytes = file_.GetBytes();
+    return {reinterpret_cast<char const*>(bytes.data()),
+            static_cast<qsizetype>(bytes.size())};
+  }
+
+  [[nodiscard]] bool WriteToFile(QString const& file_name) const {
+    return file_.WriteToFile(file_name);
+  }
+
+ private:
+  BoxWriter file_;
+  std::vector<std::unique_ptr<Atom>> atoms_;
+};
+
+std::vector<uint8_t> MakeMdhd(uint8_t version) {
+  BoxWriter mdhd;
+  // Creation and modification times.
+  mdhd.Zeros(version == 1 ? 16 : 8);
+  mdhd.U32(1000);
+  if (version == 1) {
+    mdhd.U64(5000);
+  } else {
+    mdhd.U32(5000);
+  }
+  // "und"
+  mdhd.U16(0x55c4);
+  mdhd.U16(0);
+  return mdhd.FullBox("mdhd", version, 0);
+}
+
+// An elst with two entries, the first an empty edit.
+std::vector<uint8_t> MakeElst(uint8_t version) {
+  BoxWriter elst;
+  elst.U32(2);
+  for (uint64_t const media_time : {~uint64_t{0}, uint64_t{0}}) {
+    if (version == 1) {
+      elst.U64(2000);
+      elst.U64(media_time);
+    } else {
+      elst.U32(2000);
+      elst.U32(static_cast<uint32_t>(media_time));
+    }
+    elst.U32(0x10000);
+  }
+  return elst.FullBox("elst", version, 0);
+}
+
+// Returns `data` with the bytes at `offset` replaced by `bytes`.
+QByteArray Replaced(QByteArray data, uint64_t offset,
+                    std::vector<uint8_t> const& bytes) {
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    data[static_cast<qsizetype>(offset + i)] = static_cast<char>(bytes.at(i));
+  }
+  return data;
+}
+
+QByteArray ReadFile(QString const& file_name) {
+  QFile file{file_name};
+  return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray{};
+}
+}  // namespace
+
+// Checks that each field is written where ISO 14496-12 puts it, for both
+// versions of the boxes that have them, and that nothing else changes.
+class FieldPatcherTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void init() {
+    QVERIFY(directory_.isValid());
+    file_name_ = directory_.filePath("patched.mp4");
+  }
+
+  void SetsTheMediaLanguage() {
+    TestFile file;
+    Atom& mdhd_0 = file.AddBox("mdhd", MakeMdhd(0));
+    Atom& mdhd_1 = file.AddBox("mdhd", MakeMdhd(1));
+    QVERIFY(file.WriteToFile(file_name_));
+    std::unique_ptr<FieldPatcher> patcher = OpenPatcher();
+    QVERIFY(patcher != nullptr);
+
+    std::string error = TakeError(patcher->SetMediaLanguage(mdhd_0, "eng"));
+    QVERIFY2(error.empty(), error.c_str());
+    error = TakeError(patcher->SetMediaLanguage(mdhd_1, "fra"));
+    QVERIFY2(error.empty(), error.c_str());
+    // 12 bytes of header, version and flags, then 16 or 28 bytes of times,
+    // timescale and duration.
+    QByteArray expected = Replaced(
+        file.GetBytes(), mdhd_0.GetPositionInStream().value() + 28,
+        {0x15, 0xc7});
+    expected = Replaced(expected, mdhd_1.GetPositionInStream().value() + 40,
+                        {0x1a, 0x41});
+    QCOMPARE(ReadFile(file_name_), expected);
+
+    error = TakeError(patcher->SetMediaLanguage(mdhd_0, "English"));
+    QVERIFY(!error.empty());
+    QCOMPARE(ReadFile(file_name_), expected);
+  }
+
+  void SetsTheMediaTimescale() {
+    TestFile file;
+    Atom& mdhd_0 = file.AddBox("mdhd", MakeMdhd(0));
+    Atom& mdhd_1 = file.AddBox("mdhd", MakeMdhd(1));
+    QVERIFY(file.WriteToFile(file_name_));
+    std::unique_ptr<FieldPatcher> patcher = OpenPatcher();
+    QVERIFY(patcher != nullptr);
+
+    std::string error = TakeError(patcher->SetMediaTimescale(mdhd_0, 90000));
+    QVERIFY2(error.empty(), error.c_str());
+    error = TakeError(patcher->SetMediaTimescale(mdhd_1, 48000));
+    QVERIFY2(error.empty(), error.c_str());
+    // After the creation and modification times, 4 or 8 bytes each.
+    QByteArray expected = Replaced(
+        file.GetBytes(), mdhd_0.GetPositionInStream().value() + 20,
+        {0x00, 0x01, 0x5f, 0x90});
+    expected = Replaced(expected, mdhd_1.GetPositionInStream().value() + 28,
+                        {0x00, 0x00, 0xbb, 0x80});
+    QCOMPARE(ReadFile(file_name_), expected);
+  }
+
+  void SetsTheTrackEnabledFlag() {
+    TestFile file;
+    BoxWriter fields;
+    fields.Zeros(80);
+    // In the movie and in the preview, but not enabled.
+    Atom& tkhd = file.AddBox("tkhd", fields.FullBox("tkhd", 0, 0x000006));
+    QVERIFY(file.WriteToFile(file_name_));
+    std::unique_ptr<FieldPatcher> patcher = OpenPatcher();
+    QVERIFY(patcher != nullptr);
+    uint64_t const flags_position = tkhd.GetPositionInStream().value() + 11;
+
+    std::string error = TakeError(patcher->SetTrackEnabled(tkhd, true));
+    QVERIFY2(error.empty(), error.c_str());
+    QCOMPARE(ReadFile(file_name_),
+             Replaced(file.GetBytes(), flags_position, {0x07}));
+
+    error = TakeError(patcher->SetTrackEnabled(tkhd, false));
+    QVERIFY2(error.empty(), error.c_str());
+    QCOMPARE(ReadFile(file_name_), file.GetBytes());
+  }
+
+  void SetsEditListEntries() {
+    TestFile file;
+    Atom& elst_0 = file.AddBox("elst", MakeElst(0));
+    Atom& elst_1 = file.AddBox("elst", MakeElst(1));
+    QVERIFY(file.WriteToFile(file_name_));
+    std::unique_ptr<FieldPatcher> patcher = OpenPatcher();
+    QVERIFY(patcher != nullptr);
+
+    EditListEntry const entry{3000, 1024, 0x20000};
+    std::string error = TakeError(patcher->SetEditListEntry(elst_0, 1, entry));
+    QVERIFY2(error.empty(), error.c_str());
+    error = TakeError(patcher->SetEditListEntry(elst_1, 1, entry));
+    QVERIFY2(error.empty(), error.c_str());
+    // After the header, version, flags and entry count, entries are 12 bytes
+    // in version 0 and 20 in version 1.
+    QByteArray expected = Replaced(
+        file.GetBytes(), elst_0.GetPositionInStream().value() + 28,
+        {0x00, 0x00, 0x0b, 0xb8, 0x00, 0x00, 0x04, 0x00, 0x00, 0x02, 0x00,
+         0x00});
+    expected = Replaced(
+        expected, elst_1.GetPositionInStream().value() + 36,
+        {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0b, 0xb8, 0x00, 0x00,
+         0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x02, 0x00, 0x00});
+    QCOMPARE(ReadFile(file_name_), expected);
+
+    // Neither an entry past the end, nor a time too large for version 0, is
+    // written.
+    error = TakeError(patcher->SetEditListEntry(elst_0, 2, entry));
+    QVERIFY(!error.empty());
+    error = TakeError(
+        patcher->SetEditListEntry(elst_0, 0, {uint64_t{1} << 32, 0}));
+    QVERIFY(!error.empty());
+    QCOMPARE(ReadFile(file_name_), expected);
+  }
+
+  void RejectsAnAtomThatDoesntMatchTheFile() {
+    TestFile file;
+    Atom& mdhd = file.AddBox("mdhd", MakeMdhd(0));
+    QVERIFY(file.WriteToFile(file_name_));
+    std::unique_ptr<FieldPatcher> patcher = OpenPatcher();
+    QVERIFY(patcher != nullptr);
+
+    // The atom of a box that has since grown.
+    Atom stale{"mdhd", 8, mdhd.GetSize() + 4};
+    stale.SetPositionInStream(mdhd.GetPositionInStream().value());
+    QVERIFY(!TakeError(patcher->SetMediaTimescale(stale, 90000)).empty());
+    // A box of another type.
+    QVERIFY(!TakeError(patcher->SetTrackEnabled(mdhd, true)).empty());
+    QCOMPARE(ReadFile(file_name_), file.GetBytes());
+  }
+
+ private:
+  std::unique_ptr<FieldPatcher> OpenPatcher() {
+    Result<std::unique_ptr<FieldPatcher>, std::string> open_result =
+        FieldPatcher::Open(QFile::encodeName(file_name_).constData());
+    if (open_result.IsErr()) {
+      open_result.MarkErrorHandled();
+      return nullptr;
+    }
+    return std::move(open_result).GetOk();
+  }
+
+  QTemporaryDir directory_;
+  QString file_name_;
+};
+
+}  // namespace mp4_manipulator::utility
+
+QTEST_GUILESS_MAIN(mp4_manipulator::utility::FieldPatcherTest)
+#include "field_patcher_test.moc"